@@ -1,48 +1,3417 @@
 #ifndef _CudaReconstruction_
 #define _CudaReconstruction_
 
-__global__ void kernel(int *a, int *b)
+#include "CudaReconstruction.h"
+#include "ReconstructionDepths.h"
+#include "ReconstructionFunctions.h"
+#include "ReconstructionSurface.h"
+
+#include <cuda_fp16.h>
+#include <cuda_runtime.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+// Number of threads per block of the integration kernel
+#define BLOCK_SIZE 256
+// Maximum number of blocks of a 1D grid on compute capability 2.x
+#define MAX_GRID_SIZE 65535
+// Number of streams, and of device and staging buffers, of the bricked mode
+#define BRICK_STREAMS_NB 2
+// Maximum number of depth maps in flight in the asynchronous integration
+#define ASYNC_SLOTS_NB CUDA_RECONSTRUCTION_MAX_ASYNC_DEPTH_MAPS
+// Number of voxels of a block of the sparse volume
+#define BLOCK_VOXELS_NB (CUDA_RECONSTRUCTION_BLOCK_SIZE * CUDA_RECONSTRUCTION_BLOCK_SIZE * CUDA_RECONSTRUCTION_BLOCK_SIZE)
+// Key of the empty slots of the hash table of the sparse volume
+#define EMPTY_BLOCK_KEY 0xffffffffffffffffULL
+// Bytes of the staging buffer reordering the voxels of a bricks layout grid
+#define LAYOUT_STAGING_BYTES (64 << 20)
+// Edge length, in pixels, of the thread blocks of the depth map pyramid
+#define PYRAMID_BLOCK_SIZE 16
+
+//----------------------------------------------------------------------------
+// Integration parameters in the precision of the kernel, passed by value so
+// that every context and every launch has its own copy
+template <typename T>
+struct IntegrationParameters
+{
+  // voxel indices to camera homogeneous coords of the voxel center, and to
+  // depth map homogeneous coords, folded once per depth map
+  T voxelToCamera[16];
+  T voxelToDepthMap[12];
+  int gridDims[3];
+  int layout;
+  int depthMapDims[3];
+  int interpolation;
+  // single precision depth map with hardware filtering, 0 to read depths
+  cudaTextureObject_t depthsTexture;
+};
+
+//----------------------------------------------------------------------------
+// Storage of the voxels of a device grid: the values are widened to the
+// precision T of the kernel when they are read and narrowed back when they
+// are written, so that only the registers hold the wide values
+template <typename T>
+struct NativeStorage
+{
+  typedef T Scalar;
+  typedef T Weight;
+
+  __device__ T Load(Scalar value) const { return value; }
+  __device__ Scalar Store(T value) const { return value; }
+  __device__ T LoadWeight(Weight weight) const { return weight; }
+  __device__ Weight StoreWeight(T weight) const { return weight; }
+};
+
+// Half floats, the weights are counts saturating at 65535
+template <typename T>
+struct HalfStorage
+{
+  typedef __half Scalar;
+  typedef unsigned short Weight;
+
+  __device__ T Load(Scalar value) const { return (T)__half2float(value); }
+  __device__ Scalar Store(T value) const { return __float2half_rn((float)value); }
+  __device__ T LoadWeight(Weight weight) const { return (T)weight; }
+  __device__ Weight StoreWeight(T weight) const { return weight < (T)65535 ? (Weight)weight : (Weight)65535; }
+};
+
+// Values quantised over the range of the function, the weights are counts
+// saturating at 65535
+template <typename T>
+struct UInt16Storage
 {
-  a[threadIdx.x] = b[threadIdx.x];
+  typedef unsigned short Scalar;
+  typedef unsigned short Weight;
+  T Offset;
+  T Scale;
+
+  __device__ T Load(Scalar value) const { return ReconstructionDequantize(value, this->Offset, this->Scale); }
+  __device__ Scalar Store(T value) const { return ReconstructionQuantize(value, this->Offset, this->Scale); }
+  __device__ T LoadWeight(Weight weight) const { return (T)weight; }
+  __device__ Weight StoreWeight(T weight) const { return weight < (T)65535 ? (Weight)weight : (Weight)65535; }
+};
+
+//----------------------------------------------------------------------------
+// Get the bytes of a voxel and of its weight in a storage format
+static void getStorageSizes(int storage, size_t scalarSize, size_t* voxelSize, size_t* weightSize)
+{
+  if (storage == CUDA_RECONSTRUCTION_STORAGE_HALF || storage == CUDA_RECONSTRUCTION_STORAGE_UINT16)
+    {
+    *voxelSize = sizeof(unsigned short);
+    *weightSize = sizeof(unsigned short);
+    }
+  else
+    {
+    *voxelSize = scalarSize;
+    *weightSize = scalarSize;
+    }
 }
 
-int cuda_reconstruction(
+//----------------------------------------------------------------------------
+// Check the result of a cuda call and print the error if any
+static bool checkCudaError(cudaError_t err, const char* msg)
+{
+  if (err != cudaSuccess)
+    {
+    std::cerr << msg << ": " << cudaGetErrorString(err) << std::endl;
+    return false;
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// Memory pool shared by the contexts of the process. The device and pinned
+// host blocks released by a context are cached by device, the pinned ones
+// under device -1, and handed to the next allocations of at most their size
+// instead of going through cudaMalloc and cudaFree, which synchronise the
+// device. An event recorded on the default stream when a block is released
+// orders its reuse after the work queued on it.
+struct PoolBlock
+{
+  void* pointer;
+  size_t bytes;
+  int device;
+  cudaEvent_t released;
+};
+
+struct MemoryPool
+{
+  std::vector<PoolBlock> cachedBlocks;
+  std::map<void*, PoolBlock> usedBlocks;
+  size_t cachedBytes;
+  size_t usedBytes;
+  // bytes cached at most, 0 for no limit
+  size_t limit;
+  // bytes of the used device blocks, and their most since the last reset
+  size_t usedDeviceBytes;
+  size_t peakDeviceBytes;
+};
+
+static MemoryPool pool = { std::vector<PoolBlock>(), std::map<void*, PoolBlock>(), 0, 0, 0, 0, 0 };
+
+// The contexts of several devices are used from several threads
+#ifdef _WIN32
+static SRWLOCK poolMutex = SRWLOCK_INIT;
+#else
+static pthread_mutex_t poolMutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+class PoolLock
+{
+public:
+#ifdef _WIN32
+  PoolLock() { AcquireSRWLockExclusive(&poolMutex); }
+  ~PoolLock() { ReleaseSRWLockExclusive(&poolMutex); }
+#else
+  PoolLock() { pthread_mutex_lock(&poolMutex); }
+  ~PoolLock() { pthread_mutex_unlock(&poolMutex); }
+#endif
+};
+
+//----------------------------------------------------------------------------
+// Size of the blocks of the pool: multiples of 512 bytes, then of 1 MiB
+// from 1 MiB, so that buffers of slightly different sizes share blocks
+static size_t getPoolBlockSize(size_t bytes)
+{
+  size_t granularity = bytes < (1 << 20) ? 512 : (1 << 20);
+  return (bytes + granularity - 1) / granularity * granularity;
+}
+
+//----------------------------------------------------------------------------
+// Free a cached block, on its device for a device block
+static void freePoolBlock(const PoolBlock& block)
+{
+  cudaEventDestroy(block.released);
+  if (block.device < 0)
+    {
+    cudaFreeHost(block.pointer);
+    return;
+    }
+  int currentDevice;
+  bool restoreDevice = cudaGetDevice(&currentDevice) == cudaSuccess && currentDevice != block.device;
+  if (restoreDevice)
+    {
+    cudaSetDevice(block.device);
+    }
+  cudaFree(block.pointer);
+  if (restoreDevice)
+    {
+    cudaSetDevice(currentDevice);
+    }
+}
+
+//----------------------------------------------------------------------------
+// Free the cached blocks of a device, or of all of them when device is
+// -2, until at most keptBytes stay cached, the oldest ones first
+static void trimPool(int device, size_t keptBytes)
+{
+  std::vector<PoolBlock> freedBlocks;
+    {
+    PoolLock lock;
+    std::vector<PoolBlock> keptBlocks;
+    for (size_t i = 0; i < pool.cachedBlocks.size(); i++)
+      {
+      const PoolBlock& block = pool.cachedBlocks[i];
+      if (pool.cachedBytes > keptBytes && (device == -2 || block.device == device))
+        {
+        pool.cachedBytes -= block.bytes;
+        freedBlocks.push_back(block);
+        }
+      else
+        {
+        keptBlocks.push_back(block);
+        }
+      }
+    pool.cachedBlocks.swap(keptBlocks);
+    }
+  for (size_t i = 0; i < freedBlocks.size(); i++)
+    {
+    freePoolBlock(freedBlocks[i]);
+    }
+}
+
+//----------------------------------------------------------------------------
+// Allocate a block on the current device, or a pinned host block, from the
+// pool: the smallest cached block that fits without wasting half of it, or
+// a new one once the cached blocks of the device are freed if needed
+static cudaError_t poolMalloc(void** pointer, size_t bytes, bool pinned)
+{
+  *pointer = 0;
+  if (bytes == 0)
+    {
+    return cudaSuccess;
+    }
+  PoolBlock block;
+  block.bytes = getPoolBlockSize(bytes);
+  block.device = -1;
+  if (!pinned)
+    {
+    cudaError_t err = cudaGetDevice(&block.device);
+    if (err != cudaSuccess)
+      {
+      return err;
+      }
+    }
+
+  bool cached = false;
+    {
+    PoolLock lock;
+    size_t best = pool.cachedBlocks.size();
+    for (size_t i = 0; i < pool.cachedBlocks.size(); i++)
+      {
+      const PoolBlock& candidate = pool.cachedBlocks[i];
+      if (candidate.device == block.device && candidate.bytes >= block.bytes &&
+          candidate.bytes <= 2 * block.bytes &&
+          (best == pool.cachedBlocks.size() || candidate.bytes < pool.cachedBlocks[best].bytes))
+        {
+        best = i;
+        }
+      }
+    if (best < pool.cachedBlocks.size())
+      {
+      block = pool.cachedBlocks[best];
+      pool.cachedBlocks.erase(pool.cachedBlocks.begin() + best);
+      pool.cachedBytes -= block.bytes;
+      cached = true;
+      }
+    }
+
+  if (cached)
+    {
+    // wait for the work queued on the block before it was released
+    cudaError_t err = cudaEventSynchronize(block.released);
+    cudaEventDestroy(block.released);
+    if (err != cudaSuccess)
+      {
+      return err;
+      }
+    }
+  else
+    {
+    cudaError_t err = pinned ? cudaMallocHost(&block.pointer, block.bytes) : cudaMalloc(&block.pointer, block.bytes);
+    if (err == cudaErrorMemoryAllocation)
+      {
+      cudaGetLastError();
+      trimPool(block.device, 0);
+      err = pinned ? cudaMallocHost(&block.pointer, block.bytes) : cudaMalloc(&block.pointer, block.bytes);
+      }
+    if (err != cudaSuccess)
+      {
+      return err;
+      }
+    }
+
+  PoolLock lock;
+  pool.usedBlocks[block.pointer] = block;
+  pool.usedBytes += block.bytes;
+  if (block.device >= 0)
+    {
+    pool.usedDeviceBytes += block.bytes;
+    pool.peakDeviceBytes = std::max(pool.peakDeviceBytes, pool.usedDeviceBytes);
+    }
+  *pointer = block.pointer;
+  return cudaSuccess;
+}
+
+//----------------------------------------------------------------------------
+// Release a block of the pool, it is cached unless the cache is full
+static void poolFree(void* pointer)
+{
+  if (!pointer)
+    {
+    return;
+    }
+  PoolBlock block;
+    {
+    PoolLock lock;
+    std::map<void*, PoolBlock>::iterator it = pool.usedBlocks.find(pointer);
+    if (it == pool.usedBlocks.end())
+      {
+      return;
+      }
+    block = it->second;
+    pool.usedBlocks.erase(it);
+    pool.usedBytes -= block.bytes;
+    if (block.device >= 0)
+      {
+      pool.usedDeviceBytes -= block.bytes;
+      }
+    }
+
+  // the event follows the work queued on the device of the block
+  int currentDevice;
+  bool restoreDevice = block.device >= 0 && cudaGetDevice(&currentDevice) == cudaSuccess &&
+    currentDevice != block.device;
+  if (restoreDevice)
+    {
+    cudaSetDevice(block.device);
+    }
+  bool recorded = cudaEventCreateWithFlags(&block.released, cudaEventDisableTiming) == cudaSuccess;
+  if (recorded && cudaEventRecord(block.released, 0) != cudaSuccess)
+    {
+    cudaEventDestroy(block.released);
+    recorded = false;
+    }
+  if (restoreDevice)
+    {
+    cudaSetDevice(currentDevice);
+    }
+  if (!recorded)
+    {
+    cudaGetLastError();
+    if (block.device < 0)
+      {
+      cudaFreeHost(block.pointer);
+      }
+    else
+      {
+      cudaFree(block.pointer);
+      }
+    return;
+    }
+
+  size_t limit;
+    {
+    PoolLock lock;
+    pool.cachedBlocks.push_back(block);
+    pool.cachedBytes += block.bytes;
+    limit = pool.limit;
+    }
+  if (limit > 0)
+    {
+    trimPool(-2, limit);
+    }
+}
+
+//----------------------------------------------------------------------------
+// Number of voxels of a device grid of cellDims voxels in a layout, the
+// bricks layout being padded to whole blocks
+static long long getStoredVoxelsNb(const int cellDims[3], int layout)
+{
+  long long voxelsNb = 1;
+  for (int i = 0; i < 3; i++)
+    {
+    long long dim = cellDims[i] > 0 ? cellDims[i] : 0;
+    if (layout == CUDA_RECONSTRUCTION_LAYOUT_BRICKS)
+      {
+      dim = (dim + CUDA_RECONSTRUCTION_BLOCK_SIZE - 1) / CUDA_RECONSTRUCTION_BLOCK_SIZE * CUDA_RECONSTRUCTION_BLOCK_SIZE;
+      }
+    voxelsNb *= dim;
+    }
+  return voxelsNb;
+}
+
+//----------------------------------------------------------------------------
+// Index of the voxel (i, j, k) of a device grid of cellDims voxels, x
+// fastest in the linear layout, by blocks numbered x fastest then x fastest
+// within a block in the bricks layout
+__device__ long long gridVoxelIndex(const int cellDims[3], int layout, int i, int j, int k)
+{
+  if (layout == CUDA_RECONSTRUCTION_LAYOUT_BRICKS)
+    {
+    const int size = CUDA_RECONSTRUCTION_BLOCK_SIZE;
+    long long bricksX = (cellDims[0] + size - 1) / size;
+    long long bricksY = (cellDims[1] + size - 1) / size;
+    long long brick = i / size + bricksX * (j / size + bricksY * (k / size));
+    return brick * BLOCK_VOXELS_NB + i % size + size * (j % size + size * (k % size));
+    }
+  return i + (long long)cellDims[0] * (j + (long long)cellDims[1] * k);
+}
+
+//----------------------------------------------------------------------------
+// Apply a 4x4 row-major homogeneous matrix to a point
+template <typename T>
+__device__ void transformPoint(const T matrix[16], const T in[3], T out[3])
+{
+  T tmp[4];
+  for (int i = 0; i < 4; i++)
+    {
+    tmp[i] = matrix[4 * i + 0] * in[0] + matrix[4 * i + 1] * in[1]
+           + matrix[4 * i + 2] * in[2] + matrix[4 * i + 3];
+    }
+  for (int i = 0; i < 3; i++)
+    {
+    out[i] = tmp[i] / tmp[3];
+    }
+}
+
+//----------------------------------------------------------------------------
+// Sample the depth map at (x, y), the pixel centers being at integer
+// coordinates. The points which are not within half a pixel of the depth
+// map are not sampled, nor are the interpolations with an invalid tap: the
+// invalid depths of the texture are NaN, so that the hardware filtering
+// returns NaN for them.
+template <typename T>
+__device__ bool sampleDepth(const IntegrationParameters<T>& params, const T* depths, T x, T y, T& depth)
+{
+  int ijk[2];
+  ijk[0] = round(x);
+  ijk[1] = round(y);
+  if (ijk[0] < 0 || ijk[0] > params.depthMapDims[0] - 1 ||
+      ijk[1] < 0 || ijk[1] > params.depthMapDims[1] - 1)
+    {
+    return false;
+    }
+  if (params.interpolation == CUDA_RECONSTRUCTION_INTERPOLATION_NEAREST)
+    {
+    depth = depths[ijk[0] + ijk[1] * params.depthMapDims[0]];
+    return true;
+    }
+
+  // the texels centers are at half integer coordinates
+  if (params.depthsTexture)
+    {
+    depth = (T)tex2D<float>(params.depthsTexture, (float)x + 0.5f, (float)y + 0.5f);
+    return true;
+    }
+
+  // bilinear interpolation with clamped borders
+  int i0 = (int)floor(x);
+  int j0 = (int)floor(y);
+  T fx = x - (T)i0;
+  T fy = y - (T)j0;
+  int i1 = min(i0 + 1, params.depthMapDims[0] - 1);
+  int j1 = min(j0 + 1, params.depthMapDims[1] - 1);
+  i0 = max(i0, 0);
+  j0 = max(j0, 0);
+  const T* row0 = depths + j0 * params.depthMapDims[0];
+  const T* row1 = depths + j1 * params.depthMapDims[0];
+  if (!ReconstructionAreValidTaps(row0[i0], row0[i1], row1[i0], row1[i1]))
+    {
+    return false;
+    }
+  depth = (1 - fy) * ((1 - fx) * row0[i0] + fx * row0[i1]) + fy * ((1 - fx) * row1[i0] + fx * row1[i1]);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// Project a voxel center into the depth map and accumulate the difference
+// between the depth and the voxel distance with the function F, the voxels
+// being stored as S
+template <typename T, typename F, typename S>
+__device__ void integrateVoxel(const IntegrationParameters<T>& params, const F& function, const S& storage,
+                               const int ijkVox[3], long long i_vox, const T* depths,
+                               typename S::Scalar* outScalar, typename S::Weight* outWeights)
+{
+  T ijk[3];
+  for (int i = 0; i < 3; i++)
+    {
+    ijk[i] = (T)ijkVox[i];
+    }
+
+  // voxel center in camera coords
+  const T* M = params.voxelToCamera;
+  T w = M[12] * ijk[0] + M[13] * ijk[1] + M[14] * ijk[2] + M[15];
+  T voxCameraCoords[3];
+  for (int i = 0; i < 3; i++)
+    {
+    voxCameraCoords[i] = M[4 * i] * ijk[0] + M[4 * i + 1] * ijk[1] + M[4 * i + 2] * ijk[2] + M[4 * i + 3];
+    }
+
+  // compute distance between voxel and camera
+  T distanceVoxCam = sqrt(voxCameraCoords[0] * voxCameraCoords[0]
+                        + voxCameraCoords[1] * voxCameraCoords[1]
+                        + voxCameraCoords[2] * voxCameraCoords[2]) / fabs(w);
+
+  // voxel center in depth map homogeneous coords, the homogeneous divide by
+  // w cancels out
+  const T* P = params.voxelToDepthMap;
+  T voxDepthMapCoordsHomo[3];
+  for (int i = 0; i < 3; i++)
+    {
+    voxDepthMapCoordsHomo[i] = P[4 * i] * ijk[0] + P[4 * i + 1] * ijk[1] + P[4 * i + 2] * ijk[2] + P[4 * i + 3];
+    }
+
+  // the voxels behind the camera are not seen
+  if (voxDepthMapCoordsHomo[2] <= 0)
+    {
+    return;
+    }
+
+  // voxel center in depth map coords
+  T voxDepthMapCoords[2];
+  voxDepthMapCoords[0] = voxDepthMapCoordsHomo[0] / voxDepthMapCoordsHomo[2];
+  voxDepthMapCoords[1] = voxDepthMapCoordsHomo[1] / voxDepthMapCoordsHomo[2];
+
+  // compute depth from depth map
+  T depth;
+  if (!sampleDepth(params, depths, voxDepthMapCoords[0], voxDepthMapCoords[1], depth) ||
+      !ReconstructionIsValidDepth(depth))
+    {
+    return;
+    }
+
+  // the voxels out of the band of the function are neither read nor written
+  T diff = distanceVoxCam - depth;
+  if (!function.InBand(diff))
+    {
+    return;
+    }
+
+  // compute new val
+  T val = storage.Load(outScalar[i_vox]);
+  T weight = 0;
+  if (F::HasWeights)
+    {
+    weight = storage.LoadWeight(outWeights[i_vox]);
+    }
+  function.Update(diff, val, weight);
+  outScalar[i_vox] = storage.Store(val);
+  if (F::HasWeights)
+    {
+    outWeights[i_vox] = storage.StoreWeight(weight);
+    }
+}
+
+//----------------------------------------------------------------------------
+// One thread per voxel of the grid
+template <typename T, typename F, typename S>
+__global__ void depthMapKernel(IntegrationParameters<T> params, F function, S storage, const T* depths,
+                               typename S::Scalar* outScalar, typename S::Weight* outWeights,
+                               long long voxelsNb)
+{
+  long long stride = (long long)blockDim.x * gridDim.x;
+  for (long long i_vox = (long long)blockIdx.x * blockDim.x + threadIdx.x;
+       i_vox < voxelsNb; i_vox += stride)
+    {
+    int ijkVox[3];
+    ijkVox[0] = i_vox % (params.gridDims[0] - 1);
+    ijkVox[1] = (i_vox / (params.gridDims[0] - 1)) % (params.gridDims[1] - 1);
+    ijkVox[2] = i_vox / ((params.gridDims[0] - 1) * (params.gridDims[1] - 1));
+    integrateVoxel(params, function, storage, ijkVox, i_vox, depths, outScalar, outWeights);
+    }
+}
+
+//----------------------------------------------------------------------------
+// One thread block per active block of voxels, the thread indices give the
+// voxel in the block, or per block of the grid when activeBlocks is null.
+// The block indices are shifted by firstBlock when the grid is a brick of a
+// larger grid.
+template <typename T, typename F, typename S>
+__global__ void depthMapBlocksKernel(IntegrationParameters<T> params, F function, S storage,
+                                     const int* activeBlocks, int activeBlocksNb, int firstBlock,
+                                     const T* depths, typename S::Scalar* outScalar,
+                                     typename S::Weight* outWeights)
+{
+  int cellDims[3];
+  int blocksDims[2];
+  for (int i = 0; i < 3; i++)
+    {
+    cellDims[i] = params.gridDims[i] - 1;
+    }
+  for (int i = 0; i < 2; i++)
+    {
+    blocksDims[i] = (cellDims[i] + CUDA_RECONSTRUCTION_BLOCK_SIZE - 1) / CUDA_RECONSTRUCTION_BLOCK_SIZE;
+    }
+
+  for (int b = blockIdx.x; b < activeBlocksNb; b += gridDim.x)
+    {
+    int block = activeBlocks ? activeBlocks[b] - firstBlock : b;
+    int ijkVox[3];
+    ijkVox[0] = (block % blocksDims[0]) * CUDA_RECONSTRUCTION_BLOCK_SIZE + threadIdx.x;
+    ijkVox[1] = ((block / blocksDims[0]) % blocksDims[1]) * CUDA_RECONSTRUCTION_BLOCK_SIZE + threadIdx.y;
+    ijkVox[2] = (block / (blocksDims[0] * blocksDims[1])) * CUDA_RECONSTRUCTION_BLOCK_SIZE + threadIdx.z;
+    if (ijkVox[0] >= cellDims[0] || ijkVox[1] >= cellDims[1] || ijkVox[2] >= cellDims[2])
+      {
+      continue;
+      }
+    long long i_vox = gridVoxelIndex(cellDims, params.layout, ijkVox[0], ijkVox[1], ijkVox[2]);
+    integrateVoxel(params, function, storage, ijkVox, i_vox, depths, outScalar, outWeights);
+    }
+}
+
+//----------------------------------------------------------------------------
+// One thread per cell of the z slices [firstZ, firstZ + slicesNb) of
+// cellExtent: copy it between a bricks layout grid and a buffer packing
+// these slices x fastest, into the grid when toBricks is true. V has the
+// size of a voxel.
+template <typename V>
+__global__ void reorderKernel(V* bricks, V* packed, int cellDims0, int cellDims1, int cellDims2,
+                              int extent0, int extent2, int extent4, int width, int height, int firstZ,
+                              long long cellsNb, bool toBricks)
+{
+  int cellDims[3] = {cellDims0, cellDims1, cellDims2};
+  long long stride = (long long)blockDim.x * gridDim.x;
+  for (long long i = (long long)blockIdx.x * blockDim.x + threadIdx.x; i < cellsNb; i += stride)
+    {
+    int x = extent0 + (int)(i % width);
+    int y = extent2 + (int)((i / width) % height);
+    int z = firstZ + (int)(i / ((long long)width * height));
+    long long i_vox = gridVoxelIndex(cellDims, CUDA_RECONSTRUCTION_LAYOUT_BRICKS, x, y, z);
+    if (toBricks)
+      {
+      bricks[i_vox] = packed[i];
+      }
+    else
+      {
+      packed[i] = bricks[i_vox];
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+// Fill a grid of 16 bit voxels with a value
+__global__ void fillKernel(unsigned short* outScalar, unsigned short value, long long voxelsNb)
+{
+  long long stride = (long long)blockDim.x * gridDim.x;
+  for (long long i_vox = (long long)blockIdx.x * blockDim.x + threadIdx.x;
+       i_vox < voxelsNb; i_vox += stride)
+    {
+    outScalar[i_vox] = value;
+    }
+}
+
+//----------------------------------------------------------------------------
+// Replace the invalid depths of a depth map by NaN, in place. The depths
+// whose confidence is below minConfidence are invalid when confidences is
+// not null.
+template <typename T>
+__global__ void maskDepthsKernel(T* depths, const float* confidences, long long depthsNb, T minDepth,
+                                 T maxDepth, float minConfidence)
+{
+  long long stride = (long long)blockDim.x * gridDim.x;
+  for (long long i = (long long)blockIdx.x * blockDim.x + threadIdx.x; i < depthsNb; i += stride)
+    {
+    bool confident = !confidences || confidences[i] >= minConfidence;
+    depths[i] = ReconstructionMaskDepth(depths[i], minDepth, maxDepth, confident);
+    }
+}
+
+//----------------------------------------------------------------------------
+// One thread per pixel of a pitched single precision depth map: replace its
+// invalid depths by NaN, in place
+__global__ void maskPitchedDepthsKernel(char* depths, size_t pitch, int width, int height)
+{
+  int i = blockIdx.x * blockDim.x + threadIdx.x;
+  int j = blockIdx.y * blockDim.y + threadIdx.y;
+  if (i >= width || j >= height)
+    {
+    return;
+    }
+  float* row = (float*)(depths + j * pitch);
+  row[i] = ReconstructionMaskDepth(row[i], 0.f, 0.f, true);
+}
+
+//----------------------------------------------------------------------------
+// One thread per pixel of the next level of the depth map pyramid
+template <typename T>
+__global__ void downsampleDepthsKernel(const T* depths, int dims0, int dims1, T* levelDepths,
+                                       int levelDims0, int levelDims1)
+{
+  int i = blockIdx.x * blockDim.x + threadIdx.x;
+  int j = blockIdx.y * blockDim.y + threadIdx.y;
+  if (i >= levelDims0 || j >= levelDims1)
+    {
+    return;
+    }
+  int dims[3] = {dims0, dims1, 1};
+  levelDepths[i + (long long)j * levelDims0] = ReconstructionDownsampleDepth(depths, dims, i, j);
+}
+
+//----------------------------------------------------------------------------
+int cuda_reconstruction_get_device_info(int* devicesNb, size_t* freeMemory, size_t* totalMemory)
+{
+  *devicesNb = 0;
+  *freeMemory = 0;
+  *totalMemory = 0;
+
+  // fails when there is no driver or no device
+  int count = 0;
+  if (cudaGetDeviceCount(&count) != cudaSuccess || count <= 0)
+    {
+    cudaGetLastError();
+    return 0;
+    }
+  *devicesNb = count;
+
+  if (cudaMemGetInfo(freeMemory, totalMemory) != cudaSuccess)
+    {
+    cudaGetLastError();
+    return 0;
+    }
+
+  // the blocks cached by the pool are available to the next allocations
+  int device;
+  if (cudaGetDevice(&device) == cudaSuccess)
+    {
+    PoolLock lock;
+    for (size_t i = 0; i < pool.cachedBlocks.size(); i++)
+      {
+      if (pool.cachedBlocks[i].device == device)
+        {
+        *freeMemory += pool.cachedBlocks[i].bytes;
+        }
+      }
+    }
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+void cuda_reconstruction_set_pool_limit(size_t bytes)
+{
+    {
+    PoolLock lock;
+    pool.limit = bytes;
+    }
+  if (bytes > 0)
+    {
+    trimPool(-2, bytes);
+    }
+}
+
+//----------------------------------------------------------------------------
+void cuda_reconstruction_release_pool()
+{
+  trimPool(-2, 0);
+}
+
+//----------------------------------------------------------------------------
+void cuda_reconstruction_get_pool_info(size_t* cachedBytes, size_t* usedBytes)
+{
+  PoolLock lock;
+  *cachedBytes = pool.cachedBytes;
+  *usedBytes = pool.usedBytes;
+}
+
+//----------------------------------------------------------------------------
+size_t cuda_reconstruction_get_pool_device_peak()
+{
+  PoolLock lock;
+  return pool.peakDeviceBytes;
+}
+
+//----------------------------------------------------------------------------
+void cuda_reconstruction_reset_pool_device_peak()
+{
+  PoolLock lock;
+  pool.peakDeviceBytes = pool.usedDeviceBytes;
+}
+
+//----------------------------------------------------------------------------
+struct CudaReconstructionContext
+{
+  // device holding the buffers
+  int device;
+
+  // precision of the grid, the depth maps and the computation
+  bool singlePrecision;
+  size_t scalarSize;
+
+  // grid, its parameters are given to each kernel launch
+  double gridMatrix[16];
+  double gridOrig[3];
+  int gridDims[3];
+  double gridSpacing[3];
+  void* d_outScalar;
+  long long voxelsNb;
+  size_t outScalarBytes;
+
+  // layout of the next grids, and the one of the device grid with the
+  // number of its voxels, padding included, and the buffer reordering them
+  int layout;
+  int gridLayout;
+  long long storedVoxelsNb;
+  void* d_layoutStaging;
+  size_t layoutStagingBytes;
+
+  // accumulation function of the next grids, the function of the device
+  // grid and whether it holds the TSDF weights after its signed distances
+  int function;
+  double truncation;
+  int gridFunction;
+  bool gridWeights;
+
+  // storage format of the next grids, and the one of the device grid with
+  // the bytes of its voxels and of its weights
+  int storage;
+  int gridStorage;
+  size_t voxelSize;
+  size_t weightSize;
+
+  // depth map and active blocks buffers, reused while big enough
+  void* d_depths;
+  size_t depthsBytes;
+  void* d_activeBlocks;
+  size_t activeBlocksBytes;
+
+  // bricked mode: one device brick and one pinned staging buffer per stream,
+  // reused while big enough
+  cudaStream_t streams[BRICK_STREAMS_NB];
+  bool hasStreams;
+  void* d_bricks[BRICK_STREAMS_NB];
+  void* h_stagings[BRICK_STREAMS_NB];
+  size_t brickBytes;
+
+  // sparse volume: the hash table of the allocated block keys, and for each
+  // block in allocation order its key and its voxels
+  unsigned long long* d_hashKeys;
+  unsigned long long hashCapacity;
+  unsigned long long* d_blockKeys;
+  void* d_blockScalars;
+  long long maxBlocksNb;
+  unsigned long long* d_blocksCounter;
+  double bandWidth;
+  size_t sparseBytes;
+
+  // sampling of the depth maps, and the pitched buffer and texture of the
+  // single precision depth maps sampled by the hardware
+  int interpolation;
+  void* d_depthsPitched;
+  size_t depthsPitch;
+  int depthsTextureDims[2];
+  cudaTextureObject_t depthsTexture;
+
+  // preprocessing of the next depth maps: the range of the valid depths,
+  // maxDepth 0 not bounding them, the confidence of the valid depths, and
+  // the number of halvings of the depth maps
+  double minDepth;
+  double maxDepth;
+  double minConfidence;
+  int depthMapLevel;
+
+  // asynchronous integration: the depth maps go through asyncSlotsNb slots,
+  // each one with a pinned staging buffer and a device buffer holding the
+  // depths followed by the active blocks. The uploads run on the first
+  // stream and the kernels on the second one. The queued integrations are
+  // numbered from 1, each slot keeps the number of its last one.
+  void* h_asyncStagings[ASYNC_SLOTS_NB];
+  void* d_asyncBuffers[ASYNC_SLOTS_NB];
+  size_t asyncBytes[ASYNC_SLOTS_NB];
+  cudaEvent_t uploadedEvents[ASYNC_SLOTS_NB];
+  cudaEvent_t integratedEvents[ASYNC_SLOTS_NB];
+  long long asyncTickets[ASYNC_SLOTS_NB];
+  bool hasAsyncEvents;
+  int asyncSlotsNb;
+  int asyncSlot;
+  bool asyncPending;
+  long long asyncSubmittedNb;
+  long long asyncCompletedNb;
+
+  // surface extraction: the compacted active cubes of the device grid, the
+  // points of the triangles of the last extraction and the counters of the
+  // kernels, reused while big enough
+  void* d_activeCubes;
+  size_t activeCubesBytes;
+  void* d_triangles;
+  size_t trianglesBytes;
+  void* d_surfaceCounters;
+  size_t surfaceCountersBytes;
+  long long trianglesNb;
+
+  // page-locked host buffers and their sizes
+  std::vector<std::pair<char*, size_t> > registeredBuffers;
+
+  // timing of the stages, the events enclose the current stage
+  bool timing;
+  cudaEvent_t timingEvents[2];
+  double timings[CUDA_RECONSTRUCTION_STAGES_NB];
+
+  // bytes copied to and from the device
+  long long transferredBytes[2];
+};
+
+//----------------------------------------------------------------------------
+int cuda_reconstruction_set_device(int device)
+{
+  return checkCudaError(cudaSetDevice(device), "Unable to select the device") ? 1 : 0;
+}
+
+//----------------------------------------------------------------------------
+CudaReconstructionContext* cuda_reconstruction_new()
+{
+  CudaReconstructionContext* context = new CudaReconstructionContext;
+  if (cudaGetDevice(&context->device) != cudaSuccess)
+    {
+    context->device = 0;
+    }
+  context->singlePrecision = false;
+  context->scalarSize = sizeof(double);
+  context->d_outScalar = 0;
+  context->voxelsNb = 0;
+  context->outScalarBytes = 0;
+  context->layout = CUDA_RECONSTRUCTION_LAYOUT_BRICKS;
+  context->gridLayout = CUDA_RECONSTRUCTION_LAYOUT_LINEAR;
+  context->storedVoxelsNb = 0;
+  context->d_layoutStaging = 0;
+  context->layoutStagingBytes = 0;
+  context->function = CUDA_RECONSTRUCTION_FUNCTION_CUMUL;
+  context->truncation = 0;
+  context->gridFunction = CUDA_RECONSTRUCTION_FUNCTION_CUMUL;
+  context->gridWeights = false;
+  context->storage = CUDA_RECONSTRUCTION_STORAGE_NATIVE;
+  context->gridStorage = CUDA_RECONSTRUCTION_STORAGE_NATIVE;
+  context->voxelSize = sizeof(double);
+  context->weightSize = sizeof(double);
+  context->d_depths = 0;
+  context->depthsBytes = 0;
+  context->d_activeBlocks = 0;
+  context->activeBlocksBytes = 0;
+  context->hasStreams = false;
+  for (int i = 0; i < BRICK_STREAMS_NB; i++)
+    {
+    context->d_bricks[i] = 0;
+    context->h_stagings[i] = 0;
+    }
+  context->brickBytes = 0;
+  context->d_hashKeys = 0;
+  context->hashCapacity = 0;
+  context->d_blockKeys = 0;
+  context->d_blockScalars = 0;
+  context->maxBlocksNb = 0;
+  context->d_blocksCounter = 0;
+  context->bandWidth = 0;
+  context->sparseBytes = 0;
+  context->interpolation = CUDA_RECONSTRUCTION_INTERPOLATION_NEAREST;
+  context->d_depthsPitched = 0;
+  context->depthsPitch = 0;
+  context->depthsTextureDims[0] = 0;
+  context->depthsTextureDims[1] = 0;
+  context->depthsTexture = 0;
+  context->minDepth = 0;
+  context->maxDepth = 0;
+  context->minConfidence = 0;
+  context->depthMapLevel = 0;
+  for (int i = 0; i < ASYNC_SLOTS_NB; i++)
+    {
+    context->h_asyncStagings[i] = 0;
+    context->d_asyncBuffers[i] = 0;
+    context->asyncBytes[i] = 0;
+    context->asyncTickets[i] = 0;
+    }
+  context->d_activeCubes = 0;
+  context->activeCubesBytes = 0;
+  context->d_triangles = 0;
+  context->trianglesBytes = 0;
+  context->d_surfaceCounters = 0;
+  context->surfaceCountersBytes = 0;
+  context->trianglesNb = 0;
+  context->hasAsyncEvents = false;
+  context->asyncSlotsNb = 2;
+  context->asyncSlot = 0;
+  context->asyncPending = false;
+  context->asyncSubmittedNb = 0;
+  context->asyncCompletedNb = 0;
+  context->timing = false;
+  for (int i = 0; i < CUDA_RECONSTRUCTION_STAGES_NB; i++)
+    {
+    context->timings[i] = 0;
+    }
+  context->transferredBytes[0] = 0;
+  context->transferredBytes[1] = 0;
+  return context;
+}
+
+//----------------------------------------------------------------------------
+// Copy memory between the host and the device, counting the transferred
+// bytes of the context
+static cudaError_t copyMemory(CudaReconstructionContext* context, void* dst, const void* src, size_t bytes,
+                              cudaMemcpyKind kind)
+{
+  context->transferredBytes[kind == cudaMemcpyDeviceToHost ? 1 : 0] += (long long)bytes;
+  return cudaMemcpy(dst, src, bytes, kind);
+}
+
+static cudaError_t copyMemoryAsync(CudaReconstructionContext* context, void* dst, const void* src, size_t bytes,
+                                   cudaMemcpyKind kind, cudaStream_t stream)
+{
+  context->transferredBytes[kind == cudaMemcpyDeviceToHost ? 1 : 0] += (long long)bytes;
+  return cudaMemcpyAsync(dst, src, bytes, kind, stream);
+}
+
+//----------------------------------------------------------------------------
+// Free the buffers of the bricked mode
+static void freeBricks(CudaReconstructionContext* context)
+{
+  for (int i = 0; i < BRICK_STREAMS_NB; i++)
+    {
+    poolFree(context->d_bricks[i]);
+    poolFree(context->h_stagings[i]);
+    context->d_bricks[i] = 0;
+    context->h_stagings[i] = 0;
+    }
+  context->brickBytes = 0;
+}
+
+//----------------------------------------------------------------------------
+// Free the buffers of the sparse volume
+static void freeSparse(CudaReconstructionContext* context)
+{
+  poolFree(context->d_hashKeys);
+  poolFree(context->d_blockKeys);
+  poolFree(context->d_blockScalars);
+  poolFree(context->d_blocksCounter);
+  context->d_hashKeys = 0;
+  context->hashCapacity = 0;
+  context->d_blockKeys = 0;
+  context->d_blockScalars = 0;
+  context->maxBlocksNb = 0;
+  context->d_blocksCounter = 0;
+  context->sparseBytes = 0;
+}
+
+//----------------------------------------------------------------------------
+// Wait for the asynchronous integrations and free their buffers
+static void freeAsync(CudaReconstructionContext* context)
+{
+  if (context->asyncPending)
+    {
+    cudaStreamSynchronize(context->streams[1]);
+    context->asyncPending = false;
+    }
+  context->asyncCompletedNb = context->asyncSubmittedNb;
+  for (int i = 0; i < ASYNC_SLOTS_NB; i++)
+    {
+    poolFree(context->h_asyncStagings[i]);
+    poolFree(context->d_asyncBuffers[i]);
+    context->h_asyncStagings[i] = 0;
+    context->d_asyncBuffers[i] = 0;
+    context->asyncBytes[i] = 0;
+    }
+}
+
+//----------------------------------------------------------------------------
+// Free the texture of the depth maps and its buffer
+static void freeDepthsTexture(CudaReconstructionContext* context)
+{
+  if (context->depthsTexture)
+    {
+    cudaDestroyTextureObject(context->depthsTexture);
+    }
+  cudaFree(context->d_depthsPitched);
+  context->depthsTexture = 0;
+  context->d_depthsPitched = 0;
+  context->depthsPitch = 0;
+  context->depthsTextureDims[0] = 0;
+  context->depthsTextureDims[1] = 0;
+}
+
+//----------------------------------------------------------------------------
+void cuda_reconstruction_delete(CudaReconstructionContext* context)
+{
+  if (!context)
+    {
+    return;
+    }
+
+  // the buffers are freed on their device
+  int currentDevice;
+  bool restoreDevice = cudaGetDevice(&currentDevice) == cudaSuccess && currentDevice != context->device;
+  if (restoreDevice)
+    {
+    cudaSetDevice(context->device);
+    }
+  poolFree(context->d_outScalar);
+  poolFree(context->d_layoutStaging);
+  poolFree(context->d_depths);
+  poolFree(context->d_activeBlocks);
+  poolFree(context->d_activeCubes);
+  poolFree(context->d_triangles);
+  poolFree(context->d_surfaceCounters);
+  freeBricks(context);
+  freeSparse(context);
+  freeDepthsTexture(context);
+  freeAsync(context);
+  if (context->hasAsyncEvents)
+    {
+    for (int i = 0; i < ASYNC_SLOTS_NB; i++)
+      {
+      cudaEventDestroy(context->uploadedEvents[i]);
+      cudaEventDestroy(context->integratedEvents[i]);
+      }
+    }
+  if (context->hasStreams)
+    {
+    for (int i = 0; i < BRICK_STREAMS_NB; i++)
+      {
+      cudaStreamDestroy(context->streams[i]);
+      }
+    }
+  cuda_reconstruction_set_timing(context, false);
+  for (size_t i = 0; i < context->registeredBuffers.size(); i++)
+    {
+    cudaHostUnregister(context->registeredBuffers[i].first);
+    }
+  if (restoreDevice)
+    {
+    cudaSetDevice(currentDevice);
+    }
+  delete context;
+}
+
+//----------------------------------------------------------------------------
+size_t cuda_reconstruction_get_allocated_memory(CudaReconstructionContext* context)
+{
+  size_t asyncBytes = 0;
+  for (int i = 0; i < ASYNC_SLOTS_NB; i++)
+    {
+    asyncBytes += context->asyncBytes[i];
+    }
+  return context->outScalarBytes + context->layoutStagingBytes + context->depthsBytes
+    + context->activeBlocksBytes + BRICK_STREAMS_NB * context->brickBytes + context->sparseBytes
+    + context->depthsPitch * context->depthsTextureDims[1] + asyncBytes;
+}
+
+//----------------------------------------------------------------------------
+int cuda_reconstruction_register_host_memory(CudaReconstructionContext* context, void* h_buffer, size_t bytes)
+{
+  if (!h_buffer || bytes == 0)
+    {
+    return 0;
+    }
+  for (size_t i = 0; i < context->registeredBuffers.size(); i++)
+    {
+    if (context->registeredBuffers[i].first == h_buffer)
+      {
+      return 0;
+      }
+    }
+  if (!checkCudaError(cudaHostRegister(h_buffer, bytes, cudaHostRegisterPortable),
+                      "Unable to page-lock a host buffer"))
+    {
+    return 0;
+    }
+  context->registeredBuffers.push_back(std::make_pair((char*)h_buffer, bytes));
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+void cuda_reconstruction_unregister_host_memory(CudaReconstructionContext* context, void* h_buffer)
+{
+  for (size_t i = 0; i < context->registeredBuffers.size(); i++)
+    {
+    if (context->registeredBuffers[i].first == h_buffer)
+      {
+      cudaHostUnregister(h_buffer);
+      context->registeredBuffers.erase(context->registeredBuffers.begin() + i);
+      return;
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+// Check whether a host range lies in a page-locked buffer of a context
+static bool isHostMemoryRegistered(CudaReconstructionContext* context, const void* h_buffer, size_t bytes)
+{
+  const char* begin = (const char*)h_buffer;
+  for (size_t i = 0; i < context->registeredBuffers.size(); i++)
+    {
+    const std::pair<char*, size_t>& buffer = context->registeredBuffers[i];
+    if (begin >= buffer.first && begin + bytes <= buffer.first + buffer.second)
+      {
+      return true;
+      }
+    }
+  return false;
+}
+
+//----------------------------------------------------------------------------
+void cuda_reconstruction_set_interpolation(CudaReconstructionContext* context, int interpolation)
+{
+  context->interpolation = interpolation == CUDA_RECONSTRUCTION_INTERPOLATION_LINEAR ?
+    CUDA_RECONSTRUCTION_INTERPOLATION_LINEAR : CUDA_RECONSTRUCTION_INTERPOLATION_NEAREST;
+  if (context->interpolation == CUDA_RECONSTRUCTION_INTERPOLATION_NEAREST)
+    {
+    freeDepthsTexture(context);
+    }
+}
+
+//----------------------------------------------------------------------------
+void cuda_reconstruction_set_depth_preprocessing(CudaReconstructionContext* context, double minDepth,
+    double maxDepth, double minConfidence, int level)
+{
+  context->minDepth = std::max(minDepth, 0.0);
+  context->maxDepth = std::max(maxDepth, 0.0);
+  context->minConfidence = minConfidence;
+  context->depthMapLevel = std::min(std::max(level, 0), RECONSTRUCTION_DEPTHS_MAX_LEVEL);
+}
+
+//----------------------------------------------------------------------------
+void cuda_reconstruction_set_function(CudaReconstructionContext* context, int function, double truncation)
+{
+  context->function = function >= CUDA_RECONSTRUCTION_FUNCTION_CUMUL &&
+    function <= CUDA_RECONSTRUCTION_FUNCTION_MAX_CONFIDENCE ? function : CUDA_RECONSTRUCTION_FUNCTION_CUMUL;
+  context->truncation = truncation;
+}
+
+//----------------------------------------------------------------------------
+void cuda_reconstruction_set_storage(CudaReconstructionContext* context, int storage)
+{
+  context->storage = storage == CUDA_RECONSTRUCTION_STORAGE_HALF || storage == CUDA_RECONSTRUCTION_STORAGE_UINT16 ?
+    storage : CUDA_RECONSTRUCTION_STORAGE_NATIVE;
+}
+
+//----------------------------------------------------------------------------
+void cuda_reconstruction_set_layout(CudaReconstructionContext* context, int layout)
+{
+  context->layout = layout == CUDA_RECONSTRUCTION_LAYOUT_LINEAR ?
+    CUDA_RECONSTRUCTION_LAYOUT_LINEAR : CUDA_RECONSTRUCTION_LAYOUT_BRICKS;
+}
+
+//----------------------------------------------------------------------------
+int cuda_reconstruction_set_timing(CudaReconstructionContext* context, bool timing)
+{
+  if (timing == context->timing)
+    {
+    return 1;
+    }
+  if (!timing)
+    {
+    cudaEventDestroy(context->timingEvents[0]);
+    cudaEventDestroy(context->timingEvents[1]);
+    context->timing = false;
+    return 1;
+    }
+  if (!checkCudaError(cudaEventCreate(&context->timingEvents[0]), "Unable to create a timing event"))
+    {
+    return 0;
+    }
+  if (!checkCudaError(cudaEventCreate(&context->timingEvents[1]), "Unable to create a timing event"))
+    {
+    cudaEventDestroy(context->timingEvents[0]);
+    return 0;
+    }
+  for (int i = 0; i < CUDA_RECONSTRUCTION_STAGES_NB; i++)
+    {
+    context->timings[i] = 0;
+    }
+  context->timing = true;
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+void cuda_reconstruction_get_timings(CudaReconstructionContext* context,
+    double timings[CUDA_RECONSTRUCTION_STAGES_NB])
+{
+  for (int i = 0; i < CUDA_RECONSTRUCTION_STAGES_NB; i++)
+    {
+    timings[i] = context->timings[i];
+    context->timings[i] = 0;
+    }
+}
+
+//----------------------------------------------------------------------------
+void cuda_reconstruction_get_transfers(CudaReconstructionContext* context, long long* uploadedBytes,
+    long long* downloadedBytes)
+{
+  *uploadedBytes = context->transferredBytes[0];
+  *downloadedBytes = context->transferredBytes[1];
+  context->transferredBytes[0] = 0;
+  context->transferredBytes[1] = 0;
+}
+
+//----------------------------------------------------------------------------
+// Start timing a stage on the default stream
+static void startStage(CudaReconstructionContext* context)
+{
+  if (context->timing)
+    {
+    cudaEventRecord(context->timingEvents[0], 0);
+    }
+}
+
+//----------------------------------------------------------------------------
+// Wait for the stage started by startStage and add its duration
+static void stopStage(CudaReconstructionContext* context, int stage)
+{
+  if (!context->timing)
+    {
+    return;
+    }
+  float ms = 0;
+  cudaEventRecord(context->timingEvents[1], 0);
+  if (cudaEventSynchronize(context->timingEvents[1]) == cudaSuccess &&
+      cudaEventElapsedTime(&ms, context->timingEvents[0], context->timingEvents[1]) == cudaSuccess)
+    {
+    context->timings[stage] += ms;
+    }
+}
+
+//----------------------------------------------------------------------------
+// Make sure a device buffer holds at least requiredBytes, its content is
+// lost when it grows
+static bool reserveBuffer(void** d_buffer, size_t* bytes, size_t requiredBytes, const char* msg)
+{
+  if (requiredBytes <= *bytes)
+    {
+    return true;
+    }
+  poolFree(*d_buffer);
+  *d_buffer = 0;
+  *bytes = 0;
+  if (!checkCudaError(poolMalloc(d_buffer, requiredBytes, false), msg))
+    {
+    return false;
+    }
+  *bytes = requiredBytes;
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// Create the streams of the bricked and of the asynchronous integrations
+static bool createStreams(CudaReconstructionContext* context)
+{
+  if (context->hasStreams)
+    {
+    return true;
+    }
+  for (int i = 0; i < BRICK_STREAMS_NB; i++)
+    {
+    if (!checkCudaError(cudaStreamCreate(&context->streams[i]), "Unable to create a stream"))
+      {
+      for (int j = 0; j < i; j++)
+        {
+        cudaStreamDestroy(context->streams[j]);
+        }
+      return false;
+      }
+    }
+  context->hasStreams = true;
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// Wait for the asynchronous integrations into the device grid
+static bool waitAsync(CudaReconstructionContext* context)
+{
+  if (!context->asyncPending)
+    {
+    return true;
+    }
+  context->asyncPending = false;
+  context->asyncCompletedNb = context->asyncSubmittedNb;
+  return checkCudaError(cudaStreamSynchronize(context->streams[1]), "Unable to integrate a depth map");
+}
+
+//----------------------------------------------------------------------------
+// Make sure the depth map buffer holds at least depthsBytes
+static bool reserveDepths(CudaReconstructionContext* context, size_t depthsBytes)
+{
+  return reserveBuffer(&context->d_depths, &context->depthsBytes, depthsBytes,
+                       "Unable to allocate the depth map");
+}
+
+//----------------------------------------------------------------------------
+// Upload a single precision depth map into the pitched buffer bound to the
+// depths texture, both are created again when the dimensions change. Its
+// invalid depths are replaced by NaN on the device.
+static bool uploadDepthsTexture(CudaReconstructionContext* context, int h_depthMapDims[3],
+                                const void* h_depths)
+{
+  if (h_depthMapDims[0] != context->depthsTextureDims[0] || h_depthMapDims[1] != context->depthsTextureDims[1])
+    {
+    freeDepthsTexture(context);
+    if (!checkCudaError(cudaMallocPitch(&context->d_depthsPitched, &context->depthsPitch,
+                                        h_depthMapDims[0] * sizeof(float), h_depthMapDims[1]),
+                        "Unable to allocate the depth map texture"))
+      {
+      return false;
+      }
+
+    cudaResourceDesc resourceDesc;
+    memset(&resourceDesc, 0, sizeof(resourceDesc));
+    resourceDesc.resType = cudaResourceTypePitch2D;
+    resourceDesc.res.pitch2D.devPtr = context->d_depthsPitched;
+    resourceDesc.res.pitch2D.desc = cudaCreateChannelDesc<float>();
+    resourceDesc.res.pitch2D.width = h_depthMapDims[0];
+    resourceDesc.res.pitch2D.height = h_depthMapDims[1];
+    resourceDesc.res.pitch2D.pitchInBytes = context->depthsPitch;
+    cudaTextureDesc textureDesc;
+    memset(&textureDesc, 0, sizeof(textureDesc));
+    textureDesc.addressMode[0] = cudaAddressModeClamp;
+    textureDesc.addressMode[1] = cudaAddressModeClamp;
+    textureDesc.filterMode = cudaFilterModeLinear;
+    textureDesc.readMode = cudaReadModeElementType;
+    textureDesc.normalizedCoords = 0;
+    if (!checkCudaError(cudaCreateTextureObject(&context->depthsTexture, &resourceDesc, &textureDesc, 0),
+                        "Unable to create the depth map texture"))
+      {
+      context->depthsTexture = 0;
+      freeDepthsTexture(context);
+      return false;
+      }
+    context->depthsTextureDims[0] = h_depthMapDims[0];
+    context->depthsTextureDims[1] = h_depthMapDims[1];
+    }
+
+  size_t rowBytes = h_depthMapDims[0] * sizeof(float);
+  context->transferredBytes[0] += (long long)rowBytes * h_depthMapDims[1];
+  if (!checkCudaError(cudaMemcpy2D(context->d_depthsPitched, context->depthsPitch, h_depths, rowBytes,
+                                   rowBytes, h_depthMapDims[1], cudaMemcpyHostToDevice),
+                      "Unable to copy the depth map to the device"))
+    {
+    return false;
+    }
+  dim3 dimBlock(PYRAMID_BLOCK_SIZE, PYRAMID_BLOCK_SIZE, 1);
+  dim3 dimGrid((h_depthMapDims[0] + PYRAMID_BLOCK_SIZE - 1) / PYRAMID_BLOCK_SIZE,
+               (h_depthMapDims[1] + PYRAMID_BLOCK_SIZE - 1) / PYRAMID_BLOCK_SIZE, 1);
+  maskPitchedDepthsKernel<<<dimGrid, dimBlock>>>((char*)context->d_depthsPitched, context->depthsPitch,
+                                                 h_depthMapDims[0], h_depthMapDims[1]);
+  return checkCudaError(cudaGetLastError(), "Unable to launch the depth mask kernel");
+}
+
+//----------------------------------------------------------------------------
+// Layout of the device buffer of a depth map: the uploaded bytes, that is
+// the depths followed by their confidences and by the active blocks if any,
+// then the levels of the pyramid aligned on 16 bytes
+struct DepthMapLayout
+{
+  bool preprocessed;
+  size_t depthsBytes;
+  size_t confidencesBytes;
+  size_t uploadBytes;
+  size_t levelsOffset;
+  size_t bytes;
+};
+
+//----------------------------------------------------------------------------
+// Lay out the buffer of a depth map with blocksBytes of active blocks, the
+// confidences and the levels are only kept when it is preprocessed
+static DepthMapLayout getDepthMapLayout(const CudaReconstructionContext* context, const int h_depthMapDims[3],
+                                        size_t scalarSize, const float* h_confidences, size_t blocksBytes)
+{
+  long long depthsNb = (long long)h_depthMapDims[0] * h_depthMapDims[1];
+  bool masksConfidences = h_confidences && context->minConfidence > 0;
+  DepthMapLayout layout;
+  layout.preprocessed = context->minDepth > 0 || context->maxDepth > 0 || masksConfidences ||
+    context->depthMapLevel > 0;
+  layout.depthsBytes = depthsNb * scalarSize;
+  layout.confidencesBytes = layout.preprocessed && masksConfidences ? depthsNb * sizeof(float) : 0;
+  layout.uploadBytes = layout.depthsBytes + layout.confidencesBytes + blocksBytes;
+  layout.levelsOffset = (layout.uploadBytes + 15) / 16 * 16;
+  long long levelsNb = 0;
+  int dims[3] = {h_depthMapDims[0], h_depthMapDims[1], h_depthMapDims[2]};
+  for (int l = 0; layout.preprocessed && l < context->depthMapLevel; l++)
+    {
+    ReconstructionDownsampleDims(dims, dims);
+    levelsNb += (long long)dims[0] * dims[1];
+    }
+  layout.bytes = levelsNb > 0 ? layout.levelsOffset + levelsNb * scalarSize : layout.uploadBytes;
+  return layout;
+}
+
+//----------------------------------------------------------------------------
+// Preprocess in the precision T, on a stream, a depth map uploaded at the
+// start of d_buffer laid out as layout: mask its invalid depths in place,
+// then halve it level by level into the levels of the buffer. The
+// dimensions and the intrinsics are updated to the last level, whose depths
+// are returned in d_levelDepths.
+template <typename T>
+static bool preprocessDepths(const CudaReconstructionContext* context, char* d_buffer,
+                             const DepthMapLayout& layout, int dims[3], double matrixK[9],
+                             const void** d_levelDepths, cudaStream_t stream)
+{
+  T* d_depths = (T*)d_buffer;
+  const float* d_confidences = layout.confidencesBytes > 0 ? (const float*)(d_buffer + layout.depthsBytes) : 0;
+  long long depthsNb = (long long)dims[0] * dims[1];
+  long long maskBlocksNb = (depthsNb + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  maskDepthsKernel<T><<<maskBlocksNb < MAX_GRID_SIZE ? maskBlocksNb : MAX_GRID_SIZE, BLOCK_SIZE, 0, stream>>>(
+    d_depths, d_confidences, depthsNb, (T)context->minDepth, (T)context->maxDepth, (float)context->minConfidence);
+  if (!checkCudaError(cudaGetLastError(), "Unable to launch the depth mask kernel"))
+    {
+    return false;
+    }
+
+  T* d_level = d_depths;
+  T* d_nextLevel = (T*)(d_buffer + layout.levelsOffset);
+  for (int l = 0; l < context->depthMapLevel; l++)
+    {
+    int levelDims[3];
+    ReconstructionDownsampleDims(dims, levelDims);
+    dim3 dimBlock(PYRAMID_BLOCK_SIZE, PYRAMID_BLOCK_SIZE, 1);
+    dim3 dimGrid((levelDims[0] + PYRAMID_BLOCK_SIZE - 1) / PYRAMID_BLOCK_SIZE,
+                 (levelDims[1] + PYRAMID_BLOCK_SIZE - 1) / PYRAMID_BLOCK_SIZE, 1);
+    downsampleDepthsKernel<T><<<dimGrid, dimBlock, 0, stream>>>(d_level, dims[0], dims[1], d_nextLevel,
+                                                                levelDims[0], levelDims[1]);
+    if (!checkCudaError(cudaGetLastError(), "Unable to launch the depth map pyramid kernel"))
+      {
+      return false;
+      }
+    ReconstructionDownsampleMatrixK(matrixK);
+    for (int i = 0; i < 3; i++)
+      {
+      dims[i] = levelDims[i];
+      }
+    d_level = d_nextLevel;
+    d_nextLevel += (long long)levelDims[0] * levelDims[1];
+    }
+  *d_levelDepths = d_level;
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// Preprocess a depth map uploaded into d_buffer if its layout requires it,
+// its depths are otherwise integrated as uploaded
+static bool preprocessDepthMap(const CudaReconstructionContext* context, bool singlePrecision, void* d_buffer,
+                               const DepthMapLayout& layout, int dims[3], double matrixK[9],
+                               const void** d_levelDepths, cudaStream_t stream)
+{
+  *d_levelDepths = d_buffer;
+  if (!layout.preprocessed)
+    {
+    return true;
+    }
+  if (singlePrecision)
+    {
+    return preprocessDepths<float>(context, (char*)d_buffer, layout, dims, matrixK, d_levelDepths, stream);
+    }
+  return preprocessDepths<double>(context, (char*)d_buffer, layout, dims, matrixK, d_levelDepths, stream);
+}
+
+//----------------------------------------------------------------------------
+// Upload a depth map and its confidences into the depth map buffer, and
+// preprocess it. dims and matrixK are updated to the level integrated,
+// whose depths are returned in d_levelDepths.
+static bool uploadDepthMap(CudaReconstructionContext* context, const void* h_depths, const float* h_confidences,
+                           int dims[3], double matrixK[9], const void** d_levelDepths)
+{
+  DepthMapLayout layout = getDepthMapLayout(context, dims, context->scalarSize, h_confidences, 0);
+  if (!reserveDepths(context, layout.bytes))
+    {
+    return false;
+    }
+  char* d_buffer = (char*)context->d_depths;
+  if (!checkCudaError(copyMemory(context, d_buffer, h_depths, layout.depthsBytes, cudaMemcpyHostToDevice),
+                      "Unable to copy the depth map to the device") ||
+      (layout.confidencesBytes > 0 &&
+       !checkCudaError(copyMemory(context, d_buffer + layout.depthsBytes, h_confidences, layout.confidencesBytes,
+                                  cudaMemcpyHostToDevice),
+                       "Unable to copy the confidences to the device")))
+    {
+    return false;
+    }
+  return preprocessDepthMap(context, context->singlePrecision, d_buffer, layout, dims, matrixK, d_levelDepths, 0);
+}
+
+//----------------------------------------------------------------------------
+// Make sure the active blocks buffer holds at least activeBlocksNb blocks
+static bool reserveActiveBlocks(CudaReconstructionContext* context, size_t activeBlocksNb)
+{
+  return reserveBuffer(&context->d_activeBlocks, &context->activeBlocksBytes, activeBlocksNb * sizeof(int),
+                       "Unable to allocate the active blocks");
+}
+
+//----------------------------------------------------------------------------
+// Reorder the cells of cellExtent between a host buffer packing them x
+// fastest and a device buffer of the grid in the bricks layout, uploaded to
+// the grid when upload is true. The cells go through the staging buffer of
+// the context, as many z slices at a time as it holds.
+template <typename V>
+static bool transferBricksExtent(CudaReconstructionContext* context, void* h_packed, void* d_bricks,
+                                 const int cellExtent[6], bool upload)
+{
+  int width = cellExtent[1] - cellExtent[0] + 1;
+  int height = cellExtent[3] - cellExtent[2] + 1;
+  size_t sliceBytes = (size_t)width * height * sizeof(V);
+  int slicesNb = (int)std::max((size_t)1, (size_t)LAYOUT_STAGING_BYTES / sliceBytes);
+  slicesNb = std::min(slicesNb, cellExtent[5] - cellExtent[4] + 1);
+  if (!reserveBuffer(&context->d_layoutStaging, &context->layoutStagingBytes, slicesNb * sliceBytes,
+                     "Unable to allocate the layout staging buffer"))
+    {
+    return false;
+    }
+  V* d_packed = (V*)context->d_layoutStaging;
+  char* h_slices = (char*)h_packed;
+  for (int z = cellExtent[4]; z <= cellExtent[5]; z += slicesNb)
+    {
+    int slabSlicesNb = std::min(slicesNb, cellExtent[5] - z + 1);
+    long long cellsNb = (long long)width * height * slabSlicesNb;
+    size_t slabBytes = slabSlicesNb * sliceBytes;
+    if (upload && !checkCudaError(copyMemory(context, d_packed, h_slices, slabBytes, cudaMemcpyHostToDevice),
+                                  "Unable to copy the output grid to the device"))
+      {
+      return false;
+      }
+    long long blocksNb = (cellsNb + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    reorderKernel<V><<<blocksNb < MAX_GRID_SIZE ? blocksNb : MAX_GRID_SIZE, BLOCK_SIZE>>>(
+      (V*)d_bricks, d_packed, context->gridDims[0] - 1, context->gridDims[1] - 1, context->gridDims[2] - 1,
+      cellExtent[0], cellExtent[2], cellExtent[4], width, height, z, cellsNb, upload);
+    if (!checkCudaError(cudaGetLastError(), "Unable to launch the layout kernel"))
+      {
+      return false;
+      }
+    if (!upload && !checkCudaError(copyMemory(context, h_slices, d_packed, slabBytes, cudaMemcpyDeviceToHost),
+                                   "Unable to copy the output grid to the host"))
+      {
+      return false;
+      }
+    h_slices += slabBytes;
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// Copy the cells of cellExtent of a device buffer of the grid, in the layout
+// of the grid, from or to a packed host buffer, the voxels having voxelSize
+// bytes
+static bool copyGridExtent(CudaReconstructionContext* context, void* h_packed, void* d_grid,
+                           size_t voxelSize, const int cellExtent[6], bool upload)
+{
+  if (context->gridLayout == CUDA_RECONSTRUCTION_LAYOUT_BRICKS)
+    {
+    if (voxelSize == sizeof(unsigned short))
+      {
+      return transferBricksExtent<unsigned short>(context, h_packed, d_grid, cellExtent, upload);
+      }
+    if (voxelSize == sizeof(float))
+      {
+      return transferBricksExtent<float>(context, h_packed, d_grid, cellExtent, upload);
+      }
+    return transferBricksExtent<double>(context, h_packed, d_grid, cellExtent, upload);
+    }
+
+  size_t rowBytes = (size_t)(context->gridDims[0] - 1) * voxelSize;
+  size_t width = (size_t)(cellExtent[1] - cellExtent[0] + 1) * voxelSize;
+  size_t height = cellExtent[3] - cellExtent[2] + 1;
+  size_t depth = cellExtent[5] - cellExtent[4] + 1;
+  cudaMemcpy3DParms params = {0};
+  cudaPitchedPtr gridPtr = make_cudaPitchedPtr(d_grid, rowBytes, rowBytes, context->gridDims[1] - 1);
+  cudaPitchedPtr packedPtr = make_cudaPitchedPtr(h_packed, width, width, height);
+  cudaPos gridPos = make_cudaPos(cellExtent[0] * voxelSize, cellExtent[2], cellExtent[4]);
+  if (upload)
+    {
+    params.srcPtr = packedPtr;
+    params.dstPtr = gridPtr;
+    params.dstPos = gridPos;
+    params.kind = cudaMemcpyHostToDevice;
+    }
+  else
+    {
+    params.srcPtr = gridPtr;
+    params.srcPos = gridPos;
+    params.dstPtr = packedPtr;
+    params.kind = cudaMemcpyDeviceToHost;
+    }
+  params.extent = make_cudaExtent(width, height, depth);
+  context->transferredBytes[upload ? 0 : 1] += (long long)(width * height * depth);
+  return checkCudaError(cudaMemcpy3D(&params), upload ? "Unable to copy the output extent to the device" :
+                        "Unable to copy the output extent to the host");
+}
+
+//----------------------------------------------------------------------------
+// Copy all the cells of a device buffer of the grid from or to a host
+// buffer, x fastest
+static bool copyGrid(CudaReconstructionContext* context, void* h_buffer, void* d_grid, size_t voxelSize,
+                     bool upload)
+{
+  if (context->gridLayout == CUDA_RECONSTRUCTION_LAYOUT_BRICKS)
+    {
+    int cellExtent[6] = {0, context->gridDims[0] - 2, 0, context->gridDims[1] - 2, 0, context->gridDims[2] - 2};
+    return copyGridExtent(context, h_buffer, d_grid, voxelSize, cellExtent, upload);
+    }
+  size_t bytes = context->voxelsNb * voxelSize;
+  return upload ?
+    checkCudaError(copyMemory(context, d_grid, h_buffer, bytes, cudaMemcpyHostToDevice),
+                   "Unable to copy the output grid to the device") :
+    checkCudaError(copyMemory(context, h_buffer, d_grid, bytes, cudaMemcpyDeviceToHost),
+                   "Unable to copy the output grid to the host");
+}
+
+//----------------------------------------------------------------------------
+int cuda_reconstruction_init_grid(CudaReconstructionContext* context, bool singlePrecision,
     double h_gridMatrix[16], double h_gridOrig[3], int h_gridDims[3], double h_gridSpacing[3],
-    int h_depthMapDims[3], double* h_depths, double h_depthMapMatrixK[16], double h_depthMapMatrixTR[16],
-    double* h_outScalar)
+    void* h_outScalar, void* h_outWeights)
 {
-  const int N = 5;
+  long long voxelsNb = (long long)(h_gridDims[0] - 1) * (h_gridDims[1] - 1) * (h_gridDims[2] - 1);
+  if (voxelsNb < 0)
+    {
+    voxelsNb = 0;
+    }
+
+  // keep the grid parameters
+  context->singlePrecision = singlePrecision;
+  context->scalarSize = singlePrecision ? sizeof(float) : sizeof(double);
+  for (int i = 0; i < 16; i++)
+    {
+    context->gridMatrix[i] = h_gridMatrix[i];
+    }
+  for (int i = 0; i < 3; i++)
+    {
+    context->gridOrig[i] = h_gridOrig[i];
+    context->gridDims[i] = h_gridDims[i];
+    context->gridSpacing[i] = h_gridSpacing[i];
+    }
+  context->voxelsNb = voxelsNb;
+  if (!waitAsync(context))
+    {
+    context->voxelsNb = 0;
+    return 0;
+    }
 
-  // create data into host
-  int h_a[N] = { 0, 0, 0, 0, 0 };
-  int h_b[N] = { 1, 1, 1, 1, 1 };
+  // allocate the grid, it replaces the bricks of the bricked mode and the
+  // sparse volume. The TSDF weights follow the signed distances.
+  freeSparse(context);
+  context->gridFunction = context->function;
+  context->gridWeights = ReconstructionFunctionHasWeights(context->function);
+  context->gridStorage = context->storage;
+  getStorageSizes(context->gridStorage, context->scalarSize, &context->voxelSize, &context->weightSize);
+  context->gridLayout = context->layout;
+  int cellDims[3] = {h_gridDims[0] - 1, h_gridDims[1] - 1, h_gridDims[2] - 1};
+  long long storedVoxelsNb = voxelsNb > 0 ? getStoredVoxelsNb(cellDims, context->gridLayout) : 0;
+  context->storedVoxelsNb = storedVoxelsNb;
+  size_t scalarsBytes = storedVoxelsNb * context->voxelSize;
+  size_t weightsBytes = storedVoxelsNb * context->weightSize;
+  size_t outScalarBytes = context->gridWeights ? scalarsBytes + weightsBytes : scalarsBytes;
+  if (outScalarBytes != context->outScalarBytes)
+    {
+    freeBricks(context);
+    poolFree(context->d_outScalar);
+    context->d_outScalar = 0;
+    context->outScalarBytes = 0;
+    if (outScalarBytes > 0 &&
+        !checkCudaError(poolMalloc(&context->d_outScalar, outScalarBytes, false),
+                        "Unable to allocate the output grid"))
+      {
+      context->voxelsNb = 0;
+      return 0;
+      }
+    context->outScalarBytes = outScalarBytes;
+    }
 
-  // tranfer data from host to device
-  int *d_a, *d_b;
-  cudaMalloc((void**)&d_a, N * sizeof(int));
-  cudaMalloc((void**)&d_b, N * sizeof(int));
-  cudaMemcpy(d_a, h_a, N * sizeof(int), cudaMemcpyHostToDevice);
-  cudaMemcpy(d_b, h_b, N * sizeof(int), cudaMemcpyHostToDevice);
+  // tranfer data from host to device, or start from zero
+  if (outScalarBytes == 0)
+    {
+    return 1;
+    }
+  startStage(context);
+  char* d_weights = (char*)context->d_outScalar + scalarsBytes;
+  int res;
+  if (!h_outScalar && context->gridStorage == CUDA_RECONSTRUCTION_STORAGE_UINT16)
+    {
+    // the quantised zero
+    double range[2];
+    ReconstructionFunctionRange(context->gridFunction, context->truncation, range);
+    double scale = (range[1] - range[0]) / 65535;
+    long long blocksNb = (storedVoxelsNb + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    fillKernel<<<blocksNb < MAX_GRID_SIZE ? blocksNb : MAX_GRID_SIZE, BLOCK_SIZE>>>(
+      (unsigned short*)context->d_outScalar, ReconstructionQuantize(0.0, range[0], scale), storedVoxelsNb);
+    res = checkCudaError(cudaGetLastError(), "Unable to initialize the output grid") ? 1 : 0;
+    }
+  else if (!h_outScalar)
+    {
+    res = checkCudaError(cudaMemset(context->d_outScalar, 0, scalarsBytes),
+                         "Unable to initialize the output grid") ? 1 : 0;
+    }
+  else
+    {
+    res = copyGrid(context, h_outScalar, context->d_outScalar, context->voxelSize, true) ? 1 : 0;
+    }
+  if (res && context->gridWeights && !h_outWeights)
+    {
+    res = checkCudaError(cudaMemset(d_weights, 0, weightsBytes),
+                         "Unable to initialize the weights") ? 1 : 0;
+    }
+  else if (res && context->gridWeights)
+    {
+    res = copyGrid(context, h_outWeights, d_weights, context->weightSize, true) ? 1 : 0;
+    }
+  stopStage(context, CUDA_RECONSTRUCTION_STAGE_UPLOAD);
+  return res;
+}
+
+//----------------------------------------------------------------------------
+// Fold the grid matrix, the camera pose and the camera intrinsics into the
+// projections of the voxel indices, in double precision before the
+// conversion to the precision of the kernel
+template <typename T>
+static void setProjection(IntegrationParameters<T>& params, const double h_gridMatrix[16],
+    const double h_gridOrig[3], const double h_gridSpacing[3], const double h_depthMapMatrixK[9],
+    const double h_depthMapMatrixTR[16])
+{
+  // voxel indices to scene coords of the voxel center
+  double voxelToScene[16];
+  for (int i = 0; i < 4; i++)
+    {
+    for (int j = 0; j < 3; j++)
+      {
+      voxelToScene[4 * i + j] = h_gridMatrix[4 * i + j] * h_gridSpacing[j];
+      }
+    double translation = h_gridMatrix[4 * i + 3];
+    for (int j = 0; j < 3; j++)
+      {
+      translation += h_gridMatrix[4 * i + j] * (h_gridOrig[j] + 0.5 * h_gridSpacing[j]);
+      }
+    voxelToScene[4 * i + 3] = translation;
+    }
 
-  // organize threads into blocks and grids
-  dim3 dimBlock(N, 1, 1);
-  dim3 dimGrid(1, 1, 1);
+  double voxelToCamera[16];
+  for (int i = 0; i < 4; i++)
+    {
+    for (int j = 0; j < 4; j++)
+      {
+      double value = 0;
+      for (int k = 0; k < 4; k++)
+        {
+        value += h_depthMapMatrixTR[4 * i + k] * voxelToScene[4 * k + j];
+        }
+      voxelToCamera[4 * i + j] = value;
+      params.voxelToCamera[4 * i + j] = (T)value;
+      }
+    }
+  for (int i = 0; i < 3; i++)
+    {
+    for (int j = 0; j < 4; j++)
+      {
+      double value = 0;
+      for (int k = 0; k < 3; k++)
+        {
+        value += h_depthMapMatrixK[3 * i + k] * voxelToCamera[4 * k + j];
+        }
+      params.voxelToDepthMap[4 * i + j] = (T)value;
+      }
+    }
+}
 
-  // run code into device
-  kernel<<<dimGrid, dimBlock>>>(d_a, d_b);
+//----------------------------------------------------------------------------
+// Launch of the integration kernels specialised on the function, the voxels
+// being stored as S
+template <typename T, typename S>
+struct IntegrationLauncher
+{
+  IntegrationParameters<T> params;
+  S storage;
+  const T* d_depths;
+  const int* d_activeBlocks;
+  int activeBlocksNb;
+  int firstBlock;
+  typename S::Scalar* d_outScalar;
+  typename S::Weight* d_outWeights;
+  long long voxelsNb;
+  cudaStream_t stream;
 
-  // transfer data from device to host
-  cudaMemcpy(h_a, d_a, N * sizeof(int), cudaMemcpyDeviceToHost);
-  for (int i = 0; i < N; i++)
+  template <typename F>
+  int operator()(const F& function)
   {
-    h_outScalar[i] = h_a[i];
+    // run code into device, one thread per voxel of the active blocks, or
+    // of all the blocks of a bricks layout grid
+    int blocksNb = this->activeBlocksNb;
+    if (blocksNb < 0 && this->params.layout == CUDA_RECONSTRUCTION_LAYOUT_BRICKS)
+      {
+      int cellDims[3] = {this->params.gridDims[0] - 1, this->params.gridDims[1] - 1, this->params.gridDims[2] - 1};
+      blocksNb = (int)(getStoredVoxelsNb(cellDims, CUDA_RECONSTRUCTION_LAYOUT_BRICKS) / BLOCK_VOXELS_NB);
+      }
+    if (blocksNb > 0)
+      {
+      dim3 dimBlock(CUDA_RECONSTRUCTION_BLOCK_SIZE, CUDA_RECONSTRUCTION_BLOCK_SIZE, CUDA_RECONSTRUCTION_BLOCK_SIZE);
+      dim3 dimGrid(blocksNb < MAX_GRID_SIZE ? blocksNb : MAX_GRID_SIZE, 1, 1);
+      depthMapBlocksKernel<T, F, S><<<dimGrid, dimBlock, 0, this->stream>>>(this->params, function,
+        this->storage, this->activeBlocksNb > 0 ? this->d_activeBlocks : 0, blocksNb, this->firstBlock,
+        this->d_depths, this->d_outScalar, this->d_outWeights);
+      return checkCudaError(cudaGetLastError(), "Unable to launch the integration kernel") ? 1 : 0;
+      }
+
+    // organize threads into blocks and grids
+    long long threadBlocksNb = (this->voxelsNb + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    dim3 dimBlock(BLOCK_SIZE, 1, 1);
+    dim3 dimGrid(threadBlocksNb < MAX_GRID_SIZE ? threadBlocksNb : MAX_GRID_SIZE, 1, 1);
+
+    // run code into device
+    depthMapKernel<T, F, S><<<dimGrid, dimBlock, 0, this->stream>>>(this->params, function, this->storage,
+      this->d_depths, this->d_outScalar, this->d_outWeights, this->voxelsNb);
+    return checkCudaError(cudaGetLastError(), "Unable to launch the integration kernel") ? 1 : 0;
   }
+};
+
+//----------------------------------------------------------------------------
+// Dispatch the function of an integration into a grid stored as S, whose
+// weights if any follow the voxelsNb scalars of d_outScalar, padding
+// included
+template <typename T, typename S>
+static int launchStorageIntegration(const IntegrationParameters<T>& params, const S& storage, int function,
+    double truncation, const void* d_depths, const int* d_activeBlocks, int activeBlocksNb, int firstBlock,
+    void* d_outScalar, long long voxelsNb, cudaStream_t stream)
+{
+  typedef typename S::Scalar Scalar;
+  typedef typename S::Weight Weight;
+  Weight* d_outWeights = ReconstructionFunctionHasWeights(function) ?
+    (Weight*)((Scalar*)d_outScalar + voxelsNb) : 0;
+  IntegrationLauncher<T, S> launcher = {params, storage, (const T*)d_depths, d_activeBlocks, activeBlocksNb,
+                                        firstBlock, (Scalar*)d_outScalar, d_outWeights, voxelsNb, stream};
+  return DispatchReconstructionFunction<T>(function, truncation, launcher);
+}
+
+//----------------------------------------------------------------------------
+// Launch the integration kernel of a depth map into a device grid, in the
+// precision T. Only the active blocks are integrated, shifted by firstBlock,
+// or all the voxels when activeBlocksNb is negative. The depths are read
+// from depthsTexture instead of d_depths when it is not 0. The kernel is
+// specialised on the function, whose weights if any follow the voxelsNb
+// stored scalars of d_outScalar, and on the storage of the grid.
+template <typename T>
+static int launchIntegration(double h_gridMatrix[16], double h_gridOrig[3], int h_gridDims[3],
+    double h_gridSpacing[3], int h_depthMapDims[3], double h_depthMapMatrixK[9],
+    double h_depthMapMatrixTR[16], const void* d_depths, int interpolation,
+    cudaTextureObject_t depthsTexture, int function, double truncation, int storage, int layout,
+    const int* d_activeBlocks, int activeBlocksNb, int firstBlock, void* d_outScalar, long long voxelsNb,
+    cudaStream_t stream)
+{
+  if (activeBlocksNb == 0)
+    {
+    return 1;
+    }
+
+  IntegrationParameters<T> params;
+  setProjection(params, h_gridMatrix, h_gridOrig, h_gridSpacing, h_depthMapMatrixK, h_depthMapMatrixTR);
+  for (int i = 0; i < 3; i++)
+    {
+    params.gridDims[i] = h_gridDims[i];
+    params.depthMapDims[i] = h_depthMapDims[i];
+    }
+  params.layout = layout;
+  params.interpolation = interpolation;
+  params.depthsTexture = depthsTexture;
+
+  if (storage == CUDA_RECONSTRUCTION_STORAGE_HALF)
+    {
+    return launchStorageIntegration(params, HalfStorage<T>(), function, truncation, d_depths, d_activeBlocks,
+                                    activeBlocksNb, firstBlock, d_outScalar, voxelsNb, stream);
+    }
+  if (storage == CUDA_RECONSTRUCTION_STORAGE_UINT16)
+    {
+    double range[2];
+    ReconstructionFunctionRange(function, truncation, range);
+    UInt16Storage<T> quantisation;
+    quantisation.Offset = (T)range[0];
+    quantisation.Scale = (T)((range[1] - range[0]) / 65535);
+    return launchStorageIntegration(params, quantisation, function, truncation, d_depths, d_activeBlocks,
+                                    activeBlocksNb, firstBlock, d_outScalar, voxelsNb, stream);
+    }
+  return launchStorageIntegration(params, NativeStorage<T>(), function, truncation, d_depths, d_activeBlocks,
+                                  activeBlocksNb, firstBlock, d_outScalar, voxelsNb, stream);
+}
+
+//----------------------------------------------------------------------------
+int cuda_reconstruction_integrate(CudaReconstructionContext* context,
+    int h_depthMapDims[3], const void* h_depths, const float* h_confidences, double h_depthMapMatrixK[9],
+    double h_depthMapMatrixTR[16], const int* h_activeBlocks, int activeBlocksNb)
+{
+  long long depthsNb = (long long)h_depthMapDims[0] * h_depthMapDims[1];
+  if (context->voxelsNb <= 0 || depthsNb <= 0 || activeBlocksNb == 0)
+    {
+    return 1;
+    }
+
+  // tranfer the active blocks from host to device
+  startStage(context);
+  if (activeBlocksNb > 0 &&
+      (!reserveActiveBlocks(context, activeBlocksNb) ||
+       !checkCudaError(copyMemory(context, context->d_activeBlocks, h_activeBlocks, activeBlocksNb * sizeof(int),
+                                  cudaMemcpyHostToDevice),
+                       "Unable to copy the active blocks to the device")))
+    {
+    return 0;
+    }
+
+  // tranfer the depth map from host to device, into the texture when the
+  // hardware interpolates it, and preprocess it on the device otherwise
+  int dims[3] = {h_depthMapDims[0], h_depthMapDims[1], h_depthMapDims[2]};
+  double matrixK[9];
+  std::copy(h_depthMapMatrixK, h_depthMapMatrixK + 9, matrixK);
+  const void* d_depths = 0;
+  bool useTexture = context->singlePrecision &&
+    context->interpolation == CUDA_RECONSTRUCTION_INTERPOLATION_LINEAR &&
+    !getDepthMapLayout(context, dims, context->scalarSize, h_confidences, 0).preprocessed;
+  if (useTexture)
+    {
+    if (!uploadDepthsTexture(context, h_depthMapDims, h_depths))
+      {
+      return 0;
+      }
+    }
+  else if (!uploadDepthMap(context, h_depths, h_confidences, dims, matrixK, &d_depths))
+    {
+    return 0;
+    }
+  stopStage(context, CUDA_RECONSTRUCTION_STAGE_UPLOAD);
+
+  startStage(context);
+  int res;
+  if (context->singlePrecision)
+    {
+    res = launchIntegration<float>(context->gridMatrix, context->gridOrig, context->gridDims,
+      context->gridSpacing, dims, matrixK, h_depthMapMatrixTR,
+      d_depths, context->interpolation, useTexture ? context->depthsTexture : 0,
+      context->gridFunction, context->truncation, context->gridStorage, context->gridLayout,
+      (const int*)context->d_activeBlocks, activeBlocksNb, 0, context->d_outScalar, context->storedVoxelsNb, 0);
+    }
+  else
+    {
+    res = launchIntegration<double>(context->gridMatrix, context->gridOrig, context->gridDims,
+      context->gridSpacing, dims, matrixK, h_depthMapMatrixTR,
+      d_depths, context->interpolation, 0,
+      context->gridFunction, context->truncation, context->gridStorage, context->gridLayout,
+      (const int*)context->d_activeBlocks, activeBlocksNb, 0, context->d_outScalar, context->storedVoxelsNb, 0);
+    }
+  stopStage(context, CUDA_RECONSTRUCTION_STAGE_KERNEL);
+  return res;
+}
+
+//----------------------------------------------------------------------------
+int cuda_reconstruction_integrate_async(CudaReconstructionContext* context,
+    int h_depthMapDims[3], const void* h_depths, const float* h_confidences, double h_depthMapMatrixK[9],
+    double h_depthMapMatrixTR[16], const int* h_activeBlocks, int activeBlocksNb)
+{
+  long long depthsNb = (long long)h_depthMapDims[0] * h_depthMapDims[1];
+  if (context->voxelsNb <= 0 || depthsNb <= 0 || activeBlocksNb == 0)
+    {
+    return 1;
+    }
+  if (!createStreams(context))
+    {
+    return 0;
+    }
+  if (!context->hasAsyncEvents)
+    {
+    for (int i = 0; i < ASYNC_SLOTS_NB; i++)
+      {
+      if (!checkCudaError(cudaEventCreateWithFlags(&context->uploadedEvents[i], cudaEventDisableTiming),
+                          "Unable to create an event") ||
+          !checkCudaError(cudaEventCreateWithFlags(&context->integratedEvents[i], cudaEventDisableTiming),
+                          "Unable to create an event"))
+        {
+        return 0;
+        }
+      }
+    context->hasAsyncEvents = true;
+    }
+
+  // wait for the integration that last used the slot, its buffers are reused
+  int slot = context->asyncSlot;
+  if (context->asyncPending &&
+      !checkCudaError(cudaEventSynchronize(context->integratedEvents[slot]), "Unable to integrate a depth map"))
+    {
+    return 0;
+    }
+
+  // the depths followed by the confidences of the preprocessing, the active
+  // blocks and the levels of the pyramid
+  size_t blocksBytes = activeBlocksNb > 0 ? activeBlocksNb * sizeof(int) : 0;
+  DepthMapLayout layout = getDepthMapLayout(context, h_depthMapDims, context->scalarSize, h_confidences,
+                                            blocksBytes);
+  size_t blocksOffset = layout.depthsBytes + layout.confidencesBytes;
+  size_t bytes = layout.bytes;
+  if (bytes > context->asyncBytes[slot])
+    {
+    poolFree(context->h_asyncStagings[slot]);
+    poolFree(context->d_asyncBuffers[slot]);
+    context->h_asyncStagings[slot] = 0;
+    context->d_asyncBuffers[slot] = 0;
+    context->asyncBytes[slot] = 0;
+    if (!checkCudaError(poolMalloc(&context->h_asyncStagings[slot], bytes, true),
+                        "Unable to allocate a staging buffer") ||
+        !checkCudaError(poolMalloc(&context->d_asyncBuffers[slot], bytes, false),
+                        "Unable to allocate a depth map buffer"))
+      {
+      poolFree(context->h_asyncStagings[slot]);
+      context->h_asyncStagings[slot] = 0;
+      context->d_asyncBuffers[slot] = 0;
+      return 0;
+      }
+    context->asyncBytes[slot] = bytes;
+    }
+
+  // the caller keeps its buffers, so the data is staged before the transfer
+  char* h_staging = (char*)context->h_asyncStagings[slot];
+  char* d_buffer = (char*)context->d_asyncBuffers[slot];
+  memcpy(h_staging, h_depths, layout.depthsBytes);
+  if (layout.confidencesBytes > 0)
+    {
+    memcpy(h_staging + layout.depthsBytes, h_confidences, layout.confidencesBytes);
+    }
+  if (blocksBytes > 0)
+    {
+    memcpy(h_staging + blocksOffset, h_activeBlocks, blocksBytes);
+    }
+
+  // upload and preprocess on the first stream, integrate on the second one
+  // once uploaded, so that the upload of the next depth map overlaps this
+  // integration
+  int dims[3] = {h_depthMapDims[0], h_depthMapDims[1], h_depthMapDims[2]};
+  double matrixK[9];
+  std::copy(h_depthMapMatrixK, h_depthMapMatrixK + 9, matrixK);
+  const void* d_depths;
+  if (!checkCudaError(copyMemoryAsync(context, d_buffer, h_staging, layout.uploadBytes, cudaMemcpyHostToDevice,
+                                      context->streams[0]),
+                      "Unable to copy the depth map to the device") ||
+      !preprocessDepthMap(context, context->singlePrecision, d_buffer, layout, dims, matrixK, &d_depths,
+                          context->streams[0]) ||
+      !checkCudaError(cudaEventRecord(context->uploadedEvents[slot], context->streams[0]),
+                      "Unable to record an event") ||
+      !checkCudaError(cudaStreamWaitEvent(context->streams[1], context->uploadedEvents[slot], 0),
+                      "Unable to wait for an event"))
+    {
+    return 0;
+    }
+  context->asyncPending = true;
+
+  const int* d_activeBlocks = blocksBytes > 0 ? (const int*)(d_buffer + blocksOffset) : 0;
+  int res;
+  if (context->singlePrecision)
+    {
+    res = launchIntegration<float>(context->gridMatrix, context->gridOrig, context->gridDims,
+      context->gridSpacing, dims, matrixK, h_depthMapMatrixTR,
+      d_depths, context->interpolation, 0, context->gridFunction, context->truncation, context->gridStorage,
+      context->gridLayout, d_activeBlocks, activeBlocksNb, 0,
+      context->d_outScalar, context->storedVoxelsNb, context->streams[1]);
+    }
+  else
+    {
+    res = launchIntegration<double>(context->gridMatrix, context->gridOrig, context->gridDims,
+      context->gridSpacing, dims, matrixK, h_depthMapMatrixTR,
+      d_depths, context->interpolation, 0, context->gridFunction, context->truncation, context->gridStorage,
+      context->gridLayout, d_activeBlocks, activeBlocksNb, 0,
+      context->d_outScalar, context->storedVoxelsNb, context->streams[1]);
+    }
+  if (!res ||
+      !checkCudaError(cudaEventRecord(context->integratedEvents[slot], context->streams[1]),
+                      "Unable to record an event"))
+    {
+    return 0;
+    }
+  context->asyncTickets[slot] = ++context->asyncSubmittedNb;
+  context->asyncSlot = (slot + 1) % context->asyncSlotsNb;
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+int cuda_reconstruction_synchronize(CudaReconstructionContext* context)
+{
+  return waitAsync(context) ? 1 : 0;
+}
+
+//----------------------------------------------------------------------------
+int cuda_reconstruction_set_async_depth(CudaReconstructionContext* context, int depthMapsNb)
+{
+  depthMapsNb = depthMapsNb < 1 ? 1 : (depthMapsNb > ASYNC_SLOTS_NB ? ASYNC_SLOTS_NB : depthMapsNb);
+  if (depthMapsNb == context->asyncSlotsNb)
+    {
+    return 1;
+    }
+
+  // the slots are numbered again from the first one
+  if (!waitAsync(context))
+    {
+    return 0;
+    }
+  context->asyncSlotsNb = depthMapsNb;
+  context->asyncSlot = 0;
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+long long cuda_reconstruction_get_async_submitted(CudaReconstructionContext* context)
+{
+  return context->asyncSubmittedNb;
+}
+
+//----------------------------------------------------------------------------
+int cuda_reconstruction_get_async_completed(CudaReconstructionContext* context, long long* completedNb)
+{
+  // the integrations end in order on the second stream, a slot being
+  // reused only once its last integration ended
+  while (context->asyncPending && context->asyncCompletedNb < context->asyncSubmittedNb)
+    {
+    long long ticket = context->asyncCompletedNb + 1;
+    int slot = -1;
+    for (int i = 0; i < context->asyncSlotsNb; i++)
+      {
+      if (context->asyncTickets[i] == ticket)
+        {
+        slot = i;
+        }
+      }
+    if (slot >= 0)
+      {
+      cudaError_t status = cudaEventQuery(context->integratedEvents[slot]);
+      if (status == cudaErrorNotReady)
+        {
+        break;
+        }
+      if (!checkCudaError(status, "Unable to integrate a depth map"))
+        {
+        *completedNb = context->asyncCompletedNb;
+        return 0;
+        }
+      }
+    context->asyncCompletedNb = ticket;
+    }
+  *completedNb = context->asyncCompletedNb;
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+int cuda_reconstruction_wait_async(CudaReconstructionContext* context, long long ticket)
+{
+  if (ticket <= context->asyncCompletedNb)
+    {
+    return 1;
+    }
+  for (int i = 0; i < context->asyncSlotsNb; i++)
+    {
+    if (context->asyncTickets[i] == ticket)
+      {
+      if (!checkCudaError(cudaEventSynchronize(context->integratedEvents[i]), "Unable to integrate a depth map"))
+        {
+        return 0;
+        }
+      long long completedNb;
+      return cuda_reconstruction_get_async_completed(context, &completedNb);
+      }
+    }
+  return waitAsync(context) ? 1 : 0;
+}
+
+//----------------------------------------------------------------------------
+int cuda_reconstruction_get_grid(CudaReconstructionContext* context, void* h_outScalar, void* h_outWeights)
+{
+  if (context->voxelsNb <= 0)
+    {
+    return 1;
+    }
+
+  // transfer data from device to host, once the queued depth maps are
+  // integrated
+  if (!waitAsync(context))
+    {
+    return 0;
+    }
+  startStage(context);
+  int res = copyGrid(context, h_outScalar, context->d_outScalar, context->voxelSize, false) ? 1 : 0;
+  if (res && context->gridWeights && h_outWeights)
+    {
+    char* d_weights = (char*)context->d_outScalar + context->storedVoxelsNb * context->voxelSize;
+    res = copyGrid(context, h_outWeights, d_weights, context->weightSize, false) ? 1 : 0;
+    }
+  stopStage(context, CUDA_RECONSTRUCTION_STAGE_DOWNLOAD);
+  return res;
+}
+
+//----------------------------------------------------------------------------
+int cuda_reconstruction_get_grid_extent(CudaReconstructionContext* context, const int cellExtent[6],
+    void* h_outScalar, void* h_outWeights)
+{
+  for (int i = 0; i < 3; i++)
+    {
+    if (cellExtent[2 * i] < 0 || cellExtent[2 * i + 1] >= context->gridDims[i] - 1)
+      {
+      std::cerr << "The extent is out of the device grid." << std::endl;
+      return 0;
+      }
+    if (cellExtent[2 * i] > cellExtent[2 * i + 1])
+      {
+      return 1;
+      }
+    }
+  if (context->voxelsNb <= 0)
+    {
+    return 1;
+    }
+
+  if (!waitAsync(context))
+    {
+    return 0;
+    }
+  startStage(context);
+  int res = copyGridExtent(context, h_outScalar, context->d_outScalar, context->voxelSize, cellExtent, false) ? 1 : 0;
+  if (res && context->gridWeights && h_outWeights)
+    {
+    char* d_weights = (char*)context->d_outScalar + context->storedVoxelsNb * context->voxelSize;
+    res = copyGridExtent(context, h_outWeights, d_weights, context->weightSize, cellExtent, false) ? 1 : 0;
+    }
+  stopStage(context, CUDA_RECONSTRUCTION_STAGE_DOWNLOAD);
+  return res;
+}
+
+//----------------------------------------------------------------------------
+// Triangle cases of the marching cubes, as in vtkMarchingCubesTriangleCases
+__constant__ signed char c_triangleCases[256 * RECONSTRUCTION_SURFACE_CASE_SIZE];
+
+// Surface extraction parameters, the cubes join the centers of the voxels
+struct SurfaceParameters
+{
+  int cellDims[3];
+  int layout;
+  // center of the first voxel
+  float origin[3];
+  float spacing[3];
+  float isoValue;
+};
+
+//----------------------------------------------------------------------------
+// Read the values at the corners of a cube, false when a corner was never
+// integrated into, its weight being zero
+template <typename S>
+__device__ bool loadCube(const SurfaceParameters& params, const S& storage, const typename S::Scalar* scalars,
+                         const typename S::Weight* weights, long long cube, int ijk[3], float values[8])
+{
+  long long cubesX = params.cellDims[0] - 1;
+  long long cubesY = params.cellDims[1] - 1;
+  ijk[0] = cube % cubesX;
+  ijk[1] = (cube / cubesX) % cubesY;
+  ijk[2] = cube / (cubesX * cubesY);
+  for (int c = 0; c < 8; c++)
+    {
+    int offset[3];
+    ReconstructionCubeCorner(c, offset);
+    long long i_vox = gridVoxelIndex(params.cellDims, params.layout,
+                                     ijk[0] + offset[0], ijk[1] + offset[1], ijk[2] + offset[2]);
+    if (weights && storage.LoadWeight(weights[i_vox]) == 0)
+      {
+      return false;
+      }
+    values[c] = (float)storage.Load(scalars[i_vox]);
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// One thread per cube: count the cubes crossed by the surface and their
+// triangles, and compact the indices of these cubes while they fit in
+// activeCubes
+template <typename S>
+__global__ void classifyCubesKernel(SurfaceParameters params, S storage, const typename S::Scalar* scalars,
+                                    const typename S::Weight* weights, long long cubesNb,
+                                    unsigned long long* counters, long long* activeCubes,
+                                    long long activeCubesCapacity)
+{
+  for (long long cube = blockIdx.x * (long long)blockDim.x + threadIdx.x, stride = blockDim.x * gridDim.x;
+       cube < cubesNb; cube += stride)
+    {
+    int ijk[3];
+    float values[8];
+    if (!loadCube(params, storage, scalars, weights, cube, ijk, values))
+      {
+      continue;
+      }
+    int trianglesNb = ReconstructionCaseTrianglesNb(
+      c_triangleCases + RECONSTRUCTION_SURFACE_CASE_SIZE * ReconstructionCubeCase(values, params.isoValue));
+    if (trianglesNb == 0)
+      {
+      continue;
+      }
+    unsigned long long slot = atomicAdd(&counters[0], 1ULL);
+    if (slot < (unsigned long long)activeCubesCapacity)
+      {
+      activeCubes[slot] = cube;
+      }
+    atomicAdd(&counters[1], (unsigned long long)trianglesNb);
+    }
+}
+
+//----------------------------------------------------------------------------
+// One thread per active cube: write its triangles, 9 coordinates each, at
+// the end of the triangles counted so far
+template <typename S>
+__global__ void cubeTrianglesKernel(SurfaceParameters params, S storage, const typename S::Scalar* scalars,
+                                    const typename S::Weight* weights, const long long* activeCubes,
+                                    long long activeCubesNb, unsigned long long* trianglesCounter,
+                                    float* triangles)
+{
+  for (long long i = blockIdx.x * (long long)blockDim.x + threadIdx.x, stride = blockDim.x * gridDim.x;
+       i < activeCubesNb; i += stride)
+    {
+    int ijk[3];
+    float values[8];
+    loadCube(params, storage, scalars, weights, activeCubes[i], ijk, values);
+    const signed char* caseEdges =
+      c_triangleCases + RECONSTRUCTION_SURFACE_CASE_SIZE * ReconstructionCubeCase(values, params.isoValue);
+    int trianglesNb = ReconstructionCaseTrianglesNb(caseEdges);
+    unsigned long long first = atomicAdd(trianglesCounter, (unsigned long long)trianglesNb);
+    float origin[3];
+    for (int n = 0; n < 3; n++)
+      {
+      origin[n] = params.origin[n] + ijk[n] * params.spacing[n];
+      }
+    float* out = triangles + 9 * first;
+    for (int e = 0; e < 3 * trianglesNb; e++)
+      {
+      ReconstructionEdgePoint(values, params.isoValue, (int)caseEdges[e], origin, params.spacing, out + 3 * e);
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+// Extract the surface of the device grid stored as S: the cubes crossed by
+// the surface are compacted, growing their buffer and classifying again
+// when they do not fit, then only them generate triangles
+template <typename S>
+static int extractStorageSurface(CudaReconstructionContext* context, const SurfaceParameters& params,
+                                 const S& storage)
+{
+  typedef typename S::Scalar Scalar;
+  typedef typename S::Weight Weight;
+  const Scalar* d_scalars = (const Scalar*)context->d_outScalar;
+  const Weight* d_weights = context->gridWeights ? (const Weight*)(d_scalars + context->storedVoxelsNb) : 0;
+  long long cubesNb = (long long)(params.cellDims[0] - 1) * (params.cellDims[1] - 1) * (params.cellDims[2] - 1);
+  unsigned long long* d_counters = (unsigned long long*)context->d_surfaceCounters;
+
+  unsigned long long counters[2] = {0, 0};
+  for (int pass = 0; pass < 2; pass++)
+    {
+    long long capacity = (long long)(context->activeCubesBytes / sizeof(long long));
+    if (!checkCudaError(cudaMemset(d_counters, 0, 2 * sizeof(unsigned long long)),
+                        "Unable to initialize the surface counters"))
+      {
+      return 0;
+      }
+    long long blocksNb = (cubesNb + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    classifyCubesKernel<S><<<blocksNb < MAX_GRID_SIZE ? blocksNb : MAX_GRID_SIZE, BLOCK_SIZE>>>(
+      params, storage, d_scalars, d_weights, cubesNb, d_counters, (long long*)context->d_activeCubes, capacity);
+    if (!checkCudaError(cudaGetLastError(), "Unable to launch the cubes classification kernel") ||
+        !checkCudaError(copyMemory(context, counters, d_counters, 2 * sizeof(unsigned long long),
+                                   cudaMemcpyDeviceToHost),
+                        "Unable to get the number of active cubes"))
+      {
+      return 0;
+      }
+    if ((long long)counters[0] <= capacity)
+      {
+      break;
+      }
+    if (pass == 1 ||
+        !reserveBuffer(&context->d_activeCubes, &context->activeCubesBytes, counters[0] * sizeof(long long),
+                       "Unable to allocate the active cubes"))
+      {
+      return 0;
+      }
+    }
+
+  long long activeCubesNb = (long long)counters[0];
+  context->trianglesNb = (long long)counters[1];
+  if (context->trianglesNb == 0)
+    {
+    return 1;
+    }
+  if (!reserveBuffer(&context->d_triangles, &context->trianglesBytes, context->trianglesNb * 9 * sizeof(float),
+                     "Unable to allocate the triangles") ||
+      !checkCudaError(cudaMemset(d_counters, 0, sizeof(unsigned long long)),
+                      "Unable to initialize the surface counters"))
+    {
+    context->trianglesNb = 0;
+    return 0;
+    }
+  long long blocksNb = (activeCubesNb + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  cubeTrianglesKernel<S><<<blocksNb < MAX_GRID_SIZE ? blocksNb : MAX_GRID_SIZE, BLOCK_SIZE>>>(
+    params, storage, d_scalars, d_weights, (const long long*)context->d_activeCubes, activeCubesNb, d_counters,
+    (float*)context->d_triangles);
+  if (!checkCudaError(cudaGetLastError(), "Unable to launch the triangles kernel"))
+    {
+    context->trianglesNb = 0;
+    return 0;
+    }
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+int cuda_reconstruction_extract_surface(CudaReconstructionContext* context, double isoValue,
+    const int h_triangleCases[256 * 16], long long* trianglesNb)
+{
+  *trianglesNb = 0;
+  context->trianglesNb = 0;
+  if (context->voxelsNb <= 0 || context->gridDims[0] < 3 || context->gridDims[1] < 3 || context->gridDims[2] < 3)
+    {
+    return 1;
+    }
+  if (!waitAsync(context))
+    {
+    return 0;
+    }
+
+  // the triangle cases go to the constant memory of the device of the context
+  signed char triangleCases[256 * RECONSTRUCTION_SURFACE_CASE_SIZE];
+  for (int i = 0; i < 256 * RECONSTRUCTION_SURFACE_CASE_SIZE; i++)
+    {
+    triangleCases[i] = (signed char)h_triangleCases[i];
+    }
+  context->transferredBytes[0] += (long long)sizeof(triangleCases);
+  if (!checkCudaError(cudaMemcpyToSymbol(c_triangleCases, triangleCases, sizeof(triangleCases)),
+                      "Unable to copy the triangle cases to the device") ||
+      !reserveBuffer(&context->d_surfaceCounters, &context->surfaceCountersBytes, 2 * sizeof(unsigned long long),
+                     "Unable to allocate the surface counters"))
+    {
+    return 0;
+    }
+
+  SurfaceParameters params;
+  for (int i = 0; i < 3; i++)
+    {
+    params.cellDims[i] = context->gridDims[i] - 1;
+    params.spacing[i] = (float)context->gridSpacing[i];
+    params.origin[i] = (float)(context->gridOrig[i] + 0.5 * context->gridSpacing[i]);
+    }
+  params.layout = context->gridLayout;
+  params.isoValue = (float)isoValue;
+
+  startStage(context);
+  int res;
+  if (context->gridStorage == CUDA_RECONSTRUCTION_STORAGE_HALF)
+    {
+    res = extractStorageSurface(context, params, HalfStorage<float>());
+    }
+  else if (context->gridStorage == CUDA_RECONSTRUCTION_STORAGE_UINT16)
+    {
+    double range[2];
+    ReconstructionFunctionRange(context->gridFunction, context->truncation, range);
+    UInt16Storage<float> quantisation;
+    quantisation.Offset = (float)range[0];
+    quantisation.Scale = (float)((range[1] - range[0]) / 65535);
+    res = extractStorageSurface(context, params, quantisation);
+    }
+  else if (context->singlePrecision)
+    {
+    res = extractStorageSurface(context, params, NativeStorage<float>());
+    }
+  else
+    {
+    res = extractStorageSurface(context, params, NativeStorage<double>());
+    }
+  stopStage(context, CUDA_RECONSTRUCTION_STAGE_KERNEL);
+  *trianglesNb = context->trianglesNb;
+  return res;
+}
+
+//----------------------------------------------------------------------------
+int cuda_reconstruction_get_surface(CudaReconstructionContext* context, float* h_points)
+{
+  if (context->trianglesNb <= 0)
+    {
+    return 1;
+    }
+  startStage(context);
+  int res = checkCudaError(copyMemory(context, h_points, context->d_triangles,
+                                      context->trianglesNb * 9 * sizeof(float), cudaMemcpyDeviceToHost),
+                           "Unable to copy the surface to the host") ? 1 : 0;
+  stopStage(context, CUDA_RECONSTRUCTION_STAGE_DOWNLOAD);
+  return res;
+}
+
+//----------------------------------------------------------------------------
+// Integrate all the depth maps, whose depths are on the device with their
+// active blocks one after the other in the active blocks buffer, into a
+// brick of the grid starting at slice z. The active blocks are only used when the
+// brick starts on a block boundary. With the TSDF function the weights of the
+// brick follow its signed distances.
+template <typename T>
+static int integrateBrick(CudaReconstructionContext* context, double h_gridMatrix[16],
+    double h_brickOrig[3], int h_brickDims[3], double h_gridSpacing[3], long long z,
+    int depthMapsNb, const CudaReconstructionDepthMap* h_depthMaps, void* d_brick,
+    long long brickVoxelsNb, cudaStream_t stream)
+{
+  // blocks of the brick, as a range of the block indices of the grid
+  int planeBlocksNb = ((h_brickDims[0] - 2) / CUDA_RECONSTRUCTION_BLOCK_SIZE + 1)
+    * ((h_brickDims[1] - 2) / CUDA_RECONSTRUCTION_BLOCK_SIZE + 1);
+  int slabBlocksNb = (h_brickDims[2] - 2) / CUDA_RECONSTRUCTION_BLOCK_SIZE + 1;
+  int firstBlock = (int)(z / CUDA_RECONSTRUCTION_BLOCK_SIZE) * planeBlocksNb;
+  int lastBlock = firstBlock + slabBlocksNb * planeBlocksNb;
+  bool useBlocks = z % CUDA_RECONSTRUCTION_BLOCK_SIZE == 0;
+
+  const int* d_activeBlocks = (const int*)context->d_activeBlocks;
+  for (int i = 0; i < depthMapsNb; i++)
+    {
+    CudaReconstructionDepthMap depthMap = h_depthMaps[i];
+    const int* d_brickBlocks = 0;
+    int brickBlocksNb = -1;
+    if (depthMap.activeBlocksNb >= 0 && useBlocks)
+      {
+      const int* begin = std::lower_bound(depthMap.activeBlocks, depthMap.activeBlocks + depthMap.activeBlocksNb,
+                                          firstBlock);
+      const int* end = std::lower_bound(begin, depthMap.activeBlocks + depthMap.activeBlocksNb, lastBlock);
+      d_brickBlocks = d_activeBlocks + (begin - depthMap.activeBlocks);
+      brickBlocksNb = (int)(end - begin);
+      }
+    if (!launchIntegration<T>(h_gridMatrix, h_brickOrig, h_brickDims, h_gridSpacing, depthMap.dims,
+                              depthMap.matrixK, depthMap.matrixTR, depthMap.depths, context->interpolation, 0,
+                              context->function, context->truncation, CUDA_RECONSTRUCTION_STORAGE_NATIVE,
+                              CUDA_RECONSTRUCTION_LAYOUT_LINEAR, d_brickBlocks, brickBlocksNb, firstBlock, d_brick, brickVoxelsNb, stream))
+      {
+      return 0;
+      }
+    if (depthMap.activeBlocksNb > 0)
+      {
+      d_activeBlocks += depthMap.activeBlocksNb;
+      }
+    }
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+int cuda_reconstruction_integrate_bricked(CudaReconstructionContext* context, bool singlePrecision,
+    double h_gridMatrix[16], double h_gridOrig[3], int h_gridDims[3], double h_gridSpacing[3],
+    int depthMapsNb, const CudaReconstructionDepthMap* h_depthMaps, void* h_outScalar,
+    void* h_outWeights, long long maxBrickVoxels, int* bricksNb)
+{
+  if (bricksNb)
+    {
+    *bricksNb = 0;
+    }
+  size_t scalarSize = singlePrecision ? sizeof(float) : sizeof(double);
+  long long sliceVoxelsNb = (long long)(h_gridDims[0] - 1) * (h_gridDims[1] - 1);
+  long long slicesNb = h_gridDims[2] - 1;
+  if (sliceVoxelsNb <= 0 || slicesNb <= 0 || depthMapsNb <= 0)
+    {
+    return 1;
+    }
+  size_t sliceBytes = sliceVoxelsNb * scalarSize;
+
+  // the TSDF weights go through the bricks after the signed distances
+  int arraysNb = 1;
+  char* hostArrays[2] = {(char*)h_outScalar, (char*)h_outWeights};
+  if (ReconstructionFunctionHasWeights(context->function))
+    {
+    if (!h_outWeights)
+      {
+      std::cerr << "The TSDF integration needs the weights of the grid." << std::endl;
+      return 0;
+      }
+    arraysNb = 2;
+    }
+
+  // the bricks replace the device grid
+  if (!waitAsync(context))
+    {
+    return 0;
+    }
+  freeSparse(context);
+  poolFree(context->d_outScalar);
+  context->d_outScalar = 0;
+  context->outScalarBytes = 0;
+  context->voxelsNb = 0;
+
+  // all the depth maps stay on the device while the bricks go through it,
+  // each one preprocessed once, their copies pointing to their device depths
+  // at the level integrated
+  std::vector<DepthMapLayout> layouts(depthMapsNb);
+  size_t depthsBytes = 0;
+  for (int i = 0; i < depthMapsNb; i++)
+    {
+    layouts[i] = getDepthMapLayout(context, h_depthMaps[i].dims, scalarSize, h_depthMaps[i].confidences, 0);
+    depthsBytes += (layouts[i].bytes + 15) / 16 * 16;
+    }
+  if (!reserveDepths(context, depthsBytes))
+    {
+    return 0;
+    }
+  std::vector<CudaReconstructionDepthMap> depthMaps(h_depthMaps, h_depthMaps + depthMapsNb);
+  char* d_depths = (char*)context->d_depths;
+  for (int i = 0; i < depthMapsNb; i++)
+    {
+    const DepthMapLayout& layout = layouts[i];
+    if (!checkCudaError(copyMemory(context, d_depths, h_depthMaps[i].depths, layout.depthsBytes,
+                                   cudaMemcpyHostToDevice),
+                        "Unable to copy the depth map to the device") ||
+        (layout.confidencesBytes > 0 &&
+         !checkCudaError(copyMemory(context, d_depths + layout.depthsBytes, h_depthMaps[i].confidences,
+                                    layout.confidencesBytes, cudaMemcpyHostToDevice),
+                         "Unable to copy the confidences to the device")) ||
+        !preprocessDepthMap(context, singlePrecision, d_depths, layout, depthMaps[i].dims, depthMaps[i].matrixK,
+                            &depthMaps[i].depths, 0))
+      {
+      return 0;
+      }
+    d_depths += (layout.bytes + 15) / 16 * 16;
+    }
+
+  // and so do their active blocks
+  size_t activeBlocksNb = 0;
+  for (int i = 0; i < depthMapsNb; i++)
+    {
+    activeBlocksNb += std::max(h_depthMaps[i].activeBlocksNb, 0);
+    }
+  if (activeBlocksNb > 0 && !reserveActiveBlocks(context, activeBlocksNb))
+    {
+    return 0;
+    }
+  int* d_activeBlocks = (int*)context->d_activeBlocks;
+  for (int i = 0; i < depthMapsNb; i++)
+    {
+    if (h_depthMaps[i].activeBlocksNb <= 0)
+      {
+      continue;
+      }
+    if (!checkCudaError(copyMemory(context, d_activeBlocks, h_depthMaps[i].activeBlocks,
+                                   h_depthMaps[i].activeBlocksNb * sizeof(int), cudaMemcpyHostToDevice),
+                        "Unable to copy the active blocks to the device"))
+      {
+      return 0;
+      }
+    d_activeBlocks += h_depthMaps[i].activeBlocksNb;
+    }
+
+  // size the bricks to the free memory, the current bricks are reused, and
+  // keep a margin for the driver and the other allocations
+  size_t freeMemory, totalMemory;
+  if (!checkCudaError(cudaMemGetInfo(&freeMemory, &totalMemory), "Unable to get the device memory"))
+    {
+    return 0;
+    }
+  size_t availableMemory = freeMemory / 10 * 9 + BRICK_STREAMS_NB * context->brickBytes;
+  long long brickSlicesNb = availableMemory / (BRICK_STREAMS_NB * arraysNb * sliceBytes);
+  if (maxBrickVoxels > 0)
+    {
+    long long maxSlicesNb = maxBrickVoxels / sliceVoxelsNb;
+    brickSlicesNb = std::min(brickSlicesNb, std::max(maxSlicesNb, 1LL));
+    }
+  brickSlicesNb = std::min(brickSlicesNb, slicesNb);
+
+  // bricks aligned on the blocks can skip the culled blocks
+  if (brickSlicesNb < slicesNb && brickSlicesNb > CUDA_RECONSTRUCTION_BLOCK_SIZE)
+    {
+    brickSlicesNb -= brickSlicesNb % CUDA_RECONSTRUCTION_BLOCK_SIZE;
+    }
+  if (brickSlicesNb < 1)
+    {
+    std::cerr << "Not enough device memory for a slice of the grid." << std::endl;
+    return 0;
+    }
+
+  // allocate the bricks and the streams
+  size_t brickBytes = arraysNb * brickSlicesNb * sliceBytes;
+  if (brickBytes > context->brickBytes)
+    {
+    freeBricks(context);
+    for (int i = 0; i < BRICK_STREAMS_NB; i++)
+      {
+      if (!checkCudaError(poolMalloc(&context->d_bricks[i], brickBytes, false), "Unable to allocate a brick") ||
+          !checkCudaError(poolMalloc(&context->h_stagings[i], brickBytes, true),
+                          "Unable to allocate a staging buffer"))
+        {
+        freeBricks(context);
+        return 0;
+        }
+      }
+    context->brickBytes = brickBytes;
+    }
+  if (!createStreams(context))
+    {
+    return 0;
+    }
+
+  // the bricks alternate between the streams, the staging buffer of a stream
+  // is emptied once its previous brick is back on the host. A page-locked
+  // grid is transferred in place.
+  bool inPlace = true;
+  for (int a = 0; a < arraysNb; a++)
+    {
+    inPlace = inPlace && isHostMemoryRegistered(context, hostArrays[a], slicesNb * sliceBytes);
+    }
+  size_t pendingOffsets[BRICK_STREAMS_NB];
+  size_t pendingBytes[BRICK_STREAMS_NB];
+  for (int i = 0; i < BRICK_STREAMS_NB; i++)
+    {
+    pendingBytes[i] = 0;
+    }
+  int res = 1;
+  int brick = 0;
+  for (long long z = 0; res && z < slicesNb; z += brickSlicesNb, brick++)
+    {
+    int s = brick % BRICK_STREAMS_NB;
+    cudaStream_t stream = context->streams[s];
+    res = checkCudaError(cudaStreamSynchronize(stream), "Unable to integrate a brick");
+    if (!res)
+      {
+      break;
+      }
+    for (int a = 0; pendingBytes[s] > 0 && a < arraysNb; a++)
+      {
+      memcpy(hostArrays[a] + pendingOffsets[s], (char*)context->h_stagings[s] + a * pendingBytes[s],
+             pendingBytes[s]);
+      }
+    pendingBytes[s] = 0;
+
+    // brick of whole slices, its origin is shifted along z of the grid
+    long long nz = std::min(brickSlicesNb, slicesNb - z);
+    int brickDims[3] = {h_gridDims[0], h_gridDims[1], (int)nz + 1};
+    double brickOrig[3] = {h_gridOrig[0], h_gridOrig[1], h_gridOrig[2] + z * h_gridSpacing[2]};
+    long long brickVoxelsNb = nz * sliceVoxelsNb;
+    size_t offset = z * sliceBytes;
+    size_t bytes = nz * sliceBytes;
+
+    // the arrays of the brick are contiguous on the device and in the
+    // staging buffer
+    char* h_bricks[2];
+    char* d_brick = (char*)context->d_bricks[s];
+    for (int a = 0; res && a < arraysNb; a++)
+      {
+      h_bricks[a] = inPlace ? hostArrays[a] + offset : (char*)context->h_stagings[s] + a * bytes;
+      if (!inPlace)
+        {
+        memcpy(h_bricks[a], hostArrays[a] + offset, bytes);
+        }
+      res = checkCudaError(copyMemoryAsync(context, d_brick + a * bytes, h_bricks[a], bytes, cudaMemcpyHostToDevice,
+                                           stream),
+                           "Unable to copy a brick to the device");
+      }
+    if (res && singlePrecision)
+      {
+      res = integrateBrick<float>(context, h_gridMatrix, brickOrig, brickDims, h_gridSpacing, z,
+                                  depthMapsNb, &depthMaps[0], context->d_bricks[s], brickVoxelsNb, stream);
+      }
+    else if (res)
+      {
+      res = integrateBrick<double>(context, h_gridMatrix, brickOrig, brickDims, h_gridSpacing, z,
+                                   depthMapsNb, &depthMaps[0], context->d_bricks[s], brickVoxelsNb, stream);
+      }
+    for (int a = 0; res && a < arraysNb; a++)
+      {
+      res = checkCudaError(copyMemoryAsync(context, h_bricks[a], d_brick + a * bytes, bytes, cudaMemcpyDeviceToHost,
+                                           stream),
+                           "Unable to copy a brick to the host");
+      }
+    pendingOffsets[s] = offset;
+    pendingBytes[s] = (res && !inPlace) ? bytes : 0;
+    }
+
+  // get the last bricks back
+  for (int s = 0; s < BRICK_STREAMS_NB; s++)
+    {
+    if (!checkCudaError(cudaStreamSynchronize(context->streams[s]), "Unable to integrate a brick"))
+      {
+      res = 0;
+      }
+    else
+      {
+      for (int a = 0; res && pendingBytes[s] > 0 && a < arraysNb; a++)
+        {
+        memcpy(hostArrays[a] + pendingOffsets[s], (char*)context->h_stagings[s] + a * pendingBytes[s],
+               pendingBytes[s]);
+        }
+      }
+    }
+
+  if (bricksNb)
+    {
+    *bricksNb = brick;
+    }
+  return res;
+}
+
+//----------------------------------------------------------------------------
+// Parameters of the allocation of the sparse blocks around the depths
+template <typename T>
+struct AllocationParameters
+{
+  T depthMapMatrixKInv[9];
+  T cameraToVoxel[16];
+  int cellDims[3];
+  int depthMapDims[3];
+  T bandWidth;
+  T stepLength;
+};
+
+//----------------------------------------------------------------------------
+// Pack the indices of a block into a key, 21 bits per axis
+__device__ unsigned long long blockKey(int bx, int by, int bz)
+{
+  return ((unsigned long long)bz << 42) | ((unsigned long long)by << 21) | (unsigned long long)bx;
+}
+
+//----------------------------------------------------------------------------
+// Insert a block into the hash table, the first thread inserting it takes
+// the next free block of the sparse volume
+__device__ void allocateBlock(unsigned long long key, unsigned long long* hashKeys,
+                              unsigned long long hashCapacity, unsigned long long* blockKeys,
+                              long long maxBlocksNb, unsigned long long* blocksCounter)
+{
+  unsigned long long slot = ((key * 0x9e3779b97f4a7c15ULL) >> 20) & (hashCapacity - 1);
+  for (unsigned long long probe = 0; probe < hashCapacity; probe++)
+    {
+    unsigned long long previousKey = atomicCAS(&hashKeys[slot], EMPTY_BLOCK_KEY, key);
+    if (previousKey == key)
+      {
+      return;
+      }
+    if (previousKey == EMPTY_BLOCK_KEY)
+      {
+      // the counter keeps counting the blocks which do not fit any more
+      unsigned long long block = atomicAdd(blocksCounter, 1ULL);
+      if (block < (unsigned long long)maxBlocksNb)
+        {
+        blockKeys[block] = key;
+        }
+      return;
+      }
+    slot = (slot + 1) & (hashCapacity - 1);
+    }
+}
+
+//----------------------------------------------------------------------------
+// One thread per pixel: allocate the blocks crossed by the ray of the pixel
+// in a band around its depth
+template <typename T>
+__global__ void sparseAllocationKernel(AllocationParameters<T> params, const T* depths,
+    unsigned long long* hashKeys, unsigned long long hashCapacity, unsigned long long* blockKeys,
+    long long maxBlocksNb, unsigned long long* blocksCounter)
+{
+  int pixelsNb = params.depthMapDims[0] * params.depthMapDims[1];
+  for (int pixel = blockIdx.x * blockDim.x + threadIdx.x; pixel < pixelsNb; pixel += blockDim.x * gridDim.x)
+    {
+    T depth = depths[pixel];
+    if (!(depth > 0))
+      {
+      continue;
+      }
+
+    // direction of the ray of the pixel center in camera coords, the depths
+    // are distances to the camera
+    T uv[3] = {(T)(pixel % params.depthMapDims[0]), (T)(pixel / params.depthMapDims[0]), 1};
+    T dir[3];
+    for (int i = 0; i < 3; i++)
+      {
+      dir[i] = params.depthMapMatrixKInv[3 * i] * uv[0] + params.depthMapMatrixKInv[3 * i + 1] * uv[1]
+             + params.depthMapMatrixKInv[3 * i + 2] * uv[2];
+      }
+    T norm = sqrt(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+
+    int stepsNb = (int)(2 * params.bandWidth / params.stepLength);
+    for (int step = 0; step <= stepsNb; step++)
+      {
+      T t = depth - params.bandWidth + step * params.stepLength;
+      if (t <= 0)
+        {
+        continue;
+        }
+      T cameraCoords[3];
+      for (int i = 0; i < 3; i++)
+        {
+        cameraCoords[i] = dir[i] * t / norm;
+        }
+      T voxel[3];
+      transformPoint(params.cameraToVoxel, cameraCoords, voxel);
+      int ijk[3];
+      bool inside = true;
+      for (int i = 0; i < 3; i++)
+        {
+        ijk[i] = round(voxel[i]);
+        inside = inside && ijk[i] >= 0 && ijk[i] < params.cellDims[i];
+        }
+      if (inside)
+        {
+        allocateBlock(blockKey(ijk[0] / CUDA_RECONSTRUCTION_BLOCK_SIZE, ijk[1] / CUDA_RECONSTRUCTION_BLOCK_SIZE,
+                               ijk[2] / CUDA_RECONSTRUCTION_BLOCK_SIZE),
+                      hashKeys, hashCapacity, blockKeys, maxBlocksNb, blocksCounter);
+        }
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+// One thread block per allocated block, the thread indices give the voxel
+// in the block
+template <typename T>
+__global__ void sparseIntegrationKernel(IntegrationParameters<T> params, ReconstructionFunctionCumul<T> function,
+                                        const unsigned long long* blockKeys,
+                                        long long blocksNb, const T* depths, T* blockScalars)
+{
+  for (long long b = blockIdx.x; b < blocksNb; b += gridDim.x)
+    {
+    unsigned long long key = blockKeys[b];
+    int ijkVox[3];
+    ijkVox[0] = (int)(key & 0x1fffff) * CUDA_RECONSTRUCTION_BLOCK_SIZE + threadIdx.x;
+    ijkVox[1] = (int)((key >> 21) & 0x1fffff) * CUDA_RECONSTRUCTION_BLOCK_SIZE + threadIdx.y;
+    ijkVox[2] = (int)(key >> 42) * CUDA_RECONSTRUCTION_BLOCK_SIZE + threadIdx.z;
+    if (ijkVox[0] >= params.gridDims[0] - 1 || ijkVox[1] >= params.gridDims[1] - 1 ||
+        ijkVox[2] >= params.gridDims[2] - 1)
+      {
+      continue;
+      }
+    long long i_vox = threadIdx.x + CUDA_RECONSTRUCTION_BLOCK_SIZE * (threadIdx.y + CUDA_RECONSTRUCTION_BLOCK_SIZE * threadIdx.z);
+    integrateVoxel(params, function, NativeStorage<T>(), ijkVox, i_vox, depths, blockScalars + b * BLOCK_VOXELS_NB,
+                   (T*)0);
+    }
+}
+
+//----------------------------------------------------------------------------
+// Invert a 4x4 row-major matrix, returns false if it is singular
+static bool invertMatrix4x4(const double in[16], double out[16])
+{
+  double m[4][8];
+  for (int i = 0; i < 4; i++)
+    {
+    for (int j = 0; j < 4; j++)
+      {
+      m[i][j] = in[4 * i + j];
+      m[i][j + 4] = i == j ? 1 : 0;
+      }
+    }
+  for (int c = 0; c < 4; c++)
+    {
+    int pivot = c;
+    for (int r = c + 1; r < 4; r++)
+      {
+      if (fabs(m[r][c]) > fabs(m[pivot][c]))
+        {
+        pivot = r;
+        }
+      }
+    if (m[pivot][c] == 0)
+      {
+      return false;
+      }
+    for (int j = 0; j < 8; j++)
+      {
+      std::swap(m[c][j], m[pivot][j]);
+      }
+    double scale = 1 / m[c][c];
+    for (int j = 0; j < 8; j++)
+      {
+      m[c][j] *= scale;
+      }
+    for (int r = 0; r < 4; r++)
+      {
+      double factor = m[r][c];
+      if (r == c || factor == 0)
+        {
+        continue;
+        }
+      for (int j = 0; j < 8; j++)
+        {
+        m[r][j] -= factor * m[c][j];
+        }
+      }
+    }
+  for (int i = 0; i < 4; i++)
+    {
+    for (int j = 0; j < 4; j++)
+      {
+      out[4 * i + j] = m[i][j + 4];
+      }
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// Multiply two 4x4 row-major matrices
+static void multiplyMatrix4x4(const double a[16], const double b[16], double out[16])
+{
+  for (int i = 0; i < 4; i++)
+    {
+    for (int j = 0; j < 4; j++)
+      {
+      out[4 * i + j] = 0;
+      for (int k = 0; k < 4; k++)
+        {
+        out[4 * i + j] += a[4 * i + k] * b[4 * k + j];
+        }
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+int cuda_reconstruction_sparse_init(CudaReconstructionContext* context, bool singlePrecision,
+    double h_gridMatrix[16], double h_gridOrig[3], int h_gridDims[3], double h_gridSpacing[3],
+    long long maxBlocksNb, double bandWidth)
+{
+  // the sparse volume replaces the dense grid and the bricks
+  if (context->function != CUDA_RECONSTRUCTION_FUNCTION_CUMUL)
+    {
+    std::cerr << "The sparse volume only supports the cumulative function." << std::endl;
+    return 0;
+    }
+  if (!waitAsync(context))
+    {
+    return 0;
+    }
+  poolFree(context->d_outScalar);
+  context->d_outScalar = 0;
+  context->outScalarBytes = 0;
+  context->voxelsNb = 0;
+  freeBricks(context);
+  freeSparse(context);
+
+  // keep the grid parameters
+  context->singlePrecision = singlePrecision;
+  context->scalarSize = singlePrecision ? sizeof(float) : sizeof(double);
+  for (int i = 0; i < 16; i++)
+    {
+    context->gridMatrix[i] = h_gridMatrix[i];
+    }
+  for (int i = 0; i < 3; i++)
+    {
+    context->gridOrig[i] = h_gridOrig[i];
+    context->gridDims[i] = h_gridDims[i];
+    context->gridSpacing[i] = h_gridSpacing[i];
+    if ((h_gridDims[i] - 2) / CUDA_RECONSTRUCTION_BLOCK_SIZE >= (1 << 21))
+      {
+      std::cerr << "The grid is too large for the sparse volume." << std::endl;
+      return 0;
+      }
+    }
+  context->bandWidth = bandWidth;
+
+  // size the volume to half of the free memory by default, the hash table
+  // has at least twice as many slots as blocks
+  size_t blockBytes = BLOCK_VOXELS_NB * context->scalarSize + 3 * sizeof(unsigned long long);
+  if (maxBlocksNb <= 0)
+    {
+    size_t freeMemory, totalMemory;
+    if (!checkCudaError(cudaMemGetInfo(&freeMemory, &totalMemory), "Unable to get the device memory"))
+      {
+      return 0;
+      }
+    maxBlocksNb = freeMemory / 2 / blockBytes;
+    }
+  long long blocksNb = (long long)((h_gridDims[0] - 2) / CUDA_RECONSTRUCTION_BLOCK_SIZE + 1)
+    * ((h_gridDims[1] - 2) / CUDA_RECONSTRUCTION_BLOCK_SIZE + 1) * ((h_gridDims[2] - 2) / CUDA_RECONSTRUCTION_BLOCK_SIZE + 1);
+  maxBlocksNb = std::min(maxBlocksNb, blocksNb);
+  if (maxBlocksNb <= 0)
+    {
+    std::cerr << "Not enough device memory for the sparse volume." << std::endl;
+    return 0;
+    }
+  unsigned long long hashCapacity = 1;
+  while (hashCapacity < 2 * (unsigned long long)maxBlocksNb)
+    {
+    hashCapacity <<= 1;
+    }
+
+  size_t scalarsBytes = maxBlocksNb * BLOCK_VOXELS_NB * context->scalarSize;
+  if (!checkCudaError(poolMalloc((void**)&context->d_hashKeys, hashCapacity * sizeof(unsigned long long), false),
+                      "Unable to allocate the hash table") ||
+      !checkCudaError(poolMalloc((void**)&context->d_blockKeys, maxBlocksNb * sizeof(unsigned long long), false),
+                      "Unable to allocate the block keys") ||
+      !checkCudaError(poolMalloc(&context->d_blockScalars, scalarsBytes, false), "Unable to allocate the blocks") ||
+      !checkCudaError(poolMalloc((void**)&context->d_blocksCounter, sizeof(unsigned long long), false),
+                      "Unable to allocate the block counter"))
+    {
+    freeSparse(context);
+    return 0;
+    }
+  context->hashCapacity = hashCapacity;
+  context->maxBlocksNb = maxBlocksNb;
+  context->sparseBytes = hashCapacity * sizeof(unsigned long long)
+    + maxBlocksNb * sizeof(unsigned long long) + scalarsBytes + sizeof(unsigned long long);
+
+  // the blocks start from zero when they are allocated
+  if (!checkCudaError(cudaMemset(context->d_hashKeys, 0xff, hashCapacity * sizeof(unsigned long long)),
+                      "Unable to initialize the hash table") ||
+      !checkCudaError(cudaMemset(context->d_blockScalars, 0, scalarsBytes), "Unable to initialize the blocks") ||
+      !checkCudaError(cudaMemset(context->d_blocksCounter, 0, sizeof(unsigned long long)),
+                      "Unable to initialize the block counter"))
+    {
+    freeSparse(context);
+    return 0;
+    }
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+// Allocate the blocks seen by a depth map on the device and integrate it
+// into all the allocated blocks, in the precision T
+template <typename T>
+static int sparseIntegration(CudaReconstructionContext* context, int h_depthMapDims[3], const void* d_depths,
+    double h_depthMapMatrixK[9], double h_depthMapMatrixTR[16])
+{
+  // camera coords to voxel indices, the voxel centers are at the integer
+  // indices
+  double voxelToGrid[16] = {
+    context->gridSpacing[0], 0, 0, context->gridOrig[0] + 0.5 * context->gridSpacing[0],
+    0, context->gridSpacing[1], 0, context->gridOrig[1] + 0.5 * context->gridSpacing[1],
+    0, 0, context->gridSpacing[2], context->gridOrig[2] + 0.5 * context->gridSpacing[2],
+    0, 0, 0, 1 };
+  double voxelToScene[16];
+  multiplyMatrix4x4(context->gridMatrix, voxelToGrid, voxelToScene);
+  double voxelToCamera[16];
+  multiplyMatrix4x4(h_depthMapMatrixTR, voxelToScene, voxelToCamera);
+  double cameraToVoxel[16];
+  double matrixK[16] = {
+    h_depthMapMatrixK[0], h_depthMapMatrixK[1], h_depthMapMatrixK[2], 0,
+    h_depthMapMatrixK[3], h_depthMapMatrixK[4], h_depthMapMatrixK[5], 0,
+    h_depthMapMatrixK[6], h_depthMapMatrixK[7], h_depthMapMatrixK[8], 0,
+    0, 0, 0, 1 };
+  double matrixKInv[16];
+  if (!invertMatrix4x4(voxelToCamera, cameraToVoxel) || !invertMatrix4x4(matrixK, matrixKInv))
+    {
+    std::cerr << "Singular camera matrices, the depth map is skipped." << std::endl;
+    return 1;
+    }
+
+  AllocationParameters<T> allocationParams;
+  for (int i = 0; i < 16; i++)
+    {
+    allocationParams.cameraToVoxel[i] = (T)cameraToVoxel[i];
+    }
+  for (int i = 0; i < 3; i++)
+    {
+    for (int j = 0; j < 3; j++)
+      {
+      allocationParams.depthMapMatrixKInv[3 * i + j] = (T)matrixKInv[4 * i + j];
+      }
+    allocationParams.cellDims[i] = context->gridDims[i] - 1;
+    allocationParams.depthMapDims[i] = h_depthMapDims[i];
+    }
+
+  // the band defaults to the width of a block, the rays are sampled once per
+  // voxel
+  double minSpacing = std::min(fabs(context->gridSpacing[0]),
+                               std::min(fabs(context->gridSpacing[1]), fabs(context->gridSpacing[2])));
+  double maxSpacing = std::max(fabs(context->gridSpacing[0]),
+                               std::max(fabs(context->gridSpacing[1]), fabs(context->gridSpacing[2])));
+  double bandWidth = context->bandWidth > 0 ? context->bandWidth : CUDA_RECONSTRUCTION_BLOCK_SIZE * maxSpacing;
+  allocationParams.bandWidth = (T)bandWidth;
+  allocationParams.stepLength = (T)(minSpacing > 0 ? minSpacing : bandWidth);
+
+  int pixelsNb = h_depthMapDims[0] * h_depthMapDims[1];
+  int allocationBlocksNb = (pixelsNb + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  sparseAllocationKernel<T><<<std::min(allocationBlocksNb, MAX_GRID_SIZE), BLOCK_SIZE>>>(allocationParams,
+    (const T*)d_depths, context->d_hashKeys, context->hashCapacity, context->d_blockKeys,
+    context->maxBlocksNb, context->d_blocksCounter);
+  if (!checkCudaError(cudaGetLastError(), "Unable to launch the allocation kernel"))
+    {
+    return 0;
+    }
+
+  unsigned long long blocksCounter;
+  if (!checkCudaError(copyMemory(context, &blocksCounter, context->d_blocksCounter, sizeof(unsigned long long),
+                                 cudaMemcpyDeviceToHost),
+                      "Unable to get the number of blocks"))
+    {
+    return 0;
+    }
+  long long blocksNb = std::min((long long)blocksCounter, context->maxBlocksNb);
+  if (blocksNb <= 0)
+    {
+    return 1;
+    }
+
+  IntegrationParameters<T> params;
+  setProjection(params, context->gridMatrix, context->gridOrig, context->gridSpacing, h_depthMapMatrixK,
+                h_depthMapMatrixTR);
+  for (int i = 0; i < 3; i++)
+    {
+    params.gridDims[i] = context->gridDims[i];
+    params.depthMapDims[i] = h_depthMapDims[i];
+    }
+  params.interpolation = context->interpolation;
+  params.depthsTexture = 0;
+  ReconstructionFunctionCumul<T> function(0);
+  dim3 dimBlock(CUDA_RECONSTRUCTION_BLOCK_SIZE, CUDA_RECONSTRUCTION_BLOCK_SIZE, CUDA_RECONSTRUCTION_BLOCK_SIZE);
+  dim3 dimGrid(blocksNb < MAX_GRID_SIZE ? blocksNb : MAX_GRID_SIZE, 1, 1);
+  sparseIntegrationKernel<T><<<dimGrid, dimBlock>>>(params, function, context->d_blockKeys, blocksNb,
+                                                    (const T*)d_depths, (T*)context->d_blockScalars);
+  return checkCudaError(cudaGetLastError(), "Unable to launch the integration kernel") ? 1 : 0;
+}
+
+//----------------------------------------------------------------------------
+int cuda_reconstruction_sparse_integrate(CudaReconstructionContext* context,
+    int h_depthMapDims[3], const void* h_depths, const float* h_confidences, double h_depthMapMatrixK[9],
+    double h_depthMapMatrixTR[16])
+{
+  long long depthsNb = (long long)h_depthMapDims[0] * h_depthMapDims[1];
+  if (!context->d_hashKeys || depthsNb <= 0)
+    {
+    return 1;
+    }
+
+  // tranfer the depth map from host to device and preprocess it
+  startStage(context);
+  int dims[3] = {h_depthMapDims[0], h_depthMapDims[1], h_depthMapDims[2]};
+  double matrixK[9];
+  std::copy(h_depthMapMatrixK, h_depthMapMatrixK + 9, matrixK);
+  const void* d_depths;
+  if (!uploadDepthMap(context, h_depths, h_confidences, dims, matrixK, &d_depths))
+    {
+    return 0;
+    }
+  stopStage(context, CUDA_RECONSTRUCTION_STAGE_UPLOAD);
 
-  // free memory
-  cudaFree(d_a);
-  cudaFree(d_b);
+  startStage(context);
+  int res;
+  if (context->singlePrecision)
+    {
+    res = sparseIntegration<float>(context, dims, d_depths, matrixK, h_depthMapMatrixTR);
+    }
+  else
+    {
+    res = sparseIntegration<double>(context, dims, d_depths, matrixK, h_depthMapMatrixTR);
+    }
+  stopStage(context, CUDA_RECONSTRUCTION_STAGE_KERNEL);
+  return res;
+}
+
+//----------------------------------------------------------------------------
+int cuda_reconstruction_sparse_get_number_of_blocks(CudaReconstructionContext* context,
+    long long* blocksNb, long long* lostBlocksNb)
+{
+  *blocksNb = 0;
+  *lostBlocksNb = 0;
+  if (!context->d_blocksCounter)
+    {
+    return 1;
+    }
+  unsigned long long blocksCounter;
+  if (!checkCudaError(copyMemory(context, &blocksCounter, context->d_blocksCounter, sizeof(unsigned long long),
+                                 cudaMemcpyDeviceToHost),
+                      "Unable to get the number of blocks"))
+    {
+    return 0;
+    }
+  *blocksNb = std::min((long long)blocksCounter, context->maxBlocksNb);
+  *lostBlocksNb = (long long)blocksCounter - *blocksNb;
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+int cuda_reconstruction_sparse_get_blocks(CudaReconstructionContext* context, int* h_blockIndices,
+    void* h_blockScalars)
+{
+  long long blocksNb, lostBlocksNb;
+  if (!cuda_reconstruction_sparse_get_number_of_blocks(context, &blocksNb, &lostBlocksNb))
+    {
+    return 0;
+    }
+  if (blocksNb <= 0)
+    {
+    return 1;
+    }
 
+  std::vector<unsigned long long> blockKeys(blocksNb);
+  startStage(context);
+  if (!checkCudaError(copyMemory(context, &blockKeys[0], context->d_blockKeys, blocksNb * sizeof(unsigned long long),
+                                 cudaMemcpyDeviceToHost),
+                      "Unable to copy the block keys to the host") ||
+      !checkCudaError(copyMemory(context, h_blockScalars, context->d_blockScalars,
+                                 blocksNb * BLOCK_VOXELS_NB * context->scalarSize, cudaMemcpyDeviceToHost),
+                      "Unable to copy the blocks to the host"))
+    {
+    return 0;
+    }
+  stopStage(context, CUDA_RECONSTRUCTION_STAGE_DOWNLOAD);
+  for (long long b = 0; b < blocksNb; b++)
+    {
+    h_blockIndices[3 * b] = (int)(blockKeys[b] & 0x1fffff);
+    h_blockIndices[3 * b + 1] = (int)((blockKeys[b] >> 21) & 0x1fffff);
+    h_blockIndices[3 * b + 2] = (int)(blockKeys[b] >> 42);
+    }
   return 1;
 }
 
+//----------------------------------------------------------------------------
+int cuda_reconstruction(
+    double h_gridMatrix[16], double h_gridOrig[3], int h_gridDims[3], double h_gridSpacing[3],
+    int h_depthMapDims[3], double* h_depths, double h_depthMapMatrixK[9], double h_depthMapMatrixTR[16],
+    double* h_outScalar)
+{
+  CudaReconstructionContext* context = cuda_reconstruction_new();
+  int res = cuda_reconstruction_init_grid(context, false, h_gridMatrix, h_gridOrig, h_gridDims, h_gridSpacing,
+                                          h_outScalar, 0)
+    && cuda_reconstruction_integrate(context, h_depthMapDims, h_depths, 0, h_depthMapMatrixK,
+                                     h_depthMapMatrixTR, 0, -1)
+    && cuda_reconstruction_get_grid(context, h_outScalar, 0);
+  cuda_reconstruction_delete(context);
+  return res;
+}
+
 #endif
@@ -0,0 +1,290 @@
+// Host interface of the CUDA integration implemented in CudaReconstruction.cu.
+// Matrices are given as row-major arrays, grids hold one value per cell with
+// x varying fastest.
+
+#ifndef CudaReconstruction_h
+#define CudaReconstruction_h
+
+#include <cstddef>
+
+// Edge length, in voxels, of the blocks culled against the view frustum of
+// the depth maps. The blocks of a grid are numbered with x varying fastest.
+#define CUDA_RECONSTRUCTION_BLOCK_SIZE 8
+
+// Device buffers kept alive between successive integrations
+struct CudaReconstructionContext;
+
+// Get the number of cuda devices and the memory of the current one, returns
+// 0 when no device is usable
+int cuda_reconstruction_get_device_info(int* devicesNb, size_t* freeMemory, size_t* totalMemory);
+
+// The device buffers and the pinned host buffers of the contexts come from
+// a pool shared by the process: the buffers released by a context, when it
+// grows one or is deleted, are cached and reused by the next allocations of
+// all the contexts instead of going through cudaMalloc and cudaFree. The
+// cached device blocks count as free memory in
+// cuda_reconstruction_get_device_info. Set the bytes cached at most, 0 (the
+// default) for no limit, the blocks of a device being freed first when an
+// allocation on it fails, or free all the cached blocks, and get the bytes
+// cached and in use.
+void cuda_reconstruction_set_pool_limit(size_t bytes);
+void cuda_reconstruction_release_pool();
+void cuda_reconstruction_get_pool_info(size_t* cachedBytes, size_t* usedBytes);
+
+// Get the most bytes of device blocks of the pool in use at once since the
+// last reset, or reset it to the bytes in use. The buffer of the depths
+// texture is not allocated from the pool.
+size_t cuda_reconstruction_get_pool_device_peak();
+void cuda_reconstruction_reset_pool_device_peak();
+
+// Make a device current for the calling thread. A context allocates its
+// buffers on the device which is current when it is created, and must only
+// be used while this device is current.
+int cuda_reconstruction_set_device(int device);
+
+CudaReconstructionContext* cuda_reconstruction_new();
+void cuda_reconstruction_delete(CudaReconstructionContext* context);
+
+// Get the number of bytes allocated on the device by a context
+size_t cuda_reconstruction_get_allocated_memory(CudaReconstructionContext* context);
+
+// Page-lock a host buffer for the transfers of a context until it is
+// unregistered or the context is deleted. The transfers from and to it are
+// then done by DMA, and the bricked integration streams the grid without
+// going through staging buffers. Returns 0 if the buffer is already
+// registered or cannot be page-locked, its transfers then stay pageable.
+int cuda_reconstruction_register_host_memory(CudaReconstructionContext* context, void* h_buffer, size_t bytes);
+void cuda_reconstruction_unregister_host_memory(CudaReconstructionContext* context, void* h_buffer);
+
+// Sampling of the depth maps
+#define CUDA_RECONSTRUCTION_INTERPOLATION_NEAREST 0
+#define CUDA_RECONSTRUCTION_INTERPOLATION_LINEAR 1
+
+// Set the sampling of the depth maps by the next integrations of a context,
+// nearest by default. In linear mode the single precision grid integration
+// samples the depth maps through a texture with hardware filtering, the
+// other modes interpolate in the kernels. The borders are clamped, and the
+// interpolations with an invalid pixel are not integrated.
+void cuda_reconstruction_set_interpolation(CudaReconstructionContext* context, int interpolation);
+
+// Accumulation of the depth maps into the voxels
+#define CUDA_RECONSTRUCTION_FUNCTION_CUMUL 0
+#define CUDA_RECONSTRUCTION_FUNCTION_TSDF 1
+#define CUDA_RECONSTRUCTION_FUNCTION_LOG_ODDS 2
+#define CUDA_RECONSTRUCTION_FUNCTION_MAX_CONFIDENCE 3
+
+// Set the accumulation of the next grids of a context, the cumulative
+// inverse distance by default, see ReconstructionFunctions.h. The TSDF
+// function averages the signed distances from the voxels to the depths,
+// positive in front of them, with a weight per voxel stored after the signed
+// distances. The truncation bounds the band of the updated voxels. It
+// applies to the grids initialized and to the bricked integrations started
+// after the call. The sparse volume only supports the cumulative function.
+void cuda_reconstruction_set_function(CudaReconstructionContext* context, int function, double truncation);
+
+// Storage of the voxels of the device grid
+#define CUDA_RECONSTRUCTION_STORAGE_NATIVE 0
+#define CUDA_RECONSTRUCTION_STORAGE_HALF 1
+#define CUDA_RECONSTRUCTION_STORAGE_UINT16 2
+
+// Set the storage of the grids initialized after the call, native by
+// default: the precision of the grid. The half and uint16 formats keep 2
+// bytes per voxel on the device, widened to the precision of the grid in
+// the registers of the kernels only. A uint16 voxel q stands for
+// range[0] + q * (range[1] - range[0]) / 65535, range being given by
+// ReconstructionFunctionRange for the function and the truncation of the
+// grid, and the empty grid holds the quantised zero. The TSDF weights are
+// then unsigned short counts saturating at 65535. The host buffers of
+// init_grid and get_grid are in the storage format, the half voxels as
+// their bits. The bricked integration and the sparse volume stay native.
+void cuda_reconstruction_set_storage(CudaReconstructionContext* context, int storage);
+
+// Layout of the voxels of the device grid
+#define CUDA_RECONSTRUCTION_LAYOUT_LINEAR 0
+#define CUDA_RECONSTRUCTION_LAYOUT_BRICKS 1
+
+// Set the layout of the grids initialized after the call, bricks by
+// default. The linear layout keeps the voxels x fastest, a warp then covers
+// a thin row of voxels whose projections spread over the depth map for
+// oblique cameras. The bricks layout stores the voxels by blocks of
+// CUDA_RECONSTRUCTION_BLOCK_SIZE^3, numbered as the active blocks and x
+// fastest within a block, the grid being padded to whole blocks: a thread
+// block integrates a compact tile of voxels whose depths are close in the
+// depth map, and writes it contiguously. The host buffers of init_grid,
+// get_grid and get_grid_extent stay x fastest, the voxels are reordered on
+// the device through a staging buffer of bounded size. The bricked
+// integration and the sparse volume do not depend on the layout.
+void cuda_reconstruction_set_layout(CudaReconstructionContext* context, int layout);
+
+// Set the preprocessing of the depth maps integrated after the call, none by
+// default. Once uploaded, and on the stream of the upload, the depths out
+// of [minDepth, maxDepth] (maxDepth 0 does not bound them) or whose
+// confidence is below minConfidence are marked invalid, then the depth map
+// is halved level times, from 0 to RECONSTRUCTION_DEPTHS_MAX_LEVEL, see
+// ReconstructionDepths.h. The camera intrinsics are adjusted to the level,
+// the active blocks of the depth maps stay valid. The depths which are not
+// positive are never integrated, preprocessed or not. The preprocessed
+// depth maps are sampled without the texture.
+void cuda_reconstruction_set_depth_preprocessing(CudaReconstructionContext* context, double minDepth,
+    double maxDepth, double minConfidence, int level);
+
+// Stages of the integration timed by a context
+enum
+{
+  CUDA_RECONSTRUCTION_STAGE_UPLOAD = 0,
+  CUDA_RECONSTRUCTION_STAGE_KERNEL,
+  CUDA_RECONSTRUCTION_STAGE_DOWNLOAD,
+  CUDA_RECONSTRUCTION_STAGES_NB
+};
+
+// Turn on/off the timing of the stages of the grid and sparse integrations
+// of a context. A timed stage waits for the device to complete it, the
+// bricked integration is not timed.
+int cuda_reconstruction_set_timing(CudaReconstructionContext* context, bool timing);
+
+// Get the milliseconds spent in each stage since the timing was turned on or
+// since the last call, and restart from zero
+void cuda_reconstruction_get_timings(CudaReconstructionContext* context,
+    double timings[CUDA_RECONSTRUCTION_STAGES_NB]);
+
+// Get the bytes copied to and from the device by a context since its
+// creation or since the last call, and restart from zero. The transfers are
+// always counted, timed or not.
+void cuda_reconstruction_get_transfers(CudaReconstructionContext* context, long long* uploadedBytes,
+    long long* downloadedBytes);
+
+// Allocate the grid on the device and upload its initial cell values, the
+// grid starts from zero when h_outScalar is null. The grid, the depth maps
+// and the computation are in float or double depending on singlePrecision.
+// The device buffer is kept when its size does not change. With the TSDF
+// function h_outWeights holds the initial weights, zero when it is null.
+int cuda_reconstruction_init_grid(CudaReconstructionContext* context, bool singlePrecision,
+    double h_gridMatrix[16], double h_gridOrig[3], int h_gridDims[3], double h_gridSpacing[3],
+    void* h_outScalar, void* h_outWeights);
+
+// Integrate one depth map into the device grid, the depths are in the
+// precision of the grid. h_confidences, when not null, holds the confidence
+// of each depth for the preprocessing. Only the voxels of the sorted list of
+// active blocks are integrated, or all of them when activeBlocksNb is
+// negative.
+int cuda_reconstruction_integrate(CudaReconstructionContext* context,
+    int h_depthMapDims[3], const void* h_depths, const float* h_confidences, double h_depthMapMatrixK[9],
+    double h_depthMapMatrixTR[16], const int* h_activeBlocks, int activeBlocksNb);
+
+// Queue the integration of one depth map into the device grid, like
+// cuda_reconstruction_integrate, and return without waiting for it. The
+// depth map and its active blocks are copied, so the caller can reuse its
+// buffers right away, and its upload overlaps the integration of the
+// previous one. The number of depth maps in flight is bounded by
+// cuda_reconstruction_set_async_depth, a new one waits for the oldest one
+// beyond it. The depths are sampled without the texture.
+int cuda_reconstruction_integrate_async(CudaReconstructionContext* context,
+    int h_depthMapDims[3], const void* h_depths, const float* h_confidences, double h_depthMapMatrixK[9],
+    double h_depthMapMatrixTR[16], const int* h_activeBlocks, int activeBlocksNb);
+
+// Wait for the queued integrations, get_grid and init_grid wait for them too
+int cuda_reconstruction_synchronize(CudaReconstructionContext* context);
+
+// Maximum number of depth maps in flight in the asynchronous integration
+#define CUDA_RECONSTRUCTION_MAX_ASYNC_DEPTH_MAPS 8
+
+// Set the number of depth maps in flight, from 1 to
+// CUDA_RECONSTRUCTION_MAX_ASYNC_DEPTH_MAPS (2 by default), each one keeping
+// its pinned staging buffer and its device buffer. The queued
+// integrations are waited for when it changes.
+int cuda_reconstruction_set_async_depth(CudaReconstructionContext* context, int depthMapsNb);
+
+// The integrations queued by cuda_reconstruction_integrate_async are
+// numbered from 1. Get the number of the last one queued, and without
+// blocking the number of the ones ended.
+long long cuda_reconstruction_get_async_submitted(CudaReconstructionContext* context);
+int cuda_reconstruction_get_async_completed(CudaReconstructionContext* context, long long* completedNb);
+
+// Wait for the queued integration numbered ticket and the ones before it
+int cuda_reconstruction_wait_async(CudaReconstructionContext* context, long long ticket);
+
+// Copy the device grid back to the host, and its TSDF weights when
+// h_outWeights is not null
+int cuda_reconstruction_get_grid(CudaReconstructionContext* context, void* h_outScalar, void* h_outWeights);
+
+// Copy the cells of the device grid in cellExtent, the inclusive ranges of
+// their i, j and k indices, back to packed host buffers, and their TSDF
+// weights when h_outWeights is not null
+int cuda_reconstruction_get_grid_extent(CudaReconstructionContext* context, const int cellExtent[6],
+    void* h_outScalar, void* h_outWeights);
+
+// Extract the isoValue surface of the device grid with marching cubes over
+// the centers of its voxels, the voxels of zero TSDF weight being left out.
+// triangleCases are the 256 edge lists of vtkMarchingCubesTriangleCases. The
+// triangles stay on the device, their number is returned in trianglesNb.
+int cuda_reconstruction_extract_surface(CudaReconstructionContext* context, double isoValue,
+    const int triangleCases[256 * 16], long long* trianglesNb);
+
+// Copy the triangles of the last extracted surface to the host, 9
+// coordinates per triangle in the frame of the grid before its matrix
+int cuda_reconstruction_get_surface(CudaReconstructionContext* context, float* h_points);
+
+// A depth map with its camera matrices and its sorted active blocks in the
+// grid, the depths are in the precision of the grid they are integrated
+// into and their confidences, if not null, in single precision. A negative
+// activeBlocksNb integrates all the voxels.
+struct CudaReconstructionDepthMap
+{
+  int dims[3];
+  const void* depths;
+  const float* confidences;
+  double matrixK[9];
+  double matrixTR[16];
+  const int* activeBlocks;
+  int activeBlocksNb;
+};
+
+// Integrate depth maps into a grid which does not need to fit in the device
+// memory, h_outScalar is updated in place. The grid is split into bricks of
+// whole z slices holding at most maxBrickVoxels cells, or sized to the free
+// device memory when maxBrickVoxels is 0. Each brick is copied to the device,
+// integrates all the depth maps and is copied back, the transfers of a brick
+// overlapping the computation of the previous one on a second stream. The
+// number of bricks used is returned in bricksNb when not null. The device
+// grid of the context, if any, is released. The TSDF weights are updated in
+// place in h_outWeights, ignored by the cumulative function. The depth maps
+// are uploaded and preprocessed once for all the bricks.
+int cuda_reconstruction_integrate_bricked(CudaReconstructionContext* context, bool singlePrecision,
+    double h_gridMatrix[16], double h_gridOrig[3], int h_gridDims[3], double h_gridSpacing[3],
+    int depthMapsNb, const CudaReconstructionDepthMap* h_depthMaps, void* h_outScalar,
+    void* h_outWeights, long long maxBrickVoxels, int* bricksNb);
+
+// Create a sparse volume over a grid: a hash table of blocks of
+// CUDA_RECONSTRUCTION_BLOCK_SIZE^3 voxels allocated on demand, in a band of
+// bandWidth around the depths of the integrated depth maps (the width of a
+// block when bandWidth is 0). It holds at most maxBlocksNb blocks, or fills
+// half of the free device memory when maxBlocksNb is 0. It replaces the
+// device grid of the context.
+int cuda_reconstruction_sparse_init(CudaReconstructionContext* context, bool singlePrecision,
+    double h_gridMatrix[16], double h_gridOrig[3], int h_gridDims[3], double h_gridSpacing[3],
+    long long maxBlocksNb, double bandWidth);
+
+// Allocate the blocks seen by a depth map, then integrate it into all the
+// allocated blocks. The depths are in the precision of the volume, their
+// confidences, if not null, in single precision.
+int cuda_reconstruction_sparse_integrate(CudaReconstructionContext* context,
+    int h_depthMapDims[3], const void* h_depths, const float* h_confidences, double h_depthMapMatrixK[9],
+    double h_depthMapMatrixTR[16]);
+
+// Get the number of allocated blocks of the sparse volume, and the number of
+// blocks which could not be allocated because the volume was full
+int cuda_reconstruction_sparse_get_number_of_blocks(CudaReconstructionContext* context,
+    long long* blocksNb, long long* lostBlocksNb);
+
+// Copy the allocated blocks to the host: the block indices (3 per block) and
+// the voxels (BLOCK_SIZE^3 per block, x varying fastest)
+int cuda_reconstruction_sparse_get_blocks(CudaReconstructionContext* context, int* h_blockIndices,
+    void* h_blockScalars);
+
+// Integrate one depth map into h_outScalar, updated in place
+int cuda_reconstruction(
+    double h_gridMatrix[16], double h_gridOrig[3], int h_gridDims[3], double h_gridSpacing[3],
+    int h_depthMapDims[3], double* h_depths, double h_depthMapMatrixK[9], double h_depthMapMatrixTR[16],
+    double* h_outScalar);
+
+#endif
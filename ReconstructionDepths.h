@@ -0,0 +1,113 @@
+// Preprocessing of the depth maps before their integration, shared by the
+// host and the cuda kernels. A depth is valid when it is positive, NaN is
+// not. When a depth range, a minimum confidence or a level is set, the
+// invalid depths, and the ones out of the range or of too low confidence,
+// are replaced by NaN; otherwise the depths are integrated as they are.
+// Either way every integration loop leaves the voxels seeing an invalid
+// depth, or interpolating one, untouched. A level of the depth map pyramid
+// halves the previous one, each pixel keeping the nearest valid depth of
+// the 2x2 pixels it covers.
+
+#ifndef ReconstructionDepths_h
+#define ReconstructionDepths_h
+
+#include "ReconstructionFunctions.h"
+
+#include <limits>
+
+// Number of halvings of the depth maps at most
+#define RECONSTRUCTION_DEPTHS_MAX_LEVEL 8
+
+//----------------------------------------------------------------------------
+// Whether a depth is seen, NaN is not
+template <typename T>
+RECONSTRUCTION_FUNCTION_DECL bool ReconstructionIsValidDepth(T depth)
+{
+  return depth > 0;
+}
+
+//----------------------------------------------------------------------------
+template <typename T>
+RECONSTRUCTION_FUNCTION_DECL T ReconstructionInvalidDepth()
+{
+#ifdef __CUDA_ARCH__
+  return (T)nan("");
+#else
+  return std::numeric_limits<T>::quiet_NaN();
+#endif
+}
+
+//----------------------------------------------------------------------------
+// Whether the four taps of a bilinear interpolation are valid, the depth
+// interpolated across the border of a hole would lie between the surface
+// and the hole
+template <typename T>
+RECONSTRUCTION_FUNCTION_DECL bool ReconstructionAreValidTaps(T d00, T d01, T d10, T d11)
+{
+  return ReconstructionIsValidDepth(d00) && ReconstructionIsValidDepth(d01) &&
+    ReconstructionIsValidDepth(d10) && ReconstructionIsValidDepth(d11);
+}
+
+//----------------------------------------------------------------------------
+// The depth if it is valid, within [minDepth, maxDepth] and confident, NaN
+// otherwise. A maxDepth of 0 does not bound the depths.
+template <typename T>
+RECONSTRUCTION_FUNCTION_DECL T ReconstructionMaskDepth(T depth, T minDepth, T maxDepth, bool confident)
+{
+  if (!ReconstructionIsValidDepth(depth) || !(depth >= minDepth) || (maxDepth > 0 && depth > maxDepth) ||
+      !confident)
+    {
+    return ReconstructionInvalidDepth<T>();
+    }
+  return depth;
+}
+
+//----------------------------------------------------------------------------
+// Dimensions of the next level of the pyramid, the odd last pixels are kept
+RECONSTRUCTION_FUNCTION_DECL void ReconstructionDownsampleDims(const int dims[3], int levelDims[3])
+{
+  levelDims[0] = (dims[0] + 1) / 2;
+  levelDims[1] = (dims[1] + 1) / 2;
+  levelDims[2] = dims[2];
+}
+
+//----------------------------------------------------------------------------
+// Depth of the pixel (i, j) of the next level of the pyramid: the nearest
+// valid depth of the 2x2 pixels it covers, the borders being clamped, NaN
+// when none is valid
+template <typename T>
+RECONSTRUCTION_FUNCTION_DECL T ReconstructionDownsampleDepth(const T* depths, const int dims[3], int i, int j)
+{
+  T depth = ReconstructionInvalidDepth<T>();
+  for (int dj = 0; dj < 2; dj++)
+    {
+    int y = 2 * j + dj < dims[1] ? 2 * j + dj : dims[1] - 1;
+    for (int di = 0; di < 2; di++)
+      {
+      int x = 2 * i + di < dims[0] ? 2 * i + di : dims[0] - 1;
+      T tap = depths[x + (long long)y * dims[0]];
+      if (ReconstructionIsValidDepth(tap) && !(depth <= tap))
+        {
+        depth = tap;
+        }
+      }
+    }
+  return depth;
+}
+
+//----------------------------------------------------------------------------
+// Intrinsics of the next level of the pyramid, row-major: the pixel centers
+// being at integer coordinates, the pixel u of the level covers the pixels 2u
+// and 2u + 1, so its coordinates are (u - 0.5) / 2 in its level
+RECONSTRUCTION_FUNCTION_DECL void ReconstructionDownsampleMatrixK(double matrixK[9])
+{
+  for (int r = 0; r < 2; r++)
+    {
+    for (int c = 0; c < 3; c++)
+      {
+      matrixK[3 * r + c] = (matrixK[3 * r + c] - 0.5 * matrixK[6 + c]) / 2;
+      }
+    }
+}
+
+#endif
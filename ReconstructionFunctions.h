@@ -0,0 +1,267 @@
+// Accumulation rules of the depth maps into the voxels, shared by the CPU
+// backends and the cuda kernels. The integration loops are templated on the
+// rule, so each rule compiles to its own inlined loop without any test of
+// the function per voxel.
+//
+// A rule is a functor in the precision T of the integration which provides:
+// - Identifier, its CUDA_RECONSTRUCTION_FUNCTION_ identifier;
+// - HasWeights, whether a weight per voxel follows the scalars;
+// - Truncation, the width of its band;
+// - InBand(diff), false when the voxel is left untouched, it is tested before
+//   the voxel is read;
+// - Update(diff, val, weight), the new value and weight of the voxel.
+// diff is the distance from the camera to the voxel minus the depth seen
+// along its ray, it is negative in front of the surface. The rules only see
+// the valid depths of ReconstructionDepths.h. To try a new rule,
+// add its functor and its identifier to CudaReconstruction.h and to
+// DispatchReconstructionFunction, and its vectorised version to
+// SimdReconstructionKernel.h.
+
+#ifndef ReconstructionFunctions_h
+#define ReconstructionFunctions_h
+
+#include "CudaReconstruction.h"
+
+#ifdef __CUDACC__
+#define RECONSTRUCTION_FUNCTION_DECL __host__ __device__ inline
+#else
+#define RECONSTRUCTION_FUNCTION_DECL inline
+#endif
+
+//----------------------------------------------------------------------------
+template <typename T>
+RECONSTRUCTION_FUNCTION_DECL T ReconstructionAbs(T x)
+{
+  return x < 0 ? -x : x;
+}
+
+//----------------------------------------------------------------------------
+// Sum of the inverse distances to the depths, clamped at 100
+template <typename T>
+struct ReconstructionFunctionCumul
+{
+  enum { Identifier = CUDA_RECONSTRUCTION_FUNCTION_CUMUL, HasWeights = 0 };
+  T Truncation;
+
+  explicit ReconstructionFunctionCumul(T truncation) : Truncation(truncation) {}
+
+  RECONSTRUCTION_FUNCTION_DECL bool InBand(T) const
+  {
+    return true;
+  }
+
+  RECONSTRUCTION_FUNCTION_DECL void Update(T diff, T& val, T&) const
+  {
+    if (ReconstructionAbs(diff) != 0)
+      {
+      val += 1 / ReconstructionAbs(diff);
+      }
+    else
+      {
+      val += 10;
+      }
+    if (val > 100)
+      {
+      val = 100;
+      }
+  }
+};
+
+//----------------------------------------------------------------------------
+// Weighted average of the signed distances within the truncation band,
+// positive in front of the surface
+template <typename T>
+struct ReconstructionFunctionTSDF
+{
+  enum { Identifier = CUDA_RECONSTRUCTION_FUNCTION_TSDF, HasWeights = 1 };
+  T Truncation;
+
+  explicit ReconstructionFunctionTSDF(T truncation) : Truncation(truncation) {}
+
+  RECONSTRUCTION_FUNCTION_DECL bool InBand(T diff) const
+  {
+    return ReconstructionAbs(diff) <= this->Truncation;
+  }
+
+  RECONSTRUCTION_FUNCTION_DECL void Update(T diff, T& val, T& weight) const
+  {
+    val = (val * weight - diff) / (weight + 1);
+    weight += 1;
+  }
+};
+
+//----------------------------------------------------------------------------
+// Occupancy log-odds: the voxels within the truncation band are hits, the
+// ones in front of it are misses and the ones behind are unknown. The
+// probabilities and the clamping are the usual 0.7, 0.4 and [0.12, 0.97].
+template <typename T>
+struct ReconstructionFunctionLogOdds
+{
+  enum { Identifier = CUDA_RECONSTRUCTION_FUNCTION_LOG_ODDS, HasWeights = 0 };
+  T Truncation;
+
+  explicit ReconstructionFunctionLogOdds(T truncation) : Truncation(truncation) {}
+
+  RECONSTRUCTION_FUNCTION_DECL bool InBand(T diff) const
+  {
+    return diff <= this->Truncation;
+  }
+
+  RECONSTRUCTION_FUNCTION_DECL void Update(T diff, T& val, T&) const
+  {
+    val += diff < -this->Truncation ? (T)-0.405 : (T)0.847;
+    if (val < (T)-2)
+      {
+      val = (T)-2;
+      }
+    else if (val > (T)3.5)
+      {
+      val = (T)3.5;
+      }
+  }
+};
+
+//----------------------------------------------------------------------------
+// Highest confidence of the depth maps, decreasing linearly from 1 on the
+// surface to 0 at the truncation distance
+template <typename T>
+struct ReconstructionFunctionMaxConfidence
+{
+  enum { Identifier = CUDA_RECONSTRUCTION_FUNCTION_MAX_CONFIDENCE, HasWeights = 0 };
+  T Truncation;
+
+  explicit ReconstructionFunctionMaxConfidence(T truncation) : Truncation(truncation) {}
+
+  RECONSTRUCTION_FUNCTION_DECL bool InBand(T diff) const
+  {
+    return ReconstructionAbs(diff) < this->Truncation;
+  }
+
+  RECONSTRUCTION_FUNCTION_DECL void Update(T diff, T& val, T&) const
+  {
+    T confidence = 1 - ReconstructionAbs(diff) / this->Truncation;
+    if (confidence > val)
+      {
+      val = confidence;
+      }
+  }
+};
+
+//----------------------------------------------------------------------------
+// Whether a function keeps a weight per voxel after the scalars
+inline bool ReconstructionFunctionHasWeights(int function)
+{
+  return function == CUDA_RECONSTRUCTION_FUNCTION_TSDF;
+}
+
+//----------------------------------------------------------------------------
+// Range of the values of a function, over which they are quantised in the
+// uint16 storage
+inline void ReconstructionFunctionRange(int function, double truncation, double range[2])
+{
+  switch (function)
+    {
+    case CUDA_RECONSTRUCTION_FUNCTION_TSDF:
+      range[0] = -truncation;
+      range[1] = truncation;
+      break;
+    case CUDA_RECONSTRUCTION_FUNCTION_LOG_ODDS:
+      range[0] = -2;
+      range[1] = 3.5;
+      break;
+    case CUDA_RECONSTRUCTION_FUNCTION_MAX_CONFIDENCE:
+      range[0] = 0;
+      range[1] = 1;
+      break;
+    default:
+      range[0] = 0;
+      range[1] = 100;
+    }
+  if (!(range[1] > range[0]))
+    {
+    range[1] = range[0] + 1;
+    }
+}
+
+//----------------------------------------------------------------------------
+// 16 bit quantisation of the values: q stands for offset + q * scale, the
+// values out of the 65536 levels are clamped
+template <typename T>
+RECONSTRUCTION_FUNCTION_DECL unsigned short ReconstructionQuantize(T value, T offset, T scale)
+{
+  T q = (value - offset) / scale + (T)0.5;
+  if (!(q > 0))
+    {
+    return 0;
+    }
+  return q < (T)65535 ? (unsigned short)q : (unsigned short)65535;
+}
+
+template <typename T>
+RECONSTRUCTION_FUNCTION_DECL T ReconstructionDequantize(unsigned short q, T offset, T scale)
+{
+  return offset + (T)q * scale;
+}
+
+//----------------------------------------------------------------------------
+// Widen the bits of a half float, on the host
+inline float ReconstructionHalfToFloat(unsigned short h)
+{
+  unsigned int sign = (unsigned int)(h & 0x8000) << 16;
+  unsigned int exponent = (h >> 10) & 0x1f;
+  unsigned int mantissa = h & 0x3ff;
+  unsigned int bits;
+  if (exponent == 0x1f)
+    {
+    // infinities and NaNs
+    bits = sign | 0x7f800000 | (mantissa << 13);
+    }
+  else if (exponent != 0)
+    {
+    bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+  else if (mantissa == 0)
+    {
+    bits = sign;
+    }
+  else
+    {
+    // subnormal, normalised in float
+    exponent = 113;
+    while (!(mantissa & 0x400))
+      {
+      mantissa <<= 1;
+      exponent--;
+      }
+    bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+    }
+  union
+  {
+    unsigned int u;
+    float f;
+  } value;
+  value.u = bits;
+  return value.f;
+}
+
+//----------------------------------------------------------------------------
+// Call the templated operator() of runner with the functor of a function,
+// once per integration so that the loops are specialised. Returns the
+// result of the runner.
+template <typename T, typename Runner>
+int DispatchReconstructionFunction(int function, double truncation, Runner& runner)
+{
+  switch (function)
+    {
+    case CUDA_RECONSTRUCTION_FUNCTION_TSDF:
+      return runner(ReconstructionFunctionTSDF<T>((T)truncation));
+    case CUDA_RECONSTRUCTION_FUNCTION_LOG_ODDS:
+      return runner(ReconstructionFunctionLogOdds<T>((T)truncation));
+    case CUDA_RECONSTRUCTION_FUNCTION_MAX_CONFIDENCE:
+      return runner(ReconstructionFunctionMaxConfidence<T>((T)truncation));
+    default:
+      return runner(ReconstructionFunctionCumul<T>((T)truncation));
+    }
+}
+
+#endif
@@ -0,0 +1,85 @@
+// Marching cubes over the voxels of a reconstruction grid, shared by the
+// extraction on the host and the cuda kernels. A cube joins the centers of
+// 2x2x2 neighbour voxels, its corners and its edges are numbered as in
+// vtkMarchingCubes so that the triangle cases of
+// vtkMarchingCubesTriangleCases apply: 256 cases of at most 5 triangles, as
+// lists of 16 cube edges ended by -1.
+
+#ifndef ReconstructionSurface_h
+#define ReconstructionSurface_h
+
+#include "ReconstructionFunctions.h"
+
+// Number of edges listed per triangle case
+#define RECONSTRUCTION_SURFACE_CASE_SIZE 16
+
+//----------------------------------------------------------------------------
+// Offset along x, y and z of a corner of a cube, the corners go around the
+// bottom face then around the top one
+RECONSTRUCTION_FUNCTION_DECL void ReconstructionCubeCorner(int corner, int offset[3])
+{
+  offset[0] = (corner & 1) ^ ((corner >> 1) & 1);
+  offset[1] = (corner >> 1) & 1;
+  offset[2] = (corner >> 2) & 1;
+}
+
+//----------------------------------------------------------------------------
+// Corners joined by an edge of a cube, packed as one hexadecimal digit per
+// edge
+RECONSTRUCTION_FUNCTION_DECL void ReconstructionCubeEdge(int edge, int& first, int& second)
+{
+  first = static_cast<int>((0x231047540310ULL >> (4 * edge)) & 0xf);
+  second = static_cast<int>((0x675476653221ULL >> (4 * edge)) & 0xf);
+}
+
+//----------------------------------------------------------------------------
+// Triangle case of a cube, a bit per corner whose value is at least isoValue
+template <typename T>
+RECONSTRUCTION_FUNCTION_DECL int ReconstructionCubeCase(const T values[8], T isoValue)
+{
+  int index = 0;
+  for (int c = 0; c < 8; c++)
+    {
+    if (values[c] >= isoValue)
+      {
+      index |= 1 << c;
+      }
+    }
+  return index;
+}
+
+//----------------------------------------------------------------------------
+// Number of triangles of a triangle case given as its list of edges
+template <typename E>
+RECONSTRUCTION_FUNCTION_DECL int ReconstructionCaseTrianglesNb(const E* caseEdges)
+{
+  int edgesNb = 0;
+  while (edgesNb < RECONSTRUCTION_SURFACE_CASE_SIZE - 1 && caseEdges[edgesNb] >= 0)
+    {
+    edgesNb++;
+    }
+  return edgesNb / 3;
+}
+
+//----------------------------------------------------------------------------
+// Point where the values cross isoValue along an edge of a cube whose first
+// corner is at origin
+template <typename T>
+RECONSTRUCTION_FUNCTION_DECL void ReconstructionEdgePoint(const T values[8], T isoValue, int edge,
+                                                          const T origin[3], const T spacing[3], T point[3])
+{
+  int first, second;
+  ReconstructionCubeEdge(edge, first, second);
+  T delta = values[second] - values[first];
+  T t = delta != 0 ? (isoValue - values[first]) / delta : static_cast<T>(0.5);
+  int firstOffset[3];
+  int secondOffset[3];
+  ReconstructionCubeCorner(first, firstOffset);
+  ReconstructionCubeCorner(second, secondOffset);
+  for (int n = 0; n < 3; n++)
+    {
+    point[n] = origin[n] + spacing[n] * (firstOffset[n] + t * (secondOffset[n] - firstOffset[n]));
+    }
+}
+
+#endif
@@ -0,0 +1,99 @@
+#include "SimdReconstruction.h"
+#include "CudaReconstruction.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+//----------------------------------------------------------------------------
+// Get the widest instruction set supported by the CPU and by the operating
+// system, whether or not it is built in
+static int GetCPUInstructionSet()
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    {
+    return SIMD_RECONSTRUCTION_AVX512;
+    }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+    return SIMD_RECONSTRUCTION_AVX2;
+    }
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  int info[4];
+  __cpuid(info, 1);
+  bool fma = (info[2] & (1 << 12)) != 0;
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  if (!osxsave)
+    {
+    return SIMD_RECONSTRUCTION_NONE;
+    }
+  // the registers must be saved by the operating system
+  unsigned long long xcr0 = _xgetbv(0);
+  __cpuidex(info, 7, 0);
+  bool avx2 = (info[1] & (1 << 5)) != 0 && (xcr0 & 0x6) == 0x6;
+  bool avx512 = (info[1] & (1 << 16)) != 0 && (xcr0 & 0xe6) == 0xe6;
+  if (avx512)
+    {
+    return SIMD_RECONSTRUCTION_AVX512;
+    }
+  if (avx2 && fma)
+    {
+    return SIMD_RECONSTRUCTION_AVX2;
+    }
+#endif
+  return SIMD_RECONSTRUCTION_NONE;
+}
+
+//----------------------------------------------------------------------------
+int simd_reconstruction_get_instruction_set()
+{
+  static int instructionSet = -1;
+  if (instructionSet < 0)
+    {
+    // the CUDA_RECONSTRUCTION_FUNCTION_CUMUL kernel tells whether an
+    // instruction set is built in
+    int cpuInstructionSet = GetCPUInstructionSet();
+    int result = SIMD_RECONSTRUCTION_NONE;
+    if (cpuInstructionSet >= SIMD_RECONSTRUCTION_AVX512 && simd_reconstruction_get_avx512_row_function(CUDA_RECONSTRUCTION_FUNCTION_CUMUL))
+      {
+      result = SIMD_RECONSTRUCTION_AVX512;
+      }
+    else if (cpuInstructionSet >= SIMD_RECONSTRUCTION_AVX2 && simd_reconstruction_get_avx2_row_function(CUDA_RECONSTRUCTION_FUNCTION_CUMUL))
+      {
+      result = SIMD_RECONSTRUCTION_AVX2;
+      }
+    instructionSet = result;
+    }
+  return instructionSet;
+}
+
+//----------------------------------------------------------------------------
+const char* simd_reconstruction_get_instruction_set_name(int instructionSet)
+{
+  switch (instructionSet)
+    {
+    case SIMD_RECONSTRUCTION_AVX2:
+      return "avx2";
+    case SIMD_RECONSTRUCTION_AVX512:
+      return "avx512";
+    default:
+      return "none";
+    }
+}
+
+//----------------------------------------------------------------------------
+SimdReconstructionRowFunction simd_reconstruction_get_row_function(int function)
+{
+  switch (simd_reconstruction_get_instruction_set())
+    {
+    case SIMD_RECONSTRUCTION_AVX512:
+      return simd_reconstruction_get_avx512_row_function(function);
+    case SIMD_RECONSTRUCTION_AVX2:
+      return simd_reconstruction_get_avx2_row_function(function);
+    default:
+      return 0;
+    }
+}
@@ -0,0 +1,48 @@
+// Vectorised CPU integration of a row of voxels along x, in single
+// precision. The kernels are built for several instruction sets in
+// SimdReconstructionAVX2.cxx and SimdReconstructionAVX512.cxx, and the
+// widest one supported by the CPU is selected at run time.
+
+#ifndef SimdReconstruction_h
+#define SimdReconstruction_h
+
+// Instruction sets of the vectorised integration
+#define SIMD_RECONSTRUCTION_NONE 0
+#define SIMD_RECONSTRUCTION_AVX2 1
+#define SIMD_RECONSTRUCTION_AVX512 2
+
+// Depth map and grid shared by the rows of an integration. The steps are the
+// increments of the homogeneous coords of the voxel centers from one voxel
+// to the next along x. The interpolation is one of the
+// CUDA_RECONSTRUCTION_INTERPOLATION_ modes, the weights are only used by the
+// functions which have some.
+struct SimdReconstructionFrame
+{
+  float cameraStep[4];
+  float depthMapStep[3];
+  const float* depths;
+  int depthMapDims[2];
+  int interpolation;
+  float truncation;
+  float* outScalar;
+  float* outWeights;
+};
+
+// Integrate voxelsNb voxels from the voxel i_vox, whose center has the
+// given camera and depth map homogeneous coords
+typedef void (*SimdReconstructionRowFunction)(const SimdReconstructionFrame* frame,
+  const float cameraCoordsHomo[4], const float depthMapCoordsHomo[3], long long i_vox, long long voxelsNb);
+
+// Get the widest instruction set supported by the CPU and built in
+int simd_reconstruction_get_instruction_set();
+const char* simd_reconstruction_get_instruction_set_name(int instructionSet);
+
+// Get the row function of a CUDA_RECONSTRUCTION_FUNCTION_ accumulation for
+// the widest instruction set, 0 if there is none
+SimdReconstructionRowFunction simd_reconstruction_get_row_function(int function);
+
+// Row functions of each instruction set, 0 when it is not built in
+SimdReconstructionRowFunction simd_reconstruction_get_avx2_row_function(int function);
+SimdReconstructionRowFunction simd_reconstruction_get_avx512_row_function(int function);
+
+#endif
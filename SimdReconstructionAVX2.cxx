@@ -0,0 +1,74 @@
+// AVX2 build of the row integration kernel, compiled with -mavx2 -mfma
+// (/arch:AVX2 with MSVC). It is only called when the CPU supports AVX2 and
+// FMA.
+
+#include "SimdReconstruction.h"
+
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+#include "SimdReconstructionKernel.h"
+
+//----------------------------------------------------------------------------
+// Eight float lanes, the masks are all ones lanes
+struct SimdFloat8
+{
+  typedef __m256 Type;
+  typedef __m256 Mask;
+  typedef __m256i Int;
+  enum { Width = 8 };
+
+  static Type Set(float x) { return _mm256_set1_ps(x); }
+  static Type Ramp() { return _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7); }
+  static Type Add(Type a, Type b) { return _mm256_add_ps(a, b); }
+  static Type Sub(Type a, Type b) { return _mm256_sub_ps(a, b); }
+  static Type Mul(Type a, Type b) { return _mm256_mul_ps(a, b); }
+  static Type Div(Type a, Type b) { return _mm256_div_ps(a, b); }
+  static Type FMA(Type a, Type b, Type c) { return _mm256_fmadd_ps(a, b, c); }
+  static Type Min(Type a, Type b) { return _mm256_min_ps(a, b); }
+  static Type Max(Type a, Type b) { return _mm256_max_ps(a, b); }
+  static Type Sqrt(Type a) { return _mm256_sqrt_ps(a); }
+  static Type Abs(Type a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+  static Type Floor(Type a) { return _mm256_floor_ps(a); }
+
+  static Mask True() { return _mm256_castsi256_ps(_mm256_set1_epi32(-1)); }
+  static Mask FirstLanes(int n) { return _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(n),
+    _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7))); }
+  static Mask Less(Type a, Type b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+  static Mask LessEqual(Type a, Type b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+  static Mask Greater(Type a, Type b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+  static Mask NotEqual(Type a, Type b) { return _mm256_cmp_ps(a, b, _CMP_NEQ_OQ); }
+  static Mask And(Mask a, Mask b) { return _mm256_and_ps(a, b); }
+  static bool Any(Mask a) { return _mm256_movemask_ps(a) != 0; }
+  static Type Select(Mask m, Type a, Type b) { return _mm256_blendv_ps(b, a, m); }
+
+  // row * width + column, from integral floats
+  static Int Index(Type row, int width, Type column)
+  {
+    return _mm256_add_epi32(_mm256_mullo_epi32(_mm256_cvttps_epi32(row), _mm256_set1_epi32(width)),
+                            _mm256_cvttps_epi32(column));
+  }
+  static Type Gather(const float* base, Int index, Mask m)
+  {
+    return _mm256_mask_i32gather_ps(_mm256_setzero_ps(), base, index, m, 4);
+  }
+  static Type Load(const float* p, Mask m) { return _mm256_maskload_ps(p, _mm256_castps_si256(m)); }
+  static void Store(float* p, Mask m, Type a) { _mm256_maskstore_ps(p, _mm256_castps_si256(m), a); }
+};
+
+//----------------------------------------------------------------------------
+SimdReconstructionRowFunction simd_reconstruction_get_avx2_row_function(int function)
+{
+  return SimdGetRowFunction<SimdFloat8>(function);
+}
+
+#else
+
+//----------------------------------------------------------------------------
+SimdReconstructionRowFunction simd_reconstruction_get_avx2_row_function(int)
+{
+  return 0;
+}
+
+#endif
@@ -0,0 +1,74 @@
+// AVX-512 build of the row integration kernel, compiled with -mavx512f
+// (/arch:AVX512 with MSVC). It is only called when the CPU supports
+// AVX-512F.
+
+#include "SimdReconstruction.h"
+
+#if defined(__AVX512F__)
+
+#include <immintrin.h>
+
+#include "SimdReconstructionKernel.h"
+
+//----------------------------------------------------------------------------
+// Sixteen float lanes, the masks are mask registers
+struct SimdFloat16
+{
+  typedef __m512 Type;
+  typedef __mmask16 Mask;
+  typedef __m512i Int;
+  enum { Width = 16 };
+
+  static Type Set(float x) { return _mm512_set1_ps(x); }
+  static Type Ramp() { return _mm512_setr_ps(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15); }
+  static Type Add(Type a, Type b) { return _mm512_add_ps(a, b); }
+  static Type Sub(Type a, Type b) { return _mm512_sub_ps(a, b); }
+  static Type Mul(Type a, Type b) { return _mm512_mul_ps(a, b); }
+  static Type Div(Type a, Type b) { return _mm512_div_ps(a, b); }
+  static Type FMA(Type a, Type b, Type c) { return _mm512_fmadd_ps(a, b, c); }
+  static Type Min(Type a, Type b) { return _mm512_min_ps(a, b); }
+  static Type Max(Type a, Type b) { return _mm512_max_ps(a, b); }
+  static Type Sqrt(Type a) { return _mm512_sqrt_ps(a); }
+  static Type Abs(Type a) { return _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(a),
+    _mm512_set1_epi32(0x7fffffff))); }
+  static Type Floor(Type a) { return _mm512_mask_roundscale_ps(a, 0xffff, a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+
+  static Mask True() { return (Mask)0xffff; }
+  static Mask FirstLanes(int n) { return (Mask)((1u << n) - 1); }
+  static Mask Less(Type a, Type b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+  static Mask LessEqual(Type a, Type b) { return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+  static Mask Greater(Type a, Type b) { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+  static Mask NotEqual(Type a, Type b) { return _mm512_cmp_ps_mask(a, b, _CMP_NEQ_OQ); }
+  static Mask And(Mask a, Mask b) { return (Mask)(a & b); }
+  static bool Any(Mask a) { return a != 0; }
+  static Type Select(Mask m, Type a, Type b) { return _mm512_mask_blend_ps(m, b, a); }
+
+  // row * width + column, from integral floats
+  static Int Index(Type row, int width, Type column)
+  {
+    return _mm512_add_epi32(_mm512_mullo_epi32(_mm512_cvttps_epi32(row), _mm512_set1_epi32(width)),
+                            _mm512_cvttps_epi32(column));
+  }
+  static Type Gather(const float* base, Int index, Mask m)
+  {
+    return _mm512_mask_i32gather_ps(_mm512_setzero_ps(), m, index, base, 4);
+  }
+  static Type Load(const float* p, Mask m) { return _mm512_maskz_loadu_ps(m, p); }
+  static void Store(float* p, Mask m, Type a) { _mm512_mask_storeu_ps(p, m, a); }
+};
+
+//----------------------------------------------------------------------------
+SimdReconstructionRowFunction simd_reconstruction_get_avx512_row_function(int function)
+{
+  return SimdGetRowFunction<SimdFloat16>(function);
+}
+
+#else
+
+//----------------------------------------------------------------------------
+SimdReconstructionRowFunction simd_reconstruction_get_avx512_row_function(int)
+{
+  return 0;
+}
+
+#endif
@@ -0,0 +1,279 @@
+// Row integration kernel of SimdReconstruction.h, written once over a vector
+// type V and included by the translation unit of each instruction set, which
+// is compiled for it. It must not include any header defining inline
+// functions shared with the other translation units, so that no code of the
+// instruction set leaks into them.
+//
+// V provides the lanes Type, Mask and Int and the operations used below. The
+// voxels of a row are integrated Width at a time: the lanes out of the row,
+// behind the camera, out of the depth map or out of the band of the
+// function are masked, the depths are gathered and the voxels are loaded
+// and stored under the mask so that the masked voxels are neither read nor
+// written.
+
+#ifndef SimdReconstructionKernel_h
+#define SimdReconstructionKernel_h
+
+#include "CudaReconstruction.h"
+#include "SimdReconstruction.h"
+
+//----------------------------------------------------------------------------
+// Vectorised versions of the functors of ReconstructionFunctions.h
+template <typename V, int Function>
+struct SimdFunction;
+
+template <typename V>
+struct SimdFunction<V, CUDA_RECONSTRUCTION_FUNCTION_CUMUL>
+{
+  enum { HasWeights = 0 };
+  typedef typename V::Type Type;
+  typedef typename V::Mask Mask;
+
+  explicit SimdFunction(float) {}
+
+  Mask InBand(Type) const
+  {
+    return V::True();
+  }
+
+  void Update(Type diff, Type& val, Type&) const
+  {
+    Type absDiff = V::Abs(diff);
+    Type inverse = V::Div(V::Set(1), absDiff);
+    val = V::Add(val, V::Select(V::NotEqual(absDiff, V::Set(0)), inverse, V::Set(10)));
+    val = V::Min(val, V::Set(100));
+  }
+};
+
+template <typename V>
+struct SimdFunction<V, CUDA_RECONSTRUCTION_FUNCTION_TSDF>
+{
+  enum { HasWeights = 1 };
+  typedef typename V::Type Type;
+  typedef typename V::Mask Mask;
+  Type Truncation;
+
+  explicit SimdFunction(float truncation) : Truncation(V::Set(truncation)) {}
+
+  Mask InBand(Type diff) const
+  {
+    return V::LessEqual(V::Abs(diff), this->Truncation);
+  }
+
+  void Update(Type diff, Type& val, Type& weight) const
+  {
+    Type nextWeight = V::Add(weight, V::Set(1));
+    val = V::Div(V::Sub(V::Mul(val, weight), diff), nextWeight);
+    weight = nextWeight;
+  }
+};
+
+template <typename V>
+struct SimdFunction<V, CUDA_RECONSTRUCTION_FUNCTION_LOG_ODDS>
+{
+  enum { HasWeights = 0 };
+  typedef typename V::Type Type;
+  typedef typename V::Mask Mask;
+  Type Truncation;
+
+  explicit SimdFunction(float truncation) : Truncation(V::Set(truncation)) {}
+
+  Mask InBand(Type diff) const
+  {
+    return V::LessEqual(diff, this->Truncation);
+  }
+
+  void Update(Type diff, Type& val, Type&) const
+  {
+    Type miss = V::Set(-0.405f);
+    Type hit = V::Set(0.847f);
+    val = V::Add(val, V::Select(V::Less(diff, V::Sub(V::Set(0), this->Truncation)), miss, hit));
+    val = V::Min(V::Max(val, V::Set(-2)), V::Set(3.5f));
+  }
+};
+
+template <typename V>
+struct SimdFunction<V, CUDA_RECONSTRUCTION_FUNCTION_MAX_CONFIDENCE>
+{
+  enum { HasWeights = 0 };
+  typedef typename V::Type Type;
+  typedef typename V::Mask Mask;
+  Type Truncation;
+
+  explicit SimdFunction(float truncation) : Truncation(V::Set(truncation)) {}
+
+  Mask InBand(Type diff) const
+  {
+    return V::Less(V::Abs(diff), this->Truncation);
+  }
+
+  void Update(Type diff, Type& val, Type&) const
+  {
+    Type confidence = V::Sub(V::Set(1), V::Div(V::Abs(diff), this->Truncation));
+    val = V::Max(val, confidence);
+  }
+};
+
+//----------------------------------------------------------------------------
+// Integrate a row with the function F, Linear selects the bilinear
+// interpolation of the depths
+template <typename V, typename F, bool Linear>
+static void SimdIntegrateRow(const SimdReconstructionFrame* frame, const float cameraCoordsHomo[4],
+  const float depthMapCoordsHomo[3], long long i_vox, long long voxelsNb)
+{
+  typedef typename V::Type Type;
+  typedef typename V::Mask Mask;
+  typedef typename V::Int Int;
+
+  const F function(frame->truncation);
+  Type cameraStart[4];
+  Type cameraStep[4];
+  for (int m = 0; m < 4; m++)
+    {
+    cameraStart[m] = V::Set(cameraCoordsHomo[m]);
+    cameraStep[m] = V::Set(frame->cameraStep[m]);
+    }
+  Type depthMapStart[3];
+  Type depthMapStep[3];
+  for (int m = 0; m < 3; m++)
+    {
+    depthMapStart[m] = V::Set(depthMapCoordsHomo[m]);
+    depthMapStep[m] = V::Set(frame->depthMapStep[m]);
+    }
+  int width = frame->depthMapDims[0];
+  Type maxU = V::Set(frame->depthMapDims[0] - 0.5f);
+  Type maxV = V::Set(frame->depthMapDims[1] - 0.5f);
+  Type lastU = V::Set((float)(frame->depthMapDims[0] - 1));
+  Type lastV = V::Set((float)(frame->depthMapDims[1] - 1));
+  Type minUV = V::Set(-0.5f);
+  Type zero = V::Set(0);
+  Type one = V::Set(1);
+  Type half = V::Set(0.5f);
+  float* outScalar = frame->outScalar + i_vox;
+  float* outWeights = F::HasWeights ? frame->outWeights + i_vox : 0;
+
+  for (long long n = 0; n < voxelsNb; n += V::Width)
+    {
+    long long lanesNb = voxelsNb - n;
+    Mask mask = V::FirstLanes(lanesNb < V::Width ? (int)lanesNb : (int)V::Width);
+
+    // homogeneous coords of the voxel centers of the lanes, from the row
+    // start so that the steps do not accumulate rounding errors
+    Type lane = V::Add(V::Ramp(), V::Set((float)n));
+    Type camera[4];
+    for (int m = 0; m < 4; m++)
+      {
+      camera[m] = V::FMA(lane, cameraStep[m], cameraStart[m]);
+      }
+    Type depthMap[3];
+    for (int m = 0; m < 3; m++)
+      {
+      depthMap[m] = V::FMA(lane, depthMapStep[m], depthMapStart[m]);
+      }
+
+    // the voxels behind the camera are not seen
+    mask = V::And(mask, V::Greater(depthMap[2], zero));
+    if (!V::Any(mask))
+      {
+      continue;
+      }
+
+    // the voxels whose nearest pixel is out of the depth map are not
+    // integrated, in both interpolation modes
+    Type u = V::Div(depthMap[0], depthMap[2]);
+    Type v = V::Div(depthMap[1], depthMap[2]);
+    mask = V::And(mask, V::And(V::And(V::Greater(u, minUV), V::Less(u, maxU)),
+                               V::And(V::Greater(v, minUV), V::Less(v, maxV))));
+    if (!V::Any(mask))
+      {
+      continue;
+      }
+
+    Type depth;
+    if (Linear)
+      {
+      // bilinear interpolation with clamped borders
+      Type u0 = V::Floor(u);
+      Type v0 = V::Floor(v);
+      Type fu = V::Sub(u, u0);
+      Type fv = V::Sub(v, v0);
+      Type u1 = V::Min(V::Add(u0, one), lastU);
+      Type v1 = V::Min(V::Add(v0, one), lastV);
+      u0 = V::Max(u0, zero);
+      v0 = V::Max(v0, zero);
+      Type d00 = V::Gather(frame->depths, V::Index(v0, width, u0), mask);
+      Type d01 = V::Gather(frame->depths, V::Index(v0, width, u1), mask);
+      Type d10 = V::Gather(frame->depths, V::Index(v1, width, u0), mask);
+      Type d11 = V::Gather(frame->depths, V::Index(v1, width, u1), mask);
+      // the interpolations with an invalid tap are not integrated
+      mask = V::And(mask, V::And(V::And(V::Greater(d00, zero), V::Greater(d01, zero)),
+                                 V::And(V::Greater(d10, zero), V::Greater(d11, zero))));
+      Type row0 = V::FMA(fu, V::Sub(d01, d00), d00);
+      Type row1 = V::FMA(fu, V::Sub(d11, d10), d10);
+      depth = V::FMA(fv, V::Sub(row1, row0), row0);
+      }
+    else
+      {
+      Int index = V::Index(V::Floor(V::Add(v, half)), width, V::Floor(V::Add(u, half)));
+      depth = V::Gather(frame->depths, index, mask);
+      }
+
+    // distance between the voxels and the camera
+    Type distanceVoxCam = V::Div(V::Sqrt(V::FMA(camera[0], camera[0],
+                                                V::FMA(camera[1], camera[1], V::Mul(camera[2], camera[2])))),
+                                 V::Abs(camera[3]));
+    // the voxels seeing an invalid depth, NaN included, are left untouched
+    Type diff = V::Sub(distanceVoxCam, depth);
+    mask = V::And(mask, V::And(V::Greater(depth, zero), function.InBand(diff)));
+    if (!V::Any(mask))
+      {
+      continue;
+      }
+
+    // compute new val
+    Type val = V::Load(outScalar + n, mask);
+    Type weight = F::HasWeights ? V::Load(outWeights + n, mask) : zero;
+    function.Update(diff, val, weight);
+    V::Store(outScalar + n, mask, val);
+    if (F::HasWeights)
+      {
+      V::Store(outWeights + n, mask, weight);
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+template <typename V, typename F>
+static void SimdIntegrateRow(const SimdReconstructionFrame* frame, const float cameraCoordsHomo[4],
+  const float depthMapCoordsHomo[3], long long i_vox, long long voxelsNb)
+{
+  if (frame->interpolation == CUDA_RECONSTRUCTION_INTERPOLATION_LINEAR)
+    {
+    SimdIntegrateRow<V, F, true>(frame, cameraCoordsHomo, depthMapCoordsHomo, i_vox, voxelsNb);
+    }
+  else
+    {
+    SimdIntegrateRow<V, F, false>(frame, cameraCoordsHomo, depthMapCoordsHomo, i_vox, voxelsNb);
+    }
+}
+
+//----------------------------------------------------------------------------
+template <typename V>
+static SimdReconstructionRowFunction SimdGetRowFunction(int function)
+{
+  switch (function)
+    {
+    case CUDA_RECONSTRUCTION_FUNCTION_CUMUL:
+      return &SimdIntegrateRow<V, SimdFunction<V, CUDA_RECONSTRUCTION_FUNCTION_CUMUL> >;
+    case CUDA_RECONSTRUCTION_FUNCTION_TSDF:
+      return &SimdIntegrateRow<V, SimdFunction<V, CUDA_RECONSTRUCTION_FUNCTION_TSDF> >;
+    case CUDA_RECONSTRUCTION_FUNCTION_LOG_ODDS:
+      return &SimdIntegrateRow<V, SimdFunction<V, CUDA_RECONSTRUCTION_FUNCTION_LOG_ODDS> >;
+    case CUDA_RECONSTRUCTION_FUNCTION_MAX_CONFIDENCE:
+      return &SimdIntegrateRow<V, SimdFunction<V, CUDA_RECONSTRUCTION_FUNCTION_MAX_CONFIDENCE> >;
+    default:
+      return 0;
+    }
+}
+
+#endif
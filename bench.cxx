@@ -0,0 +1,556 @@
+// Benchmark of the integration backends on synthetic scenes: a sphere or a
+// plane seen by cameras orbiting the grid. For each grid size and backend
+// the depth maps are integrated in one pass, profiled by the filter, in a
+// process of its own, and the timings and the memory peaks are written as
+// CSV or JSON.
+
+#include "vtkCellData.h"
+#include "vtkDataArray.h"
+#include "vtkImageData.h"
+#include "vtkMath.h"
+#include "vtkMatrix3x3.h"
+#include "vtkMatrix4x4.h"
+#include "vtkNew.h"
+#include "vtkPointData.h"
+#include "vtkSmartPointer.h"
+#include "vtkCudaReconstructionFilter.h"
+#include "vtkTimerLog.h"
+#include "CudaReconstruction.h"
+
+#include <vtksys/CommandLineArguments.hxx>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// arguments
+std::vector<int> g_gridSizes;
+int g_framesNb;
+std::vector<int> g_depthMapDims;
+std::string g_scene;
+std::vector<std::string> g_backends;
+std::string g_format;
+std::string g_outputFilename;
+bool g_singlePrecision;
+bool g_noVectorization;
+bool g_linearLayout;
+
+// Result of the integration of the frames into a grid by a backend, the
+// stages being timed by the filter during the same update, and the peaks
+// of the device blocks of the memory pool and of the resident memory of
+// the process running the configuration. It is copied as is from the
+// process of the configuration.
+struct BenchResult
+{
+  int gridSize;
+  int backend;
+  bool success;
+  double totalMs;
+  double stagesMs[vtkCudaReconstructionFilter::PROFILE_STAGES_NB];
+  double voxelsPerSecond;
+  size_t devicePeakBytes;
+  long hostPeakKb;
+};
+
+bool read_arguments(int argc, char ** argv);
+void make_camera(int frame, vtkMatrix3x3* matrixK, vtkMatrix4x4* matrixTR);
+vtkSmartPointer<vtkImageData> make_depth_map(vtkMatrix3x3* matrixK, vtkMatrix4x4* matrixTR);
+void make_grid(int gridSize, vtkImageData* grid);
+bool run_filter(vtkImageData* grid, const std::vector<vtkSmartPointer<vtkImageData> >& depthMaps,
+                const std::vector<vtkSmartPointer<vtkMatrix3x3> >& matricesK,
+                const std::vector<vtkSmartPointer<vtkMatrix4x4> >& matricesTR, int backend,
+                BenchResult& result);
+void run_configuration(int gridSize, int backend, BenchResult& result);
+void run_isolated_configuration(int gridSize, int backend, BenchResult& result);
+long get_host_peak_memory();
+void write_csv(std::ostream& os, const std::vector<BenchResult>& results);
+void write_json(std::ostream& os, const std::vector<BenchResult>& results);
+int backend_from_string(const std::string& backend);
+
+int main(int argc, char ** argv)
+{
+  if (!read_arguments(argc, argv))
+    {
+    return EXIT_FAILURE;
+    }
+
+  // each grid and backend is run in its own process, so that the peak of
+  // its host memory is its own
+  std::vector<BenchResult> results;
+  for (size_t g = 0; g < g_gridSizes.size(); g++)
+    {
+    for (size_t b = 0; b < g_backends.size(); b++)
+      {
+      BenchResult result;
+      run_isolated_configuration(g_gridSizes[g], backend_from_string(g_backends[b]), result);
+      results.push_back(result);
+
+      std::cerr << g_gridSizes[g] << "^3 " << g_backends[b] << ": "
+                << (result.success ? "" : "failed, ") << result.totalMs << " ms" << std::endl;
+      }
+    }
+
+  // write the results
+  std::ofstream file;
+  if (g_outputFilename != "")
+    {
+    file.open(g_outputFilename.c_str());
+    if (!file.is_open())
+      {
+      std::cerr << "Unable to open " << g_outputFilename << "." << std::endl;
+      return EXIT_FAILURE;
+      }
+    }
+  std::ostream& os = file.is_open() ? file : std::cout;
+  if (g_format == "json")
+    {
+    write_json(os, results);
+    }
+  else
+    {
+    write_csv(os, results);
+    }
+
+  return EXIT_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------
+// Camera looking at the center of the grid from a circle of radius 3 above
+// it, the frames are spread over the circle
+void make_camera(int frame, vtkMatrix3x3* matrixK, vtkMatrix4x4* matrixTR)
+{
+  // intrinsics, about 53 degrees of horizontal field of view
+  matrixK->Identity();
+  matrixK->SetElement(0, 0, g_depthMapDims[0]);
+  matrixK->SetElement(1, 1, g_depthMapDims[0]);
+  matrixK->SetElement(0, 2, 0.5 * (g_depthMapDims[0] - 1));
+  matrixK->SetElement(1, 2, 0.5 * (g_depthMapDims[1] - 1));
+
+  // camera axes: x to the right, y down and z toward the center of the grid
+  double angle = 2 * vtkMath::Pi() * frame / g_framesNb;
+  double center[3] = {3 * cos(angle), 3 * sin(angle), 1.5};
+  double axisZ[3] = {-center[0], -center[1], -center[2]};
+  vtkMath::Normalize(axisZ);
+  double up[3] = {0, 0, 1};
+  double axisX[3];
+  vtkMath::Cross(axisZ, up, axisX);
+  vtkMath::Normalize(axisX);
+  double axisY[3];
+  vtkMath::Cross(axisZ, axisX, axisY);
+
+  // world to camera
+  matrixTR->Identity();
+  for (int j = 0; j < 3; j++)
+    {
+    matrixTR->SetElement(0, j, axisX[j]);
+    matrixTR->SetElement(1, j, axisY[j]);
+    matrixTR->SetElement(2, j, axisZ[j]);
+    }
+  matrixTR->SetElement(0, 3, -vtkMath::Dot(axisX, center));
+  matrixTR->SetElement(1, 3, -vtkMath::Dot(axisY, center));
+  matrixTR->SetElement(2, 3, -vtkMath::Dot(axisZ, center));
+}
+
+//-----------------------------------------------------------------------------
+// Depth map of the scene seen by a camera: the distance from the camera
+// center along the ray of each pixel, the background is far away
+vtkSmartPointer<vtkImageData> make_depth_map(vtkMatrix3x3* matrixK, vtkMatrix4x4* matrixTR)
+{
+  const double sphereRadius = 0.5;
+  const double backgroundDepth = 100;
+
+  // camera center, and rotation from camera to world
+  double rotation[3][3];
+  double translation[3];
+  for (int i = 0; i < 3; i++)
+    {
+    for (int j = 0; j < 3; j++)
+      {
+      rotation[i][j] = matrixTR->GetElement(j, i);
+      }
+    translation[i] = matrixTR->GetElement(i, 3);
+    }
+  double center[3];
+  vtkMath::Multiply3x3(rotation, translation, center);
+  for (int i = 0; i < 3; i++)
+    {
+    center[i] = -center[i];
+    }
+
+  vtkSmartPointer<vtkImageData> depthMap = vtkSmartPointer<vtkImageData>::New();
+  depthMap->SetDimensions(g_depthMapDims[0], g_depthMapDims[1], 1);
+  vtkSmartPointer<vtkDataArray> depths;
+  depths.TakeReference(vtkDataArray::CreateDataArray(g_singlePrecision ? VTK_FLOAT : VTK_DOUBLE));
+  depths->SetName("Depths");
+  depths->SetNumberOfComponents(1);
+  depths->SetNumberOfTuples(depthMap->GetNumberOfPoints());
+
+  double fx = matrixK->GetElement(0, 0);
+  double fy = matrixK->GetElement(1, 1);
+  double cx = matrixK->GetElement(0, 2);
+  double cy = matrixK->GetElement(1, 2);
+  for (int v = 0; v < g_depthMapDims[1]; v++)
+    {
+    for (int u = 0; u < g_depthMapDims[0]; u++)
+      {
+      double rayCamera[3] = {(u - cx) / fx, (v - cy) / fy, 1};
+      double ray[3];
+      vtkMath::Multiply3x3(rotation, rayCamera, ray);
+      vtkMath::Normalize(ray);
+
+      double depth = backgroundDepth;
+      if (g_scene == "plane")
+        {
+        // plane z = 0
+        if (ray[2] < 0)
+          {
+          depth = -center[2] / ray[2];
+          }
+        }
+      else
+        {
+        // sphere at the center of the grid
+        double b = vtkMath::Dot(center, ray);
+        double c = vtkMath::Dot(center, center) - sphereRadius * sphereRadius;
+        double delta = b * b - c;
+        if (delta >= 0 && -b - sqrt(delta) > 0)
+          {
+          depth = -b - sqrt(delta);
+          }
+        }
+      depths->SetTuple1(u + v * g_depthMapDims[0], depth);
+      }
+    }
+  depthMap->GetPointData()->AddArray(depths);
+  return depthMap;
+}
+
+//-----------------------------------------------------------------------------
+// Grid of gridSize^3 cells over [-1, 1]^3
+void make_grid(int gridSize, vtkImageData* grid)
+{
+  grid->SetDimensions(gridSize + 1, gridSize + 1, gridSize + 1);
+  grid->SetSpacing(2.0 / gridSize, 2.0 / gridSize, 2.0 / gridSize);
+  grid->SetOrigin(-1, -1, -1);
+}
+
+//-----------------------------------------------------------------------------
+// Integrate all the depth maps with the filter, the frustum culling is off
+// so that every backend integrates all the voxels. The profiling of the
+// filter times the stages of this update, without overlapping the
+// transfers and the integrations, and the bytes of the memory pool in use
+// are read before the filter releases them.
+bool run_filter(vtkImageData* grid, const std::vector<vtkSmartPointer<vtkImageData> >& depthMaps,
+                const std::vector<vtkSmartPointer<vtkMatrix3x3> >& matricesK,
+                const std::vector<vtkSmartPointer<vtkMatrix4x4> >& matricesTR, int backend,
+                BenchResult& result)
+{
+  vtkNew<vtkMatrix4x4> gridMatrix;
+  gridMatrix->Identity();
+
+  vtkNew<vtkCudaReconstructionFilter> cudaReconstructionFilter;
+  cudaReconstructionFilter->SetInputData(grid);
+  cudaReconstructionFilter->SetGridMatrix(gridMatrix.Get());
+  for (size_t i = 0; i < depthMaps.size(); i++)
+    {
+    cudaReconstructionFilter->AddDepthMap(depthMaps[i], matricesK[i], matricesTR[i]);
+    }
+  cudaReconstructionFilter->SetBackend(backend);
+  cudaReconstructionFilter->SetOutputScalarPrecision(g_singlePrecision ?
+    vtkAlgorithm::SINGLE_PRECISION : vtkAlgorithm::DOUBLE_PRECISION);
+  cudaReconstructionFilter->FrustumCullingOff();
+  cudaReconstructionFilter->SetVectorization(g_noVectorization ? 0 : 1);
+  cudaReconstructionFilter->SetDeviceLayout(g_linearLayout ?
+    vtkCudaReconstructionFilter::LAYOUT_LINEAR : vtkCudaReconstructionFilter::LAYOUT_BRICKS);
+  cudaReconstructionFilter->ProfilingOn();
+
+  cuda_reconstruction_reset_pool_device_peak();
+  double start = vtkTimerLog::GetUniversalTime();
+  cudaReconstructionFilter->Update();
+  result.totalMs = 1000 * (vtkTimerLog::GetUniversalTime() - start);
+  for (int s = 0; s < vtkCudaReconstructionFilter::PROFILE_STAGES_NB; s++)
+    {
+    result.stagesMs[s] = cudaReconstructionFilter->GetLastStageTime(s);
+    }
+  result.devicePeakBytes = cuda_reconstruction_get_pool_device_peak();
+
+  vtkImageData* output = vtkImageData::SafeDownCast(cudaReconstructionFilter->GetOutput());
+  return output && output->GetCellData()->GetArray("reconstruction_scalar") &&
+    cudaReconstructionFilter->GetLastBackend() == backend;
+}
+
+//-----------------------------------------------------------------------------
+// Integrate the depth maps of the scene into a grid with a backend
+void run_configuration(int gridSize, int backend, BenchResult& result)
+{
+  result.gridSize = gridSize;
+  result.backend = backend;
+
+  // the first cuda call creates the device context, keep it out of the
+  // timings
+  int devicesNb;
+  size_t freeMemory, totalMemory;
+  cuda_reconstruction_get_device_info(&devicesNb, &freeMemory, &totalMemory);
+
+  std::vector<vtkSmartPointer<vtkImageData> > depthMaps;
+  std::vector<vtkSmartPointer<vtkMatrix3x3> > matricesK;
+  std::vector<vtkSmartPointer<vtkMatrix4x4> > matricesTR;
+  for (int i = 0; i < g_framesNb; i++)
+    {
+    vtkSmartPointer<vtkMatrix3x3> matrixK = vtkSmartPointer<vtkMatrix3x3>::New();
+    vtkSmartPointer<vtkMatrix4x4> matrixTR = vtkSmartPointer<vtkMatrix4x4>::New();
+    make_camera(i, matrixK, matrixTR);
+    depthMaps.push_back(make_depth_map(matrixK, matrixTR));
+    matricesK.push_back(matrixK);
+    matricesTR.push_back(matrixTR);
+    }
+
+  vtkNew<vtkImageData> grid;
+  make_grid(gridSize, grid.Get());
+  double voxelsNb = static_cast<double>(grid->GetNumberOfCells());
+  result.success = run_filter(grid.Get(), depthMaps, matricesK, matricesTR, backend, result);
+  result.voxelsPerSecond = result.totalMs > 0 ? voxelsNb * g_framesNb / (result.totalMs / 1000) : 0;
+  result.hostPeakKb = get_host_peak_memory();
+}
+
+//-----------------------------------------------------------------------------
+// Run a configuration in a child process which sends its result back
+// through a pipe, the cuda devices being only used by the children. On
+// Windows it runs in this process, whose peak memory then covers the
+// previous configurations too.
+void run_isolated_configuration(int gridSize, int backend, BenchResult& result)
+{
+  result.gridSize = gridSize;
+  result.backend = backend;
+  result.success = false;
+  result.totalMs = 0;
+  for (int s = 0; s < vtkCudaReconstructionFilter::PROFILE_STAGES_NB; s++)
+    {
+    result.stagesMs[s] = 0;
+    }
+  result.voxelsPerSecond = 0;
+  result.devicePeakBytes = 0;
+  result.hostPeakKb = 0;
+#ifdef _WIN32
+  run_configuration(gridSize, backend, result);
+#else
+  int fds[2];
+  if (pipe(fds) != 0)
+    {
+    std::cerr << "Unable to create a pipe." << std::endl;
+    return;
+    }
+  pid_t pid = fork();
+  if (pid < 0)
+    {
+    std::cerr << "Unable to fork the configuration process." << std::endl;
+    close(fds[0]);
+    close(fds[1]);
+    return;
+    }
+  if (pid == 0)
+    {
+    close(fds[0]);
+    BenchResult childResult = result;
+    run_configuration(gridSize, backend, childResult);
+    bool written = write(fds[1], &childResult, sizeof(childResult)) == static_cast<ssize_t>(sizeof(childResult));
+    close(fds[1]);
+    _exit(written ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+  close(fds[1]);
+  BenchResult childResult;
+  size_t readBytes = 0;
+  char* buffer = reinterpret_cast<char*>(&childResult);
+  while (readBytes < sizeof(childResult))
+    {
+    ssize_t n = read(fds[0], buffer + readBytes, sizeof(childResult) - readBytes);
+    if (n <= 0)
+      {
+      break;
+      }
+    readBytes += static_cast<size_t>(n);
+    }
+  close(fds[0]);
+  int status;
+  waitpid(pid, &status, 0);
+  if (readBytes == sizeof(childResult))
+    {
+    result = childResult;
+    }
+  else
+    {
+    std::cerr << "The configuration process of the " << gridSize << "^3 grid failed." << std::endl;
+    }
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Peak resident memory of the process in kB, 0 when unknown
+long get_host_peak_memory()
+{
+#ifndef _WIN32
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+    }
+#endif
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+void write_csv(std::ostream& os, const std::vector<BenchResult>& results)
+{
+  os << "grid_size,frames,backend,precision,layout,success,total_ms,upload_ms,kernel_ms,download_ms,"
+     << "host_prepare_ms,vtk_ms,voxels_per_s,device_peak_bytes,host_peak_kb" << std::endl;
+  for (size_t i = 0; i < results.size(); i++)
+    {
+    const BenchResult& r = results[i];
+    os << r.gridSize << "," << g_framesNb << "," << vtkCudaReconstructionFilter::GetBackendAsString(r.backend) << ","
+       << (g_singlePrecision ? "float" : "double") << "," << (g_linearLayout ? "linear" : "bricks") << ","
+       << (r.success ? 1 : 0) << ","
+       << r.totalMs << "," << r.stagesMs[vtkCudaReconstructionFilter::PROFILE_STAGE_UPLOAD] << ","
+       << r.stagesMs[vtkCudaReconstructionFilter::PROFILE_STAGE_KERNEL] << ","
+       << r.stagesMs[vtkCudaReconstructionFilter::PROFILE_STAGE_DOWNLOAD] << ","
+       << r.stagesMs[vtkCudaReconstructionFilter::PROFILE_STAGE_HOST_PREPARE] << ","
+       << r.stagesMs[vtkCudaReconstructionFilter::PROFILE_STAGE_WRAP] << ","
+       << r.voxelsPerSecond << "," << r.devicePeakBytes << "," << r.hostPeakKb << std::endl;
+    }
+}
+
+//-----------------------------------------------------------------------------
+void write_json(std::ostream& os, const std::vector<BenchResult>& results)
+{
+  os << "[" << std::endl;
+  for (size_t i = 0; i < results.size(); i++)
+    {
+    const BenchResult& r = results[i];
+    os << "  {\"grid_size\": " << r.gridSize << ", \"frames\": " << g_framesNb
+       << ", \"backend\": \"" << vtkCudaReconstructionFilter::GetBackendAsString(r.backend)
+       << "\", \"precision\": \""
+       << (g_singlePrecision ? "float" : "double") << "\", \"layout\": \""
+       << (g_linearLayout ? "linear" : "bricks") << "\", \"success\": " << (r.success ? "true" : "false")
+       << ", \"total_ms\": " << r.totalMs
+       << ", \"upload_ms\": " << r.stagesMs[vtkCudaReconstructionFilter::PROFILE_STAGE_UPLOAD]
+       << ", \"kernel_ms\": " << r.stagesMs[vtkCudaReconstructionFilter::PROFILE_STAGE_KERNEL]
+       << ", \"download_ms\": " << r.stagesMs[vtkCudaReconstructionFilter::PROFILE_STAGE_DOWNLOAD]
+       << ", \"host_prepare_ms\": " << r.stagesMs[vtkCudaReconstructionFilter::PROFILE_STAGE_HOST_PREPARE]
+       << ", \"vtk_ms\": " << r.stagesMs[vtkCudaReconstructionFilter::PROFILE_STAGE_WRAP]
+       << ", \"voxels_per_s\": " << r.voxelsPerSecond
+       << ", \"device_peak_bytes\": " << r.devicePeakBytes << ", \"host_peak_kb\": " << r.hostPeakKb << "}"
+       << (i + 1 < results.size() ? "," : "") << std::endl;
+    }
+  os << "]" << std::endl;
+}
+
+//-----------------------------------------------------------------------------
+int backend_from_string(const std::string& backend)
+{
+  for (int i = vtkCudaReconstructionFilter::BACKEND_CUDA; i <= vtkCudaReconstructionFilter::BACKEND_CPU_SERIAL; i++)
+    {
+    if (backend == vtkCudaReconstructionFilter::GetBackendAsString(i))
+      {
+      return i;
+      }
+    }
+  return -1;
+}
+
+//-----------------------------------------------------------------------------
+bool read_arguments(int argc, char ** argv)
+{
+  bool help = false;
+  g_framesNb = 10;
+  g_singlePrecision = false;
+  g_noVectorization = false;
+  g_linearLayout = false;
+
+  vtksys::CommandLineArguments arg;
+  arg.Initialize(argc, argv);
+  typedef vtksys::CommandLineArguments argT;
+
+  arg.AddArgument("--gridSizes", argT::MULTI_ARGUMENT, &g_gridSizes, "Specify the numbers of cells per side of the grids, from 64 to 1024 (default 64 128 256)");
+  arg.AddArgument("--framesNb", argT::SPACE_ARGUMENT, &g_framesNb, "Specify the number of depth maps (default 10)");
+  arg.AddArgument("--depthMapDims", argT::MULTI_ARGUMENT, &g_depthMapDims, "Specify the depth map dimensions (default 640 480)");
+  arg.AddArgument("--scene", argT::SPACE_ARGUMENT, &g_scene, "Specify the scene: sphere or plane (default sphere)");
+  arg.AddArgument("--backends", argT::MULTI_ARGUMENT, &g_backends, "Specify the backends: cuda, cpu and/or serial (default cuda cpu)");
+  arg.AddArgument("--format", argT::SPACE_ARGUMENT, &g_format, "Specify the output format: csv or json (default csv)");
+  arg.AddArgument("--outputFilename", argT::SPACE_ARGUMENT, &g_outputFilename, "Specify the output filename (default standard output)");
+  arg.AddBooleanArgument("--singlePrecision", &g_singlePrecision, "Integrate in float");
+  arg.AddBooleanArgument("--noVectorization", &g_noVectorization, "Integrate the float rows of the cpu backend without AVX2/AVX-512");
+  arg.AddBooleanArgument("--linearLayout", &g_linearLayout, "Lay the device grid out x fastest instead of by bricks of 8x8x8 voxels");
+  arg.AddBooleanArgument("--help", &help, "Print this help message");
+
+  int result = arg.Parse();
+  if (!result || help)
+    {
+    std::cout << arg.GetHelp() ;
+    return false;
+    }
+
+  if (g_gridSizes.empty())
+    {
+    g_gridSizes.push_back(64);
+    g_gridSizes.push_back(128);
+    g_gridSizes.push_back(256);
+    }
+  if (g_depthMapDims.size() != 2)
+    {
+    g_depthMapDims.clear();
+    g_depthMapDims.push_back(640);
+    g_depthMapDims.push_back(480);
+    }
+  if (g_scene == "")
+    {
+    g_scene = "sphere";
+    }
+  if (g_backends.empty())
+    {
+    g_backends.push_back("cuda");
+    g_backends.push_back("cpu");
+    }
+  if (g_format == "")
+    {
+    g_format = "csv";
+    }
+
+  for (size_t i = 0; i < g_gridSizes.size(); i++)
+    {
+    if (g_gridSizes[i] <= 0)
+      {
+      std::cout << "Bad grid size " << g_gridSizes[i] << "." << std::endl;
+      return false;
+      }
+    }
+  for (size_t i = 0; i < g_backends.size(); i++)
+    {
+    if (backend_from_string(g_backends[i]) < 0)
+      {
+      std::cout << "Unknown backend " << g_backends[i] << "." << std::endl;
+      std::cout << arg.GetHelp() ;
+      return false;
+      }
+    }
+  if (g_framesNb <= 0 || g_depthMapDims[0] <= 0 || g_depthMapDims[1] <= 0 ||
+      (g_scene != "sphere" && g_scene != "plane") || (g_format != "csv" && g_format != "json"))
+    {
+    std::cout << "Problem parsing arguments." << std::endl;
+    std::cout << arg.GetHelp() ;
+    return false;
+    }
+
+  return true;
+}
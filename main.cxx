@@ -1,21 +1,38 @@
+#include "vtkCoarseToFineReconstructionFilter.h"
+#include "vtkConditionVariable.h"
+#include "vtkDepthMapSequence.h"
 #include "vtkImageData.h"
+#include "vtkMath.h"
 #include "vtkMatrix3x3.h"
 #include "vtkMatrix4x4.h"
+#include "vtkMultiThreader.h"
+#include "vtkMutexLock.h"
 #include "vtkNew.h"
-#include "vtkPiecewiseFunction.h"
 #include "vtkPolyData.h"
 #include "vtkCudaReconstructionFilter.h"
+#include "vtkSmartPointer.h"
 #include "vtkStructuredGrid.h"
 #include "vtkTransform.h"
 #include "vtkTransformFilter.h"
-#include "vtkUnstructuredGrid.h"
 #include "vtkXMLImageDataReader.h"
+#include "vtkXMLImageDataWriter.h"
+#include "vtkXMLMultiBlockDataWriter.h"
+#include "vtkXMLPImageDataWriter.h"
+#include "vtkXMLPolyDataWriter.h"
 #include "vtkXMLStructuredGridReader.h"
 #include "vtkXMLStructuredGridWriter.h"
 
 #include <vtksys/CommandLineArguments.hxx>
+#include <vtksys/Glob.hxx>
 #include <vtksys/SystemTools.hxx>
 
+#include <algorithm>
+#include <map>
+
+// Literal of the value of a macro, for the help messages
+#define MAIN_STRINGIFY(x) #x
+#define MAIN_VALUE_STRING(x) MAIN_STRINGIFY(x)
+
 // arguments
 std::vector<int> g_gridDims(3);
 std::vector<double> g_gridSpacing(3);
@@ -26,30 +43,107 @@ std::vector<double> g_gridVecZ(3);
 std::string g_depthMapFilename;
 std::string g_matrixKRTDFilename;
 std::string g_outputGridFilename;
+std::string g_sequenceFilename;
+std::string g_depthMapPattern;
+std::string g_matrixKRTDPattern;
+int g_frameStride;
+int g_maxFrames;
+int g_readerThreads;
+std::string g_convertedSequenceFilename;
+bool g_halfPrecisionDepths;
+bool g_compressDepths;
+std::string g_backend;
+bool g_singlePrecision;
+std::string g_integrationFunction;
+double g_truncationDistance;
+std::string g_storageFormat;
+std::string g_deviceLayout;
+double g_minDepth;
+double g_maxDepth;
+std::string g_confidenceArrayName;
+double g_minConfidence;
+int g_depthMapLevel;
+bool g_downsampleDepthMaps;
+bool g_profiling;
+int g_verbosity;
+std::string g_outputMode;
+int g_outputPieces;
+std::string g_surfaceFilename;
+double g_surfaceValue;
+int g_levels;
+int g_pendingDepthMaps;
+int g_projectionCacheSize;
+int g_blockSize;
+double g_refinementThreshold;
+
+// Number of depth maps read ahead of the integration in sequence mode, in
+// addition to the one of each reader thread
+#define SEQUENCE_QUEUE_SIZE 2
+
+// A depth map of a sequence with its matrices
+struct SequenceFrame
+{
+  vtkSmartPointer<vtkImageData> DepthMap;
+  vtkSmartPointer<vtkMatrix3x3> MatrixK;
+  vtkSmartPointer<vtkMatrix4x4> MatrixTR;
+};
+
+// State shared by the threads reading a sequence and the integration. The
+// threads read the frames in any order, the integration takes them in the
+// order of the sequence.
+struct SequenceReader
+{
+  std::vector<std::string> DepthMapFilenames;
+  std::vector<std::string> MatrixKRTDFilenames;
+  std::map<size_t, SequenceFrame> Frames;
+  size_t NextRead;
+  size_t NextFrame;
+  size_t ReadAhead;
+  int RunningThreads;
+  bool Failed;
+  bool Aborted;
+  vtkMutexLock* Lock;
+  vtkConditionVariable* Condition;
+};
 
 bool read_arguments(int argc, char ** argv);
 bool read_krtd(std::string filename, vtkMatrix3x3* matrixK, vtkMatrix4x4* matrixTR);
+bool read_sequence_file(std::string filename, std::vector<std::string>& depthMapFilenames,
+                        std::vector<std::string>& matrixKRTDFilenames);
+bool find_sequence_files(const std::string& depthMapPattern, const std::string& matrixKRTDPattern,
+                         std::vector<std::string>& depthMapFilenames,
+                         std::vector<std::string>& matrixKRTDFilenames);
+bool get_sequence_files(const std::string& filename, std::vector<std::string>& depthMapFilenames,
+                        std::vector<std::string>& matrixKRTDFilenames);
+bool integrate_sequence(vtkCudaReconstructionFilter* filter, const std::string& filename);
+bool convert_sequence(const std::string& filename, const std::string& outputFilename);
+int backend_from_string(const std::string& backend);
+int function_from_string(const std::string& function);
+int storage_from_string(const std::string& storage);
+int layout_from_string(const std::string& layout);
+bool is_output_mode(const std::string& mode);
+void compute_grid_matrix(vtkMatrix4x4* gridMatrix);
+bool write_output(vtkCudaReconstructionFilter* filter, vtkMatrix4x4* gridMatrix);
+bool write_surface(vtkCudaReconstructionFilter* filter, vtkMatrix4x4* gridMatrix);
+bool write_blocks(vtkCudaReconstructionFilter* filter, vtkImageData* grid);
 
-// todo remove
 void init_arguments();
 
 int main(int argc, char ** argv)
 {
   // arguments
-  // todo activate read_arguments and deactivate init_arguments
-  /*
+  init_arguments();
   if (!read_arguments(argc, argv))
     {
     return EXIT_FAILURE;
     }
-   * */
-  init_arguments();
+  bool sequence = g_sequenceFilename != "" || g_depthMapPattern != "";
 
-  // read depth map
-  vtkNew<vtkXMLImageDataReader> depthMapReader;
-  depthMapReader->SetFileName(g_depthMapFilename.c_str());
-  depthMapReader->Update();
-  vtkImageData* depthMap = depthMapReader->GetOutput();
+  // convert a sequence of vti and krtd files to a binary sequence file
+  if (g_convertedSequenceFilename != "")
+    {
+    return convert_sequence(g_sequenceFilename, g_convertedSequenceFilename) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
   // generate grid from arguments
   vtkNew<vtkImageData> grid;
@@ -57,113 +151,94 @@ int main(int argc, char ** argv)
   grid->SetSpacing(&g_gridSpacing[0]);
   grid->SetOrigin(&g_gridOrigin[0]);
 
-  // read depth map matrix
-  vtkNew<vtkMatrix3x3> depthMapMatrixK;
-  vtkNew<vtkMatrix4x4> depthMapMatrixTR;
-  bool res = read_krtd(g_matrixKRTDFilename, depthMapMatrixK.Get(), depthMapMatrixTR.Get());
-  if (!res)
-    {
-    return EXIT_FAILURE;
-    }
-
-  // todo compute matrix
-  // compute transform matrix from gridVecs
+  // the grid vectors orient the grid around its origin
   vtkNew<vtkMatrix4x4> gridMatrix;
-  gridMatrix->Identity();
+  compute_grid_matrix(gridMatrix.Get());
 
-  // todo remove
-  std::cout << "Reconstruction filter." << std::endl;
+  if (g_verbosity >= 1)
+    {
+    std::cout << "Reconstruction filter." << std::endl;
+    }
 
   // reconstruction
   vtkNew<vtkCudaReconstructionFilter> cudaReconstructionFilter;
   cudaReconstructionFilter->SetInputData(grid.Get());
-  cudaReconstructionFilter->SetDepthMap(depthMap);
-  cudaReconstructionFilter->SetDepthMapMatrixK(depthMapMatrixK.Get());
-  cudaReconstructionFilter->SetDepthMapMatrixTR(depthMapMatrixTR.Get());
   cudaReconstructionFilter->SetGridMatrix(gridMatrix.Get());
-  cudaReconstructionFilter->Update();
-
-  // todo remove
-  std::cout << "Transform filter." << std::endl;
+  cudaReconstructionFilter->SetBackend(backend_from_string(g_backend));
+  cudaReconstructionFilter->SetOutputScalarPrecision(g_singlePrecision ?
+    vtkAlgorithm::SINGLE_PRECISION : vtkAlgorithm::DEFAULT_PRECISION);
+  cudaReconstructionFilter->SetIntegrationFunction(function_from_string(g_integrationFunction));
+  cudaReconstructionFilter->SetTruncationDistance(g_truncationDistance);
+  cudaReconstructionFilter->SetStorageFormat(storage_from_string(g_storageFormat));
+  cudaReconstructionFilter->SetDeviceLayout(layout_from_string(g_deviceLayout));
+  cudaReconstructionFilter->SetMinDepth(g_minDepth);
+  cudaReconstructionFilter->SetMaxDepth(g_maxDepth);
+  if (g_confidenceArrayName != "")
+    {
+    cudaReconstructionFilter->SetConfidenceArrayName(g_confidenceArrayName.c_str());
+    cudaReconstructionFilter->SetMinConfidence(g_minConfidence);
+    }
+  cudaReconstructionFilter->SetDepthMapLevel(g_depthMapLevel);
+  cudaReconstructionFilter->SetProfiling(g_profiling);
+  cudaReconstructionFilter->SetVerbosity(g_verbosity);
+  cudaReconstructionFilter->SetMaxPendingDepthMaps(g_pendingDepthMaps);
+  cudaReconstructionFilter->SetProjectionCacheSize(g_projectionCacheSize);
+  if (g_surfaceFilename != "")
+    {
+    cudaReconstructionFilter->ExtractSurfaceOn();
+    cudaReconstructionFilter->SetSurfaceValue(g_surfaceValue);
+    }
+  if (sequence && g_levels > 1)
+    {
+    std::cout << "The coarse to fine reconstruction needs --depthMapFilename." << std::endl;
+    return EXIT_FAILURE;
+    }
+  if (sequence)
+    {
+    // integrate the sequence frame by frame while the next frames are read
+    cudaReconstructionFilter->IncrementalOn();
+    if (!integrate_sequence(cudaReconstructionFilter.Get(), g_sequenceFilename))
+      {
+      return EXIT_FAILURE;
+      }
+    }
+  else
+    {
+    // read depth map
+    vtkNew<vtkXMLImageDataReader> depthMapReader;
+    depthMapReader->SetFileName(g_depthMapFilename.c_str());
+    depthMapReader->Update();
+
+    // read depth map matrix
+    vtkNew<vtkMatrix3x3> depthMapMatrixK;
+    vtkNew<vtkMatrix4x4> depthMapMatrixTR;
+    bool res = read_krtd(g_matrixKRTDFilename, depthMapMatrixK.Get(), depthMapMatrixTR.Get());
+    if (!res)
+      {
+      return EXIT_FAILURE;
+      }
 
-  // todo compute transform according to gridVecs
-  vtkNew<vtkTransform> transform;
-  transform->SetMatrix(gridMatrix.Get());
-  vtkNew<vtkTransformFilter> transformFilter;
-  transformFilter->SetInputConnection(cudaReconstructionFilter->GetOutputPort());
-  transformFilter->SetTransform(transform.Get());
-  transformFilter->Update();
-  vtkStructuredGrid* outputGrid = vtkStructuredGrid::SafeDownCast(transformFilter->GetOutput());
+    cudaReconstructionFilter->SetDepthMap(depthMapReader->GetOutput());
+    cudaReconstructionFilter->SetDepthMapMatrixK(depthMapMatrixK.Get());
+    cudaReconstructionFilter->SetDepthMapMatrixTR(depthMapMatrixTR.Get());
+    }
 
-  // todo remove
-  std::cout << "Write output." << std::endl;
+  // the levels refine the blocks of the grid crossed by the surfaces
+  if (g_levels > 1)
+    {
+    return write_blocks(cudaReconstructionFilter.Get(), grid.Get()) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
-  vtkNew<vtkXMLStructuredGridWriter> gridWriter;
-  gridWriter->SetFileName(g_outputGridFilename.c_str());
-  gridWriter->SetInputData(outputGrid);
-  gridWriter->Write();
-
-  ////////// Setup visualization ////////
-
-  // todo remove
-  /*
-  // structured to tetra
-  vtkNew<vtkThreshold> thresholdFilter;
-  thresholdFilter->SetInputData(outputGrid);
-  thresholdFilter->ThresholdByUpper(-1);
-  thresholdFilter->AllScalarsOff();
-  vtkNew<vtkDataSetTriangleFilter> trifilter;
-  trifilter->SetInputConnection(thresholdFilter->GetOutputPort());
-  trifilter->Update();
-  vtkUnstructuredGrid* uGrid = trifilter->GetOutput();
-  std::cout << uGrid->GetNumberOfPoints() << std::endl;
-
-  // mapper
-  vtkNew<vtkProjectedTetrahedraMapper> gridMapper;
-  gridMapper->SetInputData(uGrid);
-
-  // Create transfer mapping scalar value to opacity.
-  vtkNew<vtkPiecewiseFunction> opacityTransferFunction;
-  opacityTransferFunction->AddPoint(00.0,  0.1);
-  opacityTransferFunction->AddPoint(80.0,  0.2);
-  opacityTransferFunction->AddPoint(120.0, 0.3);
-  opacityTransferFunction->AddPoint(255.0, 0.4);
-
-  // Create transfer mapping scalar value to color.
-  vtkNew<vtkColorTransferFunction> colorTransferFunction;
-  colorTransferFunction->AddRGBPoint(00.0,  1.0, 0.0, 0.0);
-  colorTransferFunction->AddRGBPoint(80.0,  0.0, 0.0, 0.0);
-  colorTransferFunction->AddRGBPoint(120.0, 0.0, 0.0, 1.0);
-  colorTransferFunction->AddRGBPoint(160.0, 1.0, 0.0, 0.0);
-  colorTransferFunction->AddRGBPoint(200.0, 0.0, 1.0, 0.0);
-  colorTransferFunction->AddRGBPoint(255.0, 0.0, 1.0, 1.0);
-
-  // The property describes how the data will look.
-  vtkNew<vtkVolumeProperty> volumeProperty;
-  volumeProperty->SetColor(colorTransferFunction.Get());
-  volumeProperty->SetScalarOpacity(opacityTransferFunction.Get());
-  volumeProperty->ShadeOff();
-  volumeProperty->SetInterpolationTypeToLinear();
-
-  // actor
-  vtkNew<vtkVolume> gridActor;
-  gridActor->SetMapper(gridMapper.Get());
-  gridActor->SetProperty(volumeProperty.Get());
-
-  vtkNew<vtkRenderer> renderer;
-  vtkNew<vtkRenderWindow> renderWindow;
-  renderWindow->AddRenderer(renderer.Get());
-  vtkNew<vtkRenderWindowInteractor> renderWindowInteractor;
-  renderWindowInteractor->SetRenderWindow(renderWindow.Get());
-
-  vtkNew<vtkInteractorStyleTrackballCamera> style;
-  renderWindowInteractor->SetInteractorStyle(style.Get());
-
-  renderer->AddActor(gridActor.Get());
-
-  renderWindow->Render();
-  renderWindowInteractor->Start();
-   * */
+  // the surface is written first, from the volume reconstructed in one
+  // piece, the reconstruction then runs as the writer requests the output
+  if (g_surfaceFilename != "" && !write_surface(cudaReconstructionFilter.Get(), gridMatrix.Get()))
+    {
+    return EXIT_FAILURE;
+    }
+  if (!write_output(cudaReconstructionFilter.Get(), gridMatrix.Get()))
+    {
+    return EXIT_FAILURE;
+    }
 
   return EXIT_SUCCESS;
 }
@@ -174,8 +249,7 @@ bool read_krtd(std::string filename, vtkMatrix3x3* matrixK, vtkMatrix4x4* matrix
   std::ifstream file(filename.c_str());
   if (!file.is_open())
     {
-    // todo error message
-    std::cout << "Unable to open krtd file." << std::endl;
+    std::cerr << "Unable to open the krtd file " << filename << "." << std::endl;
     return false;
     }
 
@@ -233,6 +307,463 @@ bool read_krtd(std::string filename, vtkMatrix3x3* matrixK, vtkMatrix4x4* matrix
   return true;
 }
 
+//-----------------------------------------------------------------------------
+// Read a sequence file, each line holds a depth map filename and the
+// filename of its krtd matrices
+bool read_sequence_file(std::string filename, std::vector<std::string>& depthMapFilenames,
+                        std::vector<std::string>& matrixKRTDFilenames)
+{
+  std::ifstream file(filename.c_str());
+  if (!file.is_open())
+    {
+    std::cout << "Unable to open sequence file." << std::endl;
+    return false;
+    }
+
+  std::string line;
+  while (getline(file, line))
+    {
+    std::istringstream iss(line);
+    std::string depthMapFilename;
+    std::string matrixKRTDFilename;
+    if (!(iss >> depthMapFilename))
+      {
+      continue;
+      }
+    if (!(iss >> matrixKRTDFilename))
+      {
+      std::cout << "Missing krtd file for " << depthMapFilename << "." << std::endl;
+      return false;
+      }
+    depthMapFilenames.push_back(depthMapFilename);
+    matrixKRTDFilenames.push_back(matrixKRTDFilename);
+    }
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+// Find the depth maps and the krtd files of a sequence matching two
+// patterns, the frames pair the files in the order of their names
+bool find_sequence_files(const std::string& depthMapPattern, const std::string& matrixKRTDPattern,
+                         std::vector<std::string>& depthMapFilenames,
+                         std::vector<std::string>& matrixKRTDFilenames)
+{
+  vtksys::Glob depthMapGlob;
+  depthMapGlob.RecurseOff();
+  vtksys::Glob matrixKRTDGlob;
+  matrixKRTDGlob.RecurseOff();
+  if (!depthMapGlob.FindFiles(depthMapPattern) || !matrixKRTDGlob.FindFiles(matrixKRTDPattern))
+    {
+    std::cout << "Unable to search the sequence files." << std::endl;
+    return false;
+    }
+  depthMapFilenames = depthMapGlob.GetFiles();
+  matrixKRTDFilenames = matrixKRTDGlob.GetFiles();
+  std::sort(depthMapFilenames.begin(), depthMapFilenames.end());
+  std::sort(matrixKRTDFilenames.begin(), matrixKRTDFilenames.end());
+  if (depthMapFilenames.size() != matrixKRTDFilenames.size())
+    {
+    std::cout << "Found " << depthMapFilenames.size() << " depth maps and " << matrixKRTDFilenames.size()
+              << " krtd files." << std::endl;
+    return false;
+    }
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+// Get the files of the frames of a text sequence file, or of the patterns of
+// the arguments, keeping one frame every g_frameStride up to g_maxFrames
+bool get_sequence_files(const std::string& filename, std::vector<std::string>& depthMapFilenames,
+                        std::vector<std::string>& matrixKRTDFilenames)
+{
+  std::vector<std::string> allDepthMapFilenames;
+  std::vector<std::string> allMatrixKRTDFilenames;
+  bool res = g_depthMapPattern != "" ?
+    find_sequence_files(g_depthMapPattern, g_matrixKRTDPattern, allDepthMapFilenames, allMatrixKRTDFilenames) :
+    read_sequence_file(filename, allDepthMapFilenames, allMatrixKRTDFilenames);
+  if (!res)
+    {
+    return false;
+    }
+  for (size_t i = 0; i < allDepthMapFilenames.size(); i += g_frameStride)
+    {
+    if (g_maxFrames > 0 && static_cast<int>(depthMapFilenames.size()) >= g_maxFrames)
+      {
+      break;
+      }
+    depthMapFilenames.push_back(allDepthMapFilenames[i]);
+    matrixKRTDFilenames.push_back(allMatrixKRTDFilenames[i]);
+    }
+  if (depthMapFilenames.empty())
+    {
+    std::cout << "No frame in the sequence." << std::endl;
+    return false;
+    }
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+// Thread reading frames of a sequence, the readers stay at most ReadAhead
+// frames ahead of the integration
+static VTK_THREAD_RETURN_TYPE read_sequence_frames(void* arg)
+{
+  vtkMultiThreader::ThreadInfo* info = static_cast<vtkMultiThreader::ThreadInfo*>(arg);
+  SequenceReader* reader = static_cast<SequenceReader*>(info->UserData);
+
+  for (;;)
+    {
+    reader->Lock->Lock();
+    while (!reader->Failed && !reader->Aborted && reader->NextRead < reader->DepthMapFilenames.size() &&
+           reader->NextRead >= reader->NextFrame + reader->ReadAhead)
+      {
+      reader->Condition->Wait(reader->Lock);
+      }
+    if (reader->Failed || reader->Aborted || reader->NextRead >= reader->DepthMapFilenames.size())
+      {
+      reader->Lock->Unlock();
+      break;
+      }
+    size_t i = reader->NextRead++;
+    reader->Lock->Unlock();
+
+    // parse the files without holding the lock
+    SequenceFrame frame;
+    vtkNew<vtkXMLImageDataReader> depthMapReader;
+    depthMapReader->SetFileName(reader->DepthMapFilenames[i].c_str());
+    depthMapReader->Update();
+    frame.DepthMap = depthMapReader->GetOutput();
+    frame.MatrixK = vtkSmartPointer<vtkMatrix3x3>::New();
+    frame.MatrixTR = vtkSmartPointer<vtkMatrix4x4>::New();
+    bool failed = frame.DepthMap->GetNumberOfPoints() == 0;
+    if (failed)
+      {
+      std::cout << "Unable to read depth map " << reader->DepthMapFilenames[i] << "." << std::endl;
+      }
+    failed = failed || !read_krtd(reader->MatrixKRTDFilenames[i], frame.MatrixK, frame.MatrixTR);
+
+    reader->Lock->Lock();
+    if (failed)
+      {
+      reader->Failed = true;
+      }
+    else
+      {
+      reader->Frames[i] = frame;
+      }
+    reader->Condition->Broadcast();
+    reader->Lock->Unlock();
+    }
+
+  reader->Lock->Lock();
+  reader->RunningThreads--;
+  reader->Condition->Broadcast();
+  reader->Lock->Unlock();
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//-----------------------------------------------------------------------------
+// Integrate the frames of a sequence into an incremental filter, all of them
+// into one volume. g_readerThreads threads read the next frames while the
+// current one is integrated, and the filter uploads a frame while
+// integrating the previous one.
+bool integrate_sequence(vtkCudaReconstructionFilter* filter, const std::string& filename)
+{
+  // the frames of a binary sequence are mapped in memory, without parsing
+  if (g_depthMapPattern == "" && vtkDepthMapSequence::IsSequenceFile(filename.c_str()))
+    {
+    vtkNew<vtkDepthMapSequence> sequence;
+    if (!sequence->Open(filename.c_str()))
+      {
+      return false;
+      }
+    for (int i = 0, n = 0; i < sequence->GetNumberOfFrames() && (g_maxFrames <= 0 || n < g_maxFrames);
+         i += g_frameStride, n++)
+      {
+      vtkNew<vtkImageData> depthMap;
+      vtkNew<vtkMatrix3x3> depthMapMatrixK;
+      vtkNew<vtkMatrix4x4> depthMapMatrixTR;
+      if (!sequence->GetFrame(i, depthMap.Get(), depthMapMatrixK.Get(), depthMapMatrixTR.Get()))
+        {
+        return false;
+        }
+      if (!filter->IntegrateAsync(depthMap.Get(), depthMapMatrixK.Get(), depthMapMatrixTR.Get()))
+        {
+        std::cout << "Unable to integrate a depth map." << std::endl;
+        return false;
+        }
+      }
+    return filter->Synchronize() != 0;
+    }
+
+  vtkNew<vtkMutexLock> lock;
+  vtkNew<vtkConditionVariable> condition;
+  SequenceReader reader;
+  reader.NextRead = 0;
+  reader.NextFrame = 0;
+  reader.ReadAhead = g_readerThreads + SEQUENCE_QUEUE_SIZE;
+  reader.RunningThreads = g_readerThreads;
+  reader.Failed = false;
+  reader.Aborted = false;
+  reader.Lock = lock.Get();
+  reader.Condition = condition.Get();
+  if (!get_sequence_files(filename, reader.DepthMapFilenames, reader.MatrixKRTDFilenames))
+    {
+    return false;
+    }
+
+  vtkNew<vtkMultiThreader> threader;
+  std::vector<int> threadIds;
+  for (int i = 0; i < g_readerThreads; i++)
+    {
+    threadIds.push_back(threader->SpawnThread(read_sequence_frames, &reader));
+    }
+
+  bool res = true;
+  while (res)
+    {
+    // wait for the next frame, in the order of the sequence
+    lock->Lock();
+    while (!reader.Failed && reader.RunningThreads > 0 && reader.Frames.find(reader.NextFrame) == reader.Frames.end())
+      {
+      condition->Wait(lock.Get());
+      }
+    std::map<size_t, SequenceFrame>::iterator it = reader.Frames.find(reader.NextFrame);
+    if (reader.Failed || it == reader.Frames.end())
+      {
+      res = !reader.Failed;
+      lock->Unlock();
+      break;
+      }
+    SequenceFrame frame = it->second;
+    reader.Frames.erase(it);
+    reader.NextFrame++;
+    condition->Broadcast();
+    lock->Unlock();
+
+    if (!filter->IntegrateAsync(frame.DepthMap, frame.MatrixK, frame.MatrixTR))
+      {
+      std::cout << "Unable to integrate a depth map." << std::endl;
+      res = false;
+      }
+    }
+  res = filter->Synchronize() && res;
+
+  // stop the readers if the integration failed
+  lock->Lock();
+  reader.Aborted = true;
+  condition->Broadcast();
+  lock->Unlock();
+  for (size_t i = 0; i < threadIds.size(); i++)
+    {
+    threader->TerminateThread(threadIds[i]);
+    }
+  return res;
+}
+
+//-----------------------------------------------------------------------------
+// Convert a sequence file listing vti and krtd files to a binary sequence
+bool convert_sequence(const std::string& filename, const std::string& outputFilename)
+{
+  std::vector<std::string> depthMapFilenames;
+  std::vector<std::string> matrixKRTDFilenames;
+  if (!get_sequence_files(filename, depthMapFilenames, matrixKRTDFilenames))
+    {
+    return false;
+    }
+
+  vtkNew<vtkDepthMapSequence> sequence;
+  sequence->SetDepthType(g_halfPrecisionDepths ?
+    vtkDepthMapSequence::DEPTHS_FLOAT16 : vtkDepthMapSequence::DEPTHS_FLOAT32);
+  sequence->SetCompression(g_compressDepths ?
+    vtkDepthMapSequence::COMPRESSION_ZLIB : vtkDepthMapSequence::COMPRESSION_NONE);
+  if (!sequence->BeginWrite(outputFilename.c_str()))
+    {
+    return false;
+    }
+  bool res = true;
+  for (size_t i = 0; res && i < depthMapFilenames.size(); i++)
+    {
+    vtkNew<vtkXMLImageDataReader> depthMapReader;
+    depthMapReader->SetFileName(depthMapFilenames[i].c_str());
+    depthMapReader->Update();
+    vtkNew<vtkMatrix3x3> depthMapMatrixK;
+    vtkNew<vtkMatrix4x4> depthMapMatrixTR;
+    res = read_krtd(matrixKRTDFilenames[i], depthMapMatrixK.Get(), depthMapMatrixTR.Get()) &&
+      sequence->WriteFrame(depthMapReader->GetOutput(), depthMapMatrixK.Get(), depthMapMatrixTR.Get());
+    }
+  return sequence->EndWrite() && res;
+}
+
+//-----------------------------------------------------------------------------
+int backend_from_string(const std::string& backend)
+{
+  for (int i = vtkCudaReconstructionFilter::BACKEND_AUTO; i <= vtkCudaReconstructionFilter::BACKEND_CPU_SERIAL; i++)
+    {
+    if (backend == vtkCudaReconstructionFilter::GetBackendAsString(i))
+      {
+      return i;
+      }
+    }
+  return -1;
+}
+
+//-----------------------------------------------------------------------------
+int function_from_string(const std::string& function)
+{
+  for (int i = vtkCudaReconstructionFilter::FUNCTION_CUMUL;
+       i <= vtkCudaReconstructionFilter::FUNCTION_MAX_CONFIDENCE; i++)
+    {
+    if (function == vtkCudaReconstructionFilter::GetIntegrationFunctionAsString(i))
+      {
+      return i;
+      }
+    }
+  return -1;
+}
+
+//-----------------------------------------------------------------------------
+int storage_from_string(const std::string& storage)
+{
+  for (int i = vtkCudaReconstructionFilter::STORAGE_NATIVE; i <= vtkCudaReconstructionFilter::STORAGE_UINT16; i++)
+    {
+    if (storage == vtkCudaReconstructionFilter::GetStorageFormatAsString(i))
+      {
+      return i;
+      }
+    }
+  return -1;
+}
+
+//-----------------------------------------------------------------------------
+int layout_from_string(const std::string& layout)
+{
+  for (int i = vtkCudaReconstructionFilter::LAYOUT_LINEAR; i <= vtkCudaReconstructionFilter::LAYOUT_BRICKS; i++)
+    {
+    if (layout == vtkCudaReconstructionFilter::GetDeviceLayoutAsString(i))
+      {
+      return i;
+      }
+    }
+  return -1;
+}
+
+//-----------------------------------------------------------------------------
+bool is_output_mode(const std::string& mode)
+{
+  return mode == "structured" || mode == "image" || mode == "pieces";
+}
+
+//-----------------------------------------------------------------------------
+// Grid matrix whose columns are the normalized grid vectors, rotating the
+// grid around its origin: a point p of the grid is placed at
+// origin + R (p - origin)
+void compute_grid_matrix(vtkMatrix4x4* gridMatrix)
+{
+  gridMatrix->Identity();
+  std::vector<double>* vecs[3] = { &g_gridVecX, &g_gridVecY, &g_gridVecZ };
+  for (int j = 0; j < 3; j++)
+    {
+    double vec[3] = { (*vecs[j])[0], (*vecs[j])[1], (*vecs[j])[2] };
+    vtkMath::Normalize(vec);
+    for (int i = 0; i < 3; i++)
+      {
+      gridMatrix->SetElement(i, j, vec[i]);
+      }
+    }
+  for (int i = 0; i < 3; i++)
+    {
+    double translation = g_gridOrigin[i];
+    for (int j = 0; j < 3; j++)
+      {
+      translation -= gridMatrix->GetElement(i, j) * g_gridOrigin[j];
+      }
+    gridMatrix->SetElement(i, 3, translation);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Write the reconstruction: a vtkStructuredGrid with the grid matrix applied
+// to its points, or the vtkImageData of the filter which keeps the grid
+// matrix in its reconstruction_grid_matrix field data. The image data is
+// streamed, each piece being reconstructed then appended raw and compressed
+// to one vti file, or to its own vti file of a pvti.
+bool write_output(vtkCudaReconstructionFilter* filter, vtkMatrix4x4* gridMatrix)
+{
+  if (g_outputMode == "image" || g_outputMode == "pieces")
+    {
+    vtkNew<vtkXMLImageDataWriter> imageWriter;
+    imageWriter->SetNumberOfPieces(g_outputPieces);
+    vtkNew<vtkXMLPImageDataWriter> piecesWriter;
+    piecesWriter->SetNumberOfPieces(g_outputPieces);
+    piecesWriter->SetStartPiece(0);
+    piecesWriter->SetEndPiece(g_outputPieces - 1);
+    vtkXMLWriter* writer = g_outputMode == "image" ?
+      static_cast<vtkXMLWriter*>(imageWriter.Get()) : piecesWriter.Get();
+    writer->SetFileName(g_outputGridFilename.c_str());
+    writer->SetInputConnection(filter->GetOutputPort());
+    writer->SetDataModeToAppended();
+    writer->EncodeAppendedDataOff();
+    writer->SetCompressorTypeToZLib();
+    return writer->Write() != 0;
+    }
+
+  vtkNew<vtkTransform> transform;
+  transform->SetMatrix(gridMatrix);
+  vtkNew<vtkTransformFilter> transformFilter;
+  transformFilter->SetInputConnection(filter->GetOutputPort());
+  transformFilter->SetTransform(transform.Get());
+  transformFilter->Update();
+  vtkStructuredGrid* outputGrid = vtkStructuredGrid::SafeDownCast(transformFilter->GetOutput());
+
+  vtkNew<vtkXMLStructuredGridWriter> gridWriter;
+  gridWriter->SetFileName(g_outputGridFilename.c_str());
+  gridWriter->SetInputData(outputGrid);
+  return gridWriter->Write() != 0;
+}
+
+//-----------------------------------------------------------------------------
+// Write the isosurface of the second output of the filter to a vtp file, in
+// the frame of the grid matrix
+bool write_surface(vtkCudaReconstructionFilter* filter, vtkMatrix4x4* gridMatrix)
+{
+  vtkNew<vtkTransform> transform;
+  transform->SetMatrix(gridMatrix);
+  vtkNew<vtkTransformFilter> transformFilter;
+  transformFilter->SetInputConnection(filter->GetOutputPort(1));
+  transformFilter->SetTransform(transform.Get());
+
+  vtkNew<vtkXMLPolyDataWriter> surfaceWriter;
+  surfaceWriter->SetFileName(g_surfaceFilename.c_str());
+  surfaceWriter->SetInputConnection(transformFilter->GetOutputPort());
+  surfaceWriter->SetDataModeToAppended();
+  surfaceWriter->EncodeAppendedDataOff();
+  surfaceWriter->SetCompressorTypeToZLib();
+  return surfaceWriter->Write() != 0;
+}
+
+//-----------------------------------------------------------------------------
+// Reconstruct the grid coarse to fine and write the blocks of its finest
+// level to a vtm file, each vti block keeping the grid matrix in its field
+// data
+bool write_blocks(vtkCudaReconstructionFilter* filter, vtkImageData* grid)
+{
+  vtkNew<vtkCoarseToFineReconstructionFilter> coarseToFineFilter;
+  coarseToFineFilter->SetInputData(grid);
+  coarseToFineFilter->SetReconstructionFilter(filter);
+  coarseToFineFilter->SetNumberOfLevels(g_levels);
+  coarseToFineFilter->SetBlockSize(g_blockSize);
+  coarseToFineFilter->SetRefinementThreshold(g_refinementThreshold);
+  coarseToFineFilter->SetDownsampleDepthMaps(g_downsampleDepthMaps);
+
+  vtkNew<vtkXMLMultiBlockDataWriter> blocksWriter;
+  blocksWriter->SetFileName(g_outputGridFilename.c_str());
+  blocksWriter->SetInputConnection(coarseToFineFilter->GetOutputPort());
+  blocksWriter->SetDataModeToAppended();
+  blocksWriter->EncodeAppendedDataOff();
+  blocksWriter->SetCompressorTypeToZLib();
+  return blocksWriter->Write() != 0;
+}
+
 //-----------------------------------------------------------------------------
 bool read_arguments(int argc, char ** argv)
 {
@@ -245,12 +776,44 @@ bool read_arguments(int argc, char ** argv)
   arg.AddArgument("--gridDims", argT::MULTI_ARGUMENT, &g_gridDims, "Specify the input grid dimensions (required)");
   arg.AddArgument("--gridSpacing", argT::MULTI_ARGUMENT, &g_gridSpacing, "Specify the input grid spacing (required)");
   arg.AddArgument("--gridOrigin", argT::MULTI_ARGUMENT, &g_gridOrigin, "Specify the input grid origin (required)");
-  arg.AddArgument("--gridVecX", argT::MULTI_ARGUMENT, &g_gridVecX, "Specify the input grid direction X (required)");
-  arg.AddArgument("--gridVecY", argT::MULTI_ARGUMENT, &g_gridVecY, "Specify the input grid direction Y (required)");
-  arg.AddArgument("--gridVecZ", argT::MULTI_ARGUMENT, &g_gridVecZ, "Specify the input grid direction Z (required)");
+  arg.AddArgument("--gridVecX", argT::MULTI_ARGUMENT, &g_gridVecX, "Specify the direction of the X axis of the grid, normalized (default 1 0 0)");
+  arg.AddArgument("--gridVecY", argT::MULTI_ARGUMENT, &g_gridVecY, "Specify the direction of the Y axis of the grid, normalized (default 0 1 0)");
+  arg.AddArgument("--gridVecZ", argT::MULTI_ARGUMENT, &g_gridVecZ, "Specify the direction of the Z axis of the grid, normalized (default 0 0 1)");
   arg.AddArgument("--depthMapFilename", argT::SPACE_ARGUMENT, &g_depthMapFilename, "Specify the depth map filename (required)");
   arg.AddArgument("--matrixKRTDFilename", argT::SPACE_ARGUMENT, &g_matrixKRTDFilename, "Specify the depth map matrix filename (required)");
+  arg.AddArgument("--sequenceFilename", argT::SPACE_ARGUMENT, &g_sequenceFilename, "Specify a file listing a depth map filename and its matrix filename per line, they replace --depthMapFilename and --matrixKRTDFilename, or a binary sequence file");
+  arg.AddArgument("--depthMapPattern", argT::SPACE_ARGUMENT, &g_depthMapPattern, "Specify a glob pattern of the depth maps of a sequence, such as data/*_depth_map.0.vti, they are paired in the order of their names with the files of --matrixKRTDPattern and replace --sequenceFilename");
+  arg.AddArgument("--matrixKRTDPattern", argT::SPACE_ARGUMENT, &g_matrixKRTDPattern, "Specify a glob pattern of the krtd files of the depth maps of --depthMapPattern, such as data/*.krtd");
+  arg.AddArgument("--frameStride", argT::SPACE_ARGUMENT, &g_frameStride, "Integrate one frame every frameStride frames of a sequence (default 1)");
+  arg.AddArgument("--maxFrames", argT::SPACE_ARGUMENT, &g_maxFrames, "Specify the maximum number of frames of a sequence to integrate (default 0, all of them)");
+  arg.AddArgument("--readerThreads", argT::SPACE_ARGUMENT, &g_readerThreads, "Specify the number of threads reading the vti and krtd files of a sequence (default 2)");
+  arg.AddArgument("--convertedSequenceFilename", argT::SPACE_ARGUMENT, &g_convertedSequenceFilename, "Convert the sequence file to this binary sequence file instead of reconstructing");
+  arg.AddBooleanArgument("--halfPrecisionDepths", &g_halfPrecisionDepths, "Store float16 depths in the converted sequence file");
+  arg.AddBooleanArgument("--compressDepths", &g_compressDepths, "Compress the depths of the converted sequence file");
   arg.AddArgument("--outputGridFilename", argT::SPACE_ARGUMENT, &g_outputGridFilename, "Specify the output grid filename (required)");
+  arg.AddArgument("--backend", argT::SPACE_ARGUMENT, &g_backend, "Specify the backend: auto, cuda, cpu or serial (default auto)");
+  arg.AddBooleanArgument("--singlePrecision", &g_singlePrecision, "Integrate in float and write float scalars");
+  arg.AddArgument("--integrationFunction", argT::SPACE_ARGUMENT, &g_integrationFunction, "Specify the integration function: cumul, tsdf, logodds or maxconfidence (default cumul)");
+  arg.AddArgument("--truncationDistance", argT::SPACE_ARGUMENT, &g_truncationDistance, "Specify the truncation distance of the tsdf, logodds and maxconfidence functions (default 3 times the largest grid spacing)");
+  arg.AddArgument("--storageFormat", argT::SPACE_ARGUMENT, &g_storageFormat, "Specify the storage of the voxels: native, half or uint16 (default native)");
+  arg.AddArgument("--deviceLayout", argT::SPACE_ARGUMENT, &g_deviceLayout, "Specify the layout of the voxels on the device: linear or bricks of 8x8x8 voxels (default bricks)");
+  arg.AddArgument("--minDepth", argT::SPACE_ARGUMENT, &g_minDepth, "Specify the smallest valid depth, the depths below it are not integrated (default 0)");
+  arg.AddArgument("--maxDepth", argT::SPACE_ARGUMENT, &g_maxDepth, "Specify the largest valid depth, the depths beyond it are not integrated (default 0, no limit)");
+  arg.AddArgument("--confidenceArrayName", argT::SPACE_ARGUMENT, &g_confidenceArrayName, "Specify the point data array of the depth maps holding the confidence of the depths");
+  arg.AddArgument("--minConfidence", argT::SPACE_ARGUMENT, &g_minConfidence, "Specify the confidence below which the depths are not integrated, with --confidenceArrayName (default 0)");
+  arg.AddArgument("--depthMapLevel", argT::SPACE_ARGUMENT, &g_depthMapLevel, "Specify the number of times the depth maps are halved before their integration, from 0 to " MAIN_VALUE_STRING(RECONSTRUCTION_DEPTHS_MAX_LEVEL) " (default 0)");
+  arg.AddArgument("--outputMode", argT::SPACE_ARGUMENT, &g_outputMode, "Specify the output: structured for a vts grid with transformed points, image for a vti written in streamed pieces, pieces for a pvti with one vti per piece (default structured)");
+  arg.AddArgument("--outputPieces", argT::SPACE_ARGUMENT, &g_outputPieces, "Specify the number of pieces the image and pieces outputs are streamed in (default 8)");
+  arg.AddArgument("--pendingDepthMaps", argT::SPACE_ARGUMENT, &g_pendingDepthMaps, "Specify the number of depth maps of a sequence in flight on the device, from 1 to 8 (default 2)");
+  arg.AddArgument("--projectionCacheSize", argT::SPACE_ARGUMENT, &g_projectionCacheSize, "Specify the number of cameras of a fixed rig whose voxel projections are kept by the parallel CPU backend (default 0, none)");
+  arg.AddArgument("--levels", argT::SPACE_ARGUMENT, &g_levels, "Specify the number of levels of a coarse to fine reconstruction, the output is then a vtm file of the blocks of the finest level (default 1, the whole grid at once)");
+  arg.AddArgument("--blockSize", argT::SPACE_ARGUMENT, &g_blockSize, "Specify the number of cells along each axis of the blocks refined by the coarse to fine reconstruction (default 32)");
+  arg.AddArgument("--refinementThreshold", argT::SPACE_ARGUMENT, &g_refinementThreshold, "Specify the cumul score from which the coarse to fine reconstruction refines a cell (default 0, from the size of the cell)");
+  arg.AddBooleanArgument("--downsampleDepthMaps", &g_downsampleDepthMaps, "Integrate the coarse levels of a coarse to fine reconstruction with depth maps halved once per level");
+  arg.AddArgument("--surfaceFilename", argT::SPACE_ARGUMENT, &g_surfaceFilename, "Extract the isosurface of the volume with marching cubes and write it to this vtp file");
+  arg.AddArgument("--surfaceValue", argT::SPACE_ARGUMENT, &g_surfaceValue, "Specify the value of the extracted isosurface (default 0)");
+  arg.AddBooleanArgument("--profiling", &g_profiling, "Time the stages of the reconstruction and count the voxels and bytes it processes, printed from verbosity 1 which it implies");
+  arg.AddArgument("--verbosity", argT::SPACE_ARGUMENT, &g_verbosity, "Specify the verbosity of the reconstruction: 0 silent, 1 summary, 2 stages (default 0)");
   arg.AddBooleanArgument("--help", &help, "Print this help message");
 
   int result = arg.Parse();
@@ -260,51 +823,190 @@ bool read_arguments(int argc, char ** argv)
     return false;
     }
 
-  if (g_depthMapFilename == "" || g_matrixKRTDFilename == "" || g_outputGridFilename == "")
+  if ((g_sequenceFilename == "" && g_depthMapPattern == "" &&
+       (g_depthMapFilename == "" || g_matrixKRTDFilename == "")) ||
+      (g_depthMapPattern != "" && g_matrixKRTDPattern == "") ||
+      (g_outputGridFilename == "" && g_convertedSequenceFilename == ""))
+    {
+    std::cout << "Missing depth maps, krtd files or output filename." << std::endl;
+    std::cout << arg.GetHelp() ;
+    return false;
+    }
+  if (g_convertedSequenceFilename == "" &&
+      (g_gridDims.size() != 3 || g_gridSpacing.size() != 3 || g_gridOrigin.size() != 3))
+    {
+    std::cout << "The grid needs 3 dimensions, 3 spacings and 3 origin coordinates." << std::endl;
+    std::cout << arg.GetHelp() ;
+    return false;
+    }
+  if (g_gridVecX.empty())
+    {
+    g_gridVecX.push_back(1);
+    g_gridVecX.push_back(0);
+    g_gridVecX.push_back(0);
+    }
+  if (g_gridVecY.empty())
+    {
+    g_gridVecY.push_back(0);
+    g_gridVecY.push_back(1);
+    g_gridVecY.push_back(0);
+    }
+  if (g_gridVecZ.empty())
+    {
+    g_gridVecZ.push_back(0);
+    g_gridVecZ.push_back(0);
+    g_gridVecZ.push_back(1);
+    }
+  if (g_convertedSequenceFilename == "" &&
+      (g_gridVecX.size() != 3 || g_gridVecY.size() != 3 || g_gridVecZ.size() != 3 ||
+       vtkMath::Norm(&g_gridVecX[0]) == 0 || vtkMath::Norm(&g_gridVecY[0]) == 0 ||
+       vtkMath::Norm(&g_gridVecZ[0]) == 0))
+    {
+    std::cout << "The grid vectors need 3 coordinates and cannot be null." << std::endl;
+    std::cout << arg.GetHelp() ;
+    return false;
+    }
+
+  if (g_backend == "")
+    {
+    g_backend = "auto";
+    }
+  if (backend_from_string(g_backend) < 0)
+    {
+    std::cout << "Unknown backend " << g_backend << "." << std::endl;
+    std::cout << arg.GetHelp() ;
+    return false;
+    }
+  if (g_integrationFunction == "")
+    {
+    g_integrationFunction = "cumul";
+    }
+  if (function_from_string(g_integrationFunction) < 0)
+    {
+    std::cout << "Unknown integration function " << g_integrationFunction << "." << std::endl;
+    std::cout << arg.GetHelp() ;
+    return false;
+    }
+  if (g_storageFormat == "")
+    {
+    g_storageFormat = "native";
+    }
+  if (storage_from_string(g_storageFormat) < 0)
+    {
+    std::cout << "Unknown storage format " << g_storageFormat << "." << std::endl;
+    std::cout << arg.GetHelp() ;
+    return false;
+    }
+  if (g_deviceLayout == "")
+    {
+    g_deviceLayout = "bricks";
+    }
+  if (layout_from_string(g_deviceLayout) < 0)
+    {
+    std::cout << "Unknown device layout " << g_deviceLayout << "." << std::endl;
+    std::cout << arg.GetHelp() ;
+    return false;
+    }
+  if (g_outputMode == "")
+    {
+    g_outputMode = "structured";
+    }
+  if (!is_output_mode(g_outputMode))
+    {
+    std::cout << "Unknown output mode " << g_outputMode << "." << std::endl;
+    std::cout << arg.GetHelp() ;
+    return false;
+    }
+  if (g_outputPieces <= 0)
+    {
+    g_outputPieces = 8;
+    }
+  if (g_frameStride <= 0)
+    {
+    g_frameStride = 1;
+    }
+  if (g_maxFrames < 0)
+    {
+    g_maxFrames = 0;
+    }
+  if (g_readerThreads <= 0)
+    {
+    g_readerThreads = 2;
+    }
+  if (g_pendingDepthMaps <= 0)
+    {
+    g_pendingDepthMaps = 2;
+    }
+  if (g_projectionCacheSize < 0)
     {
-    // todo error message
-    std::cout << "Problem parsing arguments." << std::endl;
+    g_projectionCacheSize = 0;
+    }
+  // the profile is printed by the filter with its summary
+  if (g_profiling && g_verbosity < 1)
+    {
+    g_verbosity = 1;
+    }
+  if (g_depthMapLevel < 0 || g_depthMapLevel > RECONSTRUCTION_DEPTHS_MAX_LEVEL)
+    {
+    std::cout << "The depth map level must be from 0 to " << RECONSTRUCTION_DEPTHS_MAX_LEVEL << "." << std::endl;
     std::cout << arg.GetHelp() ;
     return false;
     }
+  if (g_levels <= 0)
+    {
+    g_levels = 1;
+    }
+  if (g_blockSize <= 0)
+    {
+    g_blockSize = 32;
+    }
 
   return true;
 }
 
 //-----------------------------------------------------------------------------
+// Default values of the arguments, the grid has none
 void init_arguments()
 {
   g_gridDims.clear();
-  g_gridDims.push_back(100);
-  g_gridDims.push_back(100);
-  g_gridDims.push_back(100);
-
   g_gridSpacing.clear();
-  g_gridSpacing.push_back(0.1);
-  g_gridSpacing.push_back(0.1);
-  g_gridSpacing.push_back(0.1);
-
   g_gridOrigin.clear();
-  g_gridOrigin.push_back(-5);
-  g_gridOrigin.push_back(-5);
-  g_gridOrigin.push_back(-5);
-
   g_gridVecX.clear();
-  g_gridVecX.push_back(1);
-  g_gridVecX.push_back(0);
-  g_gridVecX.push_back(0);
-
   g_gridVecY.clear();
-  g_gridVecY.push_back(0);
-  g_gridVecY.push_back(1);
-  g_gridVecY.push_back(0);
-
   g_gridVecZ.clear();
-  g_gridVecZ.push_back(0);
-  g_gridVecZ.push_back(0);
-  g_gridVecZ.push_back(1);
-
-  g_depthMapFilename = "/home/kitware/dev/cudareconstruction_sources/data/frame_0003_depth_map.0.vti";
-  g_matrixKRTDFilename = "/home/kitware/dev/cudareconstruction_sources/data/frame_0003.krtd";
-  g_outputGridFilename = "/home/kitware/dev/cudareconstruction_sources/data/outputgrid.vts";
+  g_depthMapFilename = "";
+  g_matrixKRTDFilename = "";
+  g_outputGridFilename = "";
+  g_sequenceFilename = "";
+  g_depthMapPattern = "";
+  g_matrixKRTDPattern = "";
+  g_frameStride = 1;
+  g_maxFrames = 0;
+  g_readerThreads = 2;
+  g_convertedSequenceFilename = "";
+  g_halfPrecisionDepths = false;
+  g_compressDepths = false;
+  g_backend = "auto";
+  g_singlePrecision = false;
+  g_integrationFunction = "cumul";
+  g_truncationDistance = 0;
+  g_storageFormat = "native";
+  g_deviceLayout = "bricks";
+  g_minDepth = 0;
+  g_maxDepth = 0;
+  g_confidenceArrayName = "";
+  g_minConfidence = 0;
+  g_depthMapLevel = 0;
+  g_downsampleDepthMaps = false;
+  g_profiling = false;
+  g_verbosity = 0;
+  g_outputMode = "structured";
+  g_outputPieces = 8;
+  g_surfaceFilename = "";
+  g_surfaceValue = 0;
+  g_pendingDepthMaps = 2;
+  g_projectionCacheSize = 0;
+  g_levels = 1;
+  g_blockSize = 32;
+  g_refinementThreshold = 0;
 }
@@ -0,0 +1,323 @@
+#include "vtkCoarseToFineReconstructionFilter.h"
+#include "vtkCudaReconstructionFilter.h"
+
+#include "vtkCellData.h"
+#include "vtkDataArray.h"
+#include "vtkImageData.h"
+#include "vtkInformation.h"
+#include "vtkInformationVector.h"
+#include "vtkMultiBlockDataSet.h"
+#include "vtkNew.h"
+#include "vtkObjectFactory.h"
+#include "vtkSmartPointer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+vtkStandardNewMacro(vtkCoarseToFineReconstructionFilter);
+
+vtkSetObjectImplementationMacro(vtkCoarseToFineReconstructionFilter, ReconstructionFilter,
+                                vtkCudaReconstructionFilter);
+
+//----------------------------------------------------------------------------
+// Settings of the reconstruction filter changed to score a coarse level,
+// restored when the scope ends
+class vtkScopedScoringSettings
+{
+public:
+  vtkScopedScoringSettings(vtkCudaReconstructionFilter* filter)
+    : Filter(filter), IntegrationFunction(filter->GetIntegrationFunction()),
+    StorageFormat(filter->GetStorageFormat()), ExtractSurface(filter->GetExtractSurface()),
+    DepthMapLevel(filter->GetDepthMapLevel())
+  {
+  }
+  ~vtkScopedScoringSettings()
+  {
+    this->Filter->SetIntegrationFunction(this->IntegrationFunction);
+    this->Filter->SetStorageFormat(this->StorageFormat);
+    this->Filter->SetExtractSurface(this->ExtractSurface);
+    this->Filter->SetDepthMapLevel(this->DepthMapLevel);
+  }
+
+  // Score with the cumul function, in native voxels read as they are
+  void SetScoring(bool scoring)
+  {
+    this->Filter->SetIntegrationFunction(scoring ? vtkCudaReconstructionFilter::FUNCTION_CUMUL :
+                                         this->IntegrationFunction);
+    this->Filter->SetStorageFormat(scoring ? vtkCudaReconstructionFilter::STORAGE_NATIVE : this->StorageFormat);
+    this->Filter->SetExtractSurface(scoring ? 0 : this->ExtractSurface);
+  }
+
+  // Halve the depth maps levelsNb more times than the filter does, at most
+  // RECONSTRUCTION_DEPTHS_MAX_LEVEL times in all
+  void SetExtraDepthMapLevels(int levelsNb)
+  {
+    this->Filter->SetDepthMapLevel(std::min(this->DepthMapLevel + levelsNb, RECONSTRUCTION_DEPTHS_MAX_LEVEL));
+  }
+
+private:
+  vtkCudaReconstructionFilter* Filter;
+  int IntegrationFunction;
+  int StorageFormat;
+  int ExtractSurface;
+  int DepthMapLevel;
+};
+
+//----------------------------------------------------------------------------
+vtkCoarseToFineReconstructionFilter::vtkCoarseToFineReconstructionFilter()
+{
+  this->SetNumberOfInputPorts(1);
+  this->ReconstructionFilter = 0;
+  this->NumberOfLevels = 3;
+  this->BlockSize = 32;
+  this->RefinementThreshold = 0;
+  this->DownsampleDepthMaps = 0;
+  this->LastNumberOfBlocks = 0;
+  this->LastNumberOfCells = 0;
+}
+
+//----------------------------------------------------------------------------
+vtkCoarseToFineReconstructionFilter::~vtkCoarseToFineReconstructionFilter()
+{
+  if (this->ReconstructionFilter)
+    {
+    this->ReconstructionFilter->Delete();
+    }
+}
+
+//----------------------------------------------------------------------------
+unsigned long vtkCoarseToFineReconstructionFilter::GetMTime()
+{
+  unsigned long mTime = this->Superclass::GetMTime();
+  if (this->ReconstructionFilter)
+    {
+    mTime = std::max(mTime, this->ReconstructionFilter->GetMTime());
+    }
+  return mTime;
+}
+
+//----------------------------------------------------------------------------
+int vtkCoarseToFineReconstructionFilter::FillInputPortInformation(int vtkNotUsed(port), vtkInformation* info)
+{
+  info->Set(vtkAlgorithm::INPUT_REQUIRED_DATA_TYPE(), "vtkImageData");
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+vtkImageData* vtkCoarseToFineReconstructionFilter::IntegrateBlock(const double origin[3],
+  const double spacing[3], const int cellExtent[6])
+{
+  vtkNew<vtkImageData> grid;
+  grid->SetOrigin(origin[0], origin[1], origin[2]);
+  grid->SetSpacing(spacing[0], spacing[1], spacing[2]);
+  grid->SetExtent(cellExtent[0], cellExtent[1] + 1, cellExtent[2], cellExtent[3] + 1,
+                  cellExtent[4], cellExtent[5] + 1);
+  this->ReconstructionFilter->SetInputData(grid.Get());
+  this->ReconstructionFilter->Update();
+  if (this->ReconstructionFilter->GetOutput()->GetNumberOfCells() != grid->GetNumberOfCells())
+    {
+    return 0;
+    }
+
+  // the next update of the reconstruction filter keeps its output object
+  vtkImageData* block = vtkImageData::New();
+  block->ShallowCopy(this->ReconstructionFilter->GetOutput());
+  this->LastNumberOfCells += block->GetNumberOfCells();
+  return block;
+}
+
+//----------------------------------------------------------------------------
+int vtkCoarseToFineReconstructionFilter::RequestData(
+  vtkInformation *vtkNotUsed(request),
+  vtkInformationVector **inputVector,
+  vtkInformationVector *outputVector)
+{
+  vtkImageData *inGrid = vtkImageData::SafeDownCast(
+    inputVector[0]->GetInformationObject(0)->Get(vtkDataObject::DATA_OBJECT()));
+  vtkMultiBlockDataSet *output = vtkMultiBlockDataSet::SafeDownCast(
+    outputVector->GetInformationObject(0)->Get(vtkDataObject::DATA_OBJECT()));
+
+  this->LastNumberOfBlocks = 0;
+  this->LastNumberOfCells = 0;
+  if (!this->ReconstructionFilter || this->ReconstructionFilter->GetIncremental())
+    {
+    vtkErrorMacro("The coarse to fine reconstruction needs a reconstruction filter out of incremental mode.");
+    return 0;
+    }
+
+  // the levels share the corner of the first cell of the input, a cell of
+  // a level covers 2x2x2 cells of the next one
+  int inExtent[6];
+  inGrid->GetExtent(inExtent);
+  double inOrigin[3];
+  inGrid->GetOrigin(inOrigin);
+  double inSpacing[3];
+  inGrid->GetSpacing(inSpacing);
+  int cellDims[3];
+  double origin[3];
+  for (int i = 0; i < 3; i++)
+    {
+    cellDims[i] = inExtent[2 * i + 1] - inExtent[2 * i];
+    origin[i] = inOrigin[i] + inExtent[2 * i] * inSpacing[i];
+    }
+  if (cellDims[0] <= 0 || cellDims[1] <= 0 || cellDims[2] <= 0)
+    {
+    output->SetNumberOfBlocks(0);
+    return 1;
+    }
+  int blockSize = std::max(2, this->BlockSize - this->BlockSize % 2);
+
+  // the first level is a single block over the whole grid, the blocks of
+  // the next levels are refined when flagged in refinedBlocks
+  vtkScopedScoringSettings settings(this->ReconstructionFilter);
+  std::vector<char> refinedBlocks;
+  int blocksDims[3] = { 0, 0, 0 };
+  std::vector<vtkSmartPointer<vtkImageData> > blocks;
+  for (int level = 0; level < this->NumberOfLevels; level++)
+    {
+    bool finest = level == this->NumberOfLevels - 1;
+    int factor = 1 << (this->NumberOfLevels - 1 - level);
+    double spacing[3];
+    int levelCellDims[3];
+    for (int i = 0; i < 3; i++)
+      {
+      spacing[i] = inSpacing[i] * factor;
+      levelCellDims[i] = (cellDims[i] + factor - 1) / factor;
+      }
+    double threshold = this->RefinementThreshold;
+    if (threshold <= 0)
+      {
+      double halfDiagonal = 0.5 * std::sqrt(spacing[0] * spacing[0] + spacing[1] * spacing[1] +
+                                            spacing[2] * spacing[2]);
+      threshold = halfDiagonal > 0 ? std::min(1 / halfDiagonal, 100.) : 100.;
+      }
+    settings.SetScoring(!finest);
+    settings.SetExtraDepthMapLevels(this->DownsampleDepthMaps ? this->NumberOfLevels - 1 - level : 0);
+
+    // blocks of the level as their extents of cells
+    std::vector<int> cellExtents;
+    if (level == 0)
+      {
+      int cellExtent[6] = { 0, levelCellDims[0] - 1, 0, levelCellDims[1] - 1, 0, levelCellDims[2] - 1 };
+      cellExtents.insert(cellExtents.end(), cellExtent, cellExtent + 6);
+      }
+    else
+      {
+      for (int k = 0; k < blocksDims[2]; k++)
+        {
+        for (int j = 0; j < blocksDims[1]; j++)
+          {
+          for (int i = 0; i < blocksDims[0]; i++)
+            {
+            if (!refinedBlocks[i + blocksDims[0] * (j + static_cast<size_t>(blocksDims[1]) * k)])
+              {
+              continue;
+              }
+            int ijk[3] = { i, j, k };
+            for (int n = 0; n < 3; n++)
+              {
+              cellExtents.push_back(ijk[n] * blockSize);
+              cellExtents.push_back(std::min((ijk[n] + 1) * blockSize, levelCellDims[n]) - 1);
+              }
+            }
+          }
+        }
+      }
+    if (this->ReconstructionFilter->GetVerbosity() >= 1)
+      {
+      std::cout << "Level " << level << ": " << cellExtents.size() / 6 << " blocks." << std::endl;
+      }
+
+    // integrate the blocks, flagging the blocks of the next level that
+    // cover the cells whose score reaches the threshold
+    std::vector<char> nextRefinedBlocks;
+    int nextBlocksDims[3];
+    if (!finest)
+      {
+      for (int i = 0; i < 3; i++)
+        {
+        int nextFactor = factor / 2;
+        int nextCellDims = (cellDims[i] + nextFactor - 1) / nextFactor;
+        nextBlocksDims[i] = (nextCellDims + blockSize - 1) / blockSize;
+        }
+      nextRefinedBlocks.assign(static_cast<size_t>(nextBlocksDims[0]) * nextBlocksDims[1] * nextBlocksDims[2], 0);
+      }
+    for (size_t b = 0; b < cellExtents.size(); b += 6)
+      {
+      const int* cellExtent = &cellExtents[b];
+      vtkSmartPointer<vtkImageData> block;
+      block.TakeReference(this->IntegrateBlock(origin, spacing, cellExtent));
+      if (!block)
+        {
+        vtkErrorMacro("Unable to integrate a block of level " << level << ".");
+        return 0;
+        }
+      if (finest)
+        {
+        blocks.push_back(block);
+        continue;
+        }
+      vtkDataArray* scores = block->GetCellData()->GetArray("reconstruction_scalar");
+      int dims[3];
+      for (int i = 0; i < 3; i++)
+        {
+        dims[i] = cellExtent[2 * i + 1] - cellExtent[2 * i] + 1;
+        }
+      vtkIdType id = 0;
+      for (int k = 0; k < dims[2]; k++)
+        {
+        for (int j = 0; j < dims[1]; j++)
+          {
+          for (int i = 0; i < dims[0]; i++, id++)
+            {
+            if (scores->GetTuple1(id) < threshold)
+              {
+              continue;
+              }
+            // the two finer cells of each axis lie in the same even sized block
+            int ijk[3] = { i, j, k };
+            int next[3];
+            for (int n = 0; n < 3; n++)
+              {
+              next[n] = 2 * (cellExtent[2 * n] + ijk[n]) / blockSize;
+              }
+            nextRefinedBlocks[next[0] + nextBlocksDims[0] * (next[1] + static_cast<size_t>(nextBlocksDims[1]) *
+                                                             next[2])] = 1;
+            }
+          }
+        }
+      }
+    refinedBlocks.swap(nextRefinedBlocks);
+    std::copy(nextBlocksDims, nextBlocksDims + 3, blocksDims);
+    }
+
+  output->SetNumberOfBlocks(static_cast<unsigned int>(blocks.size()));
+  for (size_t i = 0; i < blocks.size(); i++)
+    {
+    output->SetBlock(static_cast<unsigned int>(i), blocks[i]);
+    }
+  this->LastNumberOfBlocks = static_cast<vtkIdType>(blocks.size());
+  if (this->ReconstructionFilter->GetVerbosity() >= 1)
+    {
+    vtkIdType gridCellsNb = static_cast<vtkIdType>(cellDims[0]) * cellDims[1] * cellDims[2];
+    std::cout << "Coarse to fine: " << this->LastNumberOfCells << " cells integrated for a grid of "
+              << gridCellsNb << " cells." << std::endl;
+    }
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+void vtkCoarseToFineReconstructionFilter::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os,indent);
+
+  os << indent << "Reconstruction Filter: " << this->ReconstructionFilter << "\n";
+  os << indent << "Number Of Levels: " << this->NumberOfLevels << "\n";
+  os << indent << "Block Size: " << this->BlockSize << "\n";
+  os << indent << "Refinement Threshold: " << this->RefinementThreshold << "\n";
+  os << indent << "Downsample Depth Maps: " << this->DownsampleDepthMaps << "\n";
+  os << indent << "Last Number Of Blocks: " << this->LastNumberOfBlocks << "\n";
+  os << indent << "Last Number Of Cells: " << this->LastNumberOfCells << "\n";
+}
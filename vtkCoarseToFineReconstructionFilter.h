@@ -0,0 +1,107 @@
+// .NAME vtkCoarseToFineReconstructionFilter - multi-resolution reconstruction
+// .SECTION Description
+// vtkCoarseToFineReconstructionFilter reconstructs the grid of its input
+// vtkImageData level by level with a vtkCudaReconstructionFilter, which
+// holds the depth maps, the grid matrix and the settings of the
+// integration. The first level covers the whole grid with cells
+// 2^(NumberOfLevels-1) times as large as the input ones. Its cells are
+// scored with the cumul function and the ones whose score reaches the
+// refinement threshold are refined: the blocks of the next level, twice as
+// fine, that cover them are integrated in turn, down to the spacing of the
+// input. The output is a vtkMultiBlockDataSet of the vtkImageData blocks
+// of the finest level, integrated with the function of the reconstruction
+// filter, so that the compute and the memory follow the surfaces seen by
+// the depth maps rather than the whole grid.
+
+#ifndef vtkCoarseToFineReconstructionFilter_h
+#define vtkCoarseToFineReconstructionFilter_h
+
+#include "vtkFiltersCoreModule.h" // For export macro
+#include "vtkMultiBlockDataSetAlgorithm.h"
+
+class vtkCudaReconstructionFilter;
+class vtkImageData;
+
+class vtkCoarseToFineReconstructionFilter : public vtkMultiBlockDataSetAlgorithm
+{
+public:
+  static vtkCoarseToFineReconstructionFilter *New();
+  vtkTypeMacro(vtkCoarseToFineReconstructionFilter,vtkMultiBlockDataSetAlgorithm);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  // Description:
+  // Set/get the filter integrating the blocks of each level. It must not be
+  // in incremental mode, its depth maps are integrated into every block.
+  void SetReconstructionFilter(vtkCudaReconstructionFilter* filter);
+  vtkGetObjectMacro(ReconstructionFilter, vtkCudaReconstructionFilter);
+
+  // Description:
+  // Set/get the number of levels, each one halving the spacing of the
+  // previous one down to the spacing of the input (default 3). One level
+  // integrates the whole input grid as a single block.
+  vtkSetClampMacro(NumberOfLevels, int, 1, 16);
+  vtkGetMacro(NumberOfLevels, int);
+
+  // Description:
+  // Set/get the number of cells along each axis of the blocks refined
+  // after the first level, rounded down to an even number (default 32).
+  vtkSetClampMacro(BlockSize, int, 2, 1024);
+  vtkGetMacro(BlockSize, int);
+
+  // Description:
+  // Set/get the cumul score from which a cell is refined. 0, the default,
+  // refines the cells that the surface of a single depth map may cross:
+  // the inverse of the half diagonal of the cell, clamped to the
+  // saturation of the cumul function.
+  vtkSetClampMacro(RefinementThreshold, double, 0, 100);
+  vtkGetMacro(RefinementThreshold, double);
+
+  // Description:
+  // Turn on/off the downsampling of the depth maps for the coarse levels
+  // (off by default): a level whose cells are 2^n times as large as the
+  // input ones integrates the depth maps halved n more times, see
+  // vtkCudaReconstructionFilter::SetDepthMapLevel, so that its voxels
+  // sample about one pixel each. The depth maps are halved at most
+  // RECONSTRUCTION_DEPTHS_MAX_LEVEL times in all, the coarser levels then
+  // integrating depth maps finer than their cells.
+  vtkSetMacro(DownsampleDepthMaps, int);
+  vtkGetMacro(DownsampleDepthMaps, int);
+  vtkBooleanMacro(DownsampleDepthMaps, int);
+
+  // Description:
+  // Get the number of blocks of the finest level, and the number of cells
+  // integrated over all the levels by the last update.
+  vtkGetMacro(LastNumberOfBlocks, vtkIdType);
+  vtkGetMacro(LastNumberOfCells, vtkIdType);
+
+  // Description:
+  // Take the modifications of the reconstruction filter into account.
+  unsigned long GetMTime();
+
+protected:
+  vtkCoarseToFineReconstructionFilter();
+  ~vtkCoarseToFineReconstructionFilter();
+
+  virtual int RequestData(vtkInformation *, vtkInformationVector **,
+    vtkInformationVector *);
+  virtual int FillInputPortInformation(int port, vtkInformation* info);
+
+  // Description:
+  // Integrate the cells cellExtent of a level of the grid, the extent
+  // giving the first and the last cell along each axis, into a new block.
+  vtkImageData* IntegrateBlock(const double origin[3], const double spacing[3], const int cellExtent[6]);
+
+  vtkCudaReconstructionFilter* ReconstructionFilter;
+  int NumberOfLevels;
+  int BlockSize;
+  double RefinementThreshold;
+  int DownsampleDepthMaps;
+  vtkIdType LastNumberOfBlocks;
+  vtkIdType LastNumberOfCells;
+
+private:
+  vtkCoarseToFineReconstructionFilter(const vtkCoarseToFineReconstructionFilter&);  // Not implemented.
+  void operator=(const vtkCoarseToFineReconstructionFilter&);  // Not implemented.
+};
+
+#endif
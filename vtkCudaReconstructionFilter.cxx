@@ -1,23 +1,47 @@
 #include "vtkCudaReconstructionFilter.h"
+#include "CudaReconstruction.h"
+#include "ReconstructionDepths.h"
+#include "ReconstructionFunctions.h"
+#include "ReconstructionSurface.h"
+#include "SimdReconstruction.h"
 
 #include "vtkCell.h"
+#include "vtkCellArray.h"
 #include "vtkCellData.h"
 #include "vtkDataSet.h"
 #include "vtkDoubleArray.h"
+#include "vtkFieldData.h"
+#include "vtkFloatArray.h"
+#include "vtkIdTypeArray.h"
 #include "vtkImageData.h"
 #include "vtkInformation.h"
 #include "vtkInformationVector.h"
+#include "vtkMarchingCubesTriangleCases.h"
 #include "vtkMath.h"
 #include "vtkMatrix3x3.h"
 #include "vtkMatrix4x4.h"
+#include "vtkMultiThreader.h"
 #include "vtkNew.h"
 #include "vtkObjectFactory.h"
 #include "vtkPointData.h"
+#include "vtkPoints.h"
+#include "vtkPolyData.h"
+#include "vtkSmartPointer.h"
+#include "vtkSMPTools.h"
 #include "vtkStreamingDemandDrivenPipeline.h"
 #include "vtkStructuredGrid.h"
+#include "vtkTimerLog.h"
 #include "vtkTransform.h"
+#include "vtkTypeTraits.h"
 
+#ifdef CUDA_RECONSTRUCTION_USE_NVTX
+#include <nvToolsExt.h>
+#endif
+
+#include <algorithm>
 #include <cmath>
+#include <deque>
+#include <iostream>
 #include <vector>
 
 vtkStandardNewMacro(vtkCudaReconstructionFilter);
@@ -27,260 +51,3522 @@ vtkSetObjectImplementationMacro(vtkCudaReconstructionFilter, DepthMapMatrixK, vt
 vtkSetObjectImplementationMacro(vtkCudaReconstructionFilter, DepthMapMatrixTR, vtkMatrix4x4);
 vtkSetObjectImplementationMacro(vtkCudaReconstructionFilter, GridMatrix, vtkMatrix4x4);
 
-int cuda_reconstruction(
-    double h_gridMatrix[16], double h_gridOrig[3], int h_gridDims[3], double h_gridSpacing[3],
-    int h_depthMapDims[3], double* h_depths, double h_depthMapMatrixK[16], double h_depthMapMatrixTR[16],
-    double* h_outScalar);
+//----------------------------------------------------------------------------
+// Blocks of a grid which may project into a depth map, kept for the grid and
+// the camera they were computed for and shared by the copies of a frame
+class vtkActiveBlocks : public vtkObject
+{
+public:
+  static vtkActiveBlocks* New();
+  vtkTypeMacro(vtkActiveBlocks, vtkObject);
+
+  std::vector<int> Blocks;
+  bool IsValid;
+  double VoxelToDepthMap[12];
+  int CellDims[3];
+  int DepthMapDims[2];
+
+protected:
+  vtkActiveBlocks() : IsValid(false) {}
+
+private:
+  vtkActiveBlocks(const vtkActiveBlocks&);  // Not implemented.
+  void operator=(const vtkActiveBlocks&);  // Not implemented.
+};
+
+vtkStandardNewMacro(vtkActiveBlocks);
+
+//----------------------------------------------------------------------------
+// Projection of the voxels of a grid into the depth maps of a fixed camera:
+// the voxels in front of the camera whose nearest pixel is in the depth
+// map, with this pixel and their distance to the camera in the precision of
+// the integration, indexed with 32 bits
+class vtkProjectionTable : public vtkObject
+{
+public:
+  static vtkProjectionTable* New();
+  vtkTypeMacro(vtkProjectionTable, vtkObject);
+
+  // camera and grid of the table
+  double VoxelToCamera[16];
+  double VoxelToDepthMap[12];
+  int CellDims[3];
+  int DepthMapDims[2];
+  int ScalarType;
+
+  std::vector<vtkTypeUInt32> Voxels;
+  std::vector<vtkTypeUInt32> Pixels;
+  vtkSmartPointer<vtkDataArray> Distances;
+
+  bool Matches(const double voxelToCamera[16], const double voxelToDepthMap[12], const int cellDims[3],
+               const int depthMapDims[2], int scalarType) const
+  {
+    return std::equal(voxelToCamera, voxelToCamera + 16, this->VoxelToCamera) &&
+      std::equal(voxelToDepthMap, voxelToDepthMap + 12, this->VoxelToDepthMap) &&
+      std::equal(cellDims, cellDims + 3, this->CellDims) &&
+      std::equal(depthMapDims, depthMapDims + 2, this->DepthMapDims) && scalarType == this->ScalarType;
+  }
+
+protected:
+  vtkProjectionTable() : ScalarType(VTK_DOUBLE) {}
+
+private:
+  vtkProjectionTable(const vtkProjectionTable&);  // Not implemented.
+  void operator=(const vtkProjectionTable&);  // Not implemented.
+};
+
+vtkStandardNewMacro(vtkProjectionTable);
+
+//----------------------------------------------------------------------------
+// A depth map with its camera matrices
+struct vtkDepthMapFrame
+{
+  vtkSmartPointer<vtkImageData> DepthMap;
+  vtkSmartPointer<vtkMatrix3x3> MatrixK;
+  vtkSmartPointer<vtkMatrix4x4> MatrixTR;
+  vtkSmartPointer<vtkActiveBlocks> ActiveBlocks;
+};
+
+//----------------------------------------------------------------------------
+// Add the milliseconds elapsed during its lifetime to the time of a stage of
+// the profile, and mark them as an NVTX range when built with it
+class vtkProfiledStage
+{
+public:
+  vtkProfiledStage(double* stageTimes, int stage, bool profiling)
+    : StageTime(profiling ? stageTimes + stage : 0), Start(0)
+  {
+    if (!this->StageTime)
+      {
+      return;
+      }
+#ifdef CUDA_RECONSTRUCTION_USE_NVTX
+    nvtxRangePushA(vtkCudaReconstructionFilter::GetProfileStageAsString(stage));
+#endif
+    this->Start = vtkTimerLog::GetUniversalTime();
+  }
+
+  ~vtkProfiledStage()
+  {
+    if (!this->StageTime)
+      {
+      return;
+      }
+    *this->StageTime += 1000 * (vtkTimerLog::GetUniversalTime() - this->Start);
+#ifdef CUDA_RECONSTRUCTION_USE_NVTX
+    nvtxRangePop();
+#endif
+  }
+
+private:
+  double* StageTime;
+  double Start;
+};
+
+//----------------------------------------------------------------------------
+class vtkCudaReconstructionFilter::vtkInternals
+{
+public:
+  vtkInternals() : Context(0), GridStorage(STORAGE_NATIVE), GridLayout(LAYOUT_BRICKS), HasVolume(false), VolumeOnDevice(false),
+    VolumeScalarType(VTK_DOUBLE), VolumeIsSparse(false), VolumeFunction(FUNCTION_CUMUL), HasSparseVolume(false),
+    SparseScalarType(VTK_DOUBLE), DeviceGridIsOutput(false), LastAsyncHandle(0)
+  {
+    this->DepthMapActiveBlocks = vtkSmartPointer<vtkActiveBlocks>::New();
+  }
+  ~vtkInternals()
+  {
+    cuda_reconstruction_delete(this->Context);
+    for (size_t i = 0; i < this->DeviceContexts.size(); i++)
+      {
+      cuda_reconstruction_delete(this->DeviceContexts[i]);
+      }
+  }
+
+  // Depth maps added with AddDepthMap, in incremental mode only the ones not
+  // integrated yet
+  std::vector<vtkDepthMapFrame> DepthMaps;
+
+  // Active blocks of the depth map set with SetDepthMap
+  vtkSmartPointer<vtkActiveBlocks> DepthMapActiveBlocks;
+
+  // Contexts of the devices after the first one, used by the multi-device
+  // integration
+  std::vector<CudaReconstructionContext*> DeviceContexts;
+
+  // Persistent volume of the incremental mode, kept in the cuda context or
+  // in Volume depending on the backend used to create it, with the weights
+  // of the TSDF function
+  CudaReconstructionContext* Context;
+  // storage format and layout of the device grid of the context
+  int GridStorage;
+  int GridLayout;
+  vtkSmartPointer<vtkDataArray> Volume;
+  vtkSmartPointer<vtkDataArray> VolumeWeights;
+  bool HasVolume;
+  bool VolumeOnDevice;
+  int VolumeScalarType;
+  bool VolumeIsSparse;
+  int VolumeFunction;
+
+  // Grid of the persistent volume
+  double VolumeGridMatrix[16];
+  double VolumeGridOrig[3];
+  int VolumeGridDims[3];
+  double VolumeGridSpacing[3];
+
+  bool IsVolumeGrid(double gridMatrix[16], double gridOrig[3], int gridDims[3],
+                    double gridSpacing[3])
+  {
+    for (int i = 0; i < 16; i++)
+      {
+      if (gridMatrix[i] != this->VolumeGridMatrix[i])
+        {
+        return false;
+        }
+      }
+    for (int i = 0; i < 3; i++)
+      {
+      if (gridOrig[i] != this->VolumeGridOrig[i] || gridDims[i] != this->VolumeGridDims[i] ||
+          gridSpacing[i] != this->VolumeGridSpacing[i])
+        {
+        return false;
+        }
+      }
+    return true;
+  }
+
+  // Sparse volume held by the cuda context, its precision and its grid
+  bool HasSparseVolume;
+  int SparseScalarType;
+  double SparseGridMatrix[16];
+  double SparseGridOrig[3];
+  int SparseGridDims[3];
+  double SparseGridSpacing[3];
+
+  // Whether the device grid of the context holds the cells of the last
+  // output, its surface is then extracted on the device
+  bool DeviceGridIsOutput;
+
+  // Output array page-locked for the transfers of Context
+  struct vtkPinnedArray
+  {
+    vtkPinnedArray() : Buffer(0) {}
+    vtkSmartPointer<vtkDataArray> Array;
+    void* Buffer;
+  };
+
+  // Scalars and weights of the last outputs, reused by the next updates
+  // while their type and size match so that they are registered once
+  vtkPinnedArray PinnedScalars;
+  vtkPinnedArray PinnedWeights;
+
+  // Keep an output array registered with Context in place of the pinned
+  // one, unless it is already. The pinned array is released when enabled is
+  // false or when the array is not transferred as is.
+  void PinOutput(vtkPinnedArray& pinned, vtkDataArray* array, int scalarType, bool enabled)
+  {
+    void* buffer = 0;
+    if (enabled && this->Context && array && array->GetDataType() == scalarType &&
+        array->GetNumberOfTuples() > 0)
+      {
+      buffer = array->GetVoidPointer(0);
+      }
+    if (buffer && buffer == pinned.Buffer)
+      {
+      return;
+      }
+    this->UnpinOutput(pinned);
+    size_t bytes = buffer ? static_cast<size_t>(array->GetNumberOfTuples()) * array->GetNumberOfComponents() *
+      array->GetDataTypeSize() : 0;
+    if (buffer && cuda_reconstruction_register_host_memory(this->Context, buffer, bytes))
+      {
+      pinned.Array = array;
+      pinned.Buffer = buffer;
+      }
+  }
+
+  void UnpinOutput(vtkPinnedArray& pinned)
+  {
+    if (pinned.Buffer)
+      {
+      cuda_reconstruction_unregister_host_memory(this->Context, pinned.Buffer);
+      }
+    pinned.Array = 0;
+    pinned.Buffer = 0;
+  }
+
+  // Create an output array of one component, the pinned one when it has
+  // the type and the number of tuples
+  static vtkDataArray* NewOutputArray(const vtkPinnedArray& pinned, int type, vtkIdType tuplesNb)
+  {
+    vtkDataArray* array = pinned.Array;
+    if (array && array->GetDataType() == type && array->GetNumberOfComponents() == 1 &&
+        array->GetNumberOfTuples() == tuplesNb)
+      {
+      array->Register(0);
+      return array;
+      }
+    array = vtkDataArray::CreateDataArray(type);
+    array->SetNumberOfComponents(1);
+    array->SetNumberOfTuples(tuplesNb);
+    return array;
+  }
+
+  // Projection tables of the last cameras integrated by the parallel CPU
+  // backend, the most recently used last
+  std::vector<vtkSmartPointer<vtkProjectionTable> > ProjectionTables;
+
+  // Get the projection table of the camera of a depth map in a grid, built
+  // if it is not among the maxTablesNb tables kept
+  vtkProjectionTable* GetProjectionTable(vtkImageData* depthMap, vtkMatrix3x3* depthMapMatrixK,
+                                         vtkMatrix4x4* depthMapMatrixTR, vtkMatrix4x4* gridMatrix,
+                                         double gridOrig[3], int gridDims[3], double gridSpacing[3],
+                                         int scalarType, int maxTablesNb);
+
+  // Handles of IntegrateAsync, with the number of the last integration of
+  // the context queued for each handle not known to be integrated yet
+  vtkIdType LastAsyncHandle;
+  std::deque<std::pair<vtkIdType, long long> > PendingHandles;
+
+  // Forget the handles whose integrations ended, returns 0 if one failed
+  int UpdatePendingHandles()
+  {
+    if (!this->Context)
+      {
+      this->PendingHandles.clear();
+      return 1;
+      }
+    long long completedNb = 0;
+    int res = cuda_reconstruction_get_async_completed(this->Context, &completedNb);
+    while (!this->PendingHandles.empty() && (!res || this->PendingHandles.front().second <= completedNb))
+      {
+      this->PendingHandles.pop_front();
+      }
+    return res;
+  }
+
+  // Create the sparse volume of the cuda context
+  int InitSparseVolume(bool singlePrecision, double gridMatrix[16], double gridOrig[3], int gridDims[3],
+                       double gridSpacing[3], vtkIdType maxBlocksNb, double bandWidth);
+
+  // Copy the blocks of the sparse volume into the dense scalars of its grid,
+  // the voxels outside the blocks are set to zero
+  int ExportSparseVolume(vtkDataArray* outScalar);
+
+  // Get the depth maps to integrate: the added ones followed by the one
+  // set with SetDepthMap
+  void GetFramesToIntegrate(vtkCudaReconstructionFilter* self,
+                            std::vector<vtkDepthMapFrame>& frames)
+  {
+    frames = this->DepthMaps;
+    if (self->DepthMap && self->DepthMapMatrixK && self->DepthMapMatrixTR)
+      {
+      vtkDepthMapFrame frame;
+      frame.DepthMap = self->DepthMap;
+      frame.MatrixK = self->DepthMapMatrixK;
+      frame.MatrixTR = self->DepthMapMatrixTR;
+      frame.ActiveBlocks = this->DepthMapActiveBlocks;
+      frames.push_back(frame);
+      }
+  }
+};
+
+//----------------------------------------------------------------------------
+// Get the depth scalars of a depth map
+static vtkDataArray* GetDepths(vtkImageData* depthMap)
+{
+  return depthMap->GetPointData()->GetArray("Depths");
+}
+
+//----------------------------------------------------------------------------
+// Get the depths as an array of T, they are converted into buffer when the
+// Depths array has another type
+template <typename T>
+static const T* GetDepthsPointer(vtkDataArray* depths, std::vector<T>& buffer)
+{
+  if (depths->GetDataType() == vtkTypeTraits<T>::VTKTypeID())
+    {
+    return static_cast<const T*>(depths->GetVoidPointer(0));
+    }
+  vtkIdType depthsNb = depths->GetNumberOfTuples();
+  buffer.resize(depthsNb);
+  for (vtkIdType i = 0; i < depthsNb; i++)
+    {
+    buffer[i] = static_cast<T>(depths->GetTuple1(i));
+    }
+  return depthsNb > 0 ? &buffer[0] : 0;
+}
+
+//----------------------------------------------------------------------------
+// Preprocessing of the depth maps before their integration, see
+// ReconstructionDepths.h
+struct vtkDepthPreprocessing
+{
+  double MinDepth;
+  double MaxDepth;
+  const char* ConfidenceArrayName;
+  double MinConfidence;
+  int Level;
+};
+
+//----------------------------------------------------------------------------
+// Get the confidences of a depth map, null when it has none or when they
+// do not mask any depth
+static vtkDataArray* GetConfidences(vtkImageData* depthMap, const vtkDepthPreprocessing& preprocessing)
+{
+  if (!preprocessing.ConfidenceArrayName || !(preprocessing.MinConfidence > 0))
+    {
+    return 0;
+    }
+  return depthMap->GetPointData()->GetArray(preprocessing.ConfidenceArrayName);
+}
+
+//----------------------------------------------------------------------------
+// Replace the invalid depths of a depth map by NaN into Out
+template <typename T>
+struct vtkDepthMaskFunctor
+{
+  const T* Depths;
+  const float* Confidences;
+  T* Out;
+  T MinDepth;
+  T MaxDepth;
+  float MinConfidence;
+
+  void operator()(vtkIdType begin, vtkIdType end)
+  {
+    for (vtkIdType i = begin; i < end; i++)
+      {
+      bool confident = !this->Confidences || this->Confidences[i] >= this->MinConfidence;
+      this->Out[i] = ReconstructionMaskDepth(this->Depths[i], this->MinDepth, this->MaxDepth, confident);
+      }
+  }
+};
+
+//----------------------------------------------------------------------------
+// Halve a depth map into the next level of the pyramid, by rows of the level
+template <typename T>
+struct vtkDepthDownsampleFunctor
+{
+  const T* Depths;
+  const int* Dims;
+  T* Out;
+  const int* OutDims;
+
+  void operator()(vtkIdType begin, vtkIdType end)
+  {
+    for (vtkIdType j = begin; j < end; j++)
+      {
+      T* row = this->Out + j * this->OutDims[0];
+      for (int i = 0; i < this->OutDims[0]; i++)
+        {
+        row[i] = ReconstructionDownsampleDepth(this->Depths, this->Dims, i, static_cast<int>(j));
+        }
+      }
+  }
+};
+
+//----------------------------------------------------------------------------
+// Preprocess the depths of a depth map in the precision T into the Depths
+// of outDepthMap: mask them then halve them level by level, matrixK being
+// adjusted to the last level
+template <typename T>
+static void PreprocessDepths(vtkImageData* depthMap, const vtkDepthPreprocessing& preprocessing,
+                             vtkImageData* outDepthMap, double matrixK[9])
+{
+  int dims[3];
+  depthMap->GetDimensions(dims);
+  std::vector<T> buffer;
+  const T* depths = GetDepthsPointer(GetDepths(depthMap), buffer);
+  vtkDataArray* confidences = GetConfidences(depthMap, preprocessing);
+  std::vector<float> confidenceBuffer;
+  vtkIdType depthsNb = static_cast<vtkIdType>(dims[0]) * dims[1];
+  std::vector<T> levelDepths(depthsNb);
+  if (depthsNb > 0)
+    {
+    vtkDepthMaskFunctor<T> mask = {depths, confidences ? GetDepthsPointer(confidences, confidenceBuffer) : 0,
+                                   &levelDepths[0], static_cast<T>(preprocessing.MinDepth),
+                                   static_cast<T>(preprocessing.MaxDepth),
+                                   static_cast<float>(preprocessing.MinConfidence)};
+    vtkSMPTools::For(0, depthsNb, mask);
+    }
+  for (int l = 0; l < preprocessing.Level && depthsNb > 0; l++)
+    {
+    int nextDims[3];
+    ReconstructionDownsampleDims(dims, nextDims);
+    std::vector<T> nextDepths(static_cast<vtkIdType>(nextDims[0]) * nextDims[1]);
+    vtkDepthDownsampleFunctor<T> downsample = {&levelDepths[0], dims, &nextDepths[0], nextDims};
+    vtkSMPTools::For(0, nextDims[1], downsample);
+    levelDepths.swap(nextDepths);
+    ReconstructionDownsampleMatrixK(matrixK);
+    std::copy(nextDims, nextDims + 3, dims);
+    }
+
+  vtkSmartPointer<vtkDataArray> outDepths;
+  outDepths.TakeReference(vtkDataArray::CreateDataArray(vtkTypeTraits<T>::VTKTypeID()));
+  outDepths->SetName("Depths");
+  outDepths->SetNumberOfTuples(static_cast<vtkIdType>(levelDepths.size()));
+  if (!levelDepths.empty())
+    {
+    std::copy(levelDepths.begin(), levelDepths.end(), static_cast<T*>(outDepths->GetVoidPointer(0)));
+    }
+  outDepthMap->SetDimensions(dims);
+  outDepthMap->GetPointData()->AddArray(outDepths);
+}
+
+//----------------------------------------------------------------------------
+// Preprocess a depth map for the CPU backends in the precision scalarType:
+// the frame itself when its depths are integrated as they are, a frame with
+// a new depth map and intrinsics otherwise. The active blocks of the frame
+// stay valid for the preprocessed one. The cuda backend preprocesses the
+// depth maps on the device.
+static vtkDepthMapFrame PreprocessFrame(const vtkDepthMapFrame& frame, const vtkDepthPreprocessing& preprocessing,
+                                        int scalarType)
+{
+  bool masksConfidences = GetConfidences(frame.DepthMap, preprocessing) != 0;
+  if ((preprocessing.MinDepth <= 0 && preprocessing.MaxDepth <= 0 && !masksConfidences &&
+       preprocessing.Level <= 0) || !GetDepths(frame.DepthMap))
+    {
+    return frame;
+    }
+  vtkDepthMapFrame preprocessed = frame;
+  preprocessed.DepthMap = vtkSmartPointer<vtkImageData>::New();
+  double matrixK[9];
+  vtkMatrix3x3::DeepCopy(matrixK, frame.MatrixK);
+  if (scalarType == VTK_FLOAT)
+    {
+    PreprocessDepths<float>(frame.DepthMap, preprocessing, preprocessed.DepthMap, matrixK);
+    }
+  else
+    {
+    PreprocessDepths<double>(frame.DepthMap, preprocessing, preprocessed.DepthMap, matrixK);
+    }
+  preprocessed.MatrixK = vtkSmartPointer<vtkMatrix3x3>::New();
+  preprocessed.MatrixK->DeepCopy(matrixK);
+  return preprocessed;
+}
+
+//----------------------------------------------------------------------------
+// Get the preprocessing of the depth maps set on a filter
+static vtkDepthPreprocessing GetDepthPreprocessing(vtkCudaReconstructionFilter* self)
+{
+  vtkDepthPreprocessing preprocessing = {self->GetMinDepth(), self->GetMaxDepth(), self->GetConfidenceArrayName(),
+                                         self->GetMinConfidence(), self->GetDepthMapLevel()};
+  return preprocessing;
+}
+
+//----------------------------------------------------------------------------
+// Set the preprocessing of the depth maps integrated by a cuda context
+static void SetDepthPreprocessing(CudaReconstructionContext* context, const vtkDepthPreprocessing& preprocessing)
+{
+  cuda_reconstruction_set_depth_preprocessing(context, preprocessing.MinDepth, preprocessing.MaxDepth,
+                                              preprocessing.MinConfidence, preprocessing.Level);
+}
+
+//----------------------------------------------------------------------------
+// Bilinear interpolation of the depths at (x, y), the pixel centers being at
+// integer coordinates and the borders being clamped. The depth is invalid
+// when one of the four taps is.
+template <typename T>
+static T InterpolateDepth(const T* depths, const int dims[2], T x, T y)
+{
+  int i0 = static_cast<int>(std::floor(x));
+  int j0 = static_cast<int>(std::floor(y));
+  T fx = x - i0;
+  T fy = y - j0;
+  int i1 = std::min(i0 + 1, dims[0] - 1);
+  int j1 = std::min(j0 + 1, dims[1] - 1);
+  i0 = std::max(i0, 0);
+  j0 = std::max(j0, 0);
+  const T* row0 = depths + static_cast<vtkIdType>(j0) * dims[0];
+  const T* row1 = depths + static_cast<vtkIdType>(j1) * dims[0];
+  if (!ReconstructionAreValidTaps(row0[i0], row0[i1], row1[i0], row1[i1]))
+    {
+    return ReconstructionInvalidDepth<T>();
+    }
+  return (1 - fy) * ((1 - fx) * row0[i0] + fx * row0[i1]) + fy * ((1 - fx) * row1[i0] + fx * row1[i1]);
+}
+
+//----------------------------------------------------------------------------
+// Compute the matrix transforming the voxel indices (i, j, k) into the
+// camera coords of the voxel center, as a row-major homogeneous matrix
+static void ComputeVoxelToCameraMatrix(vtkMatrix4x4 *gridMatrix, double gridOrig[3],
+  double gridSpacing[3], vtkMatrix4x4 *depthMapMatrixTR, double voxelToCamera[16])
+{
+  // voxel indices to grid coords
+  double voxelToGrid[16] = {
+    gridSpacing[0], 0, 0, gridOrig[0] + 0.5 * gridSpacing[0],
+    0, gridSpacing[1], 0, gridOrig[1] + 0.5 * gridSpacing[1],
+    0, 0, gridSpacing[2], gridOrig[2] + 0.5 * gridSpacing[2],
+    0, 0, 0, 1 };
+
+  double voxelToScene[16];
+  vtkMatrix4x4::Multiply4x4(gridMatrix->GetData(), voxelToGrid, voxelToScene);
+  vtkMatrix4x4::Multiply4x4(depthMapMatrixTR->GetData(), voxelToScene, voxelToCamera);
+}
+
+//----------------------------------------------------------------------------
+// Compute the 3x4 row-major matrix transforming the voxel indices into the
+// depth map homogeneous coords of the voxel center
+static void ComputeVoxelToDepthMapMatrix(vtkMatrix3x3 *depthMapMatrixK, const double voxelToCamera[16],
+  double voxelToDepthMap[12])
+{
+  for (int i = 0; i < 3; i++)
+    {
+    for (int j = 0; j < 4; j++)
+      {
+      double value = 0;
+      for (int k = 0; k < 3; k++)
+        {
+        value += depthMapMatrixK->GetElement(i, k) * voxelToCamera[4 * k + j];
+        }
+      voxelToDepthMap[4 * i + j] = value;
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+// Project the voxel (i, j, k) into homogeneous camera coords and depth map
+// homogeneous coords with the matrices of ComputeVoxelToCameraMatrix and
+// ComputeVoxelToDepthMapMatrix. Along a row the projections of the next
+// voxel are obtained by adding the x column of the matrices.
+template <typename T>
+static void ProjectVoxel(const T voxelToCamera[16], const T voxelToDepthMap[12], T i, T j, T k,
+  T cameraCoordsHomo[4], T depthMapCoordsHomo[3])
+{
+  for (int n = 0; n < 4; n++)
+    {
+    cameraCoordsHomo[n] = voxelToCamera[4 * n] * i + voxelToCamera[4 * n + 1] * j +
+                          voxelToCamera[4 * n + 2] * k + voxelToCamera[4 * n + 3];
+    }
+  for (int n = 0; n < 3; n++)
+    {
+    depthMapCoordsHomo[n] = voxelToDepthMap[4 * n] * i + voxelToDepthMap[4 * n + 1] * j +
+                            voxelToDepthMap[4 * n + 2] * k + voxelToDepthMap[4 * n + 3];
+    }
+}
+
+//----------------------------------------------------------------------------
+// Get the sorted list of the blocks of CUDA_RECONSTRUCTION_BLOCK_SIZE^3
+// voxels which may project into a depth map. A block is culled when the
+// centers of its corner voxels are all behind the camera, or all in front of
+// it and projected outside the image: the projection of the block is then
+// inside the bounding box of the projected corners.
+static void CullBlocks(const double voxelToDepthMap[12], const int cellDims[3],
+                       const int depthMapDims[2], std::vector<int>& activeBlocks)
+{
+  const double* P = voxelToDepthMap;
+  int blocksDims[3];
+  for (int i = 0; i < 3; i++)
+    {
+    blocksDims[i] = (cellDims[i] + CUDA_RECONSTRUCTION_BLOCK_SIZE - 1) / CUDA_RECONSTRUCTION_BLOCK_SIZE;
+    }
+
+  // the pixels are selected by rounding, a margin of one pixel covers the
+  // rounding differences of the single precision
+  double bounds[4] = {-1.5, depthMapDims[0] + 0.5, -1.5, depthMapDims[1] + 0.5};
+
+  activeBlocks.clear();
+  int block = 0;
+  for (int bz = 0; bz < blocksDims[2]; bz++)
+    {
+    for (int by = 0; by < blocksDims[1]; by++)
+      {
+      for (int bx = 0; bx < blocksDims[0]; bx++, block++)
+        {
+        int b[3] = {bx, by, bz};
+        double range[3][2];
+        for (int i = 0; i < 3; i++)
+          {
+          range[i][0] = b[i] * CUDA_RECONSTRUCTION_BLOCK_SIZE;
+          range[i][1] = std::min((b[i] + 1) * CUDA_RECONSTRUCTION_BLOCK_SIZE, cellDims[i]) - 1;
+          }
+
+        int behindNb = 0;
+        double uvBounds[4] = {VTK_DOUBLE_MAX, -VTK_DOUBLE_MAX, VTK_DOUBLE_MAX, -VTK_DOUBLE_MAX};
+        for (int c = 0; c < 8; c++)
+          {
+          double x = range[0][c & 1];
+          double y = range[1][(c >> 1) & 1];
+          double z = range[2][(c >> 2) & 1];
+          double h[3];
+          for (int i = 0; i < 3; i++)
+            {
+            h[i] = P[4 * i] * x + P[4 * i + 1] * y + P[4 * i + 2] * z + P[4 * i + 3];
+            }
+          if (h[2] <= 0)
+            {
+            behindNb++;
+            continue;
+            }
+          double u = h[0] / h[2];
+          double v = h[1] / h[2];
+          uvBounds[0] = std::min(uvBounds[0], u);
+          uvBounds[1] = std::max(uvBounds[1], u);
+          uvBounds[2] = std::min(uvBounds[2], v);
+          uvBounds[3] = std::max(uvBounds[3], v);
+          }
+
+        // a block crossing the camera plane is kept
+        if (behindNb == 8)
+          {
+          continue;
+          }
+        if (behindNb == 0 &&
+            (uvBounds[1] < bounds[0] || uvBounds[0] > bounds[1] ||
+             uvBounds[3] < bounds[2] || uvBounds[2] > bounds[3]))
+          {
+          continue;
+          }
+        activeBlocks.push_back(block);
+        }
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+// Get the active blocks of a depth map in a grid, they are only computed
+// again when the grid or the camera change
+static const std::vector<int>& GetActiveBlocks(const vtkDepthMapFrame& frame, vtkMatrix4x4 *gridMatrix,
+  double gridOrig[3], int gridDims[3], double gridSpacing[3])
+{
+  double voxelToCamera[16];
+  ComputeVoxelToCameraMatrix(gridMatrix, gridOrig, gridSpacing, frame.MatrixTR, voxelToCamera);
+  double voxelToDepthMap[12];
+  ComputeVoxelToDepthMapMatrix(frame.MatrixK, voxelToCamera, voxelToDepthMap);
+  int cellDims[3] = {gridDims[0] - 1, gridDims[1] - 1, gridDims[2] - 1};
+  int depthMapDims[3];
+  frame.DepthMap->GetDimensions(depthMapDims);
+
+  vtkActiveBlocks* activeBlocks = frame.ActiveBlocks;
+  bool isValid = activeBlocks->IsValid &&
+    std::equal(voxelToDepthMap, voxelToDepthMap + 12, activeBlocks->VoxelToDepthMap) &&
+    std::equal(cellDims, cellDims + 3, activeBlocks->CellDims) &&
+    std::equal(depthMapDims, depthMapDims + 2, activeBlocks->DepthMapDims);
+  if (!isValid)
+    {
+    CullBlocks(voxelToDepthMap, cellDims, depthMapDims, activeBlocks->Blocks);
+    std::copy(voxelToDepthMap, voxelToDepthMap + 12, activeBlocks->VoxelToDepthMap);
+    std::copy(cellDims, cellDims + 3, activeBlocks->CellDims);
+    std::copy(depthMapDims, depthMapDims + 2, activeBlocks->DepthMapDims);
+    activeBlocks->IsValid = true;
+    }
+  return activeBlocks->Blocks;
+}
+
+//----------------------------------------------------------------------------
+// Get the geometry of the cells of an extent of a grid, the origin is moved
+// to the first point of the extent
+static void GetGridGeometry(vtkImageData* grid, const int extent[6], double gridOrig[3],
+                            int gridDims[3], double gridSpacing[3])
+{
+  grid->GetOrigin(gridOrig);
+  grid->GetSpacing(gridSpacing);
+  for (int i = 0; i < 3; i++)
+    {
+    gridOrig[i] += extent[2 * i] * gridSpacing[i];
+    gridDims[i] = extent[2 * i + 1] - extent[2 * i] + 1;
+    }
+}
+
+//----------------------------------------------------------------------------
+// Check that requiredMemory bytes fit in the free device memory, the buffers
+// already allocated by the context are reused
+static bool FitsOnDevice(CudaReconstructionContext* context, size_t requiredMemory)
+{
+  int devicesNb;
+  size_t freeMemory, totalMemory;
+  if (!cuda_reconstruction_get_device_info(&devicesNb, &freeMemory, &totalMemory))
+    {
+    return false;
+    }
+  if (context)
+    {
+    size_t allocatedMemory = cuda_reconstruction_get_allocated_memory(context);
+    requiredMemory = requiredMemory > allocatedMemory ? requiredMemory - allocatedMemory : 0;
+    }
+
+  // keep a margin for the driver and the other allocations
+  return requiredMemory < freeMemory / 10 * 9;
+}
+
+//----------------------------------------------------------------------------
+// Host arrays page-locked for the transfers of a cuda context while this
+// object lives, for the depth maps transferred from their arrays
+class vtkScopedHostRegistration
+{
+public:
+  vtkScopedHostRegistration(CudaReconstructionContext* context, bool enabled)
+    : Context(context), Enabled(enabled) {}
+  ~vtkScopedHostRegistration()
+  {
+    for (size_t i = 0; i < this->Buffers.size(); i++)
+      {
+      cuda_reconstruction_unregister_host_memory(this->Context, this->Buffers[i]);
+      }
+  }
+
+  // Register an array which is transferred as is, the arrays of another
+  // type than scalarType are converted before their transfer
+  void Register(vtkDataArray* array, int scalarType)
+  {
+    if (!this->Enabled || !array || array->GetDataType() != scalarType || array->GetNumberOfTuples() == 0)
+      {
+      return;
+      }
+    void* buffer = array->GetVoidPointer(0);
+    size_t bytes = static_cast<size_t>(array->GetNumberOfTuples()) * array->GetNumberOfComponents() *
+      array->GetDataTypeSize();
+    if (cuda_reconstruction_register_host_memory(this->Context, buffer, bytes))
+      {
+      this->Buffers.push_back(buffer);
+      }
+  }
+
+  // Register the depths of the frames
+  void Register(const std::vector<vtkDepthMapFrame>& frames, int scalarType)
+  {
+    for (size_t i = 0; i < frames.size(); i++)
+      {
+      this->Register(GetDepths(frames[i].DepthMap), scalarType);
+      }
+  }
+
+private:
+  CudaReconstructionContext* Context;
+  bool Enabled;
+  std::vector<void*> Buffers;
+};
+
+//----------------------------------------------------------------------------
+// Fill the cuda description of a depth map, the depths are converted into
+// one of the buffers when they do not have the precision of the device
+// grid, and its confidences into confidenceBuffer when they are not in
+// single precision. All the voxels are integrated when activeBlocks is
+// null. Returns false for a depth map without depths.
+static bool GetCudaDepthMap(const vtkDepthMapFrame& frame, int scalarType,
+                            const std::vector<int>* activeBlocks, const vtkDepthPreprocessing& preprocessing,
+                            CudaReconstructionDepthMap& cudaDepthMap,
+                            std::vector<float>& floatBuffer, std::vector<double>& doubleBuffer,
+                            std::vector<float>& confidenceBuffer)
+{
+  vtkImageData* depthMap = frame.DepthMap;
+  vtkDataArray* depths = GetDepths(depthMap);
+  if (!depths)
+    {
+    vtkGenericWarningMacro("Depth map without Depths array, it is skipped.");
+    return false;
+    }
+  depthMap->GetDimensions(cudaDepthMap.dims);
+
+  // convert matrices into row-major arrays
+  vtkMatrix3x3::DeepCopy(cudaDepthMap.matrixK, frame.MatrixK);
+  vtkMatrix4x4::DeepCopy(cudaDepthMap.matrixTR, frame.MatrixTR);
+  cudaDepthMap.activeBlocks = (activeBlocks && !activeBlocks->empty()) ? &(*activeBlocks)[0] : 0;
+  cudaDepthMap.activeBlocksNb = activeBlocks ? static_cast<int>(activeBlocks->size()) : -1;
+
+  if (scalarType == VTK_FLOAT)
+    {
+    cudaDepthMap.depths = GetDepthsPointer(depths, floatBuffer);
+    }
+  else
+    {
+    cudaDepthMap.depths = GetDepthsPointer(depths, doubleBuffer);
+    }
+  vtkDataArray* confidences = GetConfidences(depthMap, preprocessing);
+  cudaDepthMap.confidences = confidences ? GetDepthsPointer(confidences, confidenceBuffer) : 0;
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// Integrate a depth map into the device grid of a cuda context, or only
+// queue its integration when async is set
+static int IntegrateWithCuda(CudaReconstructionContext* context, int scalarType,
+                             const vtkDepthMapFrame& frame, const std::vector<int>* activeBlocks,
+                             const vtkDepthPreprocessing& preprocessing, bool async = false)
+{
+  CudaReconstructionDepthMap depthMap;
+  std::vector<float> floatBuffer;
+  std::vector<double> doubleBuffer;
+  std::vector<float> confidenceBuffer;
+  if (!GetCudaDepthMap(frame, scalarType, activeBlocks, preprocessing, depthMap, floatBuffer, doubleBuffer,
+                       confidenceBuffer))
+    {
+    return 1;
+    }
+
+  if (async)
+    {
+    return cuda_reconstruction_integrate_async(context, depthMap.dims, depthMap.depths, depthMap.confidences,
+                                               depthMap.matrixK, depthMap.matrixTR,
+                                               depthMap.activeBlocks, depthMap.activeBlocksNb);
+    }
+  return cuda_reconstruction_integrate(context, depthMap.dims, depthMap.depths, depthMap.confidences,
+                                       depthMap.matrixK, depthMap.matrixTR,
+                                       depthMap.activeBlocks, depthMap.activeBlocksNb);
+}
+
+//----------------------------------------------------------------------------
+// Slab of whole z slices of a grid integrated by one device
+struct vtkDeviceSlab
+{
+  int Device;
+  CudaReconstructionContext** Context;
+  double Orig[3];
+  int Dims[3];
+  void* OutScalar;
+  void* OutWeights;
+  std::vector<CudaReconstructionDepthMap> DepthMaps;
+  std::vector<std::vector<int> > ActiveBlocks;
+  int BricksNb;
+  int Result;
+};
+
+// Grid split into slabs, shared by the threads driving the devices
+struct vtkMultiDeviceIntegration
+{
+  bool SinglePrecision;
+  double GridMatrix[16];
+  double GridSpacing[3];
+  vtkIdType MaxBrickVoxels;
+  int Interpolation;
+  vtkDepthPreprocessing Preprocessing;
+  int Function;
+  double Truncation;
+  std::vector<vtkDeviceSlab> Slabs;
+};
+
+//----------------------------------------------------------------------------
+// Thread integrating a slab on its device, brick by brick if it does not fit
+static VTK_THREAD_RETURN_TYPE IntegrateSlab(void* arg)
+{
+  vtkMultiThreader::ThreadInfo* info = static_cast<vtkMultiThreader::ThreadInfo*>(arg);
+  vtkMultiDeviceIntegration* integration = static_cast<vtkMultiDeviceIntegration*>(info->UserData);
+  vtkDeviceSlab& slab = integration->Slabs[info->ThreadID];
+  slab.BricksNb = 0;
+  slab.Result = cuda_reconstruction_set_device(slab.Device);
+  if (!slab.Result)
+    {
+    return VTK_THREAD_RETURN_VALUE;
+    }
+  if (!*slab.Context)
+    {
+    *slab.Context = cuda_reconstruction_new();
+    }
+  cuda_reconstruction_set_interpolation(*slab.Context, integration->Interpolation);
+  SetDepthPreprocessing(*slab.Context, integration->Preprocessing);
+  cuda_reconstruction_set_function(*slab.Context, integration->Function, integration->Truncation);
+  slab.Result = cuda_reconstruction_integrate_bricked(*slab.Context, integration->SinglePrecision,
+    integration->GridMatrix, slab.Orig, slab.Dims, integration->GridSpacing,
+    static_cast<int>(slab.DepthMaps.size()), slab.DepthMaps.empty() ? 0 : &slab.DepthMaps[0], slab.OutScalar,
+    slab.OutWeights, integration->MaxBrickVoxels, &slab.BricksNb);
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
+// Integrate depth maps into a grid split along z into one slab per device,
+// each device gets all the depth maps. The slabs start on block boundaries
+// so that the active blocks of the grid are shifted to the blocks of the
+// slabs. contexts holds the context of each device, created on demand, the
+// sampling, the preprocessing and the accumulation function are set on all.
+static int IntegrateOnDevices(std::vector<CudaReconstructionContext*>& contexts, bool singlePrecision,
+                              double gridMatrix[16], double gridOrig[3], int gridDims[3], double gridSpacing[3],
+                              const std::vector<CudaReconstructionDepthMap>& depthMaps, void* outScalar,
+                              void* outWeights, int interpolation, const vtkDepthPreprocessing& preprocessing,
+                              int function, double truncation,
+                              vtkIdType maxBrickVoxels, int* bricksNb)
+{
+  const int size = CUDA_RECONSTRUCTION_BLOCK_SIZE;
+  int devicesNb = static_cast<int>(contexts.size());
+  int slicesNb = gridDims[2] - 1;
+  int slabBlocksNb = ((slicesNb + size - 1) / size + devicesNb - 1) / devicesNb;
+  int slabSlicesNb = slabBlocksNb * size;
+  vtkIdType planeBlocksNb = static_cast<vtkIdType>((gridDims[0] - 2) / size + 1) * ((gridDims[1] - 2) / size + 1);
+  vtkIdType sliceVoxelsNb = static_cast<vtkIdType>(gridDims[0] - 1) * (gridDims[1] - 1);
+  size_t scalarSize = singlePrecision ? sizeof(float) : sizeof(double);
+
+  vtkMultiDeviceIntegration integration;
+  integration.SinglePrecision = singlePrecision;
+  std::copy(gridMatrix, gridMatrix + 16, integration.GridMatrix);
+  std::copy(gridSpacing, gridSpacing + 3, integration.GridSpacing);
+  integration.MaxBrickVoxels = maxBrickVoxels;
+  integration.Interpolation = interpolation;
+  integration.Preprocessing = preprocessing;
+  integration.Function = function;
+  integration.Truncation = truncation;
+  for (int d = 0; d < devicesNb && d * slabSlicesNb < slicesNb; d++)
+    {
+    int z = d * slabSlicesNb;
+    vtkDeviceSlab slab;
+    slab.Device = d;
+    slab.Context = &contexts[d];
+    slab.Orig[0] = gridOrig[0];
+    slab.Orig[1] = gridOrig[1];
+    slab.Orig[2] = gridOrig[2] + z * gridSpacing[2];
+    slab.Dims[0] = gridDims[0];
+    slab.Dims[1] = gridDims[1];
+    slab.Dims[2] = std::min(slabSlicesNb, slicesNb - z) + 1;
+    slab.OutScalar = static_cast<char*>(outScalar) + z * sliceVoxelsNb * scalarSize;
+    slab.OutWeights = outWeights ? static_cast<char*>(outWeights) + z * sliceVoxelsNb * scalarSize : 0;
+    integration.Slabs.push_back(slab);
+    }
+
+  // shift the active blocks of the grid into the blocks of the slabs
+  for (size_t s = 0; s < integration.Slabs.size(); s++)
+    {
+    vtkDeviceSlab& slab = integration.Slabs[s];
+    slab.DepthMaps = depthMaps;
+    slab.ActiveBlocks.resize(depthMaps.size());
+    int firstBlock = static_cast<int>(s * slabBlocksNb * planeBlocksNb);
+    int lastBlock = static_cast<int>((s + 1) * slabBlocksNb * planeBlocksNb);
+    for (size_t i = 0; i < depthMaps.size(); i++)
+      {
+      if (depthMaps[i].activeBlocksNb < 0)
+        {
+        continue;
+        }
+      const int* begin = std::lower_bound(depthMaps[i].activeBlocks,
+                                          depthMaps[i].activeBlocks + depthMaps[i].activeBlocksNb, firstBlock);
+      const int* end = std::lower_bound(begin, depthMaps[i].activeBlocks + depthMaps[i].activeBlocksNb,
+                                        lastBlock);
+      std::vector<int>& blocks = slab.ActiveBlocks[i];
+      for (const int* block = begin; block != end; block++)
+        {
+        blocks.push_back(*block - firstBlock);
+        }
+      slab.DepthMaps[i].activeBlocks = blocks.empty() ? 0 : &blocks[0];
+      slab.DepthMaps[i].activeBlocksNb = static_cast<int>(blocks.size());
+      }
+    }
+
+  vtkNew<vtkMultiThreader> threader;
+  threader->SetNumberOfThreads(static_cast<int>(integration.Slabs.size()));
+  threader->SetSingleMethod(IntegrateSlab, &integration);
+  threader->SingleMethodExecute();
+
+  // the first slab was integrated by the calling thread, which stays on the
+  // first device
+  int res = 1;
+  *bricksNb = 0;
+  for (size_t s = 0; s < integration.Slabs.size(); s++)
+    {
+    res = res && integration.Slabs[s].Result;
+    *bricksNb += integration.Slabs[s].BricksNb;
+    }
+  return res;
+}
+
+//----------------------------------------------------------------------------
+// Integrate a depth map into the sparse volume of a cuda context
+static int IntegrateSparseWithCuda(CudaReconstructionContext* context, int scalarType,
+                                   const vtkDepthMapFrame& frame, const vtkDepthPreprocessing& preprocessing)
+{
+  CudaReconstructionDepthMap depthMap;
+  std::vector<float> floatBuffer;
+  std::vector<double> doubleBuffer;
+  std::vector<float> confidenceBuffer;
+  if (!GetCudaDepthMap(frame, scalarType, 0, preprocessing, depthMap, floatBuffer, doubleBuffer,
+                       confidenceBuffer))
+    {
+    return 1;
+    }
+
+  return cuda_reconstruction_sparse_integrate(context, depthMap.dims, depthMap.depths, depthMap.confidences,
+                                              depthMap.matrixK, depthMap.matrixTR);
+}
+
+//----------------------------------------------------------------------------
+// Get the arrays of scalarType integrating the values of outScalar and
+// outWeights: themselves when they have this type, zeroed temporaries
+// otherwise
+static void GetIntegrationArrays(int scalarType, vtkDataArray* outScalar, vtkDataArray* outWeights,
+                                 vtkSmartPointer<vtkDataArray>& scalars, vtkSmartPointer<vtkDataArray>& weights)
+{
+  vtkDataArray* outArrays[2] = {outScalar, outWeights};
+  vtkSmartPointer<vtkDataArray>* arrays[2] = {&scalars, &weights};
+  for (int i = 0; i < 2; i++)
+    {
+    *arrays[i] = outArrays[i];
+    if (outArrays[i] && outArrays[i]->GetDataType() != scalarType)
+      {
+      arrays[i]->TakeReference(vtkDataArray::CreateDataArray(scalarType));
+      (*arrays[i])->SetNumberOfComponents(1);
+      (*arrays[i])->SetNumberOfTuples(outArrays[i]->GetNumberOfTuples());
+      (*arrays[i])->FillComponent(0, 0);
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+// Convert the integrated values into output arrays of another type, the
+// unsigned short scalars are quantised over range and the unsigned short
+// weights saturate
+static void StoreIntegration(vtkDataArray* scalars, vtkDataArray* weights, const double range[2],
+                             vtkDataArray* outScalar, vtkDataArray* outWeights)
+{
+  if (scalars != outScalar)
+    {
+    vtkIdType voxelsNb = std::min(scalars->GetNumberOfTuples(), outScalar->GetNumberOfTuples());
+    if (outScalar->GetDataType() == VTK_UNSIGNED_SHORT)
+      {
+      unsigned short* out = static_cast<unsigned short*>(outScalar->GetVoidPointer(0));
+      double scale = (range[1] - range[0]) / 65535;
+      for (vtkIdType i = 0; i < voxelsNb; i++)
+        {
+        out[i] = ReconstructionQuantize(scalars->GetTuple1(i), range[0], scale);
+        }
+      }
+    else
+      {
+      for (vtkIdType i = 0; i < voxelsNb; i++)
+        {
+        outScalar->SetTuple1(i, scalars->GetTuple1(i));
+        }
+      }
+    }
+  if (weights && outWeights && weights != outWeights)
+    {
+    vtkIdType voxelsNb = std::min(weights->GetNumberOfTuples(), outWeights->GetNumberOfTuples());
+    double maxWeight = outWeights->GetDataType() == VTK_UNSIGNED_SHORT ? 65535 : VTK_DOUBLE_MAX;
+    for (vtkIdType i = 0; i < voxelsNb; i++)
+      {
+      outWeights->SetTuple1(i, std::min(weights->GetTuple1(i), maxWeight));
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+// Copy the values of the cells of a volume in cellExtent, the inclusive
+// ranges of their indices, into a new array of the same type
+static vtkSmartPointer<vtkDataArray> ExtractCellExtent(vtkDataArray* volume, const int cellDims[3],
+                                                      const int cellExtent[6])
+{
+  int extentDims[3];
+  for (int i = 0; i < 3; i++)
+    {
+    extentDims[i] = std::max(cellExtent[2 * i + 1] - cellExtent[2 * i] + 1, 0);
+    }
+  vtkSmartPointer<vtkDataArray> extent;
+  extent.TakeReference(vtkDataArray::CreateDataArray(volume->GetDataType()));
+  extent->SetNumberOfComponents(1);
+  extent->SetNumberOfTuples(static_cast<vtkIdType>(extentDims[0]) * extentDims[1] * extentDims[2]);
+  if (extent->GetNumberOfTuples() == 0)
+    {
+    return extent;
+    }
+
+  // the rows of the extent are contiguous in the volume
+  size_t rowBytes = static_cast<size_t>(extentDims[0]) * volume->GetDataTypeSize();
+  vtkIdType id = 0;
+  for (int k = cellExtent[4]; k <= cellExtent[5]; k++)
+    {
+    for (int j = cellExtent[2]; j <= cellExtent[3]; j++, id += extentDims[0])
+      {
+      vtkIdType volumeId = cellExtent[0] + cellDims[0] * (j + static_cast<vtkIdType>(cellDims[1]) * k);
+      const char* in = static_cast<const char*>(volume->GetVoidPointer(volumeId));
+      std::copy(in, in + rowBytes, static_cast<char*>(extent->GetVoidPointer(id)));
+      }
+    }
+  return extent;
+}
+
+//----------------------------------------------------------------------------
+// Copy the voxels of the sparse blocks into dense scalars
+template <typename T>
+static void ScatterSparseBlocks(const std::vector<int>& blockIndices, const T* blockScalars,
+                                const int cellDims[3], T* outScalar)
+{
+  const int size = CUDA_RECONSTRUCTION_BLOCK_SIZE;
+  size_t blocksNb = blockIndices.size() / 3;
+  for (size_t b = 0; b < blocksNb; b++)
+    {
+    const T* block = blockScalars + b * size * size * size;
+    int first[3];
+    int last[3];
+    for (int n = 0; n < 3; n++)
+      {
+      first[n] = blockIndices[3 * b + n] * size;
+      last[n] = std::min(first[n] + size, cellDims[n]);
+      }
+    for (int k = first[2]; k < last[2]; k++)
+      {
+      for (int j = first[1]; j < last[1]; j++)
+        {
+        const T* in = block + size * ((j - first[1]) + size * (k - first[2]));
+        T* out = outScalar + first[0] + cellDims[0] * (j + static_cast<vtkIdType>(cellDims[1]) * k);
+        std::copy(in, in + (last[0] - first[0]), out);
+        }
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+// Copy the allocated blocks of the sparse volume of a cuda context to the
+// host
+static int GetSparseBlocks(CudaReconstructionContext* context, std::vector<int>& blockIndices,
+                           vtkDataArray* blockScalars)
+{
+  long long blocksNb, lostBlocksNb;
+  if (!cuda_reconstruction_sparse_get_number_of_blocks(context, &blocksNb, &lostBlocksNb))
+    {
+    return 0;
+    }
+  if (lostBlocksNb > 0)
+    {
+    vtkGenericWarningMacro("The sparse volume is full, " << lostBlocksNb << " blocks were not allocated.");
+    }
+  const int size = CUDA_RECONSTRUCTION_BLOCK_SIZE;
+  blockIndices.resize(3 * blocksNb);
+  blockScalars->SetNumberOfComponents(1);
+  blockScalars->SetNumberOfTuples(blocksNb * size * size * size);
+  if (blocksNb == 0)
+    {
+    return 1;
+    }
+  return cuda_reconstruction_sparse_get_blocks(context, &blockIndices[0], blockScalars->GetVoidPointer(0));
+}
+
+//----------------------------------------------------------------------------
+int vtkCudaReconstructionFilter::vtkInternals::InitSparseVolume(bool singlePrecision,
+  double gridMatrix[16], double gridOrig[3], int gridDims[3], double gridSpacing[3],
+  vtkIdType maxBlocksNb, double bandWidth)
+{
+  if (!this->Context)
+    {
+    this->Context = cuda_reconstruction_new();
+    }
+  this->HasSparseVolume = false;
+  if (!cuda_reconstruction_sparse_init(this->Context, singlePrecision, gridMatrix, gridOrig, gridDims,
+                                       gridSpacing, maxBlocksNb, bandWidth))
+    {
+    return 0;
+    }
+  this->SparseScalarType = singlePrecision ? VTK_FLOAT : VTK_DOUBLE;
+  std::copy(gridMatrix, gridMatrix + 16, this->SparseGridMatrix);
+  std::copy(gridOrig, gridOrig + 3, this->SparseGridOrig);
+  std::copy(gridDims, gridDims + 3, this->SparseGridDims);
+  std::copy(gridSpacing, gridSpacing + 3, this->SparseGridSpacing);
+  this->HasSparseVolume = true;
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+int vtkCudaReconstructionFilter::vtkInternals::ExportSparseVolume(vtkDataArray* outScalar)
+{
+  outScalar->FillComponent(0, 0);
+  int scalarType = outScalar->GetDataType();
+  std::vector<int> blockIndices;
+  vtkSmartPointer<vtkDataArray> blockScalars;
+  blockScalars.TakeReference(vtkDataArray::CreateDataArray(scalarType));
+  if (!this->HasSparseVolume || !GetSparseBlocks(this->Context, blockIndices, blockScalars))
+    {
+    return 0;
+    }
+
+  int cellDims[3] = {this->SparseGridDims[0] - 1, this->SparseGridDims[1] - 1, this->SparseGridDims[2] - 1};
+  if (outScalar->GetNumberOfTuples() != static_cast<vtkIdType>(cellDims[0]) * cellDims[1] * cellDims[2])
+    {
+    vtkGenericWarningMacro("The output does not match the grid of the sparse volume.");
+    return 0;
+    }
+  if (scalarType == VTK_FLOAT)
+    {
+    ScatterSparseBlocks(blockIndices, static_cast<float*>(blockScalars->GetVoidPointer(0)), cellDims,
+                        static_cast<float*>(outScalar->GetVoidPointer(0)));
+    }
+  else
+    {
+    ScatterSparseBlocks(blockIndices, static_cast<double*>(blockScalars->GetVoidPointer(0)), cellDims,
+                        static_cast<double*>(outScalar->GetVoidPointer(0)));
+    }
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+vtkCudaReconstructionFilter::vtkCudaReconstructionFilter()
+{
+  this->SetNumberOfInputPorts(1);
+  this->SetNumberOfOutputPorts(2);
+  this->DepthMap = 0;
+  this->DepthMapMatrixK = 0;
+  this->DepthMapMatrixTR = 0;
+  this->GridMatrix = 0;
+  this->Incremental = 0;
+  this->Backend = BACKEND_AUTO;
+  this->LastBackend = -1;
+  this->OutputScalarPrecision = vtkAlgorithm::DEFAULT_PRECISION;
+  this->StorageFormat = STORAGE_NATIVE;
+  this->DeviceLayout = LAYOUT_BRICKS;
+  this->MaxBrickNumberOfVoxels = 0;
+  this->LastNumberOfBricks = 0;
+  this->FrustumCulling = 1;
+  this->InterpolationMode = INTERPOLATION_NEAREST;
+  this->MinDepth = 0;
+  this->MaxDepth = 0;
+  this->ConfidenceArrayName = 0;
+  this->MinConfidence = 0;
+  this->DepthMapLevel = 0;
+  this->IntegrationFunction = FUNCTION_CUMUL;
+  this->TruncationDistance = 0;
+  this->HostMemoryPinning = 1;
+  this->Vectorization = 1;
+  this->NumberOfDevices = 1;
+  this->LastNumberOfDevices = 0;
+  this->SparseVolume = 0;
+  this->SparseMaxNumberOfBlocks = 0;
+  this->SparseBandWidth = 0;
+  this->LastNumberOfSparseBlocks = 0;
+  this->ExtractSurface = 0;
+  this->SurfaceValue = 0;
+  this->MaxPendingDepthMaps = 2;
+  this->ProjectionCacheSize = 0;
+  this->Profiling = 0;
+  std::fill(this->LastStageTimes, this->LastStageTimes + PROFILE_STAGES_NB, 0.);
+  this->ProfileStartTime = 0;
+  this->LastNumberOfIntegratedVoxels = 0;
+  this->LastNumberOfCulledVoxels = 0;
+  this->LastNumberOfUploadedBytes = 0;
+  this->LastNumberOfDownloadedBytes = 0;
+  this->Verbosity = 0;
+  this->Internals = new vtkInternals;
+}
+
+//----------------------------------------------------------------------------
+vtkCudaReconstructionFilter::~vtkCudaReconstructionFilter()
+{
+  if (this->DepthMapMatrixK)
+    {
+    this->DepthMapMatrixK->Delete();
+    }
+  if (this->DepthMapMatrixTR)
+    {
+    this->DepthMapMatrixTR->Delete();
+    }
+  if (this->GridMatrix)
+    {
+    this->GridMatrix->Delete();
+    }
+  if (this->DepthMap)
+    {
+    this->DepthMap->Delete();
+    }
+  this->SetConfidenceArrayName(0);
+  delete this->Internals;
+}
+
+//----------------------------------------------------------------------------
+void vtkCudaReconstructionFilter::AddDepthMap(vtkImageData *depthMap,
+  vtkMatrix3x3 *depthMapMatrixK, vtkMatrix4x4 *depthMapMatrixTR)
+{
+  if (!depthMap || !depthMapMatrixK || !depthMapMatrixTR)
+    {
+    vtkErrorMacro("AddDepthMap needs a depth map, a K matrix and a TR matrix.");
+    return;
+    }
+
+  // the matrices are copied so that the caller can reuse them for the next
+  // depth map
+  vtkDepthMapFrame frame;
+  frame.DepthMap = depthMap;
+  frame.MatrixK = vtkSmartPointer<vtkMatrix3x3>::New();
+  frame.MatrixK->DeepCopy(depthMapMatrixK);
+  frame.MatrixTR = vtkSmartPointer<vtkMatrix4x4>::New();
+  frame.MatrixTR->DeepCopy(depthMapMatrixTR);
+  frame.ActiveBlocks = vtkSmartPointer<vtkActiveBlocks>::New();
+  this->Internals->DepthMaps.push_back(frame);
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+void vtkCudaReconstructionFilter::RemoveAllDepthMaps()
+{
+  if (!this->Internals->DepthMaps.empty())
+    {
+    this->Internals->DepthMaps.clear();
+    this->Modified();
+    }
+}
+
+//----------------------------------------------------------------------------
+int vtkCudaReconstructionFilter::GetNumberOfDepthMaps()
+{
+  return static_cast<int>(this->Internals->DepthMaps.size());
+}
+
+//----------------------------------------------------------------------------
+const char* vtkCudaReconstructionFilter::GetBackendAsString(int backend)
+{
+  switch (backend)
+    {
+    case BACKEND_AUTO:
+      return "auto";
+    case BACKEND_CUDA:
+      return "cuda";
+    case BACKEND_CPU_PARALLEL:
+      return "cpu";
+    case BACKEND_CPU_SERIAL:
+      return "serial";
+    default:
+      return "none";
+    }
+}
+
+//----------------------------------------------------------------------------
+const char* vtkCudaReconstructionFilter::GetIntegrationFunctionAsString(int function)
+{
+  switch (function)
+    {
+    case FUNCTION_CUMUL:
+      return "cumul";
+    case FUNCTION_TSDF:
+      return "tsdf";
+    case FUNCTION_LOG_ODDS:
+      return "logodds";
+    case FUNCTION_MAX_CONFIDENCE:
+      return "maxconfidence";
+    default:
+      return "none";
+    }
+}
+
+//----------------------------------------------------------------------------
+const char* vtkCudaReconstructionFilter::GetStorageFormatAsString(int storage)
+{
+  switch (storage)
+    {
+    case STORAGE_NATIVE:
+      return "native";
+    case STORAGE_HALF:
+      return "half";
+    case STORAGE_UINT16:
+      return "uint16";
+    default:
+      return "unknown";
+    }
+}
+
+//----------------------------------------------------------------------------
+const char* vtkCudaReconstructionFilter::GetDeviceLayoutAsString(int layout)
+{
+  switch (layout)
+    {
+    case LAYOUT_LINEAR:
+      return "linear";
+    case LAYOUT_BRICKS:
+      return "bricks";
+    default:
+      return "unknown";
+    }
+}
+
+//----------------------------------------------------------------------------
+const char* vtkCudaReconstructionFilter::GetVectorizationInstructionSet()
+{
+  return simd_reconstruction_get_instruction_set_name(simd_reconstruction_get_instruction_set());
+}
+
+//----------------------------------------------------------------------------
+void vtkCudaReconstructionFilter::SetMemoryPoolLimit(vtkIdType bytes)
+{
+  cuda_reconstruction_set_pool_limit(bytes > 0 ? static_cast<size_t>(bytes) : 0);
+}
+
+//----------------------------------------------------------------------------
+void vtkCudaReconstructionFilter::ReleaseMemoryPool()
+{
+  cuda_reconstruction_release_pool();
+}
+
+//----------------------------------------------------------------------------
+vtkIdType vtkCudaReconstructionFilter::GetMemoryPoolCachedBytes()
+{
+  size_t cachedBytes, usedBytes;
+  cuda_reconstruction_get_pool_info(&cachedBytes, &usedBytes);
+  return static_cast<vtkIdType>(cachedBytes);
+}
+
+//----------------------------------------------------------------------------
+vtkIdType vtkCudaReconstructionFilter::GetMemoryPoolUsedBytes()
+{
+  size_t cachedBytes, usedBytes;
+  cuda_reconstruction_get_pool_info(&cachedBytes, &usedBytes);
+  return static_cast<vtkIdType>(usedBytes);
+}
+
+//----------------------------------------------------------------------------
+const char* vtkCudaReconstructionFilter::GetProfileStageAsString(int stage)
+{
+  switch (stage)
+    {
+    case PROFILE_STAGE_HOST_PREPARE:
+      return "host prepare";
+    case PROFILE_STAGE_UPLOAD:
+      return "upload";
+    case PROFILE_STAGE_KERNEL:
+      return "kernel";
+    case PROFILE_STAGE_DOWNLOAD:
+      return "download";
+    case PROFILE_STAGE_WRAP:
+      return "wrap";
+    default:
+      return "unknown";
+    }
+}
+
+//----------------------------------------------------------------------------
+double vtkCudaReconstructionFilter::GetLastStageTime(int stage)
+{
+  return (stage >= 0 && stage < PROFILE_STAGES_NB) ? this->LastStageTimes[stage] : 0;
+}
+
+//----------------------------------------------------------------------------
+int vtkCudaReconstructionFilter::SelectBackend(vtkIdType voxelsNb, vtkIdType maxDepthMapPointsNb,
+                                               int scalarType)
+{
+  if (this->SparseVolume && (this->Backend == BACKEND_CPU_PARALLEL || this->Backend == BACKEND_CPU_SERIAL))
+    {
+    vtkErrorMacro("The sparse volume is only available with the cuda backend.");
+    return -1;
+    }
+  if (this->SparseVolume && this->IntegrationFunction != FUNCTION_CUMUL)
+    {
+    vtkErrorMacro("The sparse volume only supports the cumulative function.");
+    return -1;
+    }
+  if (this->Backend == BACKEND_CPU_PARALLEL || this->Backend == BACKEND_CPU_SERIAL)
+    {
+    return this->Backend;
+    }
+
+  int devicesNb;
+  size_t freeMemory, totalMemory;
+  if (!cuda_reconstruction_get_device_info(&devicesNb, &freeMemory, &totalMemory))
+    {
+    if (this->Backend == BACKEND_CUDA || this->SparseVolume)
+      {
+      vtkErrorMacro("The cuda backend was requested but no cuda device is available.");
+      return -1;
+      }
+    return BACKEND_CPU_PARALLEL;
+    }
+  if (this->Backend == BACKEND_CUDA || this->SparseVolume)
+    {
+    return BACKEND_CUDA;
+    }
+
+  // a grid too large for the device is integrated brick by brick, except
+  // for the persistent volume of the incremental mode
+  if (!this->Incremental)
+    {
+    return BACKEND_CUDA;
+    }
+  size_t scalarSize = scalarType == VTK_FLOAT ? sizeof(float) : sizeof(double);
+  vtkIdType arraysNb = ReconstructionFunctionHasWeights(this->IntegrationFunction) ? 2 : 1;
+  size_t requiredMemory = static_cast<size_t>(arraysNb * voxelsNb) * this->GetVoxelSize(scalarType) +
+    static_cast<size_t>(maxDepthMapPointsNb) * scalarSize;
+  if (FitsOnDevice(this->Internals->Context, requiredMemory))
+    {
+    return BACKEND_CUDA;
+    }
+  return BACKEND_CPU_PARALLEL;
+}
+
+//----------------------------------------------------------------------------
+int vtkCudaReconstructionFilter::GetOutputScalarType(vtkImageData* depthMap)
+{
+  if (this->OutputScalarPrecision == vtkAlgorithm::SINGLE_PRECISION)
+    {
+    return VTK_FLOAT;
+    }
+  if (this->OutputScalarPrecision == vtkAlgorithm::DOUBLE_PRECISION)
+    {
+    return VTK_DOUBLE;
+    }
+
+  // default precision: the one of the depths
+  vtkDataArray* depths = depthMap ? GetDepths(depthMap) : 0;
+  return (depths && depths->GetDataType() == VTK_FLOAT) ? VTK_FLOAT : VTK_DOUBLE;
+}
+
+//----------------------------------------------------------------------------
+int vtkCudaReconstructionFilter::IntegrateDepthMaps()
+{
+  if (!this->Incremental)
+    {
+    vtkErrorMacro("IntegrateDepthMaps is only available in incremental mode.");
+    return 0;
+    }
+
+  // the grid geometry comes from the input
+  vtkAlgorithm* inputAlgorithm = this->GetInputAlgorithm(0, 0);
+  if (!inputAlgorithm)
+    {
+    vtkErrorMacro("No input grid.");
+    return 0;
+    }
+  inputAlgorithm->Update();
+  vtkImageData* grid = vtkImageData::SafeDownCast(this->GetInputDataObject(0, 0));
+  if (!grid || !this->GridMatrix)
+    {
+    vtkErrorMacro("Bad input.");
+    return 0;
+    }
+
+  this->StartProfile();
+  int res = this->IntegratePendingDepthMaps(grid);
+  this->StopProfile();
+  this->Modified();
+  return res;
+}
+
+//----------------------------------------------------------------------------
+vtkIdType vtkCudaReconstructionFilter::IntegrateAsync(vtkImageData* depthMap, vtkMatrix3x3* depthMapMatrixK,
+                                                      vtkMatrix4x4* depthMapMatrixTR)
+{
+  if (!this->Incremental)
+    {
+    vtkErrorMacro("IntegrateAsync needs the incremental mode.");
+    return 0;
+    }
+  size_t depthMapsNb = this->Internals->DepthMaps.size();
+  this->AddDepthMap(depthMap, depthMapMatrixK, depthMapMatrixTR);
+  if (this->Internals->DepthMaps.size() == depthMapsNb || !this->IntegrateDepthMaps())
+    {
+    return 0;
+    }
+
+  // only the dense volume of the device is integrated asynchronously, the
+  // handle then waits for the last integration queued on the context
+  vtkInternals* internals = this->Internals;
+  vtkIdType handle = ++internals->LastAsyncHandle;
+  if (internals->Context && internals->VolumeOnDevice && !internals->VolumeIsSparse)
+    {
+    internals->PendingHandles.push_back(
+      std::make_pair(handle, cuda_reconstruction_get_async_submitted(internals->Context)));
+    }
+  return handle;
+}
+
+//----------------------------------------------------------------------------
+int vtkCudaReconstructionFilter::IsIntegrated(vtkIdType handle)
+{
+  vtkInternals* internals = this->Internals;
+  if (!internals->UpdatePendingHandles())
+    {
+    vtkErrorMacro("Unable to integrate a depth map.");
+    }
+  return (internals->PendingHandles.empty() || internals->PendingHandles.front().first > handle) ? 1 : 0;
+}
+
+//----------------------------------------------------------------------------
+int vtkCudaReconstructionFilter::WaitForIntegration(vtkIdType handle)
+{
+  vtkInternals* internals = this->Internals;
+  long long ticket = 0;
+  for (size_t i = 0; i < internals->PendingHandles.size() && internals->PendingHandles[i].first <= handle; i++)
+    {
+    ticket = internals->PendingHandles[i].second;
+    }
+  if (ticket > 0 && !cuda_reconstruction_wait_async(internals->Context, ticket))
+    {
+    internals->PendingHandles.clear();
+    vtkErrorMacro("Unable to integrate a depth map.");
+    return 0;
+    }
+  return internals->UpdatePendingHandles();
+}
+
+//----------------------------------------------------------------------------
+int vtkCudaReconstructionFilter::Synchronize()
+{
+  vtkInternals* internals = this->Internals;
+  internals->PendingHandles.clear();
+  if (internals->Context && !cuda_reconstruction_synchronize(internals->Context))
+    {
+    vtkErrorMacro("Unable to integrate a depth map.");
+    return 0;
+    }
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+void vtkCudaReconstructionFilter::ResetVolume()
+{
+  this->Internals->HasVolume = false;
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+vtkPolyData* vtkCudaReconstructionFilter::GetSurfaceOutput()
+{
+  return vtkPolyData::SafeDownCast(this->GetOutputDataObject(1));
+}
+
+//----------------------------------------------------------------------------
+int vtkCudaReconstructionFilter::IntegratePendingDepthMaps(vtkImageData* grid)
+{
+  // get grid info
+  double gridMatrix[16];
+  vtkMatrix4x4::DeepCopy(gridMatrix, this->GridMatrix);
+  double gridOrig[3];
+  int gridDims[3];
+  double gridSpacing[3];
+  GetGridGeometry(grid, grid->GetExtent(), gridOrig, gridDims, gridSpacing);
+
+  vtkInternals* internals = this->Internals;
+  vtkIdType maxDepthMapPointsNb = 0;
+  for (size_t i = 0; i < internals->DepthMaps.size(); i++)
+    {
+    maxDepthMapPointsNb = std::max(maxDepthMapPointsNb, internals->DepthMaps[i].DepthMap->GetNumberOfPoints());
+    }
+
+  // a volume keeps the precision it was created with, until it is reset
+  int scalarType = internals->HasVolume ? internals->VolumeScalarType :
+    this->GetOutputScalarType(internals->DepthMaps.empty() ? 0 : internals->DepthMaps[0].DepthMap.GetPointer());
+  int backend = this->SelectBackend(grid->GetNumberOfCells(), maxDepthMapPointsNb, scalarType);
+  if (backend < 0)
+    {
+    return 0;
+    }
+  this->LastBackend = backend;
+  bool sparse = this->SparseVolume != 0;
+  this->LastNumberOfBricks = (backend == BACKEND_CUDA && !sparse) ? 1 : 0;
+  this->LastNumberOfDevices = backend == BACKEND_CUDA ? 1 : 0;
+
+  // create the volume, or reset it if the grid, the backend, the
+  // representation or the accumulation function changed
+  bool useCuda = backend == BACKEND_CUDA;
+  bool weights = ReconstructionFunctionHasWeights(this->IntegrationFunction);
+  double truncation = this->GetTruncation(gridSpacing);
+  if (internals->Context)
+    {
+    cuda_reconstruction_set_function(internals->Context, this->IntegrationFunction, truncation);
+    }
+  if (!internals->HasVolume || internals->VolumeOnDevice != useCuda ||
+      internals->VolumeScalarType != scalarType || internals->VolumeIsSparse != sparse ||
+      internals->VolumeFunction != this->IntegrationFunction ||
+      (useCuda && !sparse && internals->GridStorage != this->StorageFormat) ||
+      (useCuda && !sparse && internals->GridLayout != this->DeviceLayout) ||
+      !internals->IsVolumeGrid(gridMatrix, gridOrig, gridDims, gridSpacing))
+    {
+    internals->HasVolume = false;
+    internals->VolumeWeights = 0;
+    if (sparse)
+      {
+      internals->Volume = 0;
+      if (!internals->InitSparseVolume(scalarType == VTK_FLOAT, gridMatrix, gridOrig, gridDims, gridSpacing,
+                                       this->SparseMaxNumberOfBlocks, this->SparseBandWidth))
+        {
+        return 0;
+        }
+      }
+    else if (useCuda)
+      {
+      internals->HasSparseVolume = false;
+      internals->Volume = 0;
+      if (!internals->Context)
+        {
+        internals->Context = cuda_reconstruction_new();
+        cuda_reconstruction_set_function(internals->Context, this->IntegrationFunction, truncation);
+        }
+      cuda_reconstruction_set_storage(internals->Context, this->StorageFormat);
+      cuda_reconstruction_set_layout(internals->Context, this->DeviceLayout);
+      internals->GridStorage = this->StorageFormat;
+      internals->GridLayout = this->DeviceLayout;
+      if (!cuda_reconstruction_init_grid(internals->Context, scalarType == VTK_FLOAT, gridMatrix,
+                                         gridOrig, gridDims, gridSpacing, 0, 0))
+        {
+        return 0;
+        }
+      }
+    else
+      {
+      internals->UnpinOutput(internals->PinnedScalars);
+      internals->UnpinOutput(internals->PinnedWeights);
+      cuda_reconstruction_delete(internals->Context);
+      internals->Context = 0;
+      internals->HasSparseVolume = false;
+      internals->Volume.TakeReference(vtkDataArray::CreateDataArray(scalarType));
+      internals->Volume->SetNumberOfComponents(1);
+      internals->Volume->SetNumberOfTuples(grid->GetNumberOfCells());
+      internals->Volume->FillComponent(0, 0);
+      if (weights)
+        {
+        internals->VolumeWeights.TakeReference(vtkDataArray::CreateDataArray(scalarType));
+        internals->VolumeWeights->SetNumberOfComponents(1);
+        internals->VolumeWeights->SetNumberOfTuples(grid->GetNumberOfCells());
+        internals->VolumeWeights->FillComponent(0, 0);
+        }
+      }
+    for (int i = 0; i < 16; i++)
+      {
+      internals->VolumeGridMatrix[i] = gridMatrix[i];
+      }
+    for (int i = 0; i < 3; i++)
+      {
+      internals->VolumeGridOrig[i] = gridOrig[i];
+      internals->VolumeGridDims[i] = gridDims[i];
+      internals->VolumeGridSpacing[i] = gridSpacing[i];
+      }
+    internals->VolumeOnDevice = useCuda;
+    internals->VolumeScalarType = scalarType;
+    internals->VolumeIsSparse = sparse;
+    internals->VolumeFunction = this->IntegrationFunction;
+    internals->HasVolume = true;
+    }
+
+  // each depth map is integrated once, even if the integration fails
+  std::vector<vtkDepthMapFrame> frames;
+  frames.swap(internals->DepthMaps);
+
+  // the depth maps integrated asynchronously are copied into the staging
+  // buffers of the context, only the others are transferred from their
+  // arrays, unless the stages are timed one after the other
+  vtkDepthPreprocessing preprocessing = GetDepthPreprocessing(this);
+  bool async = useCuda && !sparse && !this->Profiling;
+  vtkScopedHostRegistration registration(internals->Context, useCuda && this->HostMemoryPinning && !async);
+  if (useCuda)
+    {
+    cuda_reconstruction_set_interpolation(internals->Context, this->InterpolationMode == INTERPOLATION_LINEAR ?
+      CUDA_RECONSTRUCTION_INTERPOLATION_LINEAR : CUDA_RECONSTRUCTION_INTERPOLATION_NEAREST);
+    SetDepthPreprocessing(internals->Context, preprocessing);
+    cuda_reconstruction_set_timing(internals->Context, this->Profiling != 0);
+    cuda_reconstruction_set_async_depth(internals->Context, this->MaxPendingDepthMaps);
+    registration.Register(frames, scalarType);
+    }
+  if (this->Verbosity >= 2)
+    {
+    std::cout << "Integrate " << frames.size() << " depth maps with the "
+              << vtkCudaReconstructionFilter::GetBackendAsString(backend) << " backend." << std::endl;
+    }
+
+  int res = 1;
+  for (size_t i = 0; res && i < frames.size(); i++)
+    {
+    if (sparse)
+      {
+      res = IntegrateSparseWithCuda(internals->Context, scalarType, frames[i], preprocessing);
+      this->CountSparseVoxels(gridDims);
+      continue;
+      }
+    const std::vector<int>* activeBlocks = 0;
+    if (this->FrustumCulling && backend != BACKEND_CPU_SERIAL)
+      {
+      activeBlocks = &GetActiveBlocks(frames[i], this->GridMatrix, gridOrig, gridDims, gridSpacing);
+      }
+    this->CountIntegratedVoxels(activeBlocks, gridDims);
+    if (useCuda)
+      {
+      // the upload of the next depth map overlaps this integration
+      res = IntegrateWithCuda(internals->Context, scalarType, frames[i], activeBlocks, preprocessing, async);
+      continue;
+      }
+    vtkProfiledStage stage(this->LastStageTimes, PROFILE_STAGE_KERNEL, this->Profiling != 0);
+    vtkDepthMapFrame frame = PreprocessFrame(frames[i], preprocessing, scalarType);
+    if (backend == BACKEND_CPU_PARALLEL)
+      {
+      res = this->IntegrateWithSMP(gridOrig, gridDims, gridSpacing,
+        frame.DepthMap, frame.MatrixK, frame.MatrixTR,
+        internals->Volume, activeBlocks, internals->VolumeWeights, truncation);
+      }
+    else
+      {
+      res = vtkCudaReconstructionFilter::ComputeWithoutCuda(
+        this->GridMatrix, gridOrig, gridDims, gridSpacing,
+        frame.DepthMap, frame.MatrixK, frame.MatrixTR,
+        internals->Volume, this->InterpolationMode, this->IntegrationFunction, internals->VolumeWeights,
+        truncation);
+      }
+    }
+  if (sparse)
+    {
+    this->UpdateNumberOfSparseBlocks();
+    }
+  return res;
+}
+
+//----------------------------------------------------------------------------
+double vtkCudaReconstructionFilter::GetTruncation(double gridSpacing[3])
+{
+  if (this->TruncationDistance > 0)
+    {
+    return this->TruncationDistance;
+    }
+  return 3 * std::max(std::abs(gridSpacing[0]), std::max(std::abs(gridSpacing[1]), std::abs(gridSpacing[2])));
+}
+
+//----------------------------------------------------------------------------
+size_t vtkCudaReconstructionFilter::GetVoxelSize(int scalarType)
+{
+  if (this->StorageFormat == STORAGE_HALF || this->StorageFormat == STORAGE_UINT16)
+    {
+    return sizeof(unsigned short);
+    }
+  return scalarType == VTK_FLOAT ? sizeof(float) : sizeof(double);
+}
+
+//----------------------------------------------------------------------------
+void vtkCudaReconstructionFilter::InitializeOutputArrays(vtkImageData* outGrid, int scalarType,
+  double truncation, vtkSmartPointer<vtkDataArray>& outScalar, vtkSmartPointer<vtkDataArray>& outWeights)
+{
+  vtkProfiledStage stage(this->LastStageTimes, PROFILE_STAGE_WRAP, this->Profiling != 0);
+  int outScalarType = scalarType;
+  int outWeightsType = scalarType;
+  if (this->StorageFormat == STORAGE_HALF)
+    {
+    outScalarType = VTK_FLOAT;
+    outWeightsType = VTK_UNSIGNED_SHORT;
+    }
+  else if (this->StorageFormat == STORAGE_UINT16)
+    {
+    outScalarType = VTK_UNSIGNED_SHORT;
+    outWeightsType = VTK_UNSIGNED_SHORT;
+    }
+
+  outScalar.TakeReference(vtkInternals::NewOutputArray(this->Internals->PinnedScalars, outScalarType,
+                                                       outGrid->GetNumberOfCells()));
+  outScalar->SetName("reconstruction_scalar");
+  outGrid->GetCellData()->AddArray(outScalar);
+
+  // the quantised values stand for offsets in the range of the function
+  if (this->StorageFormat == STORAGE_UINT16)
+    {
+    double range[2];
+    ReconstructionFunctionRange(this->IntegrationFunction, truncation, range);
+    vtkNew<vtkDoubleArray> rangeArray;
+    rangeArray->SetName("reconstruction_scalar_range");
+    rangeArray->SetNumberOfTuples(2);
+    rangeArray->SetValue(0, range[0]);
+    rangeArray->SetValue(1, range[1]);
+    outGrid->GetFieldData()->AddArray(rangeArray.Get());
+    }
+
+  // the image data is axis aligned, the grid matrix placing it in the world
+  // is kept along for the writers of the vti files
+  if (this->GridMatrix)
+    {
+    vtkNew<vtkDoubleArray> matrixArray;
+    matrixArray->SetName("reconstruction_grid_matrix");
+    matrixArray->SetNumberOfTuples(16);
+    for (int i = 0; i < 16; i++)
+      {
+      matrixArray->SetValue(i, this->GridMatrix->GetElement(i / 4, i % 4));
+      }
+    outGrid->GetFieldData()->AddArray(matrixArray.Get());
+    }
+
+  // the TSDF function keeps a weight per voxel, the incremental volume is
+  // reset when the function changes
+  outWeights = 0;
+  if (ReconstructionFunctionHasWeights(this->IntegrationFunction))
+    {
+    outWeights.TakeReference(vtkInternals::NewOutputArray(this->Internals->PinnedWeights, outWeightsType,
+                                                          outGrid->GetNumberOfCells()));
+    outWeights->SetName("reconstruction_weight");
+    outGrid->GetCellData()->AddArray(outWeights);
+    }
+}
+
+//----------------------------------------------------------------------------
+int vtkCudaReconstructionFilter::DownloadGrid(vtkDataArray* outScalar, vtkDataArray* outWeights,
+                                              const int* cellExtent)
+{
+  CudaReconstructionContext* context = this->Internals->Context;
+  bool half = this->Internals->GridStorage == STORAGE_HALF;
+  bool pinning = this->HostMemoryPinning != 0;
+  if (!half)
+    {
+    this->Internals->PinOutput(this->Internals->PinnedScalars, outScalar, outScalar->GetDataType(), pinning);
+    }
+  if (outWeights)
+    {
+    this->Internals->PinOutput(this->Internals->PinnedWeights, outWeights, outWeights->GetDataType(), pinning);
+    }
+  void* h_outWeights = outWeights ? outWeights->GetVoidPointer(0) : 0;
+  this->Internals->DeviceGridIsOutput = !cellExtent;
+  if (!half)
+    {
+    return cellExtent ?
+      cuda_reconstruction_get_grid_extent(context, cellExtent, outScalar->GetVoidPointer(0), h_outWeights) :
+      cuda_reconstruction_get_grid(context, outScalar->GetVoidPointer(0), h_outWeights);
+    }
+
+  // the half voxels are widened on the host
+  vtkIdType voxelsNb = outScalar->GetNumberOfTuples();
+  if (voxelsNb == 0)
+    {
+    return 1;
+    }
+  std::vector<unsigned short> halfScalars(voxelsNb);
+  if (!(cellExtent ? cuda_reconstruction_get_grid_extent(context, cellExtent, &halfScalars[0], h_outWeights) :
+        cuda_reconstruction_get_grid(context, &halfScalars[0], h_outWeights)))
+    {
+    return 0;
+    }
+  vtkProfiledStage stage(this->LastStageTimes, PROFILE_STAGE_WRAP, this->Profiling != 0);
+  float* out = static_cast<float*>(outScalar->GetVoidPointer(0));
+  for (vtkIdType i = 0; i < voxelsNb; i++)
+    {
+    out[i] = ReconstructionHalfToFloat(halfScalars[i]);
+    }
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+// Marching cubes on the host over the cells of the output, a task per slice
+// of cubes along z whose triangles are appended in order afterwards
+struct vtkSurfaceExtraction
+{
+  vtkDataArray* Scalars;
+  vtkDataArray* Weights;
+  int CellDims[3];
+  // center of the first cell
+  double Origin[3];
+  double Spacing[3];
+  // dequantisation of the values
+  double Offset;
+  double Scale;
+  double IsoValue;
+  const int* TriangleCases;
+  std::vector<std::vector<float> >* SliceTriangles;
+
+  void operator()(vtkIdType begin, vtkIdType end)
+  {
+    vtkIdType sliceSize = static_cast<vtkIdType>(this->CellDims[0]) * this->CellDims[1];
+    for (vtkIdType k = begin; k < end; k++)
+      {
+      std::vector<float>& triangles = (*this->SliceTriangles)[k];
+      for (int j = 0; j < this->CellDims[1] - 1; j++)
+        {
+        for (int i = 0; i < this->CellDims[0] - 1; i++)
+          {
+          double values[8];
+          bool integrated = true;
+          for (int c = 0; c < 8 && integrated; c++)
+            {
+            int offset[3];
+            ReconstructionCubeCorner(c, offset);
+            vtkIdType id = (i + offset[0]) + this->CellDims[0] * static_cast<vtkIdType>(j + offset[1]) +
+              sliceSize * (k + offset[2]);
+            integrated = !this->Weights || this->Weights->GetTuple1(id) != 0;
+            values[c] = this->Offset + this->Scale * this->Scalars->GetTuple1(id);
+            }
+          if (!integrated)
+            {
+            continue;
+            }
+          const int* caseEdges = this->TriangleCases +
+            RECONSTRUCTION_SURFACE_CASE_SIZE * ReconstructionCubeCase(values, this->IsoValue);
+          int trianglesNb = ReconstructionCaseTrianglesNb(caseEdges);
+          double cubeOrigin[3] = { this->Origin[0] + i * this->Spacing[0], this->Origin[1] + j * this->Spacing[1],
+                                   this->Origin[2] + k * this->Spacing[2] };
+          for (int e = 0; e < 3 * trianglesNb; e++)
+            {
+            double point[3];
+            ReconstructionEdgePoint(values, this->IsoValue, caseEdges[e], cubeOrigin, this->Spacing, point);
+            triangles.insert(triangles.end(), point, point + 3);
+            }
+          }
+        }
+      }
+  }
+};
+
+//----------------------------------------------------------------------------
+int vtkCudaReconstructionFilter::ComputeSurface(vtkImageData* outGrid, vtkPolyData* surface)
+{
+  if (this->Verbosity >= 2)
+    {
+    std::cout << "Extract surface." << std::endl;
+    }
+  int triangleCases[256 * RECONSTRUCTION_SURFACE_CASE_SIZE];
+  vtkMarchingCubesTriangleCases* cases = vtkMarchingCubesTriangleCases::GetCases();
+  for (int i = 0; i < 256; i++)
+    {
+    for (int j = 0; j < RECONSTRUCTION_SURFACE_CASE_SIZE; j++)
+      {
+      triangleCases[RECONSTRUCTION_SURFACE_CASE_SIZE * i + j] = cases[i].edges[j];
+      }
+    }
+
+  std::vector<float> triangles;
+  if (this->Internals->DeviceGridIsOutput)
+    {
+    // only the triangles come back from the device
+    CudaReconstructionContext* context = this->Internals->Context;
+    long long trianglesNb = 0;
+    if (!cuda_reconstruction_extract_surface(context, this->SurfaceValue, triangleCases, &trianglesNb))
+      {
+      vtkErrorMacro("Unable to extract the surface on the device.");
+      return 0;
+      }
+    triangles.resize(static_cast<size_t>(9 * trianglesNb));
+    if (trianglesNb > 0 && !cuda_reconstruction_get_surface(context, &triangles[0]))
+      {
+      vtkErrorMacro("Unable to copy the surface from the device.");
+      return 0;
+      }
+    }
+  else
+    {
+    vtkProfiledStage stage(this->LastStageTimes, PROFILE_STAGE_KERNEL, this->Profiling != 0);
+    vtkSurfaceExtraction extraction;
+    extraction.Scalars = outGrid->GetCellData()->GetArray("reconstruction_scalar");
+    extraction.Weights = outGrid->GetCellData()->GetArray("reconstruction_weight");
+    int extent[6];
+    outGrid->GetExtent(extent);
+    double origin[3];
+    outGrid->GetOrigin(origin);
+    outGrid->GetSpacing(extraction.Spacing);
+    for (int i = 0; i < 3; i++)
+      {
+      extraction.CellDims[i] = extent[2 * i + 1] - extent[2 * i];
+      extraction.Origin[i] = origin[i] + (extent[2 * i] + 0.5) * extraction.Spacing[i];
+      }
+    extraction.Offset = 0;
+    extraction.Scale = 1;
+    vtkDataArray* range = outGrid->GetFieldData()->GetArray("reconstruction_scalar_range");
+    if (extraction.Scalars && extraction.Scalars->GetDataType() == VTK_UNSIGNED_SHORT && range)
+      {
+      extraction.Offset = range->GetTuple1(0);
+      extraction.Scale = (range->GetTuple1(1) - range->GetTuple1(0)) / 65535;
+      }
+    extraction.IsoValue = this->SurfaceValue;
+    extraction.TriangleCases = triangleCases;
+    if (extraction.Scalars && extraction.CellDims[0] > 1 && extraction.CellDims[1] > 1 &&
+        extraction.CellDims[2] > 1)
+      {
+      std::vector<std::vector<float> > sliceTriangles(extraction.CellDims[2] - 1);
+      extraction.SliceTriangles = &sliceTriangles;
+      vtkSMPTools::For(0, static_cast<vtkIdType>(sliceTriangles.size()), extraction);
+      for (size_t k = 0; k < sliceTriangles.size(); k++)
+        {
+        triangles.insert(triangles.end(), sliceTriangles[k].begin(), sliceTriangles[k].end());
+        }
+      }
+    }
+
+  // a triangle soup, each triangle with its own points
+  vtkProfiledStage stage(this->LastStageTimes, PROFILE_STAGE_WRAP, this->Profiling != 0);
+  vtkIdType trianglesNb = static_cast<vtkIdType>(triangles.size() / 9);
+  vtkNew<vtkFloatArray> coordinates;
+  coordinates->SetNumberOfComponents(3);
+  coordinates->SetNumberOfTuples(3 * trianglesNb);
+  std::copy(triangles.begin(), triangles.end(), coordinates->GetPointer(0));
+  vtkNew<vtkPoints> points;
+  points->SetData(coordinates.Get());
+  vtkNew<vtkIdTypeArray> connectivity;
+  connectivity->SetNumberOfTuples(4 * trianglesNb);
+  vtkIdType* cell = connectivity->GetPointer(0);
+  for (vtkIdType i = 0; i < trianglesNb; i++, cell += 4)
+    {
+    cell[0] = 3;
+    cell[1] = 3 * i;
+    cell[2] = 3 * i + 1;
+    cell[3] = 3 * i + 2;
+    }
+  vtkNew<vtkCellArray> polys;
+  polys->SetCells(trianglesNb, connectivity.Get());
+  surface->SetPoints(points.Get());
+  surface->SetPolys(polys.Get());
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+void vtkCudaReconstructionFilter::UpdateNumberOfSparseBlocks()
+{
+  long long blocksNb = 0;
+  long long lostBlocksNb = 0;
+  if (this->Internals->HasSparseVolume)
+    {
+    cuda_reconstruction_sparse_get_number_of_blocks(this->Internals->Context, &blocksNb, &lostBlocksNb);
+    }
+  this->LastNumberOfSparseBlocks = static_cast<vtkIdType>(blocksNb);
+}
+
+//----------------------------------------------------------------------------
+void vtkCudaReconstructionFilter::StartProfile()
+{
+  std::fill(this->LastStageTimes, this->LastStageTimes + PROFILE_STAGES_NB, 0.);
+  this->LastNumberOfIntegratedVoxels = 0;
+  this->LastNumberOfCulledVoxels = 0;
+  this->LastNumberOfUploadedBytes = 0;
+  this->LastNumberOfDownloadedBytes = 0;
+  this->ProfileStartTime = vtkTimerLog::GetUniversalTime();
+
+  // discard what the contexts measured before this run
+  std::vector<CudaReconstructionContext*> contexts(1, this->Internals->Context);
+  contexts.insert(contexts.end(), this->Internals->DeviceContexts.begin(), this->Internals->DeviceContexts.end());
+  for (size_t i = 0; i < contexts.size(); i++)
+    {
+    if (contexts[i])
+      {
+      double timings[CUDA_RECONSTRUCTION_STAGES_NB];
+      cuda_reconstruction_get_timings(contexts[i], timings);
+      long long uploadedBytes, downloadedBytes;
+      cuda_reconstruction_get_transfers(contexts[i], &uploadedBytes, &downloadedBytes);
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkCudaReconstructionFilter::StopProfile()
+{
+  if (this->Profiling)
+    {
+    std::vector<CudaReconstructionContext*> contexts(1, this->Internals->Context);
+    contexts.insert(contexts.end(), this->Internals->DeviceContexts.begin(),
+                    this->Internals->DeviceContexts.end());
+    for (size_t i = 0; i < contexts.size(); i++)
+      {
+      if (!contexts[i])
+        {
+        continue;
+        }
+      long long uploadedBytes, downloadedBytes;
+      cuda_reconstruction_get_transfers(contexts[i], &uploadedBytes, &downloadedBytes);
+      this->LastNumberOfUploadedBytes += static_cast<vtkIdType>(uploadedBytes);
+      this->LastNumberOfDownloadedBytes += static_cast<vtkIdType>(downloadedBytes);
+      }
+
+    // only the dense grid integrated in one piece times its device stages
+    if (this->Internals->Context)
+      {
+      double timings[CUDA_RECONSTRUCTION_STAGES_NB];
+      cuda_reconstruction_get_timings(this->Internals->Context, timings);
+      this->LastStageTimes[PROFILE_STAGE_UPLOAD] += timings[CUDA_RECONSTRUCTION_STAGE_UPLOAD];
+      this->LastStageTimes[PROFILE_STAGE_KERNEL] += timings[CUDA_RECONSTRUCTION_STAGE_KERNEL];
+      this->LastStageTimes[PROFILE_STAGE_DOWNLOAD] += timings[CUDA_RECONSTRUCTION_STAGE_DOWNLOAD];
+      }
+
+    // the host prepares whatever the other stages do not cover
+    double totalTime = 1000 * (vtkTimerLog::GetUniversalTime() - this->ProfileStartTime);
+    double stagesTime = 0;
+    for (int i = PROFILE_STAGE_HOST_PREPARE + 1; i < PROFILE_STAGES_NB; i++)
+      {
+      stagesTime += this->LastStageTimes[i];
+      }
+    this->LastStageTimes[PROFILE_STAGE_HOST_PREPARE] = std::max(totalTime - stagesTime, 0.);
+    }
+
+  if (this->Verbosity >= 1)
+    {
+    std::cout << "Reconstruction with the "
+              << vtkCudaReconstructionFilter::GetBackendAsString(this->LastBackend) << " backend";
+    if (this->Profiling)
+      {
+      std::cout << ":";
+      for (int i = 0; i < PROFILE_STAGES_NB; i++)
+        {
+        std::cout << " " << vtkCudaReconstructionFilter::GetProfileStageAsString(i) << " "
+                  << this->LastStageTimes[i] << " ms,";
+        }
+      std::cout << " " << this->LastNumberOfIntegratedVoxels << " voxels integrated, "
+                << this->LastNumberOfCulledVoxels << " culled, " << this->LastNumberOfUploadedBytes
+                << " bytes uploaded, " << this->LastNumberOfDownloadedBytes << " downloaded";
+      }
+    std::cout << "." << std::endl;
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkCudaReconstructionFilter::CountIntegratedVoxels(const std::vector<int>* activeBlocks, int gridDims[3])
+{
+  if (!this->Profiling)
+    {
+    return;
+    }
+  const int size = CUDA_RECONSTRUCTION_BLOCK_SIZE;
+  int cellDims[3] = {gridDims[0] - 1, gridDims[1] - 1, gridDims[2] - 1};
+  vtkIdType voxelsNb = static_cast<vtkIdType>(cellDims[0]) * cellDims[1] * cellDims[2];
+  vtkIdType integratedNb = voxelsNb;
+  if (activeBlocks)
+    {
+    // the blocks on the far faces of the grid are partial
+    int blocksDims[3];
+    for (int n = 0; n < 3; n++)
+      {
+      blocksDims[n] = (cellDims[n] + size - 1) / size;
+      }
+    integratedNb = 0;
+    for (size_t b = 0; b < activeBlocks->size(); b++)
+      {
+      int block = (*activeBlocks)[b];
+      int blockIjk[3] = {block % blocksDims[0], (block / blocksDims[0]) % blocksDims[1],
+                         block / (blocksDims[0] * blocksDims[1])};
+      vtkIdType blockVoxelsNb = 1;
+      for (int n = 0; n < 3; n++)
+        {
+        blockVoxelsNb *= std::min(size, cellDims[n] - blockIjk[n] * size);
+        }
+      integratedNb += blockVoxelsNb;
+      }
+    }
+  this->LastNumberOfIntegratedVoxels += integratedNb;
+  this->LastNumberOfCulledVoxels += voxelsNb - integratedNb;
+}
+
+//----------------------------------------------------------------------------
+void vtkCudaReconstructionFilter::CountSparseVoxels(int gridDims[3])
+{
+  if (!this->Profiling || !this->Internals->HasSparseVolume)
+    {
+    return;
+    }
+
+  // every allocated block is integrated
+  long long blocksNb = 0;
+  long long lostBlocksNb = 0;
+  cuda_reconstruction_sparse_get_number_of_blocks(this->Internals->Context, &blocksNb, &lostBlocksNb);
+  const int size = CUDA_RECONSTRUCTION_BLOCK_SIZE;
+  vtkIdType voxelsNb = static_cast<vtkIdType>(gridDims[0] - 1) * (gridDims[1] - 1) * (gridDims[2] - 1);
+  vtkIdType integratedNb = static_cast<vtkIdType>(blocksNb) * size * size * size;
+  this->LastNumberOfIntegratedVoxels += integratedNb;
+  this->LastNumberOfCulledVoxels += std::max(voxelsNb - integratedNb, static_cast<vtkIdType>(0));
+}
+
+//----------------------------------------------------------------------------
+void vtkCudaReconstructionFilter::StoreOutput(vtkDataArray* scalars, vtkDataArray* weights,
+  const double range[2], vtkDataArray* outScalar, vtkDataArray* outWeights)
+{
+  vtkProfiledStage stage(this->LastStageTimes, PROFILE_STAGE_WRAP, this->Profiling != 0);
+  StoreIntegration(scalars, weights, range, outScalar, outWeights);
+}
+
+//----------------------------------------------------------------------------
+int vtkCudaReconstructionFilter::GetSparseVolume(vtkPolyData* output)
+{
+  vtkInternals* internals = this->Internals;
+  if (!output || !internals->HasSparseVolume)
+    {
+    vtkErrorMacro("No sparse volume to export.");
+    return 0;
+    }
+
+  std::vector<int> blockIndices;
+  vtkSmartPointer<vtkDataArray> blockScalars;
+  blockScalars.TakeReference(vtkDataArray::CreateDataArray(internals->SparseScalarType));
+  if (!GetSparseBlocks(internals->Context, blockIndices, blockScalars))
+    {
+    return 0;
+    }
+
+  // one vertex at the center of each voxel of the allocated blocks
+  vtkNew<vtkTransform> gridTransform;
+  gridTransform->SetMatrix(internals->SparseGridMatrix);
+  vtkNew<vtkPoints> points;
+  points->SetDataTypeToDouble();
+  vtkNew<vtkCellArray> verts;
+  vtkSmartPointer<vtkDataArray> scalars;
+  scalars.TakeReference(vtkDataArray::CreateDataArray(internals->SparseScalarType));
+  scalars->SetName("reconstruction_scalar");
+  scalars->SetNumberOfComponents(1);
+
+  const int size = CUDA_RECONSTRUCTION_BLOCK_SIZE;
+  size_t blocksNb = blockIndices.size() / 3;
+  for (size_t b = 0; b < blocksNb; b++)
+    {
+    vtkIdType blockOffset = static_cast<vtkIdType>(b) * size * size * size;
+    for (int k = 0; k < size; k++)
+      {
+      for (int j = 0; j < size; j++)
+        {
+        for (int i = 0; i < size; i++)
+          {
+          int ijk[3] = {blockIndices[3 * b] * size + i, blockIndices[3 * b + 1] * size + j,
+                        blockIndices[3 * b + 2] * size + k};
+          if (ijk[0] >= internals->SparseGridDims[0] - 1 || ijk[1] >= internals->SparseGridDims[1] - 1 ||
+              ijk[2] >= internals->SparseGridDims[2] - 1)
+            {
+            continue;
+            }
+          double voxCenterTemp[3];
+          for (int n = 0; n < 3; n++)
+            {
+            voxCenterTemp[n] = internals->SparseGridOrig[n] + (ijk[n] + 0.5) * internals->SparseGridSpacing[n];
+            }
+          double voxCenter[3];
+          gridTransform->TransformPoint(voxCenterTemp, voxCenter);
+          vtkIdType pointId = points->InsertNextPoint(voxCenter);
+          verts->InsertNextCell(1, &pointId);
+          scalars->InsertNextTuple1(blockScalars->GetTuple1(blockOffset + i + size * (j + size * k)));
+          }
+        }
+      }
+    }
+
+  output->Initialize();
+  output->SetPoints(points.Get());
+  output->SetVerts(verts.Get());
+  output->GetPointData()->SetScalars(scalars);
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+int vtkCudaReconstructionFilter::RequestData(
+  vtkInformation *vtkNotUsed(request),
+  vtkInformationVector **inputVector,
+  vtkInformationVector *outputVector)
+{
+  // get the info objects
+  vtkInformation *inGridInfo = inputVector[0]->GetInformationObject(0);
+  vtkInformation *outGridInfo = outputVector->GetInformationObject(0);
+
+  // get the input and output
+  vtkImageData *inGrid = vtkImageData::SafeDownCast(
+    inGridInfo->Get(vtkDataObject::DATA_OBJECT()));
+  vtkImageData *outGrid = vtkImageData::SafeDownCast(
+    outGridInfo->Get(vtkDataObject::DATA_OBJECT()));
+  vtkInformation *outSurfaceInfo = outputVector->GetInformationObject(1);
+  vtkPolyData *outSurface = outSurfaceInfo ? vtkPolyData::SafeDownCast(
+    outSurfaceInfo->Get(vtkDataObject::DATA_OBJECT())) : 0;
+
+  this->StartProfile();
+  int res = this->ReconstructVolume(inGrid, outGrid, outGridInfo);
+  if (res && this->ExtractSurface && outSurface)
+    {
+    res = this->ComputeSurface(outGrid, outSurface);
+    }
+  this->StopProfile();
+  return res;
+}
+
+//----------------------------------------------------------------------------
+int vtkCudaReconstructionFilter::ReconstructVolume(vtkImageData* inGrid, vtkImageData* outGrid,
+                                                   vtkInformation* outGridInfo)
+{
+  this->Internals->DeviceGridIsOutput = false;
+  std::vector<vtkDepthMapFrame> frames;
+  if (!this->Incremental)
+    {
+    this->Internals->GetFramesToIntegrate(this, frames);
+    }
+  if ((!this->Incremental && frames.empty()) || !this->GridMatrix)
+    {
+    vtkErrorMacro("Bad input, no depth map or no grid matrix.");
+    return 0;
+    }
+
+  // get grid info, the output covers the update extent which is a part of
+  // the input grid when the pipeline streams the volume, in incremental
+  // mode the input is the whole grid of the persistent volume
+  int inExtent[6];
+  inGrid->GetExtent(inExtent);
+  int outExtent[6];
+  std::copy(inExtent, inExtent + 6, outExtent);
+  if (outGridInfo->Has(vtkStreamingDemandDrivenPipeline::UPDATE_EXTENT()))
+    {
+    outGridInfo->Get(vtkStreamingDemandDrivenPipeline::UPDATE_EXTENT(), outExtent);
+    }
+  double gridOrig[3];
+  int gridDims[3];
+  double gridSpacing[3];
+  GetGridGeometry(inGrid, outExtent, gridOrig, gridDims, gridSpacing);
+
+  if (this->Verbosity >= 2)
+    {
+    std::cout << "Initialize output." << std::endl;
+    }
+
+  // initialize output, in the precision of the integration
+  int scalarType = VTK_DOUBLE;
+  if (this->Incremental)
+    {
+    scalarType = this->Internals->HasVolume ? this->Internals->VolumeScalarType :
+      this->GetOutputScalarType(this->Internals->DepthMaps.empty() ? 0 :
+                                this->Internals->DepthMaps[0].DepthMap.GetPointer());
+    }
+  else
+    {
+    scalarType = this->GetOutputScalarType(frames[0].DepthMap);
+    }
+  if (std::equal(inExtent, inExtent + 6, outExtent))
+    {
+    outGrid->ShallowCopy(inGrid);
+    }
+  else
+    {
+    // the arrays of the input do not match the extent, only the geometry
+    // is kept
+    outGrid->SetOrigin(inGrid->GetOrigin());
+    outGrid->SetSpacing(inGrid->GetSpacing());
+    outGrid->SetExtent(outExtent);
+    }
+  double truncation = this->GetTruncation(gridSpacing);
+  vtkSmartPointer<vtkDataArray> outScalar;
+  vtkSmartPointer<vtkDataArray> outWeights;
+  this->InitializeOutputArrays(outGrid, scalarType, truncation, outScalar, outWeights);
+  double range[2];
+  ReconstructionFunctionRange(this->IntegrationFunction, truncation, range);
+
+  // incremental computation, the persistent volume is only copied here,
+  // over the requested extent so that each streamed piece is copied once
+  if (this->Incremental)
+    {
+    if (!this->IntegratePendingDepthMaps(inGrid))
+      {
+      return 0;
+      }
+    bool wholeExtent = std::equal(inExtent, inExtent + 6, outExtent);
+    int cellDims[3];
+    int cellExtent[6];
+    for (int i = 0; i < 3; i++)
+      {
+      cellDims[i] = inExtent[2 * i + 1] - inExtent[2 * i];
+      cellExtent[2 * i] = outExtent[2 * i] - inExtent[2 * i];
+      cellExtent[2 * i + 1] = outExtent[2 * i + 1] - inExtent[2 * i] - 1;
+      }
+    if (this->Internals->VolumeIsSparse)
+      {
+      vtkSmartPointer<vtkDataArray> scalars;
+      vtkSmartPointer<vtkDataArray> weights;
+      if (wholeExtent)
+        {
+        GetIntegrationArrays(scalarType, outScalar, 0, scalars, weights);
+        }
+      else
+        {
+        scalars.TakeReference(vtkDataArray::CreateDataArray(scalarType));
+        scalars->SetNumberOfComponents(1);
+        scalars->SetNumberOfTuples(inGrid->GetNumberOfCells());
+        scalars->FillComponent(0, 0);
+        }
+      int res = this->Internals->ExportSparseVolume(scalars);
+      if (!wholeExtent)
+        {
+        scalars = ExtractCellExtent(scalars, cellDims, cellExtent);
+        }
+      this->StoreOutput(scalars, 0, range, outScalar, 0);
+      return res;
+      }
+    if (this->Internals->VolumeOnDevice)
+      {
+      return this->DownloadGrid(outScalar, outWeights, wholeExtent ? 0 : cellExtent);
+      }
+    vtkProfiledStage stage(this->LastStageTimes, PROFILE_STAGE_WRAP, this->Profiling != 0);
+    vtkSmartPointer<vtkDataArray> volume = this->Internals->Volume;
+    vtkSmartPointer<vtkDataArray> volumeWeights = this->Internals->VolumeWeights;
+    if (!wholeExtent)
+      {
+      volume = ExtractCellExtent(volume, cellDims, cellExtent);
+      if (volumeWeights)
+        {
+        volumeWeights = ExtractCellExtent(volumeWeights, cellDims, cellExtent);
+        }
+      }
+    if (this->StorageFormat != STORAGE_NATIVE)
+      {
+      StoreIntegration(volume, volumeWeights, range, outScalar, outWeights);
+      return 1;
+      }
+    outScalar->DeepCopy(volume);
+    outScalar->SetName("reconstruction_scalar");
+    if (outWeights && volumeWeights)
+      {
+      outWeights->DeepCopy(volumeWeights);
+      outWeights->SetName("reconstruction_weight");
+      }
+    return 1;
+    }
+
+  // select the backend
+  vtkIdType maxDepthMapPointsNb = 0;
+  for (size_t i = 0; i < frames.size(); i++)
+    {
+    maxDepthMapPointsNb = std::max(maxDepthMapPointsNb, frames[i].DepthMap->GetNumberOfPoints());
+    }
+  int backend = this->SelectBackend(outGrid->GetNumberOfCells(), maxDepthMapPointsNb, scalarType);
+  if (backend < 0)
+    {
+    return 0;
+    }
+  this->LastBackend = backend;
+  this->LastNumberOfBricks = 0;
+  this->LastNumberOfDevices = 0;
+
+  // computation
+  outScalar->FillComponent(0, 0);
+  if (outWeights)
+    {
+    outWeights->FillComponent(0, 0);
+    }
+  if (backend == BACKEND_CUDA)
+    {
+    return this->ComputeWithCuda(this->GridMatrix, gridOrig, gridDims, gridSpacing, scalarType, outScalar,
+                                 outWeights);
+    }
+
+  // the CPU backends integrate in the precision of the integration, the
+  // values are then converted into the storage format
+  vtkSmartPointer<vtkDataArray> scalars;
+  vtkSmartPointer<vtkDataArray> weights;
+  GetIntegrationArrays(scalarType, outScalar, outWeights, scalars, weights);
+  if (this->Verbosity >= 2)
+    {
+    std::cout << "Integrate " << frames.size() << " depth maps with the "
+              << vtkCudaReconstructionFilter::GetBackendAsString(backend) << " backend." << std::endl;
+    }
+  vtkDepthPreprocessing preprocessing = GetDepthPreprocessing(this);
+  for (size_t i = 0; i < frames.size(); i++)
+    {
+    if (backend == BACKEND_CPU_PARALLEL)
+      {
+      const std::vector<int>* activeBlocks = 0;
+      if (this->FrustumCulling)
+        {
+        activeBlocks = &GetActiveBlocks(frames[i], this->GridMatrix, gridOrig, gridDims, gridSpacing);
+        }
+      this->CountIntegratedVoxels(activeBlocks, gridDims);
+      vtkProfiledStage stage(this->LastStageTimes, PROFILE_STAGE_KERNEL, this->Profiling != 0);
+      vtkDepthMapFrame frame = PreprocessFrame(frames[i], preprocessing, scalarType);
+      this->IntegrateWithSMP(gridOrig, gridDims, gridSpacing,
+        frame.DepthMap, frame.MatrixK, frame.MatrixTR,
+        scalars, activeBlocks, weights, truncation);
+      }
+    else
+      {
+      this->CountIntegratedVoxels(0, gridDims);
+      vtkProfiledStage stage(this->LastStageTimes, PROFILE_STAGE_KERNEL, this->Profiling != 0);
+      vtkDepthMapFrame frame = PreprocessFrame(frames[i], preprocessing, scalarType);
+      vtkCudaReconstructionFilter::ComputeWithoutCuda(
+        this->GridMatrix, gridOrig, gridDims, gridSpacing,
+        frame.DepthMap, frame.MatrixK, frame.MatrixTR,
+        scalars, this->InterpolationMode, this->IntegrationFunction, weights, truncation);
+      }
+    }
+  this->StoreOutput(scalars, weights, range, outScalar, outWeights);
+
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+// Serial integration of a depth map with the function F, through the tuples
+// of the arrays. The voxels are walked in x-fastest order and their
+// projections are stepped along the rows.
+struct vtkSerialIntegration
+{
+  double VoxelToCamera[16];
+  double VoxelToDepthMap[12];
+  int* GridDims;
+  vtkImageData* DepthMap;
+  vtkDataArray* Depths;
+  const double* LinearDepths;
+  vtkDataArray* OutScalar;
+  vtkDataArray* OutWeights;
+
+  template <typename F>
+  int operator()(const F& function)
+  {
+    const double* M = this->VoxelToCamera;
+    const double* P = this->VoxelToDepthMap;
+    int dim[3];
+    this->DepthMap->GetDimensions(dim);
+    vtkIdType i_vox = 0;
+    for (vtkIdType k = 0; k < this->GridDims[2] - 1; k++)
+      {
+      for (vtkIdType j = 0; j < this->GridDims[1] - 1; j++)
+        {
+        // voxel center of the row start in camera and depth map homogeneous
+        // coords
+        double voxCameraCoordsHomo[4];
+        double voxDepthMapCoordsHomo[3];
+        ProjectVoxel(M, P, 0., static_cast<double>(j), static_cast<double>(k),
+                     voxCameraCoordsHomo, voxDepthMapCoordsHomo);
+        for (vtkIdType i = 0; i < this->GridDims[0] - 1; i++, i_vox++)
+          {
+          if (i > 0)
+            {
+            for (int n = 0; n < 3; n++)
+              {
+              voxCameraCoordsHomo[n] += M[4 * n];
+              voxDepthMapCoordsHomo[n] += P[4 * n];
+              }
+            voxCameraCoordsHomo[3] += M[12];
+            }
+          this->IntegrateVoxel(function, voxCameraCoordsHomo, voxDepthMapCoordsHomo, dim, i_vox);
+          }
+        }
+      }
+    return 1;
+  }
+
+  template <typename F>
+  void IntegrateVoxel(const F& function, const double voxCameraCoordsHomo[4],
+                      const double voxDepthMapCoordsHomo[3], int dim[3], vtkIdType i_vox)
+  {
+    // compute distance between voxel and camera
+    double distanceVoxCam = vtkMath::Norm(voxCameraCoordsHomo) / std::abs(voxCameraCoordsHomo[3]);
+
+    // the voxels behind the camera are not seen
+    if (voxDepthMapCoordsHomo[2] <= 0)
+      {
+      return;
+      }
+
+    // voxel center in depth map coords
+    double voxDepthMapCoords[2];
+    voxDepthMapCoords[0] = voxDepthMapCoordsHomo[0] / voxDepthMapCoordsHomo[2];
+    voxDepthMapCoords[1] = voxDepthMapCoordsHomo[1] / voxDepthMapCoordsHomo[2];
+
+    // compute depth from depth map
+    int ijk[3];
+    ijk[0] = round(voxDepthMapCoords[0]);
+    ijk[1] = round(voxDepthMapCoords[1]);
+    ijk[2] = 0;
+    if (ijk[0] < 0 || ijk[0] > dim[0] - 1 || ijk[1] < 0 || ijk[1] > dim[1] - 1)
+      {
+      return;
+      }
+    vtkIdType id = vtkStructuredData::ComputePointId(dim, ijk);
+    if (0 > id && id >= this->DepthMap->GetNumberOfPoints())
+      {
+      vtkGenericWarningMacro("Bad conversion from ijk to id.");
+      return;
+      }
+    double depth = this->LinearDepths ?
+      InterpolateDepth(this->LinearDepths, dim, voxDepthMapCoords[0], voxDepthMapCoords[1]) :
+      this->Depths->GetTuple1(id);
+    if (!ReconstructionIsValidDepth(depth))
+      {
+      return;
+      }
+
+    // the voxels out of the band of the function are neither read nor
+    // written
+    double diff = distanceVoxCam - depth;
+    if (!function.InBand(diff))
+      {
+      return;
+      }
 
-//----------------------------------------------------------------------------
-vtkCudaReconstructionFilter::vtkCudaReconstructionFilter()
-{
-  this->SetNumberOfInputPorts(1);
-  this->DepthMap = 0;
-  this->DepthMapMatrixK = 0;
-  this->DepthMapMatrixTR = 0;
-  this->GridMatrix = 0;
-}
+    // compute new val
+    double val = this->OutScalar->GetTuple1(i_vox);
+    double weight = F::HasWeights ? this->OutWeights->GetTuple1(i_vox) : 0;
+    function.Update(diff, val, weight);
+    this->OutScalar->SetTuple1(i_vox, val);
+    if (F::HasWeights)
+      {
+      this->OutWeights->SetTuple1(i_vox, weight);
+      }
+  }
+};
 
 //----------------------------------------------------------------------------
-vtkCudaReconstructionFilter::~vtkCudaReconstructionFilter()
+int vtkCudaReconstructionFilter::ComputeWithoutCuda(
+    vtkMatrix4x4 *gridMatrix, double gridOrig[3], int gridDims[3], double gridSpacing[3],
+    vtkImageData* depthMap, vtkMatrix3x3 *depthMapMatrixK, vtkMatrix4x4 *depthMapMatrixTR,
+    vtkDataArray* outScalar, int interpolationMode, int function, vtkDataArray* outWeights,
+    double truncationDistance)
 {
-  if (this->DepthMapMatrixK)
+  // get depth scalars
+  vtkDataArray* depths = GetDepths(depthMap);
+  if (!depths)
     {
-    this->DepthMapMatrixK->Delete();
+    vtkGenericWarningMacro("The depth map has no depths.");
+    return 0;
     }
-  if (this->DepthMapMatrixTR)
+  if (ReconstructionFunctionHasWeights(function) && !outWeights)
     {
-    this->DepthMapMatrixTR->Delete();
+    vtkGenericWarningMacro("The integration function needs the weights of the voxels.");
+    return 0;
     }
-  if (this->GridMatrix)
+  if (outScalar->GetNumberOfTuples() != static_cast<vtkIdType>(gridDims[0] - 1) * (gridDims[1] - 1) *
+      (gridDims[2] - 1))
     {
-    this->GridMatrix->Delete();
+    vtkGenericWarningMacro("The output scalars do not match the cells of the grid.");
+    return 0;
     }
-  if (this->DepthMap)
+  std::vector<double> depthsBuffer;
+  const double* linearDepths = 0;
+  if (interpolationMode == INTERPOLATION_LINEAR)
     {
-    this->DepthMap->Delete();
+    linearDepths = GetDepthsPointer(depths, depthsBuffer);
     }
+
+  // fold the grid matrix, the camera pose and the intrinsics once for all
+  // the voxels
+  vtkSerialIntegration integration;
+  ComputeVoxelToCameraMatrix(gridMatrix, gridOrig, gridSpacing, depthMapMatrixTR, integration.VoxelToCamera);
+  ComputeVoxelToDepthMapMatrix(depthMapMatrixK, integration.VoxelToCamera, integration.VoxelToDepthMap);
+  integration.GridDims = gridDims;
+  integration.DepthMap = depthMap;
+  integration.Depths = depths;
+  integration.LinearDepths = linearDepths;
+  integration.OutScalar = outScalar;
+  integration.OutWeights = outWeights;
+
+  return DispatchReconstructionFunction<double>(function, truncationDistance, integration);
 }
 
 //----------------------------------------------------------------------------
-int vtkCudaReconstructionFilter::RequestData(
-  vtkInformation *vtkNotUsed(request),
-  vtkInformationVector **inputVector,
-  vtkInformationVector *outputVector)
+// Integrate a depth map into a range of voxels, or into a range of the
+// active blocks when they are given, in the precision of T and with the
+// function F
+template <typename T, typename F>
+class vtkSMPIntegrationFunctor
 {
-  // get the info objects
-  vtkInformation *inGridInfo = inputVector[0]->GetInformationObject(0);
-  vtkInformation *outGridInfo = outputVector->GetInformationObject(0);
+public:
+  typedef T ValueType;
 
-  // get the input and output
-  vtkImageData *inGrid = vtkImageData::SafeDownCast(
-    inGridInfo->Get(vtkDataObject::DATA_OBJECT()));
-  vtkImageData *outGrid = vtkImageData::SafeDownCast(
-    outGridInfo->Get(vtkDataObject::DATA_OBJECT()));
+  explicit vtkSMPIntegrationFunctor(const F& function) : Function(function) {}
 
-  if (!this->DepthMap || !this->DepthMapMatrixK || !this->DepthMapMatrixTR)
-    {
-    // todo error message
-    std::cout << "Bad input." << std::endl;
-    return 0;
-    }
+  // voxel indices to camera coords, and to depth map homogeneous coords
+  T VoxelToCamera[16];
+  T VoxelToDepthMap[12];
+  vtkIdType CellDims[3];
+  int DepthMapDims[3];
+  const T* Depths;
+  int InterpolationMode;
+  T* OutScalar;
+  // weights of the functions which have some
+  T* OutWeights;
+  const int* ActiveBlocks;
+  F Function;
+  // vectorised integration of the rows, single precision only
+  SimdReconstructionRowFunction RowFunction;
+  SimdReconstructionFrame Frame;
 
-  // get grid info
-  double gridOrig[3];
-  inGrid->GetOrigin(gridOrig);
-  int gridDims[3];
-  inGrid->GetDimensions(gridDims);
-  double gridSpacing[3];
-  inGrid->GetSpacing(gridSpacing);
+  // Integrate count voxels along x from the voxel (i, j, k), the projections
+  // are stepped by the x column of the matrices
+  void IntegrateRow(vtkIdType i, vtkIdType j, vtkIdType k, vtkIdType i_vox, vtkIdType count)
+  {
+    T voxCameraCoordsHomo[4];
+    T voxDepthMapCoordsHomo[3];
+    ProjectVoxel(this->VoxelToCamera, this->VoxelToDepthMap, static_cast<T>(i), static_cast<T>(j),
+                 static_cast<T>(k), voxCameraCoordsHomo, voxDepthMapCoordsHomo);
+    if (this->RowFunction)
+      {
+      float cameraCoords[4];
+      float depthMapCoords[3];
+      for (int m = 0; m < 4; m++)
+        {
+        cameraCoords[m] = static_cast<float>(voxCameraCoordsHomo[m]);
+        }
+      for (int m = 0; m < 3; m++)
+        {
+        depthMapCoords[m] = static_cast<float>(voxDepthMapCoordsHomo[m]);
+        }
+      this->RowFunction(&this->Frame, cameraCoords, depthMapCoords, i_vox, count);
+      return;
+      }
+    const T* M = this->VoxelToCamera;
+    const T* P = this->VoxelToDepthMap;
+    for (vtkIdType n = 0; n < count; n++, i_vox++)
+      {
+      this->IntegrateVoxel(voxCameraCoordsHomo, voxDepthMapCoordsHomo, i_vox);
+      for (int m = 0; m < 3; m++)
+        {
+        voxCameraCoordsHomo[m] += M[4 * m];
+        voxDepthMapCoordsHomo[m] += P[4 * m];
+        }
+      voxCameraCoordsHomo[3] += M[12];
+      }
+  }
 
-  // todo remove
-  std::cout << "Initialize output." << std::endl;
+  void IntegrateVoxel(const T voxCameraCoordsHomo[4], const T voxDepthMapCoordsHomo[3], vtkIdType i_vox)
+  {
+    // compute distance between voxel and camera
+    T distanceVoxCam = std::sqrt(voxCameraCoordsHomo[0] * voxCameraCoordsHomo[0] +
+                                 voxCameraCoordsHomo[1] * voxCameraCoordsHomo[1] +
+                                 voxCameraCoordsHomo[2] * voxCameraCoordsHomo[2]) /
+      std::abs(voxCameraCoordsHomo[3]);
 
+    // the voxels behind the camera are not seen
+    if (voxDepthMapCoordsHomo[2] <= 0)
+      {
+      return;
+      }
+    T voxDepthMapCoords[2];
+    voxDepthMapCoords[0] = voxDepthMapCoordsHomo[0] / voxDepthMapCoordsHomo[2];
+    voxDepthMapCoords[1] = voxDepthMapCoordsHomo[1] / voxDepthMapCoordsHomo[2];
+    int ijk[2];
+    ijk[0] = static_cast<int>(round(voxDepthMapCoords[0]));
+    ijk[1] = static_cast<int>(round(voxDepthMapCoords[1]));
+    if (ijk[0] < 0 || ijk[0] > this->DepthMapDims[0] - 1 ||
+        ijk[1] < 0 || ijk[1] > this->DepthMapDims[1] - 1)
+      {
+      return;
+      }
+    T depth = this->InterpolationMode == vtkCudaReconstructionFilter::INTERPOLATION_LINEAR ?
+      InterpolateDepth(this->Depths, this->DepthMapDims, voxDepthMapCoords[0], voxDepthMapCoords[1]) :
+      this->Depths[ijk[0] + ijk[1] * this->DepthMapDims[0]];
+    if (!ReconstructionIsValidDepth(depth))
+      {
+      return;
+      }
 
-  // initialize output
-  vtkNew<vtkDoubleArray> outScalar;
-  outScalar->SetName("reconstruction_scalar");
-  outScalar->SetNumberOfComponents(1);
-  outScalar->SetNumberOfTuples(inGrid->GetNumberOfCells());
-  outScalar->FillComponent(0, 0);
-  outGrid->ShallowCopy(inGrid);
-  outGrid->GetCellData()->AddArray(outScalar.Get());
+    // the voxels out of the band of the function are neither read nor
+    // written
+    T diff = distanceVoxCam - depth;
+    if (!this->Function.InBand(diff))
+      {
+      return;
+      }
 
-  // computation
-  bool useCuda = true;
-  if (!useCuda)
+    // compute new val
+    T weight = 0;
+    if (F::HasWeights)
+      {
+      weight = this->OutWeights[i_vox];
+      }
+    this->Function.Update(diff, this->OutScalar[i_vox], weight);
+    if (F::HasWeights)
+      {
+      this->OutWeights[i_vox] = weight;
+      }
+  }
+
+  void operator()(vtkIdType begin, vtkIdType end)
+  {
+    if (!this->ActiveBlocks)
+      {
+      // the range is split into rows, ijk is only derived at their start
+      vtkIdType i_vox = begin;
+      while (i_vox < end)
+        {
+        vtkIdType i = i_vox % this->CellDims[0];
+        vtkIdType rowEnd = std::min(end, i_vox + this->CellDims[0] - i);
+        this->IntegrateRow(i, (i_vox / this->CellDims[0]) % this->CellDims[1],
+                           i_vox / (this->CellDims[0] * this->CellDims[1]), i_vox, rowEnd - i_vox);
+        i_vox = rowEnd;
+        }
+      return;
+      }
+
+    vtkIdType blocksDims[2];
+    for (int n = 0; n < 2; n++)
+      {
+      blocksDims[n] = (this->CellDims[n] + CUDA_RECONSTRUCTION_BLOCK_SIZE - 1) / CUDA_RECONSTRUCTION_BLOCK_SIZE;
+      }
+    for (vtkIdType b = begin; b < end; b++)
+      {
+      vtkIdType block = this->ActiveBlocks[b];
+      vtkIdType first[3];
+      first[0] = (block % blocksDims[0]) * CUDA_RECONSTRUCTION_BLOCK_SIZE;
+      first[1] = ((block / blocksDims[0]) % blocksDims[1]) * CUDA_RECONSTRUCTION_BLOCK_SIZE;
+      first[2] = (block / (blocksDims[0] * blocksDims[1])) * CUDA_RECONSTRUCTION_BLOCK_SIZE;
+      vtkIdType last[3];
+      for (int n = 0; n < 3; n++)
+        {
+        last[n] = std::min(first[n] + CUDA_RECONSTRUCTION_BLOCK_SIZE, this->CellDims[n]);
+        }
+      for (vtkIdType k = first[2]; k < last[2]; k++)
+        {
+        for (vtkIdType j = first[1]; j < last[1]; j++)
+          {
+          vtkIdType i_vox = first[0] + this->CellDims[0] * (j + this->CellDims[1] * k);
+          this->IntegrateRow(first[0], j, k, i_vox, last[0] - first[0]);
+          }
+        }
+      }
+  }
+};
+
+//----------------------------------------------------------------------------
+// Use the vectorised rows of the widest instruction set of the CPU, the
+// double precision rows stay scalar
+template <typename T, typename F>
+static void SetVectorizedRows(vtkSMPIntegrationFunctor<T, F>&)
+{
+}
+
+template <typename F>
+static void SetVectorizedRows(vtkSMPIntegrationFunctor<float, F>& functor)
+{
+  functor.RowFunction = simd_reconstruction_get_row_function(F::Identifier);
+  SimdReconstructionFrame& frame = functor.Frame;
+  for (int m = 0; m < 4; m++)
     {
-    vtkCudaReconstructionFilter::ComputeWithoutCuda(
-      this->GridMatrix, gridOrig, gridDims, gridSpacing,
-      this->DepthMap, this->DepthMapMatrixK, this->DepthMapMatrixTR,
-      outScalar.Get());
+    frame.cameraStep[m] = functor.VoxelToCamera[4 * m];
     }
-  else
+  for (int m = 0; m < 3; m++)
     {
-    vtkCudaReconstructionFilter::ComputeWithCuda(
-      this->GridMatrix, gridOrig, gridDims, gridSpacing,
-      this->DepthMap, this->DepthMapMatrixK, this->DepthMapMatrixTR,
-      outScalar.Get());
+    frame.depthMapStep[m] = functor.VoxelToDepthMap[4 * m];
     }
+  frame.depths = functor.Depths;
+  frame.depthMapDims[0] = functor.DepthMapDims[0];
+  frame.depthMapDims[1] = functor.DepthMapDims[1];
+  frame.interpolation = functor.InterpolationMode == vtkCudaReconstructionFilter::INTERPOLATION_LINEAR ?
+    CUDA_RECONSTRUCTION_INTERPOLATION_LINEAR : CUDA_RECONSTRUCTION_INTERPOLATION_NEAREST;
+  frame.truncation = functor.Function.Truncation;
+  frame.outScalar = functor.OutScalar;
+  frame.outWeights = functor.OutWeights;
+}
 
-  return 1;
+//----------------------------------------------------------------------------
+// Run the multithreaded integration of a depth map in the precision of the
+// functor, over the active blocks when they are given
+template <typename Functor>
+static void RunSMPIntegration(
+    vtkMatrix4x4 *gridMatrix, double gridOrig[3], int gridDims[3], double gridSpacing[3],
+    vtkImageData* depthMap, vtkDataArray* depths, vtkMatrix3x3 *depthMapMatrixK,
+    vtkMatrix4x4 *depthMapMatrixTR, vtkDataArray* outScalar, const std::vector<int>* activeBlocks,
+    int interpolationMode, vtkDataArray* outWeights, bool vectorization, Functor& functor)
+{
+  typedef typename Functor::ValueType T;
+
+  // combine the transforms once for all the voxels
+  double voxelToCamera[16];
+  ComputeVoxelToCameraMatrix(gridMatrix, gridOrig, gridSpacing, depthMapMatrixTR, voxelToCamera);
+  double voxelToDepthMap[12];
+  ComputeVoxelToDepthMapMatrix(depthMapMatrixK, voxelToCamera, voxelToDepthMap);
+  for (int i = 0; i < 16; i++)
+    {
+    functor.VoxelToCamera[i] = static_cast<T>(voxelToCamera[i]);
+    }
+  for (int i = 0; i < 12; i++)
+    {
+    functor.VoxelToDepthMap[i] = static_cast<T>(voxelToDepthMap[i]);
+    }
+  for (int i = 0; i < 3; i++)
+    {
+    functor.CellDims[i] = gridDims[i] - 1;
+    }
+  depthMap->GetDimensions(functor.DepthMapDims);
+  std::vector<T> depthsBuffer;
+  functor.Depths = GetDepthsPointer(depths, depthsBuffer);
+  functor.InterpolationMode = interpolationMode;
+  functor.OutScalar = static_cast<T*>(outScalar->GetVoidPointer(0));
+  functor.OutWeights = outWeights ? static_cast<T*>(outWeights->GetVoidPointer(0)) : 0;
+  functor.RowFunction = 0;
+  if (vectorization)
+    {
+    SetVectorizedRows(functor);
+    }
+
+  if (!activeBlocks)
+    {
+    functor.ActiveBlocks = 0;
+    vtkSMPTools::For(0, outScalar->GetNumberOfTuples(), functor);
+    }
+  else if (!activeBlocks->empty())
+    {
+    functor.ActiveBlocks = &(*activeBlocks)[0];
+    vtkSMPTools::For(0, static_cast<vtkIdType>(activeBlocks->size()), functor);
+    }
 }
 
 //----------------------------------------------------------------------------
-int vtkCudaReconstructionFilter::ComputeWithoutCuda(
+// Multithreaded integration of a depth map in the precision T, the functor
+// is specialised on the function
+template <typename T>
+struct vtkSMPIntegration
+{
+  vtkMatrix4x4 *GridMatrix;
+  double* GridOrig;
+  int* GridDims;
+  double* GridSpacing;
+  vtkImageData* DepthMap;
+  vtkDataArray* Depths;
+  vtkMatrix3x3 *DepthMapMatrixK;
+  vtkMatrix4x4 *DepthMapMatrixTR;
+  vtkDataArray* OutScalar;
+  const std::vector<int>* ActiveBlocks;
+  int InterpolationMode;
+  vtkDataArray* OutWeights;
+  bool Vectorization;
+
+  template <typename F>
+  int operator()(const F& function)
+  {
+    vtkSMPIntegrationFunctor<T, F> functor(function);
+    RunSMPIntegration(this->GridMatrix, this->GridOrig, this->GridDims, this->GridSpacing, this->DepthMap,
+                      this->Depths, this->DepthMapMatrixK, this->DepthMapMatrixTR, this->OutScalar,
+                      this->ActiveBlocks, this->InterpolationMode, this->OutWeights, this->Vectorization,
+                      functor);
+    return 1;
+  }
+};
+
+//----------------------------------------------------------------------------
+int vtkCudaReconstructionFilter::ComputeWithSMP(
     vtkMatrix4x4 *gridMatrix, double gridOrig[3], int gridDims[3], double gridSpacing[3],
     vtkImageData* depthMap, vtkMatrix3x3 *depthMapMatrixK, vtkMatrix4x4 *depthMapMatrixTR,
-    vtkDoubleArray* outScalar)
+    vtkDataArray* outScalar, const std::vector<int>* activeBlocks, int interpolationMode,
+    int function, vtkDataArray* outWeights, double truncationDistance, bool vectorization)
 {
-  vtkIdType voxelsNb = outScalar->GetNumberOfTuples();
-
   // get depth scalars
-  vtkDoubleArray* depths = vtkDoubleArray::SafeDownCast(depthMap->GetPointData()->GetArray("Depths"));
+  vtkDataArray* depths = GetDepths(depthMap);
   if (!depths)
     {
-    // todo error message
-    std::cout << "Bad depths." << std::endl;
+    vtkGenericWarningMacro("The depth map has no depths.");
+    return 0;
+    }
+  if (ReconstructionFunctionHasWeights(function) &&
+      (!outWeights || outWeights->GetDataType() != outScalar->GetDataType()))
+    {
+    vtkGenericWarningMacro("The integration function needs weights of the type of the output scalars.");
     return 0;
     }
 
-  // todo remove
-  std::cout << "Create matrices." << std::endl;
-
-  // create transforms from matrices
-  vtkNew<vtkTransform> transformGridToRealCoords;
-  transformGridToRealCoords->SetMatrix(gridMatrix);
-  vtkNew<vtkTransform> transformSceneToCamera;
-  transformSceneToCamera->SetMatrix(depthMapMatrixTR);
-  // change the matrix 3x3 into matrix 4x4 to be compatible with vtkTransform
-  vtkNew<vtkMatrix4x4> depthMapMatrixK4x4;
-  depthMapMatrixK4x4->Identity();
-  for (int i = 0; i < 3; i++)
+  // the computation is done in the precision of the output
+  if (outScalar->GetDataType() == VTK_FLOAT)
+    {
+    vtkSMPIntegration<float> integration = {gridMatrix, gridOrig, gridDims, gridSpacing, depthMap, depths,
+      depthMapMatrixK, depthMapMatrixTR, outScalar, activeBlocks, interpolationMode, outWeights, vectorization};
+    return DispatchReconstructionFunction<float>(function, truncationDistance, integration);
+    }
+  else if (outScalar->GetDataType() == VTK_DOUBLE)
     {
-    for (int j = 0; j < 3; j++)
+    vtkSMPIntegration<double> integration = {gridMatrix, gridOrig, gridDims, gridSpacing, depthMap, depths,
+      depthMapMatrixK, depthMapMatrixTR, outScalar, activeBlocks, interpolationMode, outWeights, vectorization};
+    return DispatchReconstructionFunction<double>(function, truncationDistance, integration);
+    }
+
+  vtkGenericWarningMacro("The output scalars must be float or double.");
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+// Build the rows of a projection table, a task per slice of voxels along z
+// whose entries are appended in order afterwards
+template <typename T>
+struct vtkProjectionTableBuilder
+{
+  T VoxelToCamera[16];
+  T VoxelToDepthMap[12];
+  vtkIdType CellDims[3];
+  int DepthMapDims[2];
+  std::vector<std::vector<vtkTypeUInt32> >* SliceVoxels;
+  std::vector<std::vector<vtkTypeUInt32> >* SlicePixels;
+  std::vector<std::vector<T> >* SliceDistances;
+
+  void operator()(vtkIdType begin, vtkIdType end)
+  {
+    const T* M = this->VoxelToCamera;
+    const T* P = this->VoxelToDepthMap;
+    for (vtkIdType k = begin; k < end; k++)
       {
-      depthMapMatrixK4x4->SetElement(i, j, depthMapMatrixK->GetElement(i, j));
+      std::vector<vtkTypeUInt32>& voxels = (*this->SliceVoxels)[k];
+      std::vector<vtkTypeUInt32>& pixels = (*this->SlicePixels)[k];
+      std::vector<T>& distances = (*this->SliceDistances)[k];
+      for (vtkIdType j = 0; j < this->CellDims[1]; j++)
+        {
+        T voxCameraCoordsHomo[4];
+        T voxDepthMapCoordsHomo[3];
+        ProjectVoxel(M, P, static_cast<T>(0), static_cast<T>(j), static_cast<T>(k),
+                     voxCameraCoordsHomo, voxDepthMapCoordsHomo);
+        vtkIdType i_vox = this->CellDims[0] * (j + this->CellDims[1] * k);
+        for (vtkIdType i = 0; i < this->CellDims[0]; i++, i_vox++)
+          {
+          if (i > 0)
+            {
+            for (int n = 0; n < 3; n++)
+              {
+              voxCameraCoordsHomo[n] += M[4 * n];
+              voxDepthMapCoordsHomo[n] += P[4 * n];
+              }
+            voxCameraCoordsHomo[3] += M[12];
+            }
+          if (voxDepthMapCoordsHomo[2] <= 0)
+            {
+            continue;
+            }
+          int x = static_cast<int>(round(voxDepthMapCoordsHomo[0] / voxDepthMapCoordsHomo[2]));
+          int y = static_cast<int>(round(voxDepthMapCoordsHomo[1] / voxDepthMapCoordsHomo[2]));
+          if (x < 0 || x > this->DepthMapDims[0] - 1 || y < 0 || y > this->DepthMapDims[1] - 1)
+            {
+            continue;
+            }
+          voxels.push_back(static_cast<vtkTypeUInt32>(i_vox));
+          pixels.push_back(static_cast<vtkTypeUInt32>(x + y * this->DepthMapDims[0]));
+          distances.push_back(std::sqrt(voxCameraCoordsHomo[0] * voxCameraCoordsHomo[0] +
+                                        voxCameraCoordsHomo[1] * voxCameraCoordsHomo[1] +
+                                        voxCameraCoordsHomo[2] * voxCameraCoordsHomo[2]) /
+                              std::abs(voxCameraCoordsHomo[3]));
+          }
+        }
       }
-    }
-  vtkNew<vtkTransform> transformCameraToDepthMap;
-  transformCameraToDepthMap->SetMatrix(depthMapMatrixK4x4.Get());
+  }
+};
 
-  // todo remove
-  std::cout << "Fill output." << std::endl;
+//----------------------------------------------------------------------------
+// Fill a projection table in the precision T
+template <typename T>
+static void BuildProjectionTable(const double voxelToCamera[16], const double voxelToDepthMap[12],
+                                 vtkProjectionTable* table)
+{
+  vtkProjectionTableBuilder<T> builder;
+  for (int i = 0; i < 16; i++)
+    {
+    builder.VoxelToCamera[i] = static_cast<T>(voxelToCamera[i]);
+    }
+  for (int i = 0; i < 12; i++)
+    {
+    builder.VoxelToDepthMap[i] = static_cast<T>(voxelToDepthMap[i]);
+    }
+  for (int i = 0; i < 3; i++)
+    {
+    builder.CellDims[i] = table->CellDims[i];
+    }
+  builder.DepthMapDims[0] = table->DepthMapDims[0];
+  builder.DepthMapDims[1] = table->DepthMapDims[1];
+  std::vector<std::vector<vtkTypeUInt32> > sliceVoxels(table->CellDims[2]);
+  std::vector<std::vector<vtkTypeUInt32> > slicePixels(table->CellDims[2]);
+  std::vector<std::vector<T> > sliceDistances(table->CellDims[2]);
+  builder.SliceVoxels = &sliceVoxels;
+  builder.SlicePixels = &slicePixels;
+  builder.SliceDistances = &sliceDistances;
+  vtkSMPTools::For(0, table->CellDims[2], builder);
 
-  for (vtkIdType i_vox = 0; i_vox < voxelsNb; i_vox++)
+  table->Voxels.clear();
+  table->Pixels.clear();
+  std::vector<T> distances;
+  for (int k = 0; k < table->CellDims[2]; k++)
     {
-    vtkIdType ijkVox[3];
-    ijkVox[0] = i_vox % (gridDims[0] - 1);
-    ijkVox[1] = (i_vox / (gridDims[0] - 1)) % (gridDims[1] - 1);
-    ijkVox[2] = i_vox / ((gridDims[0] - 1) * (gridDims[1] - 1));
+    table->Voxels.insert(table->Voxels.end(), sliceVoxels[k].begin(), sliceVoxels[k].end());
+    table->Pixels.insert(table->Pixels.end(), slicePixels[k].begin(), slicePixels[k].end());
+    distances.insert(distances.end(), sliceDistances[k].begin(), sliceDistances[k].end());
+    }
+  table->Distances.TakeReference(vtkDataArray::CreateDataArray(vtkTypeTraits<T>::VTKTypeID()));
+  table->Distances->SetNumberOfTuples(static_cast<vtkIdType>(distances.size()));
+  std::copy(distances.begin(), distances.end(), static_cast<T*>(table->Distances->GetVoidPointer(0)));
+}
 
-    // voxel center
-    double voxCenterTemp[3];
-    for (int i = 0; i < 3; i++)
+//----------------------------------------------------------------------------
+vtkProjectionTable* vtkCudaReconstructionFilter::vtkInternals::GetProjectionTable(vtkImageData* depthMap,
+  vtkMatrix3x3* depthMapMatrixK, vtkMatrix4x4* depthMapMatrixTR, vtkMatrix4x4* gridMatrix, double gridOrig[3],
+  int gridDims[3], double gridSpacing[3], int scalarType, int maxTablesNb)
+{
+  double voxelToCamera[16];
+  ComputeVoxelToCameraMatrix(gridMatrix, gridOrig, gridSpacing, depthMapMatrixTR, voxelToCamera);
+  double voxelToDepthMap[12];
+  ComputeVoxelToDepthMapMatrix(depthMapMatrixK, voxelToCamera, voxelToDepthMap);
+  int cellDims[3] = {gridDims[0] - 1, gridDims[1] - 1, gridDims[2] - 1};
+  int depthMapDims[3];
+  depthMap->GetDimensions(depthMapDims);
+
+  // a table found moves to the end of the list
+  std::vector<vtkSmartPointer<vtkProjectionTable> >& tables = this->ProjectionTables;
+  for (size_t i = 0; i < tables.size(); i++)
+    {
+    if (tables[i]->Matches(voxelToCamera, voxelToDepthMap, cellDims, depthMapDims, scalarType))
       {
-      voxCenterTemp[i] = gridOrig[i] + ((double)ijkVox[i] + 0.5) * gridSpacing[i];
+      vtkSmartPointer<vtkProjectionTable> table = tables[i];
+      tables.erase(tables.begin() + i);
+      tables.push_back(table);
+      return table;
       }
-    double voxCenter[3];
-    transformGridToRealCoords->TransformPoint(voxCenterTemp, voxCenter);
-
-    // voxel center in camera coords
-    double voxCameraCoords[3];
-    transformSceneToCamera->TransformPoint(voxCenter, voxCameraCoords);
+    }
 
-    // compute distance between voxel and camera
-    double distanceVoxCam = vtkMath::Norm(voxCameraCoords);
+  // the least recently used table makes room for the new one
+  if (static_cast<int>(tables.size()) >= maxTablesNb)
+    {
+    tables.erase(tables.begin(), tables.begin() + (tables.size() - maxTablesNb + 1));
+    }
+  vtkSmartPointer<vtkProjectionTable> table = vtkSmartPointer<vtkProjectionTable>::New();
+  std::copy(voxelToCamera, voxelToCamera + 16, table->VoxelToCamera);
+  std::copy(voxelToDepthMap, voxelToDepthMap + 12, table->VoxelToDepthMap);
+  std::copy(cellDims, cellDims + 3, table->CellDims);
+  std::copy(depthMapDims, depthMapDims + 2, table->DepthMapDims);
+  table->ScalarType = scalarType;
+  if (scalarType == VTK_FLOAT)
+    {
+    BuildProjectionTable<float>(voxelToCamera, voxelToDepthMap, table);
+    }
+  else
+    {
+    BuildProjectionTable<double>(voxelToCamera, voxelToDepthMap, table);
+    }
+  tables.push_back(table);
+  return table;
+}
 
-    // voxel center in depth map homogeneous coords
-    double voxDepthMapCoordsHomo[3];
-    transformCameraToDepthMap->TransformVector(voxCameraCoords, voxDepthMapCoordsHomo);
+//----------------------------------------------------------------------------
+// Integrate a depth map through a projection table: a gather of the depths
+// of the pixels of the voxels, each voxel appearing once in the table
+template <typename T, typename F>
+struct vtkProjectionTableFunctor
+{
+  F Function;
+  const vtkTypeUInt32* Voxels;
+  const vtkTypeUInt32* Pixels;
+  const T* Distances;
+  const T* Depths;
+  T* OutScalar;
+  T* OutWeights;
 
-    // voxel center in depth map coords
-    double voxDepthMapCoords[2];
-    voxDepthMapCoords[0] = voxDepthMapCoordsHomo[0] / voxDepthMapCoordsHomo[2];
-    voxDepthMapCoords[1] = voxDepthMapCoordsHomo[1] / voxDepthMapCoordsHomo[2];
+  explicit vtkProjectionTableFunctor(const F& function) : Function(function) {}
 
-    // compute depth from depth map
-    // todo improve with interpolation
-    int ijk[3];
-    ijk[0] = round(voxDepthMapCoords[0]);
-    ijk[1] = round(voxDepthMapCoords[1]);
-    ijk[2] = 0;
-    int dim[3];
-    depthMap->GetDimensions(dim);
-    if (ijk[0] < 0 || ijk[0] > dim[0] - 1 || ijk[1] < 0 || ijk[1] > dim[1] - 1)
+  void operator()(vtkIdType begin, vtkIdType end)
+  {
+    for (vtkIdType e = begin; e < end; e++)
       {
-      continue;
+      T depth = this->Depths[this->Pixels[e]];
+      T diff = this->Distances[e] - depth;
+      if (!ReconstructionIsValidDepth(depth) || !this->Function.InBand(diff))
+        {
+        continue;
+        }
+      vtkIdType i_vox = this->Voxels[e];
+      T weight = F::HasWeights ? this->OutWeights[i_vox] : 0;
+      this->Function.Update(diff, this->OutScalar[i_vox], weight);
+      if (F::HasWeights)
+        {
+        this->OutWeights[i_vox] = weight;
+        }
       }
-    vtkIdType id = vtkStructuredData::ComputePointId(dim, ijk);
-    if (0 > id && id >= depthMap->GetNumberOfPoints())
+  }
+};
+
+//----------------------------------------------------------------------------
+// Integration through a projection table in the precision T, the functor is
+// specialised on the function
+template <typename T>
+struct vtkProjectionTableIntegration
+{
+  vtkProjectionTable* Table;
+  vtkDataArray* Depths;
+  vtkDataArray* OutScalar;
+  vtkDataArray* OutWeights;
+
+  template <typename F>
+  int operator()(const F& function)
+  {
+    if (this->Table->Voxels.empty())
       {
-      // todo error message
-      std::cout << "Bad conversion from ijk to id." << std::endl;
-      continue;
+      return 1;
       }
-    double depth = depths->GetValue(id);
+    vtkProjectionTableFunctor<T, F> functor(function);
+    std::vector<T> depthsBuffer;
+    functor.Voxels = &this->Table->Voxels[0];
+    functor.Pixels = &this->Table->Pixels[0];
+    functor.Distances = static_cast<const T*>(this->Table->Distances->GetVoidPointer(0));
+    functor.Depths = GetDepthsPointer(this->Depths, depthsBuffer);
+    functor.OutScalar = static_cast<T*>(this->OutScalar->GetVoidPointer(0));
+    functor.OutWeights = this->OutWeights ? static_cast<T*>(this->OutWeights->GetVoidPointer(0)) : 0;
+    vtkSMPTools::For(0, static_cast<vtkIdType>(this->Table->Voxels.size()), functor);
+    return 1;
+  }
+};
 
-    // compute new val
-    // todo replace by class function
-    double val = outScalar->GetValue(i_vox);
-    vtkCudaReconstructionFilter::FunctionCumul(distanceVoxCam - depth, val);
-    outScalar->SetValue(i_vox, val);
+//----------------------------------------------------------------------------
+int vtkCudaReconstructionFilter::IntegrateWithSMP(double gridOrig[3], int gridDims[3], double gridSpacing[3],
+  vtkImageData* depthMap, vtkMatrix3x3 *depthMapMatrixK, vtkMatrix4x4 *depthMapMatrixTR,
+  vtkDataArray* outScalar, const std::vector<int>* activeBlocks, vtkDataArray* outWeights, double truncation)
+{
+  // the tables hold the nearest pixels, with 32 bits indices
+  vtkDataArray* depths = GetDepths(depthMap);
+  int scalarType = outScalar->GetDataType();
+  if (this->ProjectionCacheSize <= 0 || this->InterpolationMode != INTERPOLATION_NEAREST || !depths ||
+      (scalarType != VTK_FLOAT && scalarType != VTK_DOUBLE) ||
+      (outWeights && outWeights->GetDataType() != scalarType) ||
+      (ReconstructionFunctionHasWeights(this->IntegrationFunction) && !outWeights) ||
+      outScalar->GetNumberOfTuples() > static_cast<vtkIdType>(VTK_UNSIGNED_INT_MAX) ||
+      depthMap->GetNumberOfPoints() > static_cast<vtkIdType>(VTK_UNSIGNED_INT_MAX))
+    {
+    return vtkCudaReconstructionFilter::ComputeWithSMP(this->GridMatrix, gridOrig, gridDims, gridSpacing,
+      depthMap, depthMapMatrixK, depthMapMatrixTR, outScalar, activeBlocks, this->InterpolationMode,
+      this->IntegrationFunction, outWeights, truncation, this->Vectorization != 0);
     }
 
-  return 1;
+  // the table only holds the voxels of the frustum, the active blocks are
+  // implied
+  vtkProjectionTable* table = this->Internals->GetProjectionTable(depthMap, depthMapMatrixK, depthMapMatrixTR,
+    this->GridMatrix, gridOrig, gridDims, gridSpacing, scalarType, this->ProjectionCacheSize);
+  if (scalarType == VTK_FLOAT)
+    {
+    vtkProjectionTableIntegration<float> integration = {table, depths, outScalar, outWeights};
+    return DispatchReconstructionFunction<float>(this->IntegrationFunction, truncation, integration);
+    }
+  vtkProjectionTableIntegration<double> integration = {table, depths, outScalar, outWeights};
+  return DispatchReconstructionFunction<double>(this->IntegrationFunction, truncation, integration);
 }
 
 //----------------------------------------------------------------------------
-void vtkCudaReconstructionFilter::FunctionCumul(double diff, double& val)
+int vtkCudaReconstructionFilter::ComputeWithCuda(
+    vtkMatrix4x4 *gridMatrix, double gridOrig[3], int gridDims[3], double gridSpacing[3],
+    int scalarType, vtkDataArray* outScalar, vtkDataArray* outWeights)
 {
-  if (std::abs(diff) != 0)
+  std::vector<vtkDepthMapFrame> frames;
+  this->Internals->GetFramesToIntegrate(this, frames);
+
+  // upload the grid once for all the depth maps, the context is kept to
+  // reuse its device buffers at the next update
+  double h_gridMatrix[16];
+  vtkMatrix4x4::DeepCopy(h_gridMatrix, gridMatrix);
+  if (!this->Internals->Context)
     {
-    val += 1 / std::abs(diff);
+    this->Internals->Context = cuda_reconstruction_new();
     }
-  else
+  this->Internals->HasVolume = false;
+  CudaReconstructionContext* context = this->Internals->Context;
+  int interpolation = this->InterpolationMode == INTERPOLATION_LINEAR ?
+    CUDA_RECONSTRUCTION_INTERPOLATION_LINEAR : CUDA_RECONSTRUCTION_INTERPOLATION_NEAREST;
+  cuda_reconstruction_set_interpolation(context, interpolation);
+  vtkDepthPreprocessing preprocessing = GetDepthPreprocessing(this);
+  SetDepthPreprocessing(context, preprocessing);
+  double truncation = this->GetTruncation(gridSpacing);
+  cuda_reconstruction_set_function(context, this->IntegrationFunction, truncation);
+  cuda_reconstruction_set_timing(context, this->Profiling != 0);
+  double range[2];
+  ReconstructionFunctionRange(this->IntegrationFunction, truncation, range);
+
+  // only the grid integrated in one piece is in the storage format on the
+  // device, the other modes integrate into arrays of scalarType converted
+  // at the end
+  vtkSmartPointer<vtkDataArray> scalars;
+  vtkSmartPointer<vtkDataArray> weights;
+
+  // the depths and the grid are transferred from and to page-locked
+  // memory, the outputs staying registered for the next updates
+  bool pinning = this->HostMemoryPinning != 0;
+  vtkScopedHostRegistration registration(context, pinning);
+  registration.Register(frames, scalarType);
+  if (!this->SparseVolume)
     {
-    val += 10;
+    this->Internals->PinOutput(this->Internals->PinnedScalars, outScalar, scalarType, pinning);
     }
-  if (val > 100)
+  if (outWeights)
     {
-    val = 100;
+    this->Internals->PinOutput(this->Internals->PinnedWeights, outWeights, scalarType, pinning);
     }
-}
 
-//----------------------------------------------------------------------------
-int vtkCudaReconstructionFilter::ComputeWithCuda(
-    vtkMatrix4x4 *gridMatrix, double gridOrig[3], int gridDims[3], double gridSpacing[3],
-    vtkImageData* depthMap, vtkMatrix3x3 *depthMapMatrixK, vtkMatrix4x4 *depthMapMatrixTR,
-    vtkDoubleArray* outScalar)
-{
-  // todo convert gridMatrix, depthMapMatrixK, depthMapMatrixTR, outScalar into double*
-  double copy_gridMatrix[16];
-  double copy_depthMapMatrixK[16];
-  double copy_depthMapMatrixTR[16];
-  double copy_outScalar[10] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+  // the sparse volume only holds the blocks around the depths, it is then
+  // copied into the dense output
+  if (this->SparseVolume)
+    {
+    this->LastNumberOfBricks = 0;
+    this->LastNumberOfDevices = 1;
+    int res = this->Internals->InitSparseVolume(scalarType == VTK_FLOAT, h_gridMatrix, gridOrig, gridDims,
+                                                gridSpacing, this->SparseMaxNumberOfBlocks,
+                                                this->SparseBandWidth);
+    for (size_t i = 0; res && i < frames.size(); i++)
+      {
+      res = IntegrateSparseWithCuda(context, scalarType, frames[i], preprocessing);
+      this->CountSparseVoxels(gridDims);
+      }
+    this->UpdateNumberOfSparseBlocks();
+    GetIntegrationArrays(scalarType, outScalar, 0, scalars, weights);
+    res = res && this->Internals->ExportSparseVolume(scalars);
+    this->StoreOutput(scalars, 0, range, outScalar, 0);
+    return res;
+    }
+  this->Internals->HasSparseVolume = false;
 
-  // todo convert depthMap into double* + dims
-  int depthMapDims[3];
-  // todo this line is already done in ComputeWithoutCuda, must factorize it
-  vtkDoubleArray* depths = vtkDoubleArray::SafeDownCast(depthMap->GetPointData()->GetArray("Depths"));
-  if (!depths)
+  // split the grid into one slab of blocks per device
+  int devicesNb;
+  size_t freeMemory, totalMemory;
+  cuda_reconstruction_get_device_info(&devicesNb, &freeMemory, &totalMemory);
+  if (this->NumberOfDevices > 0)
     {
-    // todo error message
-    std::cout << "Bad depths." << std::endl;
-    return 0;
+    devicesNb = std::min(devicesNb, this->NumberOfDevices);
+    }
+  int zBlocksNb = (gridDims[2] - 2) / CUDA_RECONSTRUCTION_BLOCK_SIZE + 1;
+  devicesNb = std::max(std::min(devicesNb, zBlocksNb), 1);
+  this->LastNumberOfDevices = devicesNb;
+  if (devicesNb > 1)
+    {
+    std::vector<CudaReconstructionDepthMap> depthMaps;
+    std::vector<std::vector<float> > floatBuffers(frames.size());
+    std::vector<std::vector<double> > doubleBuffers(frames.size());
+    std::vector<std::vector<float> > confidenceBuffers(frames.size());
+    for (size_t i = 0; i < frames.size(); i++)
+      {
+      const std::vector<int>* activeBlocks = 0;
+      if (this->FrustumCulling)
+        {
+        activeBlocks = &GetActiveBlocks(frames[i], gridMatrix, gridOrig, gridDims, gridSpacing);
+        }
+      this->CountIntegratedVoxels(activeBlocks, gridDims);
+      CudaReconstructionDepthMap depthMap;
+      if (GetCudaDepthMap(frames[i], scalarType, activeBlocks, preprocessing, depthMap, floatBuffers[i],
+                          doubleBuffers[i], confidenceBuffers[i]))
+        {
+        depthMaps.push_back(depthMap);
+        }
+      }
+
+    GetIntegrationArrays(scalarType, outScalar, outWeights, scalars, weights);
+    std::vector<CudaReconstructionContext*> contexts(1, context);
+    this->Internals->DeviceContexts.resize(std::max(devicesNb - 1,
+      static_cast<int>(this->Internals->DeviceContexts.size())), 0);
+    contexts.insert(contexts.end(), this->Internals->DeviceContexts.begin(),
+                    this->Internals->DeviceContexts.begin() + devicesNb - 1);
+    int res;
+      {
+      vtkProfiledStage stage(this->LastStageTimes, PROFILE_STAGE_KERNEL, this->Profiling != 0);
+      res = IntegrateOnDevices(contexts, scalarType == VTK_FLOAT, h_gridMatrix, gridOrig, gridDims,
+        gridSpacing, depthMaps, scalars->GetVoidPointer(0), weights ? weights->GetVoidPointer(0) : 0,
+        interpolation, preprocessing, this->IntegrationFunction, truncation,
+        this->MaxBrickNumberOfVoxels, &this->LastNumberOfBricks);
+      }
+    std::copy(contexts.begin() + 1, contexts.end(), this->Internals->DeviceContexts.begin());
+    this->StoreOutput(scalars, weights, range, outScalar, outWeights);
+    return res;
+    }
+
+  // integrate brick by brick when the grid does not fit on the device
+  vtkIdType voxelsNb = outScalar->GetNumberOfTuples();
+  vtkIdType maxDepthMapPointsNb = 0;
+  for (size_t i = 0; i < frames.size(); i++)
+    {
+    maxDepthMapPointsNb = std::max(maxDepthMapPointsNb, frames[i].DepthMap->GetNumberOfPoints());
+    }
+  size_t scalarSize = scalarType == VTK_FLOAT ? sizeof(float) : sizeof(double);
+  vtkIdType arraysNb = outWeights ? 2 : 1;
+  if ((this->MaxBrickNumberOfVoxels > 0 && voxelsNb > this->MaxBrickNumberOfVoxels) ||
+      !FitsOnDevice(context, static_cast<size_t>(arraysNb * voxelsNb) * this->GetVoxelSize(scalarType) +
+                    static_cast<size_t>(maxDepthMapPointsNb) * scalarSize))
+    {
+    GetIntegrationArrays(scalarType, outScalar, outWeights, scalars, weights);
+    std::vector<CudaReconstructionDepthMap> depthMaps(frames.size());
+    std::vector<std::vector<float> > floatBuffers(frames.size());
+    std::vector<std::vector<double> > doubleBuffers(frames.size());
+    std::vector<std::vector<float> > confidenceBuffers(frames.size());
+    int depthMapsNb = 0;
+    for (size_t i = 0; i < frames.size(); i++)
+      {
+      const std::vector<int>* activeBlocks = 0;
+      if (this->FrustumCulling)
+        {
+        activeBlocks = &GetActiveBlocks(frames[i], gridMatrix, gridOrig, gridDims, gridSpacing);
+        }
+      this->CountIntegratedVoxels(activeBlocks, gridDims);
+      if (GetCudaDepthMap(frames[i], scalarType, activeBlocks, preprocessing, depthMaps[depthMapsNb],
+                          floatBuffers[i], doubleBuffers[i], confidenceBuffers[i]))
+        {
+        depthMapsNb++;
+        }
+      }
+    int res;
+      {
+      vtkProfiledStage stage(this->LastStageTimes, PROFILE_STAGE_KERNEL, this->Profiling != 0);
+      res = cuda_reconstruction_integrate_bricked(context, scalarType == VTK_FLOAT, h_gridMatrix, gridOrig,
+        gridDims, gridSpacing, depthMapsNb, depthMaps.empty() ? 0 : &depthMaps[0],
+        scalars->GetVoidPointer(0), weights ? weights->GetVoidPointer(0) : 0, this->MaxBrickNumberOfVoxels,
+        &this->LastNumberOfBricks);
+      }
+    this->StoreOutput(scalars, weights, range, outScalar, outWeights);
+    return res;
     }
-  double* copy_depths;
 
-  // call host function in cuda file
-  cuda_reconstruction(copy_gridMatrix, gridOrig, gridDims, gridSpacing,
-                      depthMapDims, copy_depths, copy_depthMapMatrixK, copy_depthMapMatrixTR,
-                      copy_outScalar);
+  // the reduced formats start from the empty grid of the device
+  this->LastNumberOfBricks = 1;
+  bool native = this->StorageFormat == STORAGE_NATIVE;
+  cuda_reconstruction_set_storage(context, this->StorageFormat);
+  cuda_reconstruction_set_layout(context, this->DeviceLayout);
+  this->Internals->GridStorage = this->StorageFormat;
+  this->Internals->GridLayout = this->DeviceLayout;
+  int res = cuda_reconstruction_init_grid(context, scalarType == VTK_FLOAT, h_gridMatrix, gridOrig,
+                                          gridDims, gridSpacing, native ? outScalar->GetVoidPointer(0) : 0,
+                                          native && outWeights ? outWeights->GetVoidPointer(0) : 0);
+
+  for (size_t i = 0; res && i < frames.size(); i++)
+    {
+    const std::vector<int>* activeBlocks = 0;
+    if (this->FrustumCulling)
+      {
+      activeBlocks = &GetActiveBlocks(frames[i], gridMatrix, gridOrig, gridDims, gridSpacing);
+      }
+    this->CountIntegratedVoxels(activeBlocks, gridDims);
+    res = IntegrateWithCuda(context, scalarType, frames[i], activeBlocks, preprocessing);
+    }
 
-  // todo fill outScalar with copy_outScalar, maybe can be done directly
-  std::cout << copy_outScalar[0] << std::endl;
+  // get the accumulated values back
+  res = res && this->DownloadGrid(outScalar, outWeights);
 
-  return 1;
+  return res;
 }
 
 //----------------------------------------------------------------------------
@@ -297,6 +3583,11 @@ int vtkCudaReconstructionFilter::RequestInformation(
                inInfo->Get(vtkStreamingDemandDrivenPipeline::WHOLE_EXTENT()),
                6);
 
+  // any sub-extent can be integrated on its own, or copied out of the
+  // persistent volume, which lets the streaming executive split a large
+  // volume into pieces
+  outInfo->Set(vtkAlgorithm::CAN_PRODUCE_SUB_EXTENT(), 1);
+
   return 1;
 }
 
@@ -306,13 +3597,92 @@ int vtkCudaReconstructionFilter::RequestUpdateExtent(
   vtkInformationVector **inputVector,
   vtkInformationVector *outputVector)
 {
+  // get the info objects
+  vtkInformation *inInfo = inputVector[0]->GetInformationObject(0);
+  vtkInformation *outInfo = outputVector->GetInformationObject(0);
+
+  // the input only gives the geometry of the requested extent, the
+  // persistent volume of the incremental mode covers the whole grid
+  if (this->Incremental || !outInfo->Has(vtkStreamingDemandDrivenPipeline::UPDATE_EXTENT()))
+    {
+    inInfo->Set(vtkStreamingDemandDrivenPipeline::UPDATE_EXTENT(),
+                inInfo->Get(vtkStreamingDemandDrivenPipeline::WHOLE_EXTENT()),
+                6);
+    }
+  else
+    {
+    inInfo->Set(vtkStreamingDemandDrivenPipeline::UPDATE_EXTENT(),
+                outInfo->Get(vtkStreamingDemandDrivenPipeline::UPDATE_EXTENT()),
+                6);
+    }
+
   return 1;
 }
 
+//----------------------------------------------------------------------------
+int vtkCudaReconstructionFilter::FillOutputPortInformation(int port, vtkInformation* info)
+{
+  if (port == 1)
+    {
+    info->Set(vtkDataObject::DATA_TYPE_NAME(), "vtkPolyData");
+    return 1;
+    }
+  return this->Superclass::FillOutputPortInformation(port, info);
+}
+
 //----------------------------------------------------------------------------
 void vtkCudaReconstructionFilter::PrintSelf(ostream& os, vtkIndent indent)
 {
   this->Superclass::PrintSelf(os,indent);
 
   os << indent << "Depth Map: " << this->DepthMap << "\n";
+  os << indent << "Number Of Depth Maps: " << this->Internals->DepthMaps.size() << "\n";
+  os << indent << "Incremental: " << this->Incremental << "\n";
+  os << indent << "Backend: " << vtkCudaReconstructionFilter::GetBackendAsString(this->Backend) << "\n";
+  os << indent << "Last Backend: " << vtkCudaReconstructionFilter::GetBackendAsString(this->LastBackend) << "\n";
+  os << indent << "Output Scalar Precision: " << this->OutputScalarPrecision << "\n";
+  os << indent << "Storage Format: "
+     << vtkCudaReconstructionFilter::GetStorageFormatAsString(this->StorageFormat) << "\n";
+  os << indent << "Device Layout: "
+     << vtkCudaReconstructionFilter::GetDeviceLayoutAsString(this->DeviceLayout) << "\n";
+  os << indent << "Max Brick Number Of Voxels: " << this->MaxBrickNumberOfVoxels << "\n";
+  os << indent << "Last Number Of Bricks: " << this->LastNumberOfBricks << "\n";
+  os << indent << "Frustum Culling: " << this->FrustumCulling << "\n";
+  os << indent << "Integration Function: "
+     << vtkCudaReconstructionFilter::GetIntegrationFunctionAsString(this->IntegrationFunction) << "\n";
+  os << indent << "Truncation Distance: " << this->TruncationDistance << "\n";
+  os << indent << "Host Memory Pinning: " << this->HostMemoryPinning << "\n";
+  os << indent << "Vectorization: " << this->Vectorization << " ("
+     << vtkCudaReconstructionFilter::GetVectorizationInstructionSet() << ")\n";
+  os << indent << "Number Of Devices: " << this->NumberOfDevices << "\n";
+  os << indent << "Last Number Of Devices: " << this->LastNumberOfDevices << "\n";
+  os << indent << "Interpolation Mode: "
+     << (this->InterpolationMode == INTERPOLATION_LINEAR ? "linear" : "nearest") << "\n";
+  os << indent << "Min Depth: " << this->MinDepth << "\n";
+  os << indent << "Max Depth: " << this->MaxDepth << "\n";
+  os << indent << "Confidence Array Name: "
+     << (this->ConfidenceArrayName ? this->ConfidenceArrayName : "(none)") << "\n";
+  os << indent << "Min Confidence: " << this->MinConfidence << "\n";
+  os << indent << "Depth Map Level: " << this->DepthMapLevel << "\n";
+  os << indent << "Sparse Volume: " << this->SparseVolume << "\n";
+  os << indent << "Sparse Max Number Of Blocks: " << this->SparseMaxNumberOfBlocks << "\n";
+  os << indent << "Sparse Band Width: " << this->SparseBandWidth << "\n";
+  os << indent << "Last Number Of Sparse Blocks: " << this->LastNumberOfSparseBlocks << "\n";
+  os << indent << "Extract Surface: " << this->ExtractSurface << "\n";
+  os << indent << "Surface Value: " << this->SurfaceValue << "\n";
+  os << indent << "Max Pending Depth Maps: " << this->MaxPendingDepthMaps << "\n";
+  os << indent << "Projection Cache Size: " << this->ProjectionCacheSize << "\n";
+  os << indent << "Memory Pool Cached Bytes: " << vtkCudaReconstructionFilter::GetMemoryPoolCachedBytes() << "\n";
+  os << indent << "Memory Pool Used Bytes: " << vtkCudaReconstructionFilter::GetMemoryPoolUsedBytes() << "\n";
+  os << indent << "Profiling: " << this->Profiling << "\n";
+  for (int i = 0; i < PROFILE_STAGES_NB; i++)
+    {
+    os << indent << "Last Stage Time (" << vtkCudaReconstructionFilter::GetProfileStageAsString(i) << "): "
+       << this->LastStageTimes[i] << " ms\n";
+    }
+  os << indent << "Last Number Of Integrated Voxels: " << this->LastNumberOfIntegratedVoxels << "\n";
+  os << indent << "Last Number Of Culled Voxels: " << this->LastNumberOfCulledVoxels << "\n";
+  os << indent << "Last Number Of Uploaded Bytes: " << this->LastNumberOfUploadedBytes << "\n";
+  os << indent << "Last Number Of Downloaded Bytes: " << this->LastNumberOfDownloadedBytes << "\n";
+  os << indent << "Verbosity: " << this->Verbosity << "\n";
 }
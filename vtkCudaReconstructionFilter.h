@@ -9,10 +9,16 @@
 #include "vtkFiltersCoreModule.h" // For export macro
 #include "vtkImageAlgorithm.h"
 
-class vtkDoubleArray;
+#include "ReconstructionDepths.h" // For RECONSTRUCTION_DEPTHS_MAX_LEVEL
+#include "vtkSmartPointer.h" // For the output arrays
+
+#include <vector> // For the active blocks
+
+class vtkDataArray;
 class vtkImageData;
 class vtkMatrix3x3;
 class vtkMatrix4x4;
+class vtkPolyData;
 
 class vtkCudaReconstructionFilter : public vtkImageAlgorithm
 {
@@ -31,6 +37,476 @@ public:
   void SetDepthMapMatrixTR(vtkMatrix4x4 *depthMapMatrixTR);
   void SetGridMatrix(vtkMatrix4x4 *gridMatrix);
 
+  // Description:
+  // Add a depth map with its K and TR matrices to the list of depth maps
+  // integrated in one pass by the next update. The depth map set with
+  // SetDepthMap, if any, is integrated after them.
+  void AddDepthMap(vtkImageData *depthMap, vtkMatrix3x3 *depthMapMatrixK,
+                   vtkMatrix4x4 *depthMapMatrixTR);
+
+  // Description:
+  // Remove all the depth maps added with AddDepthMap.
+  void RemoveAllDepthMaps();
+
+  // Description:
+  // Get the number of depth maps added with AddDepthMap.
+  int GetNumberOfDepthMaps();
+
+  // Description:
+  // Backends used to integrate the depth maps.
+  enum
+  {
+    BACKEND_AUTO = 0,
+    BACKEND_CUDA,
+    BACKEND_CPU_PARALLEL,
+    BACKEND_CPU_SERIAL
+  };
+
+  // Description:
+  // Specify the backend. In auto mode (the default) CUDA is used when a
+  // device is available and has enough free memory for the volume and the
+  // depth maps, otherwise the multithreaded CPU backend is used.
+  vtkSetClampMacro(Backend, int, BACKEND_AUTO, BACKEND_CPU_SERIAL);
+  vtkGetMacro(Backend, int);
+  void SetBackendToAuto() { this->SetBackend(BACKEND_AUTO); }
+  void SetBackendToCuda() { this->SetBackend(BACKEND_CUDA); }
+  void SetBackendToCPUParallel() { this->SetBackend(BACKEND_CPU_PARALLEL); }
+  void SetBackendToCPUSerial() { this->SetBackend(BACKEND_CPU_SERIAL); }
+  static const char* GetBackendAsString(int backend);
+
+  // Description:
+  // Get the backend used by the last integration, -1 before the first one.
+  vtkGetMacro(LastBackend, int);
+
+  // Description:
+  // Set/get the precision of the integration and of the reconstruction_scalar
+  // output: vtkAlgorithm::SINGLE_PRECISION runs in float and produces a
+  // vtkFloatArray, vtkAlgorithm::DOUBLE_PRECISION runs in double and
+  // produces a vtkDoubleArray. vtkAlgorithm::DEFAULT_PRECISION (the
+  // default) uses float when the Depths array of the first depth map is a
+  // vtkFloatArray and double otherwise. The serial CPU backend always
+  // computes in double.
+  vtkSetMacro(OutputScalarPrecision, int);
+  vtkGetMacro(OutputScalarPrecision, int);
+
+  // Description:
+  // Storage formats of the reconstruction volume, the values are the
+  // CUDA_RECONSTRUCTION_STORAGE_ ones.
+  enum
+  {
+    STORAGE_NATIVE = 0,
+    STORAGE_HALF,
+    STORAGE_UINT16
+  };
+
+  // Description:
+  // Specify how the voxels are stored. The native format (the default)
+  // keeps them in the precision of the integration. The half and uint16
+  // formats take 2 bytes per voxel in the device grid of the cuda backend,
+  // whether the volume is incremental or not, the values being widened to
+  // the precision of the integration in registers only. In uint16 the
+  // values are quantised over the range of the integration function (0 to
+  // 100 for the cumulative function, plus or minus the truncation distance
+  // for the TSDF), the reconstruction_scalar output is a
+  // vtkUnsignedShortArray and the range is given by the
+  // reconstruction_scalar_range field data array: q stands for
+  // range[0] + q * (range[1] - range[0]) / 65535. In half the output is a
+  // vtkFloatArray, VTK having no 16 bit floats. In both formats the TSDF
+  // weights are a vtkUnsignedShortArray of counts saturating at 65535. The
+  // CPU backends, the bricked and multi-device integrations and the sparse
+  // volume integrate in the precision of the integration, only their output
+  // is converted.
+  vtkSetClampMacro(StorageFormat, int, STORAGE_NATIVE, STORAGE_UINT16);
+  vtkGetMacro(StorageFormat, int);
+  void SetStorageFormatToNative() { this->SetStorageFormat(STORAGE_NATIVE); }
+  void SetStorageFormatToHalf() { this->SetStorageFormat(STORAGE_HALF); }
+  void SetStorageFormatToUInt16() { this->SetStorageFormat(STORAGE_UINT16); }
+  static const char* GetStorageFormatAsString(int storage);
+
+  // Description:
+  // Layouts of the device grid of the cuda backend, the values are the
+  // CUDA_RECONSTRUCTION_LAYOUT_ ones.
+  enum
+  {
+    LAYOUT_LINEAR = 0,
+    LAYOUT_BRICKS
+  };
+
+  // Description:
+  // Specify how the voxels are laid out in the device grid of the cuda
+  // backend. The bricks layout (the default) stores them by blocks of
+  // CUDA_RECONSTRUCTION_BLOCK_SIZE^3 voxels, so that a thread block
+  // integrates a compact tile whose projections are close in the depth map,
+  // instead of a row of voxels in the linear layout. The grid is padded to
+  // whole blocks on the device and is reordered to the x fastest order of VTK
+  // on the device when it is downloaded. The CPU backends, the bricked and
+  // multi-device integrations and the sparse volume are not affected.
+  vtkSetClampMacro(DeviceLayout, int, LAYOUT_LINEAR, LAYOUT_BRICKS);
+  vtkGetMacro(DeviceLayout, int);
+  void SetDeviceLayoutToLinear() { this->SetDeviceLayout(LAYOUT_LINEAR); }
+  void SetDeviceLayoutToBricks() { this->SetDeviceLayout(LAYOUT_BRICKS); }
+  static const char* GetDeviceLayoutAsString(int layout);
+
+  // Description:
+  // Set/get the maximum number of voxels of the bricks of the cuda backend.
+  // A grid larger than the free device memory, or than this number when it
+  // is not 0 (the default), is integrated brick by brick: slabs of whole z
+  // slices are streamed to the device, integrate all the depth maps and are
+  // streamed back, the transfers overlapping the computation. The
+  // incremental mode does not use bricks.
+  vtkSetMacro(MaxBrickNumberOfVoxels, vtkIdType);
+  vtkGetMacro(MaxBrickNumberOfVoxels, vtkIdType);
+
+  // Description:
+  // Get the number of bricks used by the last integration: 1 when the grid
+  // was integrated in one piece on the device, 0 for the CPU backends.
+  vtkGetMacro(LastNumberOfBricks, int);
+
+  // Description:
+  // Set/get the number of cuda devices used by the integration, 0 for all
+  // the devices (1 by default). With several devices the grid is split
+  // along z into one slab of whole blocks per device, each device receives
+  // all the depth maps and integrates its slab brick by brick if needed,
+  // the slabs being gathered into the output. The incremental mode and the
+  // sparse volume use a single device.
+  vtkSetClampMacro(NumberOfDevices, int, 0, VTK_INT_MAX);
+  vtkGetMacro(NumberOfDevices, int);
+
+  // Description:
+  // Get the number of devices used by the last integration with the cuda
+  // backend.
+  vtkGetMacro(LastNumberOfDevices, int);
+
+  // Description:
+  // Turn on/off the frustum culling (on by default). The grid is split into
+  // blocks of 8x8x8 voxels, and the blocks entirely behind the camera or
+  // projected outside a depth map are skipped by the cuda and the
+  // multithreaded backends. The list of active blocks of a depth map is kept
+  // with it while the grid and its camera do not change. The serial backend
+  // always projects every voxel.
+  vtkSetMacro(FrustumCulling, int);
+  vtkGetMacro(FrustumCulling, int);
+  vtkBooleanMacro(FrustumCulling, int);
+
+  // Description:
+  // Set/get the number of cameras whose projection tables are kept by the
+  // multithreaded backend, 0 (the default) projecting the voxels of every
+  // depth map. The table of a camera lists, for a grid, the voxels in front
+  // of it whose nearest pixel is in its depth maps, with this pixel and
+  // their distance to the camera, so that the next depth maps of the same
+  // camera, from a fixed rig, are integrated by a gather of their depths.
+  // A table takes 8 or 12 bytes per voxel seen, the least recently used
+  // one is dropped for a new camera. The linear interpolation always
+  // projects the voxels.
+  vtkSetClampMacro(ProjectionCacheSize, int, 0, 1024);
+  vtkGetMacro(ProjectionCacheSize, int);
+
+  // Description:
+  // Sampling of the depth maps.
+  enum
+  {
+    INTERPOLATION_NEAREST = 0,
+    INTERPOLATION_LINEAR
+  };
+
+  // Description:
+  // Specify how the depth maps are sampled at the projection of the voxels:
+  // the nearest pixel (the default) or a bilinear interpolation of the four
+  // nearest pixels with clamped borders. The single precision cuda backend
+  // interpolates through the texture hardware, which has a lower precision
+  // on the interpolation weights. The voxels projected more than half a
+  // pixel outside of the depth map are not integrated in both modes, nor
+  // are the interpolations of four pixels of which one is invalid.
+  vtkSetClampMacro(InterpolationMode, int, INTERPOLATION_NEAREST, INTERPOLATION_LINEAR);
+  vtkGetMacro(InterpolationMode, int);
+  void SetInterpolationModeToNearest() { this->SetInterpolationMode(INTERPOLATION_NEAREST); }
+  void SetInterpolationModeToLinear() { this->SetInterpolationMode(INTERPOLATION_LINEAR); }
+
+  // Description:
+  // Set/get the range of the valid depths, a MaxDepth of 0 (the default)
+  // not bounding them (MinDepth 0 by default). The depths which are not
+  // positive, or NaN, are never integrated. The depths out of the range are
+  // marked invalid before the integration, by the cuda kernels on the
+  // uploaded depth maps or on the host for the CPU backends, and the voxels
+  // which see an invalid depth, interpolated or not, are left untouched.
+  vtkSetClampMacro(MinDepth, double, 0, VTK_DOUBLE_MAX);
+  vtkGetMacro(MinDepth, double);
+  vtkSetClampMacro(MaxDepth, double, 0, VTK_DOUBLE_MAX);
+  vtkGetMacro(MaxDepth, double);
+
+  // Description:
+  // Set/get the name of the point data array of the depth maps holding the
+  // confidence of each depth, none by default, and the confidence below
+  // which a depth is marked invalid (0 by default, keeping all the depths).
+  // The depth maps without this array are integrated without confidence.
+  vtkSetStringMacro(ConfidenceArrayName);
+  vtkGetStringMacro(ConfidenceArrayName);
+  vtkSetMacro(MinConfidence, double);
+  vtkGetMacro(MinConfidence, double);
+
+  // Description:
+  // Set/get the number of times the depth maps are halved before their
+  // integration, 0 (the default) integrating them at full resolution. Each
+  // level keeps the nearest valid depth of the 2x2 pixels of the previous
+  // one, and the intrinsics are adjusted to it, so that a coarse grid
+  // samples a depth map of about the resolution of its projection, up to
+  // RECONSTRUCTION_DEPTHS_MAX_LEVEL halvings.
+  vtkSetClampMacro(DepthMapLevel, int, 0, RECONSTRUCTION_DEPTHS_MAX_LEVEL);
+  vtkGetMacro(DepthMapLevel, int);
+
+  // Description:
+  // Accumulation of the depth maps into the voxels, the values are the
+  // CUDA_RECONSTRUCTION_FUNCTION_ ones.
+  enum
+  {
+    FUNCTION_CUMUL = 0,
+    FUNCTION_TSDF,
+    FUNCTION_LOG_ODDS,
+    FUNCTION_MAX_CONFIDENCE
+  };
+
+  // Description:
+  // Specify how the depth maps are accumulated into the voxels, each
+  // function is a functor of ReconstructionFunctions.h which the backends
+  // are compiled for. The cumulative function (the default) adds the
+  // inverse of the distance between each voxel and the depth seen along its
+  // ray, clamped at 100. The TSDF function keeps in reconstruction_scalar
+  // the weighted average of the signed distances from the voxels to the
+  // depths, positive in front of the surface, and the number of averaged
+  // depth maps in a reconstruction_weight cell array. The log-odds function
+  // accumulates the occupancy of the voxels, occupied within
+  // TruncationDistance of the depths and free in front of them. The max
+  // confidence function keeps the highest confidence of the depth maps,
+  // from 1 on the depths down to 0 at TruncationDistance. The voxels out of
+  // the band of a function are not updated. The sparse volume only supports
+  // the cumulative function.
+  vtkSetClampMacro(IntegrationFunction, int, FUNCTION_CUMUL, FUNCTION_MAX_CONFIDENCE);
+  vtkGetMacro(IntegrationFunction, int);
+  void SetIntegrationFunctionToCumul() { this->SetIntegrationFunction(FUNCTION_CUMUL); }
+  void SetIntegrationFunctionToTSDF() { this->SetIntegrationFunction(FUNCTION_TSDF); }
+  void SetIntegrationFunctionToLogOdds() { this->SetIntegrationFunction(FUNCTION_LOG_ODDS); }
+  void SetIntegrationFunctionToMaxConfidence() { this->SetIntegrationFunction(FUNCTION_MAX_CONFIDENCE); }
+  static const char* GetIntegrationFunctionAsString(int function);
+
+  // Description:
+  // Set/get the truncation distance of the TSDF, log-odds and max
+  // confidence functions, in the units of the depths. 0 (the default) uses
+  // three times the largest spacing of the grid.
+  vtkSetMacro(TruncationDistance, double);
+  vtkGetMacro(TruncationDistance, double);
+
+  // Description:
+  // Turn on/off the page-locking of the host arrays transferred by the cuda
+  // backend (on by default). The Depths arrays which have the precision of
+  // the integration are registered with the driver while they are
+  // transferred, unless they are copied into the staging buffers of the
+  // asynchronous integration. The output arrays stay registered, and are
+  // reused by the next updates while the grid keeps its size and type. The
+  // transfers are then done by DMA without intermediate copies, and the
+  // bricks are streamed in place. Registering costs about as much as a
+  // pageable copy of the buffer, turn it off for small grids integrating
+  // few depth maps.
+  vtkSetMacro(HostMemoryPinning, int);
+  vtkGetMacro(HostMemoryPinning, int);
+  vtkBooleanMacro(HostMemoryPinning, int);
+
+  // Description:
+  // The device buffers and the pinned staging buffers of the cuda backend
+  // come from a memory pool shared by all the filters of the process: the
+  // buffers released when a filter grows one or is deleted are cached and
+  // reused by the next allocations, so that the frames and the filters
+  // reuse them instead of synchronising the device with cudaMalloc and
+  // cudaFree. Set the bytes the pool caches at most, 0 (the default) for no
+  // limit, free its cached buffers, or get the bytes it caches and the ones
+  // in use.
+  static void SetMemoryPoolLimit(vtkIdType bytes);
+  static void ReleaseMemoryPool();
+  static vtkIdType GetMemoryPoolCachedBytes();
+  static vtkIdType GetMemoryPoolUsedBytes();
+
+  // Description:
+  // Turn on/off the vectorised rows of the parallel CPU backend (on by
+  // default). In single precision, the rows of voxels are integrated 8 or 16
+  // at a time with AVX2 or AVX-512, the widest instruction set supported by
+  // the CPU being selected at run time. The double precision and the serial
+  // backend stay scalar.
+  vtkSetMacro(Vectorization, int);
+  vtkGetMacro(Vectorization, int);
+  vtkBooleanMacro(Vectorization, int);
+
+  // Description:
+  // Get the name of the instruction set of the vectorised rows, "none" if
+  // the CPU supports none of them.
+  static const char* GetVectorizationInstructionSet();
+
+  // Description:
+  // Turn on/off the sparse volume (off by default), cuda backend only. The
+  // grid is split into blocks of 8x8x8 voxels which are stored in a hash
+  // table on the device, and only the blocks crossed by the rays of the
+  // depth maps within SparseBandWidth of the depths are allocated and
+  // integrated, so the device memory grows with the observed surface rather
+  // than with the grid. The blocks are copied into the dense output, the
+  // other voxels being zero, or into a vtkPolyData with GetSparseVolume.
+  vtkSetMacro(SparseVolume, int);
+  vtkGetMacro(SparseVolume, int);
+  vtkBooleanMacro(SparseVolume, int);
+
+  // Description:
+  // Set/get the capacity, in blocks, of the sparse volume. 0 (the default)
+  // sizes it from the free device memory. Blocks beyond the capacity are
+  // not integrated and a warning is emitted.
+  vtkSetMacro(SparseMaxNumberOfBlocks, vtkIdType);
+  vtkGetMacro(SparseMaxNumberOfBlocks, vtkIdType);
+
+  // Description:
+  // Set/get the distance along the rays, in the units of the depths, around
+  // the depths in which the blocks of the sparse volume are allocated. 0
+  // (the default) uses the size of a block.
+  vtkSetMacro(SparseBandWidth, double);
+  vtkGetMacro(SparseBandWidth, double);
+
+  // Description:
+  // Get the number of blocks allocated in the sparse volume by the last
+  // integration.
+  vtkGetMacro(LastNumberOfSparseBlocks, vtkIdType);
+
+  // Description:
+  // Copy the sparse volume into output: one vertex at the world position of
+  // the center of each voxel of the allocated blocks, with its
+  // reconstruction_scalar point data. Returns 0 if there is no sparse
+  // volume on the device.
+  int GetSparseVolume(vtkPolyData* output);
+
+  // Description:
+  // Turn on/off the incremental mode. In incremental mode the reconstruction
+  // volume is kept alive between updates, on the device when using CUDA,
+  // and each depth map added with AddDepthMap is integrated into it exactly
+  // once. The volume is copied into the output only when the filter
+  // executes, over the requested extent when the pipeline streams it in
+  // pieces, and it is reset when the grid changes or when ResetVolume is
+  // called. The depth map set with SetDepthMap is ignored in this mode.
+  vtkSetMacro(Incremental, int);
+  vtkGetMacro(Incremental, int);
+  vtkBooleanMacro(Incremental, int);
+
+  // Description:
+  // Incremental mode only: integrate the depth maps added since the last
+  // integration into the persistent volume, without copying it back.
+  // With CUDA and a dense volume, the integrations are queued on the device
+  // and this returns once the depth maps are uploaded, so that the caller
+  // can read the next ones meanwhile; the next update waits for them.
+  // Returns 1 on success.
+  int IntegrateDepthMaps();
+
+  // Description:
+  // Incremental mode only: add a depth map with its K and TR matrices and
+  // integrate it like IntegrateDepthMaps, along with the depth maps added
+  // before it. Returns a handle greater than 0 following its integration,
+  // or 0 on failure. With CUDA and a dense volume the call returns once the
+  // depth map is staged and its upload and integration are queued on the
+  // device, waiting first for the oldest depth map in flight when there are
+  // MaxPendingDepthMaps of them. The other backends integrate it before
+  // returning.
+  vtkIdType IntegrateAsync(vtkImageData* depthMap, vtkMatrix3x3* depthMapMatrixK,
+                           vtkMatrix4x4* depthMapMatrixTR);
+
+  // Description:
+  // Return 1 if the depth map of a handle returned by IntegrateAsync, and
+  // the ones submitted before it, are integrated, without blocking.
+  int IsIntegrated(vtkIdType handle);
+
+  // Description:
+  // Wait for the integration of the depth map of a handle returned by
+  // IntegrateAsync and of the ones submitted before it, or for all the
+  // queued integrations with Synchronize. Return 1 on success.
+  int WaitForIntegration(vtkIdType handle);
+  int Synchronize();
+
+  // Description:
+  // Set/get the number of depth maps in flight on the device in
+  // incremental mode, from 1 to 8 (default 2). Each one keeps a pinned
+  // staging buffer and a device buffer of its size.
+  vtkSetClampMacro(MaxPendingDepthMaps, int, 1, 8);
+  vtkGetMacro(MaxPendingDepthMaps, int);
+
+  // Description:
+  // Incremental mode only: discard the accumulated values.
+  void ResetVolume();
+
+  // Description:
+  // Turn on/off the extraction of the SurfaceValue isosurface of the volume
+  // into the vtkPolyData of the second output port (off by default). The
+  // marching cubes join the centers of the voxels, in the frame of the
+  // image data output, and leave out the voxels of zero TSDF weight. When
+  // the volume produced is still on the device, the cubes crossed by the
+  // surface are compacted and triangulated there and only the triangles
+  // are copied back, the other backends extract it on the host. Each
+  // triangle has its own 3 points. A streamed piece only holds the surface
+  // of its own cells.
+  vtkSetMacro(ExtractSurface, int);
+  vtkGetMacro(ExtractSurface, int);
+  vtkBooleanMacro(ExtractSurface, int);
+
+  // Description:
+  // Set/get the value of the extracted isosurface, 0 (the default) being
+  // the zero crossing of the TSDF and the even odds of the log-odds.
+  vtkSetMacro(SurfaceValue, double);
+  vtkGetMacro(SurfaceValue, double);
+
+  // Description:
+  // Get the isosurface of the second output port.
+  vtkPolyData* GetSurfaceOutput();
+
+  // Description:
+  // Stages of an update, or of IntegrateDepthMaps, timed by the profiling.
+  enum
+  {
+    PROFILE_STAGE_HOST_PREPARE = 0,
+    PROFILE_STAGE_UPLOAD,
+    PROFILE_STAGE_KERNEL,
+    PROFILE_STAGE_DOWNLOAD,
+    PROFILE_STAGE_WRAP,
+    PROFILE_STAGES_NB
+  };
+
+  // Description:
+  // Turn on/off the profiling (off by default). Each update, and each call
+  // to IntegrateDepthMaps, then records the time spent in every stage and
+  // the voxels and bytes it processed. The device stages are timed with
+  // CUDA events after waiting for the device, so the profiled runs do not
+  // overlap the transfers and the integrations. The bricks and the devices
+  // of the split grids stream concurrently, their whole integration is
+  // reported as the kernel stage, as are the integrations of the CPU
+  // backends. When built with CUDA_RECONSTRUCTION_USE_NVTX the stages are
+  // also marked as NVTX ranges for the CUDA profilers.
+  vtkSetMacro(Profiling, int);
+  vtkGetMacro(Profiling, int);
+  vtkBooleanMacro(Profiling, int);
+
+  // Description:
+  // Get the milliseconds spent in a stage by the last profiled run: the
+  // host preparation (grid setup, frustum culling, depth conversions), the
+  // uploads, the integration kernels, the downloads and the wrapping of the
+  // results into the VTK output arrays.
+  double GetLastStageTime(int stage);
+  static const char* GetProfileStageAsString(int stage);
+
+  // Description:
+  // Get the counters of the last profiled run: the voxels integrated and
+  // the ones skipped by the frustum culling or the sparse volume, summed
+  // over the depth maps, and the bytes copied to and from the devices.
+  vtkGetMacro(LastNumberOfIntegratedVoxels, vtkIdType);
+  vtkGetMacro(LastNumberOfCulledVoxels, vtkIdType);
+  vtkGetMacro(LastNumberOfUploadedBytes, vtkIdType);
+  vtkGetMacro(LastNumberOfDownloadedBytes, vtkIdType);
+
+  // Description:
+  // Set/get the verbosity on the standard output: 0 (the default) prints
+  // nothing, 1 a summary of each run with its backend and its profile, 2
+  // also the stages as they start.
+  vtkSetClampMacro(Verbosity, int, 0, 2);
+  vtkGetMacro(Verbosity, int);
+
 //BTX
 protected:
   vtkCudaReconstructionFilter();
@@ -42,22 +518,155 @@ protected:
     vtkInformationVector *);
   virtual int RequestUpdateExtent(vtkInformation *, vtkInformationVector **,
     vtkInformationVector *);
+  virtual int FillOutputPortInformation(int port, vtkInformation* info);
+
+  // Description:
+  // Integrate the depth maps, or copy the incremental volume, into the
+  // outExtent of outGrid, the profiling of RequestData wrapping it.
+  int ReconstructVolume(vtkImageData* inGrid, vtkImageData* outGrid, vtkInformation* outGridInfo);
 
   static int ComputeWithoutCuda(
     vtkMatrix4x4 *gridMatrix, double gridOrig[3], int gridDims[3], double gridSpacing[3],
     vtkImageData* depthMap, vtkMatrix3x3 *depthMapMatrixK, vtkMatrix4x4 *depthMapMatrixTR,
-    vtkDoubleArray* outScalar);
-  static void FunctionCumul(double diff, double& val);
+    vtkDataArray* outScalar, int interpolationMode = INTERPOLATION_NEAREST,
+    int function = FUNCTION_CUMUL, vtkDataArray* outWeights = 0, double truncationDistance = 0);
 
-  static int ComputeWithCuda(
+  // Description:
+  // Multithreaded version of ComputeWithoutCuda, the voxels are split
+  // across the threads of vtkSMPTools. When activeBlocks is given only the
+  // voxels of these blocks are integrated. outWeights is needed by the
+  // functions which keep a weight per voxel. The single precision rows are
+  // vectorised when vectorization is true and the CPU allows it.
+  static int ComputeWithSMP(
     vtkMatrix4x4 *gridMatrix, double gridOrig[3], int gridDims[3], double gridSpacing[3],
     vtkImageData* depthMap, vtkMatrix3x3 *depthMapMatrixK, vtkMatrix4x4 *depthMapMatrixTR,
-    vtkDoubleArray* outScalar);
+    vtkDataArray* outScalar, const std::vector<int>* activeBlocks = 0,
+    int interpolationMode = INTERPOLATION_NEAREST, int function = FUNCTION_CUMUL,
+    vtkDataArray* outWeights = 0, double truncationDistance = 0, bool vectorization = true);
+
+  // Description:
+  // Integrate a depth map with the multithreaded backend, through the
+  // projection table of its camera when ProjectionCacheSize allows it.
+  int IntegrateWithSMP(double gridOrig[3], int gridDims[3], double gridSpacing[3],
+    vtkImageData* depthMap, vtkMatrix3x3 *depthMapMatrixK, vtkMatrix4x4 *depthMapMatrixTR,
+    vtkDataArray* outScalar, const std::vector<int>* activeBlocks, vtkDataArray* outWeights,
+    double truncation);
+
+  // Description:
+  // Resolve the backend to use for a grid of voxelsNb cells, the auto mode
+  // is replaced by the fastest available backend. Returns -1 if the backend
+  // is not available.
+  int SelectBackend(vtkIdType voxelsNb, vtkIdType maxDepthMapPointsNb, int scalarType);
+
+  // Description:
+  // Get the scalar type, VTK_FLOAT or VTK_DOUBLE, of the output according to
+  // OutputScalarPrecision and to the depths of the first depth map.
+  int GetOutputScalarType(vtkImageData* depthMap);
+
+  // Description:
+  // Integrate the pending depth maps into the persistent volume of the
+  // incremental mode, which is created or reset to match the grid.
+  int IntegratePendingDepthMaps(vtkImageData* grid);
+
+  // Description:
+  // Get the truncation distance of the functions for a grid spacing.
+  double GetTruncation(double gridSpacing[3]);
+
+  // Description:
+  // Get the bytes of a voxel, and of its weight if any, in the storage
+  // format for an integration in scalarType.
+  size_t GetVoxelSize(int scalarType);
+
+  // Description:
+  // Create the reconstruction_scalar output, and the reconstruction_weight
+  // one when the function has weights, in the storage format for an
+  // integration in scalarType.
+  void InitializeOutputArrays(vtkImageData* outGrid, int scalarType, double truncation,
+                              vtkSmartPointer<vtkDataArray>& outScalar,
+                              vtkSmartPointer<vtkDataArray>& outWeights);
+
+  // Description:
+  // Copy the device grid of the cuda context into the output arrays, or
+  // only its cells in cellExtent, the inclusive ranges of their indices.
+  int DownloadGrid(vtkDataArray* outScalar, vtkDataArray* outWeights, const int* cellExtent = 0);
+
+  // Description:
+  // Integrate all the depth maps in one pass, the grid, or each of its
+  // bricks, stays on the device until every depth map has been processed.
+  int ComputeWithCuda(
+    vtkMatrix4x4 *gridMatrix, double gridOrig[3], int gridDims[3], double gridSpacing[3],
+    int scalarType, vtkDataArray* outScalar, vtkDataArray* outWeights);
+
+  // Description:
+  // Update LastNumberOfSparseBlocks from the sparse volume on the device.
+  void UpdateNumberOfSparseBlocks();
+
+  // Description:
+  // Extract the isosurface of the volume of outGrid into surface, from the
+  // device grid when it holds the same cells.
+  int ComputeSurface(vtkImageData* outGrid, vtkPolyData* surface);
+
+  // Description:
+  // Reset the profile at the start of a run, and collect the device timings
+  // and transfers at its end.
+  void StartProfile();
+  void StopProfile();
+
+  // Description:
+  // Count the voxels of a depth map integrated into a grid, all of them or
+  // the ones of activeBlocks, or the blocks allocated in the sparse volume.
+  void CountIntegratedVoxels(const std::vector<int>* activeBlocks, int gridDims[3]);
+  void CountSparseVoxels(int gridDims[3]);
+
+  // Description:
+  // Convert the integrated values into the output arrays, see StoreIntegration.
+  void StoreOutput(vtkDataArray* scalars, vtkDataArray* weights, const double range[2],
+                   vtkDataArray* outScalar, vtkDataArray* outWeights);
 
   vtkImageData *DepthMap;
   vtkMatrix3x3 *DepthMapMatrixK;
   vtkMatrix4x4 *DepthMapMatrixTR;
   vtkMatrix4x4 *GridMatrix;
+  int Incremental;
+  int Backend;
+  int LastBackend;
+  int OutputScalarPrecision;
+  int StorageFormat;
+  int DeviceLayout;
+  vtkIdType MaxBrickNumberOfVoxels;
+  int LastNumberOfBricks;
+  int NumberOfDevices;
+  int LastNumberOfDevices;
+  int FrustumCulling;
+  int InterpolationMode;
+  double MinDepth;
+  double MaxDepth;
+  char* ConfidenceArrayName;
+  double MinConfidence;
+  int DepthMapLevel;
+  int IntegrationFunction;
+  double TruncationDistance;
+  int HostMemoryPinning;
+  int Vectorization;
+  int SparseVolume;
+  vtkIdType SparseMaxNumberOfBlocks;
+  double SparseBandWidth;
+  vtkIdType LastNumberOfSparseBlocks;
+  int ExtractSurface;
+  double SurfaceValue;
+  int MaxPendingDepthMaps;
+  int ProjectionCacheSize;
+  int Profiling;
+  double LastStageTimes[PROFILE_STAGES_NB];
+  double ProfileStartTime;
+  vtkIdType LastNumberOfIntegratedVoxels;
+  vtkIdType LastNumberOfCulledVoxels;
+  vtkIdType LastNumberOfUploadedBytes;
+  vtkIdType LastNumberOfDownloadedBytes;
+  int Verbosity;
+
+  class vtkInternals;
+  vtkInternals *Internals;
 
 private:
   vtkCudaReconstructionFilter(const vtkCudaReconstructionFilter&);  // Not implemented.
@@ -0,0 +1,597 @@
+#include "vtkDepthMapSequence.h"
+
+#include "vtkDataArray.h"
+#include "vtkFloatArray.h"
+#include "vtkImageData.h"
+#include "vtkMatrix3x3.h"
+#include "vtkMatrix4x4.h"
+#include "vtkObjectFactory.h"
+#include "vtkPointData.h"
+#include "vtkSmartPointer.h"
+#include "vtkType.h"
+#include "vtk_zlib.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+vtkStandardNewMacro(vtkDepthMapSequence);
+
+// Magic number and version at the start of a sequence file
+static const char SequenceMagic[8] = { 'D', 'E', 'P', 'T', 'H', 'S', 'E', 'Q' };
+static const vtkTypeUInt32 SequenceVersion = 1;
+
+// The depths of a frame start on a multiple of this alignment
+static const vtkTypeUInt64 DepthsAlignment = 64;
+
+//----------------------------------------------------------------------------
+// Header of a sequence file
+struct vtkSequenceHeader
+{
+  char Magic[8];
+  vtkTypeUInt32 Version;
+  vtkTypeUInt32 DepthType;
+  vtkTypeUInt32 Compression;
+  vtkTypeUInt32 FramesNb;
+  vtkTypeUInt64 FramesOffset;
+  vtkTypeUInt64 Reserved;
+};
+
+//----------------------------------------------------------------------------
+// Entry of the table of the frames: the camera and the location of the
+// depths in the file
+struct vtkSequenceFrame
+{
+  double MatrixK[9];
+  double MatrixR[9];
+  double VectorT[3];
+  vtkTypeUInt32 Dims[2];
+  vtkTypeUInt64 DepthsOffset;
+  vtkTypeUInt64 DepthsBytes;
+};
+
+//----------------------------------------------------------------------------
+class vtkDepthMapSequence::vtkInternals
+{
+public:
+  vtkInternals()
+  {
+    this->Data = 0;
+    this->Size = 0;
+#ifdef _WIN32
+    this->File = INVALID_HANDLE_VALUE;
+    this->Mapping = 0;
+#endif
+    this->OutFile = 0;
+  }
+
+  // mapped sequence file
+  std::string FileName;
+  char* Data;
+  vtkTypeUInt64 Size;
+#ifdef _WIN32
+  HANDLE File;
+  HANDLE Mapping;
+#endif
+  vtkSequenceHeader Header;
+  std::vector<vtkSequenceFrame> Frames;
+
+  // sequence file being written
+  FILE* OutFile;
+  vtkTypeUInt64 OutOffset;
+  vtkSequenceHeader OutHeader;
+  std::vector<vtkSequenceFrame> OutFrames;
+};
+
+//----------------------------------------------------------------------------
+// Convert a float to a half, rounding to the nearest
+static vtkTypeUInt16 FloatToHalf(float value)
+{
+  vtkTypeUInt32 f;
+  memcpy(&f, &value, sizeof(f));
+  vtkTypeUInt32 sign = (f >> 16) & 0x8000;
+  int floatExp = (f >> 23) & 0xff;
+  vtkTypeUInt32 mant = f & 0x7fffff;
+  if (floatExp == 0xff)
+    {
+    // infinity or nan
+    return static_cast<vtkTypeUInt16>(sign | 0x7c00 | (mant ? 0x200 : 0));
+    }
+  int exp = floatExp - 127 + 15;
+  if (exp >= 31)
+    {
+    return static_cast<vtkTypeUInt16>(sign | 0x7c00);
+    }
+  if (exp <= 0)
+    {
+    // subnormal half, or zero when too small
+    if (exp < -10)
+      {
+      return static_cast<vtkTypeUInt16>(sign);
+      }
+    mant |= 0x800000;
+    int shift = 14 - exp;
+    vtkTypeUInt32 half = mant >> shift;
+    if ((mant >> (shift - 1)) & 1)
+      {
+      half++;
+      }
+    return static_cast<vtkTypeUInt16>(sign | half);
+    }
+  // a carry of the rounding goes to the exponent, as expected
+  vtkTypeUInt32 half = sign | (exp << 10) | (mant >> 13);
+  if (mant & 0x1000)
+    {
+    half++;
+    }
+  return static_cast<vtkTypeUInt16>(half);
+}
+
+//----------------------------------------------------------------------------
+// Convert a half to a float
+static float HalfToFloat(vtkTypeUInt16 half)
+{
+  vtkTypeUInt32 sign = static_cast<vtkTypeUInt32>(half & 0x8000) << 16;
+  vtkTypeUInt32 exp = (half >> 10) & 0x1f;
+  vtkTypeUInt32 mant = half & 0x3ff;
+  vtkTypeUInt32 f;
+  if (exp == 0)
+    {
+    if (mant == 0)
+      {
+      f = sign;
+      }
+    else
+      {
+      // normalize the subnormal half
+      int e = -1;
+      do
+        {
+        e++;
+        mant <<= 1;
+        }
+      while (!(mant & 0x400));
+      f = sign | (static_cast<vtkTypeUInt32>(112 - e) << 23) | ((mant & 0x3ff) << 13);
+      }
+    }
+  else if (exp == 31)
+    {
+    f = sign | 0x7f800000 | (mant << 13);
+    }
+  else
+    {
+    f = sign | ((exp + 112) << 23) | (mant << 13);
+    }
+  float value;
+  memcpy(&value, &f, sizeof(value));
+  return value;
+}
+
+//----------------------------------------------------------------------------
+vtkDepthMapSequence::vtkDepthMapSequence()
+{
+  this->DepthType = DEPTHS_FLOAT32;
+  this->Compression = COMPRESSION_NONE;
+  this->Internals = new vtkInternals;
+}
+
+//----------------------------------------------------------------------------
+vtkDepthMapSequence::~vtkDepthMapSequence()
+{
+  this->Close();
+  if (this->Internals->OutFile)
+    {
+    fclose(this->Internals->OutFile);
+    }
+  delete this->Internals;
+}
+
+//----------------------------------------------------------------------------
+int vtkDepthMapSequence::IsSequenceFile(const char* filename)
+{
+  FILE* file = fopen(filename, "rb");
+  if (!file)
+    {
+    return 0;
+    }
+  char magic[sizeof(SequenceMagic)];
+  bool res = fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+    memcmp(magic, SequenceMagic, sizeof(magic)) == 0;
+  fclose(file);
+  return res ? 1 : 0;
+}
+
+//----------------------------------------------------------------------------
+int vtkDepthMapSequence::Open(const char* filename)
+{
+  this->Close();
+  vtkInternals* internals = this->Internals;
+
+  // map the whole file, the pages are private so that the depths can be
+  // page-locked by the cuda backend
+#ifdef _WIN32
+  internals->File = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING,
+                                FILE_ATTRIBUTE_NORMAL, 0);
+  LARGE_INTEGER size;
+  if (internals->File == INVALID_HANDLE_VALUE || !GetFileSizeEx(internals->File, &size))
+    {
+    vtkErrorMacro("Unable to open the sequence file " << filename);
+    this->Close();
+    return 0;
+    }
+  internals->Size = size.QuadPart;
+  internals->Mapping = CreateFileMappingA(internals->File, 0, PAGE_WRITECOPY, 0, 0, 0);
+  if (internals->Mapping)
+    {
+    internals->Data = static_cast<char*>(MapViewOfFile(internals->Mapping, FILE_MAP_COPY, 0, 0, 0));
+    }
+#else
+  int fd = open(filename, O_RDONLY);
+  struct stat status;
+  if (fd < 0 || fstat(fd, &status) != 0)
+    {
+    vtkErrorMacro("Unable to open the sequence file " << filename);
+    if (fd >= 0)
+      {
+      close(fd);
+      }
+    return 0;
+    }
+  internals->Size = status.st_size;
+  if (internals->Size > 0)
+    {
+    void* data = mmap(0, internals->Size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    internals->Data = data == MAP_FAILED ? 0 : static_cast<char*>(data);
+    }
+  close(fd);
+#endif
+  if (!internals->Data)
+    {
+    vtkErrorMacro("Unable to map the sequence file " << filename);
+    this->Close();
+    return 0;
+    }
+
+  // check the header and the table of the frames
+  vtkSequenceHeader& header = internals->Header;
+  if (internals->Size < sizeof(header))
+    {
+    vtkErrorMacro("Truncated sequence file " << filename);
+    this->Close();
+    return 0;
+    }
+  memcpy(&header, internals->Data, sizeof(header));
+  if (memcmp(header.Magic, SequenceMagic, sizeof(SequenceMagic)) != 0 ||
+      header.Version != SequenceVersion ||
+      header.DepthType > DEPTHS_FLOAT16 || header.Compression > COMPRESSION_ZLIB)
+    {
+    vtkErrorMacro("Unsupported sequence file " << filename);
+    this->Close();
+    return 0;
+    }
+  vtkTypeUInt64 framesBytes = static_cast<vtkTypeUInt64>(header.FramesNb) * sizeof(vtkSequenceFrame);
+  if (header.FramesOffset > internals->Size || framesBytes > internals->Size - header.FramesOffset)
+    {
+    vtkErrorMacro("Truncated sequence file " << filename);
+    this->Close();
+    return 0;
+    }
+  internals->Frames.resize(header.FramesNb);
+  if (header.FramesNb > 0)
+    {
+    memcpy(&internals->Frames[0], internals->Data + header.FramesOffset, framesBytes);
+    }
+  for (size_t i = 0; i < internals->Frames.size(); i++)
+    {
+    const vtkSequenceFrame& frame = internals->Frames[i];
+    if (frame.DepthsOffset > internals->Size || frame.DepthsBytes > internals->Size - frame.DepthsOffset)
+      {
+      vtkErrorMacro("Truncated sequence file " << filename);
+      this->Close();
+      return 0;
+      }
+    }
+
+  internals->FileName = filename;
+  this->DepthType = header.DepthType;
+  this->Compression = header.Compression;
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+void vtkDepthMapSequence::Close()
+{
+  vtkInternals* internals = this->Internals;
+#ifdef _WIN32
+  if (internals->Data)
+    {
+    UnmapViewOfFile(internals->Data);
+    }
+  if (internals->Mapping)
+    {
+    CloseHandle(internals->Mapping);
+    }
+  if (internals->File != INVALID_HANDLE_VALUE)
+    {
+    CloseHandle(internals->File);
+    }
+  internals->Mapping = 0;
+  internals->File = INVALID_HANDLE_VALUE;
+#else
+  if (internals->Data)
+    {
+    munmap(internals->Data, internals->Size);
+    }
+#endif
+  internals->Data = 0;
+  internals->Size = 0;
+  internals->Frames.clear();
+  internals->FileName.clear();
+}
+
+//----------------------------------------------------------------------------
+int vtkDepthMapSequence::GetNumberOfFrames()
+{
+  return static_cast<int>(this->Internals->Frames.size());
+}
+
+//----------------------------------------------------------------------------
+int vtkDepthMapSequence::GetFrame(int frameId, vtkImageData* depthMap, vtkMatrix3x3* depthMapMatrixK,
+                                  vtkMatrix4x4* depthMapMatrixTR)
+{
+  vtkInternals* internals = this->Internals;
+  if (frameId < 0 || frameId >= this->GetNumberOfFrames())
+    {
+    vtkErrorMacro("No frame " << frameId << " in the sequence");
+    return 0;
+    }
+  const vtkSequenceFrame& frame = internals->Frames[frameId];
+  const vtkSequenceHeader& header = internals->Header;
+
+  // camera
+  for (int i = 0; i < 3; i++)
+    {
+    for (int j = 0; j < 3; j++)
+      {
+      depthMapMatrixK->SetElement(i, j, frame.MatrixK[3 * i + j]);
+      depthMapMatrixTR->SetElement(i, j, frame.MatrixR[3 * i + j]);
+      }
+    depthMapMatrixTR->SetElement(i, 3, frame.VectorT[i]);
+    }
+  for (int j = 0; j < 3; j++)
+    {
+    depthMapMatrixTR->SetElement(3, j, 0);
+    }
+  depthMapMatrixTR->SetElement(3, 3, 1);
+
+  // depths, uncompressed into a temporary buffer if needed
+  vtkIdType depthsNb = static_cast<vtkIdType>(frame.Dims[0]) * frame.Dims[1];
+  size_t depthSize = header.DepthType == DEPTHS_FLOAT16 ? sizeof(vtkTypeUInt16) : sizeof(float);
+  size_t storedBytes = depthsNb * depthSize;
+  const char* stored = internals->Data + frame.DepthsOffset;
+  std::vector<char> uncompressed;
+  if (header.Compression == COMPRESSION_ZLIB)
+    {
+    uncompressed.resize(storedBytes);
+    uLongf uncompressedBytes = static_cast<uLongf>(storedBytes);
+    if (storedBytes > 0 &&
+        (uncompress(reinterpret_cast<Bytef*>(&uncompressed[0]), &uncompressedBytes,
+                    reinterpret_cast<const Bytef*>(stored), static_cast<uLong>(frame.DepthsBytes)) != Z_OK ||
+         uncompressedBytes != storedBytes))
+      {
+      vtkErrorMacro("Unable to uncompress the depths of frame " << frameId);
+      return 0;
+      }
+    stored = storedBytes > 0 ? &uncompressed[0] : stored;
+    }
+  else if (frame.DepthsBytes != storedBytes)
+    {
+    vtkErrorMacro("Unexpected size of the depths of frame " << frameId);
+    return 0;
+    }
+
+  vtkSmartPointer<vtkFloatArray> depths = vtkSmartPointer<vtkFloatArray>::New();
+  depths->SetName("Depths");
+  depths->SetNumberOfComponents(1);
+  if (header.DepthType == DEPTHS_FLOAT32 && header.Compression == COMPRESSION_NONE)
+    {
+    // the mapped depths are used in place
+    depths->SetArray(reinterpret_cast<float*>(const_cast<char*>(stored)), depthsNb, 1);
+    }
+  else if (header.DepthType == DEPTHS_FLOAT32)
+    {
+    depths->SetNumberOfTuples(depthsNb);
+    memcpy(depths->GetPointer(0), stored, storedBytes);
+    }
+  else
+    {
+    depths->SetNumberOfTuples(depthsNb);
+    float* values = depths->GetPointer(0);
+    for (vtkIdType i = 0; i < depthsNb; i++)
+      {
+      vtkTypeUInt16 half;
+      memcpy(&half, stored + i * sizeof(half), sizeof(half));
+      values[i] = HalfToFloat(half);
+      }
+    }
+
+  depthMap->Initialize();
+  depthMap->SetDimensions(frame.Dims[0], frame.Dims[1], 1);
+  depthMap->GetPointData()->SetScalars(depths);
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+int vtkDepthMapSequence::BeginWrite(const char* filename)
+{
+  vtkInternals* internals = this->Internals;
+  if (internals->OutFile)
+    {
+    fclose(internals->OutFile);
+    }
+  internals->OutFile = fopen(filename, "wb");
+  if (!internals->OutFile)
+    {
+    vtkErrorMacro("Unable to create the sequence file " << filename);
+    return 0;
+    }
+
+  // the header is written again by EndWrite with the table of the frames
+  vtkSequenceHeader& header = internals->OutHeader;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.Magic, SequenceMagic, sizeof(SequenceMagic));
+  header.Version = SequenceVersion;
+  header.DepthType = this->DepthType;
+  header.Compression = this->Compression;
+  internals->OutFrames.clear();
+  internals->OutOffset = sizeof(header);
+  if (fwrite(&header, sizeof(header), 1, internals->OutFile) != 1)
+    {
+    vtkErrorMacro("Unable to write the sequence file " << filename);
+    fclose(internals->OutFile);
+    internals->OutFile = 0;
+    return 0;
+    }
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+int vtkDepthMapSequence::WriteFrame(vtkImageData* depthMap, vtkMatrix3x3* depthMapMatrixK,
+                                    vtkMatrix4x4* depthMapMatrixTR)
+{
+  vtkInternals* internals = this->Internals;
+  const vtkSequenceHeader& header = internals->OutHeader;
+  if (!internals->OutFile)
+    {
+    vtkErrorMacro("BeginWrite must be called before WriteFrame");
+    return 0;
+    }
+  vtkDataArray* depthsArray = depthMap->GetPointData()->GetArray("Depths");
+  if (!depthsArray)
+    {
+    depthsArray = depthMap->GetPointData()->GetScalars();
+    }
+  int dims[3];
+  depthMap->GetDimensions(dims);
+  vtkIdType depthsNb = static_cast<vtkIdType>(dims[0]) * dims[1];
+  if (!depthsArray || depthsArray->GetNumberOfTuples() < depthsNb)
+    {
+    vtkErrorMacro("No depths in the depth map");
+    return 0;
+    }
+
+  vtkSequenceFrame frame;
+  memset(&frame, 0, sizeof(frame));
+  for (int i = 0; i < 3; i++)
+    {
+    for (int j = 0; j < 3; j++)
+      {
+      frame.MatrixK[3 * i + j] = depthMapMatrixK->GetElement(i, j);
+      frame.MatrixR[3 * i + j] = depthMapMatrixTR->GetElement(i, j);
+      }
+    frame.VectorT[i] = depthMapMatrixTR->GetElement(i, 3);
+    }
+  frame.Dims[0] = dims[0];
+  frame.Dims[1] = dims[1];
+
+  // encode the depths
+  std::vector<char> encoded;
+  if (header.DepthType == DEPTHS_FLOAT16)
+    {
+    encoded.resize(depthsNb * sizeof(vtkTypeUInt16));
+    for (vtkIdType i = 0; i < depthsNb; i++)
+      {
+      vtkTypeUInt16 half = FloatToHalf(static_cast<float>(depthsArray->GetComponent(i, 0)));
+      memcpy(&encoded[i * sizeof(half)], &half, sizeof(half));
+      }
+    }
+  else
+    {
+    encoded.resize(depthsNb * sizeof(float));
+    for (vtkIdType i = 0; i < depthsNb; i++)
+      {
+      float depth = static_cast<float>(depthsArray->GetComponent(i, 0));
+      memcpy(&encoded[i * sizeof(depth)], &depth, sizeof(depth));
+      }
+    }
+  if (header.Compression == COMPRESSION_ZLIB && !encoded.empty())
+    {
+    uLongf compressedBytes = compressBound(static_cast<uLong>(encoded.size()));
+    std::vector<char> compressed(compressedBytes);
+    if (compress2(reinterpret_cast<Bytef*>(&compressed[0]), &compressedBytes,
+                  reinterpret_cast<const Bytef*>(&encoded[0]), static_cast<uLong>(encoded.size()),
+                  Z_DEFAULT_COMPRESSION) != Z_OK)
+      {
+      vtkErrorMacro("Unable to compress the depths");
+      return 0;
+      }
+    compressed.resize(compressedBytes);
+    encoded.swap(compressed);
+    }
+
+  // write the depths on an aligned offset
+  vtkTypeUInt64 padding = (DepthsAlignment - internals->OutOffset % DepthsAlignment) % DepthsAlignment;
+  static const char zeros[DepthsAlignment] = { 0 };
+  frame.DepthsOffset = internals->OutOffset + padding;
+  frame.DepthsBytes = encoded.size();
+  if ((padding > 0 && fwrite(zeros, 1, padding, internals->OutFile) != padding) ||
+      (!encoded.empty() && fwrite(&encoded[0], 1, encoded.size(), internals->OutFile) != encoded.size()))
+    {
+    vtkErrorMacro("Unable to write the depths");
+    return 0;
+    }
+  internals->OutOffset = frame.DepthsOffset + frame.DepthsBytes;
+  internals->OutFrames.push_back(frame);
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+int vtkDepthMapSequence::EndWrite()
+{
+  vtkInternals* internals = this->Internals;
+  if (!internals->OutFile)
+    {
+    vtkErrorMacro("BeginWrite must be called before EndWrite");
+    return 0;
+    }
+
+  // the table of the frames, then the final header
+  vtkSequenceHeader& header = internals->OutHeader;
+  header.FramesNb = static_cast<vtkTypeUInt32>(internals->OutFrames.size());
+  header.FramesOffset = internals->OutOffset;
+  bool res = (internals->OutFrames.empty() ||
+              fwrite(&internals->OutFrames[0], sizeof(vtkSequenceFrame), internals->OutFrames.size(),
+                     internals->OutFile) == internals->OutFrames.size()) &&
+    fseek(internals->OutFile, 0, SEEK_SET) == 0 &&
+    fwrite(&header, sizeof(header), 1, internals->OutFile) == 1;
+  res = fclose(internals->OutFile) == 0 && res;
+  internals->OutFile = 0;
+  internals->OutFrames.clear();
+  if (!res)
+    {
+    vtkErrorMacro("Unable to write the sequence file");
+    return 0;
+    }
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+void vtkDepthMapSequence::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os,indent);
+
+  os << indent << "File Name: " << this->Internals->FileName << "\n";
+  os << indent << "Number Of Frames: " << this->GetNumberOfFrames() << "\n";
+  os << indent << "Depth Type: " << (this->DepthType == DEPTHS_FLOAT16 ? "float16" : "float32") << "\n";
+  os << indent << "Compression: " << (this->Compression == COMPRESSION_ZLIB ? "zlib" : "none") << "\n";
+}
@@ -0,0 +1,100 @@
+// .NAME vtkDepthMapSequence - binary container of a depth map sequence
+// .SECTION Description
+// vtkDepthMapSequence reads and writes a sequence of depth maps with their
+// K and TR matrices in a single binary file. The file starts with a header,
+// the depths of each frame follow, stored as float32 or float16 and
+// optionally compressed with zlib, and a table of the frames with their
+// matrices closes the file.
+//
+// The reader maps the file in memory. The float32 uncompressed depths are
+// handed to the depth maps without any copy, so they stay valid only until
+// the sequence is closed.
+
+#ifndef vtkDepthMapSequence_h
+#define vtkDepthMapSequence_h
+
+#include "vtkIOXMLModule.h" // For export macro
+#include "vtkObject.h"
+
+class vtkImageData;
+class vtkMatrix3x3;
+class vtkMatrix4x4;
+
+class vtkDepthMapSequence : public vtkObject
+{
+public:
+  static vtkDepthMapSequence *New();
+  vtkTypeMacro(vtkDepthMapSequence,vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  // Description:
+  // Storage of the depths.
+  enum
+  {
+    DEPTHS_FLOAT32 = 0,
+    DEPTHS_FLOAT16
+  };
+
+  // Description:
+  // Compression of the depths.
+  enum
+  {
+    COMPRESSION_NONE = 0,
+    COMPRESSION_ZLIB
+  };
+
+  // Description:
+  // Storage and compression of the depths written by WriteFrame, they are
+  // read from the file by Open. Default is float32 without compression.
+  vtkSetClampMacro(DepthType, int, DEPTHS_FLOAT32, DEPTHS_FLOAT16);
+  vtkGetMacro(DepthType, int);
+  vtkSetClampMacro(Compression, int, COMPRESSION_NONE, COMPRESSION_ZLIB);
+  vtkGetMacro(Compression, int);
+
+  // Description:
+  // Return 1 if the file starts like a depth map sequence.
+  static int IsSequenceFile(const char* filename);
+
+  // Description:
+  // Map a sequence file in memory. Returns 1 on success.
+  int Open(const char* filename);
+
+  // Description:
+  // Unmap the sequence file, the depths of the frames read without a copy
+  // are no longer valid.
+  void Close();
+
+  // Description:
+  // Get the number of frames of the open sequence.
+  int GetNumberOfFrames();
+
+  // Description:
+  // Fill depthMap with the dimensions and the "Depths" point scalars of a
+  // frame, and the matrices with its camera. Returns 1 on success.
+  int GetFrame(int frame, vtkImageData* depthMap, vtkMatrix3x3* depthMapMatrixK,
+               vtkMatrix4x4* depthMapMatrixTR);
+
+  // Description:
+  // Write a sequence frame by frame, the file is complete once EndWrite
+  // returns. Each function returns 1 on success.
+  int BeginWrite(const char* filename);
+  int WriteFrame(vtkImageData* depthMap, vtkMatrix3x3* depthMapMatrixK,
+                 vtkMatrix4x4* depthMapMatrixTR);
+  int EndWrite();
+
+protected:
+  vtkDepthMapSequence();
+  ~vtkDepthMapSequence();
+
+  int DepthType;
+  int Compression;
+
+  class vtkInternals;
+  vtkInternals *Internals;
+
+private:
+  vtkDepthMapSequence(const vtkDepthMapSequence&);  // Not implemented.
+  void operator=(const vtkDepthMapSequence&);  // Not implemented.
+};
+
+#endif